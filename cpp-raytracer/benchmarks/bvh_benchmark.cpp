@@ -0,0 +1,109 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Compares the time taken to find the closest intersection by testing every object in the scene
+// (linear scan) with the time taken by the bounding volume hierarchy
+#include "commons.hpp"
+#include "material.hpp"
+#include "objects.hpp"
+#include "scene.hpp"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using benchmark_clock = std::chrono::steady_clock;
+
+// Fills the scene with spheres randomly placed inside a cube, the cube grows with the number of
+// spheres so that the density of the spheres remains the same
+static void random_spheres(Scene &scene, int count, std::mt19937 &gen)
+{
+    double side = 2.0 * std::cbrt(static_cast<double>(count));
+    std::uniform_real_distribution<double> position(-side / 2, side / 2);
+    std::uniform_real_distribution<double> radius(0.1, 0.4);
+    int material = scene.add_material(LambertianDiffuse());
+    for (int i = 0; i < count; ++i)
+    {
+        vec3 center(position(gen), position(gen), position(gen));
+        scene.add_object(Sphere(center, radius(gen), material));
+    }
+}
+
+// Rays starting inside the cube, in random directions
+static std::vector<Ray> random_rays(int count, int spheres, std::mt19937 &gen)
+{
+    double side = 2.0 * std::cbrt(static_cast<double>(spheres));
+    std::uniform_real_distribution<double> position(-side / 2, side / 2);
+    std::uniform_real_distribution<double> direction(-1, 1);
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    while (static_cast<int>(rays.size()) < count)
+    {
+        vec3 d(direction(gen), direction(gen), direction(gen));
+        if (linalg::length2(d) < ZERO_EPSILON)
+            continue;
+        rays.push_back(Ray(vec3(position(gen), position(gen), position(gen)), d));
+    }
+    return rays;
+}
+
+// Returns the time taken in seconds, the sum of the distances is returned in checksum so that the
+// work cannot be optimized out and the results of both methods can be compared
+template <typename Fn>
+static double time_rays(const std::vector<Ray> &rays, Fn &&fn, double &checksum, int &hits)
+{
+    checksum = 0;
+    hits = 0;
+    auto start = benchmark_clock::now();
+    for (const auto &ray : rays)
+    {
+        Intersection i = fn(RayParams({ray, 0.001, INF}));
+        if (i.occured)
+        {
+            checksum += i.parametric;
+            hits++;
+        }
+    }
+    std::chrono::duration<double> elapsed = benchmark_clock::now() - start;
+    return elapsed.count();
+}
+
+int main()
+{
+    const int sizes[] = {10, 1000, 100000};
+    std::mt19937 gen(42);
+
+    std::cout << std::left << std::setw(10) << "spheres" << std::setw(10) << "rays"
+              << std::setw(12) << "build(ms)" << std::setw(18) << "linear(rays/s)"
+              << std::setw(18) << "bvh(rays/s)" << std::setw(10) << "speedup"
+              << "match" << std::endl;
+    for (int n : sizes)
+    {
+        Scene scene;
+        random_spheres(scene, n, gen);
+        auto build_start = benchmark_clock::now();
+        scene.finalize();
+        std::chrono::duration<double, std::milli> build = benchmark_clock::now() - build_start;
+
+        // Keep the number of ray-sphere tests done by the linear scan roughly constant
+        int ray_count = static_cast<int>(std::max(1000.0, std::min(1e6, 2e8 / n)));
+        auto rays = random_rays(ray_count, n, gen);
+
+        double linear_sum, bvh_sum;
+        int linear_hits, bvh_hits;
+        double linear = time_rays(
+            rays, [&](const RayParams &p) { return scene.closest_intersect_linear(p); },
+            linear_sum, linear_hits);
+        double bvh = time_rays(
+            rays, [&](const RayParams &p) { return scene.closest_intersect(p); }, bvh_sum,
+            bvh_hits);
+
+        bool match = linear_hits == bvh_hits && std::fabs(linear_sum - bvh_sum) < 1e-6 * linear_sum;
+        std::cout << std::left << std::setw(10) << n << std::setw(10) << ray_count
+                  << std::setw(12) << std::fixed << std::setprecision(2) << build.count()
+                  << std::setw(18) << std::setprecision(0) << ray_count / linear << std::setw(18)
+                  << ray_count / bvh << std::setw(10) << std::setprecision(1) << linear / bvh
+                  << (match ? "yes" : "NO") << std::endl;
+    }
+    return 0;
+}
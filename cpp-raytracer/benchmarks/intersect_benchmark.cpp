@@ -0,0 +1,373 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Measures the number of intersections per second. The first part tests a ray against every sphere
+// of a group, once building a full intersection for every closer candidate and once only testing
+// for hits closer than the best so far and building the intersection of the closest hit. The
+// second part finds the closest hits of camera rays and of rays leaving the surfaces which they
+// hit, in the reference scenes. The third part compares tracing the camera rays one by one with
+// tracing them in packets of a block of pixels. The last part compares spheres placed in the scene
+// with the same spheres in a group placed by an instance, which must give the same hits.
+#include "camera.hpp"
+#include "config.h"
+#include "instance.hpp"
+#include "material.hpp"
+#include "objects.hpp"
+#include "packet.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef RAYTRACER_SOURCE_DIR
+#define RAYTRACER_SOURCE_DIR "."
+#endif
+
+using benchmark_clock = std::chrono::steady_clock;
+
+// nullptr is the built in sample scene
+const char *BENCHMARK_SCENES[] = {nullptr, "scenes/instances.scene", "scenes/meshes.scene",
+                                  "scenes/interior.scene"};
+
+/// @brief Loads a scene of BENCHMARK_SCENES
+static void load_benchmark_scene(const char *filename, Scene &scene, Config &cfg)
+{
+    if (filename)
+        load_scene(std::string(RAYTRACER_SOURCE_DIR) + "/" + filename, scene, cfg, false);
+    else
+        load_sample_scene(scene, 0);
+}
+
+static double seconds_since(benchmark_clock::time_point start)
+{
+    return std::chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+/// @brief Tests random rays against groups of spheres, both ways
+static void candidate_benchmark()
+{
+    const int group_sizes[] = {8, 64, 1024};
+    const long long tests_per_run = 50000000;
+    PCG32 rng(7);
+
+    std::cout << std::left << std::setw(10) << "spheres" << std::setw(22) << "intersect(tests/s)"
+              << std::setw(22) << "hit(tests/s)" << std::setw(10) << "speedup"
+              << "identical" << std::endl;
+    for (int n : group_sizes)
+    {
+        std::vector<Sphere> spheres;
+        for (int i = 0; i < n; ++i)
+        {
+            vec3 center(rng.uniform(-10, 10), rng.uniform(-10, 10), rng.uniform(-10, 10));
+            spheres.push_back(Sphere(center, rng.uniform(0.2, 2.0), 0));
+        }
+        const int ray_count = 4096;
+        std::vector<Ray> rays;
+        for (int i = 0; i < ray_count; ++i)
+        {
+            vec3 origin(rng.uniform(-12, 12), rng.uniform(-12, 12), rng.uniform(-12, 12));
+            vec3 direction(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1));
+            rays.push_back(Ray(origin, direction));
+        }
+        int repeats = static_cast<int>(std::max(1LL, tests_per_run / (1LL * n * ray_count)));
+
+        // A full intersection for every candidate, copied when it is closer
+        std::vector<real> full_t(ray_count), hit_t(ray_count);
+        auto start = benchmark_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            for (int i = 0; i < ray_count; ++i)
+            {
+                RayParams params = {rays[i], real(0.001), INF};
+                Intersection closest;
+                closest.occured = false;
+                closest.parametric = INF;
+                for (const Sphere &sphere : spheres)
+                {
+                    auto intersection = sphere.intersect(params);
+                    if (intersection.occured && intersection.parametric < closest.parametric)
+                        closest = intersection;
+                }
+                full_t[i] = closest.occured ? closest.parametric : INF;
+            }
+        }
+        double full = seconds_since(start);
+
+        // Only hits closer than the best so far, the intersection is built once
+        start = benchmark_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            for (int i = 0; i < ray_count; ++i)
+            {
+                RayParams params = {rays[i], real(0.001), INF};
+                int closest = -1;
+                real t;
+                for (int s = 0; s < n; ++s)
+                {
+                    if (spheres[s].hit(params, t))
+                    {
+                        params.t_max = t;
+                        closest = s;
+                    }
+                }
+                if (closest == -1)
+                    hit_t[i] = INF;
+                else
+                    hit_t[i] = spheres[closest].surface(rays[i], params.t_max).parametric;
+            }
+        }
+        double hit = seconds_since(start);
+
+        bool identical = full_t == hit_t;
+        double tests = 1.0 * repeats * ray_count * n;
+        std::cout << std::left << std::setw(10) << n << std::setw(22) << std::fixed
+                  << std::setprecision(0) << tests / full << std::setw(22) << tests / hit
+                  << std::setw(10) << std::setprecision(2) << full / hit
+                  << (identical ? "yes" : "NO") << std::endl;
+    }
+}
+
+/// @brief Finds the closest hits of rays in the reference scenes
+static void scene_benchmark()
+{
+    const int camera_rays = 200000;
+    std::cout << std::endl
+              << std::left << std::setw(28) << "scene" << std::setw(16) << "rays/s"
+              << std::setw(20) << "intersections/s" << "tests/ray" << std::endl;
+    for (const char *filename : BENCHMARK_SCENES)
+    {
+        Config cfg;
+        Scene scene;
+        load_benchmark_scene(filename, scene, cfg);
+        const char *name = filename ? filename : "sample";
+        MovableCamera cam(cfg);
+        Sampler sampler(cfg.sampler, 1, 0);
+        PCG32 rng(11);
+
+        // Camera rays, and a ray in a random direction from every point which they hit
+        std::vector<RayParams> rays;
+        for (int i = 0; i < camera_rays; ++i)
+        {
+            int row = rng.randint(0, cfg.image_height - 1);
+            int col = rng.randint(0, cfg.image_width - 1);
+            sampler.start_pixel(row, col);
+            sampler.start_sample(0);
+            RayParams params = {cam.get_ray(row, col, sampler, true), SELF_INTERSECTION_EPSILON,
+                                INF};
+            rays.push_back(params);
+            auto intersect = scene.closest_intersect(params);
+            if (intersect.occured)
+            {
+                vec3 direction(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1));
+                if (linalg::dot(direction, intersect.local_normal) < 0)
+                    direction = -direction;
+                rays.push_back(RayParams({Ray(intersect.point, direction),
+                                          SELF_INTERSECTION_EPSILON, INF}));
+            }
+        }
+
+        RenderStats stats;
+        thread_stats() = &stats;
+        int hits = 0;
+        auto start = benchmark_clock::now();
+        for (const RayParams &params : rays)
+        {
+            hits += scene.closest_intersect(params).occured ? 1 : 0;
+        }
+        double seconds = seconds_since(start);
+        thread_stats() = nullptr;
+
+        std::cout << std::left << std::setw(28) << name << std::setw(16) << std::fixed
+                  << std::setprecision(0) << rays.size() / seconds << std::setw(20)
+                  << stats.intersection_tests / seconds << std::setprecision(2)
+                  << 1.0 * stats.intersection_tests / rays.size() << std::endl;
+        if (hits == 0)
+            std::cerr << "No ray hits " << name << std::endl;
+    }
+}
+
+/// @return true if both intersections are at the same distance on the same material
+static bool same_hit(const Intersection &a, const Intersection &b)
+{
+    if (a.occured != b.occured)
+        return false;
+    return !a.occured || (a.parametric == b.parametric && a.material_id == b.material_id);
+}
+
+/// @brief Finds the first hits of the camera rays of every pixel, ray by ray and in packets
+static void packet_benchmark()
+{
+    const int repeats = 5;
+    std::cout << std::endl
+              << std::left << std::setw(28) << "scene" << std::setw(16) << "single(rays/s)"
+              << std::setw(16) << "packet(rays/s)" << std::setw(10) << "speedup"
+              << "identical" << std::endl;
+    for (const char *filename : BENCHMARK_SCENES)
+    {
+        Config cfg;
+        Scene scene;
+        load_benchmark_scene(filename, scene, cfg);
+        const char *name = filename ? filename : "sample";
+        MovableCamera cam(cfg);
+        const int width = cfg.image_width, height = cfg.image_height;
+        std::vector<Sampler> samplers(RAY_PACKET_SIZE, Sampler(cfg.sampler, 1, cfg.seed));
+        std::vector<Intersection> single(static_cast<size_t>(width) * height);
+        std::vector<Intersection> packed(single.size());
+
+        auto start = benchmark_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            for (int row = 0; row < height; ++row)
+            {
+                for (int col = 0; col < width; ++col)
+                {
+                    Sampler &sampler = samplers[0];
+                    sampler.start_pixel(row, col);
+                    sampler.start_sample(0);
+                    int object;
+                    Ray ray = cam.get_ray(row, col, sampler);
+                    single[row * width + col] = scene.find_closest(
+                        RayParams({ray, SELF_INTERSECTION_EPSILON, INF}), object);
+                }
+            }
+        }
+        double single_seconds = seconds_since(start);
+
+        RayPacket packet;
+        int rows[RAY_PACKET_SIZE], cols[RAY_PACKET_SIZE], objects[RAY_PACKET_SIZE];
+        Sampler *lanes[RAY_PACKET_SIZE];
+        Intersection hits[RAY_PACKET_SIZE];
+        start = benchmark_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            for (int block_row = 0; block_row < height; block_row += RAY_PACKET_BLOCK)
+            {
+                for (int block_col = 0; block_col < width; block_col += RAY_PACKET_BLOCK)
+                {
+                    int count = 0;
+                    for (int row = block_row; row < std::min(block_row + RAY_PACKET_BLOCK, height);
+                         ++row)
+                    {
+                        for (int col = block_col;
+                             col < std::min(block_col + RAY_PACKET_BLOCK, width); ++col)
+                        {
+                            rows[count] = row;
+                            cols[count] = col;
+                            lanes[count] = &samplers[count];
+                            lanes[count]->start_pixel(row, col);
+                            lanes[count]->start_sample(0);
+                            ++count;
+                        }
+                    }
+                    cam.get_rays(rows, cols, lanes, count, false, packet);
+                    scene.find_closest(packet, SELF_INTERSECTION_EPSILON, hits, objects);
+                    for (int i = 0; i < count; ++i)
+                    {
+                        packed[rows[i] * width + cols[i]] = hits[i];
+                    }
+                }
+            }
+        }
+        double packet_seconds = seconds_since(start);
+
+        bool identical = true;
+        for (size_t i = 0; i < single.size(); ++i)
+        {
+            identical = identical && same_hit(single[i], packed[i]);
+        }
+        double rays = 1.0 * repeats * width * height;
+        std::cout << std::left << std::setw(28) << name << std::setw(16) << std::fixed
+                  << std::setprecision(0) << rays / single_seconds << std::setw(16)
+                  << rays / packet_seconds << std::setw(10) << std::setprecision(2)
+                  << single_seconds / packet_seconds << (identical ? "yes" : "NO") << std::endl;
+    }
+}
+
+/// @brief Finds the closest hits of random spheres placed directly in a scene and of the same
+/// spheres in a group placed by an instance which does not move them
+/// @return false if some hits differ
+static bool instance_benchmark()
+{
+    const int sphere_count = 200;
+    const int ray_count = 50000;
+    PCG32 rng(13);
+    Scene direct, instanced;
+    direct.add_material(LambertianDiffuse(color(0.5, 0.5, 0.5)));
+    instanced.add_material(LambertianDiffuse(color(0.5, 0.5, 0.5)));
+    ObjectGroup &group = instanced.add_group();
+    for (int i = 0; i < sphere_count; ++i)
+    {
+        vec3 center(rng.uniform(-10, 10), rng.uniform(-10, 10), rng.uniform(-10, 10));
+        Sphere sphere(center, rng.uniform(0.2, 2.0), 0);
+        direct.add_object(sphere);
+        group.add_object(sphere);
+    }
+    group.finalize();
+    instanced.add_object(Instance(&group, vec3(0, 0, 0)));
+    direct.finalize();
+    instanced.finalize();
+
+    // Random rays, and a ray leaving every point which they hit, which starts on a sphere
+    std::vector<RayParams> rays;
+    for (int i = 0; i < ray_count; ++i)
+    {
+        vec3 origin(rng.uniform(-12, 12), rng.uniform(-12, 12), rng.uniform(-12, 12));
+        vec3 direction(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1));
+        RayParams params = {Ray(origin, direction), SELF_INTERSECTION_EPSILON, INF};
+        rays.push_back(params);
+        auto intersect = direct.closest_intersect(params);
+        if (intersect.occured)
+        {
+            direction = vec3(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1));
+            if (linalg::dot(direction, intersect.local_normal) < 0)
+                direction = -direction;
+            rays.push_back(RayParams({Ray(intersect.point, direction),
+                                      SELF_INTERSECTION_EPSILON, INF}));
+        }
+    }
+
+    std::vector<Intersection> direct_hits(rays.size()), instanced_hits(rays.size());
+    auto start = benchmark_clock::now();
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        direct_hits[i] = direct.closest_intersect(rays[i]);
+    }
+    double direct_seconds = seconds_since(start);
+    start = benchmark_clock::now();
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        instanced_hits[i] = instanced.closest_intersect(rays[i]);
+    }
+    double instanced_seconds = seconds_since(start);
+
+    int different = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        const Intersection &a = direct_hits[i], &b = instanced_hits[i];
+        if (!same_hit(a, b) || (a.occured && a.o_normal != b.o_normal))
+            different++;
+    }
+    std::cout << std::endl
+              << std::left << std::setw(28) << "spheres" << std::setw(16) << "direct(rays/s)"
+              << std::setw(20) << "instanced(rays/s)" << "different hits" << std::endl;
+    std::cout << std::left << std::setw(28) << sphere_count << std::setw(16) << std::fixed
+              << std::setprecision(0) << rays.size() / direct_seconds << std::setw(20)
+              << rays.size() / instanced_seconds << different << " of " << rays.size()
+              << std::endl;
+    if (different != 0)
+        std::cerr << "Instanced spheres are not hit like the same spheres placed directly"
+                  << std::endl;
+    return different == 0;
+}
+
+int main()
+{
+    candidate_benchmark();
+    scene_benchmark();
+    packet_benchmark();
+    return instance_benchmark() ? 0 : 1;
+}
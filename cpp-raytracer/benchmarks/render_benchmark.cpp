@@ -0,0 +1,217 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Renders a fixed set of reference scenes with fixed seeds, and reports the throughput, the time
+// spent in every stage, the scaling with the number of threads and the depth first and wavefront
+// integrators as JSON
+//
+// Usage: render_benchmark [output.json]     (the JSON is written to stdout by default)
+#include "camera.hpp"
+#include "config.h"
+#include "image.hpp"
+#include "raytracer.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef RAYTRACER_SOURCE_DIR
+#define RAYTRACER_SOURCE_DIR "."
+#endif
+
+using benchmark_clock = std::chrono::steady_clock;
+
+const int BENCHMARK_WIDTH = 320;
+const int BENCHMARK_HEIGHT = 180;
+const int BENCHMARK_SAMPLES = 16;
+
+struct ReferenceScene
+{
+    const char *name;
+    // Scene file relative to the source directory, nullptr for the built in sample scene
+    const char *filename;
+};
+
+const ReferenceScene REFERENCE_SCENES[] = {
+    {"sample", nullptr},
+    {"instances", "scenes/instances.scene"},
+    {"meshes", "scenes/meshes.scene"},
+    {"interior", "scenes/interior.scene"},
+    {"textures", "scenes/textures.scene"},
+};
+
+static double seconds_since(benchmark_clock::time_point start)
+{
+    return std::chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+/// @brief Loads the scene, and overrides the settings which affect the amount of work so that
+/// every run does the same work
+static void load_reference_scene(const ReferenceScene &reference, Scene &scene, Config &cfg)
+{
+    if (reference.filename)
+        load_scene(std::string(RAYTRACER_SOURCE_DIR) + "/" + reference.filename, scene, cfg,
+                   false);
+    else
+        load_sample_scene(scene, 0);
+    cfg.image_width = BENCHMARK_WIDTH;
+    cfg.image_height = BENCHMARK_HEIGHT;
+    cfg.samples_per_pixel = BENCHMARK_SAMPLES;
+    cfg.seed = 0;
+    cfg.show_progress = false;
+}
+
+/// @return Thread counts from 1 to max_threads, doubling every time
+static std::vector<int> thread_counts(int max_threads)
+{
+    std::vector<int> counts;
+    for (int n = 1; n < max_threads; n *= 2)
+    {
+        counts.push_back(n);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+/// @return true if both images have exactly the same pixels
+static bool same_image(const Framebuffer &a, const Framebuffer &b)
+{
+    if (a.width() != b.width() || a.height() != b.height())
+        return false;
+    for (int r = 0; r < a.height(); ++r)
+    {
+        if (!std::equal(a.row(r), a.row(r) + a.width() * CHANNELS, b.row(r)))
+            return false;
+    }
+    return true;
+}
+
+static std::string benchmark_scene(const ReferenceScene &reference, int max_threads)
+{
+    Config cfg;
+    Scene scene;
+    load_reference_scene(reference, scene, cfg);
+    MovableCamera cam(cfg);
+    std::cerr << "Benchmarking " << reference.name << "..." << std::endl;
+
+    // An instrumented render counts the rays and measures the stages. The renders are
+    // deterministic, so the uninstrumented renders below trace exactly the same rays.
+    RenderStats stats;
+    Framebuffer img = multi_threaded_render(cfg, cam, scene, max_threads, nullptr, &stats);
+
+    auto start = benchmark_clock::now();
+    DisplayImage display = tonemap_image(img, cfg.tonemap, cfg.gamma, max_threads);
+    double tonemap_seconds = seconds_since(start);
+    std::string encode_filename = std::string("render_benchmark_") + reference.name + ".png";
+    start = benchmark_clock::now();
+    write_png(encode_filename, display);
+    double encode_seconds = seconds_since(start);
+    std::remove(encode_filename.c_str());
+
+    std::ostringstream json;
+    json << "    {\n";
+    json << "      \"name\": \"" << reference.name << "\",\n";
+    json << "      \"width\": " << cfg.image_width << ",\n";
+    json << "      \"height\": " << cfg.image_height << ",\n";
+    json << "      \"samples_per_pixel\": " << cfg.samples_per_pixel << ",\n";
+    json << "      \"objects\": " << scene.object_count() << ",\n";
+    json << "      \"arena_blocks\": " << scene.get_arena().block_count() << ",\n";
+    json << "      \"arena_bytes\": " << scene.get_arena().bytes_used() << ",\n";
+    TextureCacheStats texture_stats = scene.get_texture_cache().stats();
+    json << "      \"texture_tile_reads\": " << texture_stats.tile_reads << ",\n";
+    json << "      \"texture_cache_peak_bytes\": " << texture_stats.peak_bytes << ",\n";
+    json << "      \"camera_rays\": " << stats.camera_rays << ",\n";
+    json << "      \"rays\": " << stats.rays << ",\n";
+    json << "      \"shadow_rays\": " << stats.shadow_rays << ",\n";
+    json << "      \"shading_calls\": " << stats.shading_calls << ",\n";
+    json << "      \"intersection_tests_per_ray\": "
+         << static_cast<double>(stats.intersection_tests) / std::max<uint64_t>(stats.rays, 1)
+         << ",\n";
+    // Summed over all the threads, so they are comparable with each other but not with the wall
+    // clock time
+    json << "      \"stage_seconds\": {\"camera\": " << stats.camera_seconds
+         << ", \"traversal\": " << stats.traversal_seconds
+         << ", \"shading\": " << stats.shading_seconds << ", \"tonemap\": " << tonemap_seconds
+         << ", \"encode\": " << encode_seconds << "},\n";
+
+    json << "      \"threads\": [\n";
+    double single_thread_seconds = 0;
+    std::vector<int> counts = thread_counts(max_threads);
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        start = benchmark_clock::now();
+        multi_threaded_render(cfg, cam, scene, counts[i]);
+        double seconds = seconds_since(start);
+        if (counts[i] == 1)
+            single_thread_seconds = seconds;
+        json << "        {\"threads\": " << counts[i] << ", \"seconds\": " << seconds
+             << ", \"rays_per_second\": " << stats.rays / seconds
+             << ", \"scaling_efficiency\": " << single_thread_seconds / (counts[i] * seconds)
+             << "}" << (i + 1 < counts.size() ? "," : "") << "\n";
+    }
+    json << "      ],\n";
+
+    // The integrators on one thread. The wavefront integrator is timed with several batch sizes,
+    // and its image is compared with the depth first image, which it should match exactly.
+    json << "      \"integrators\": [\n";
+    cfg.integrator = Integrator::DepthFirst;
+    start = benchmark_clock::now();
+    Framebuffer depth_first = multi_threaded_render(cfg, cam, scene, 1);
+    double seconds = seconds_since(start);
+    json << "        {\"integrator\": \"depth_first\", \"seconds\": " << seconds
+         << ", \"rays_per_second\": " << stats.rays / seconds << "},\n";
+    cfg.integrator = Integrator::Wavefront;
+    const int batches[] = {1024, DEFAULT_WAVEFRONT_BATCH, 1 << 14};
+    const int batch_count = sizeof(batches) / sizeof(batches[0]);
+    for (int i = 0; i < batch_count; ++i)
+    {
+        cfg.wavefront_batch = batches[i];
+        start = benchmark_clock::now();
+        Framebuffer wavefront = multi_threaded_render(cfg, cam, scene, 1);
+        double wavefront_seconds = seconds_since(start);
+        json << "        {\"integrator\": \"wavefront\", \"batch\": " << batches[i]
+             << ", \"seconds\": " << wavefront_seconds
+             << ", \"rays_per_second\": " << stats.rays / wavefront_seconds
+             << ", \"speedup\": " << seconds / wavefront_seconds
+             << ", \"same_image\": " << (same_image(depth_first, wavefront) ? "true" : "false")
+             << "}" << (i + 1 < batch_count ? "," : "") << "\n";
+    }
+    json << "      ]\n";
+    json << "    }";
+    return json.str();
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"hardware_threads\": " << max_threads << ",\n";
+    json << "  \"scenes\": [\n";
+    const int scene_count = sizeof(REFERENCE_SCENES) / sizeof(REFERENCE_SCENES[0]);
+    for (int i = 0; i < scene_count; ++i)
+    {
+        json << benchmark_scene(REFERENCE_SCENES[i], max_threads)
+             << (i + 1 < scene_count ? ",\n" : "\n");
+    }
+    json << "  ]\n";
+    json << "}\n";
+
+    if (argc > 1)
+    {
+        std::ofstream out(argv[1]);
+        out << json.str();
+        std::cerr << "Results written to " << argv[1] << std::endl;
+    }
+    else
+    {
+        std::cout << json.str();
+    }
+    return 0;
+}
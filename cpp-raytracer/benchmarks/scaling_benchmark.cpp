@@ -0,0 +1,166 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Measures how the render time scales with the number of threads on machines with several NUMA
+// nodes (sockets). The threads fill one node after the other, and every count is rendered with
+// unpinned and with pinned threads. The efficiency of the whole machine is reported next to the
+// efficiency per socket: a second socket which only speeds up the render by half has an efficiency
+// per socket of 0.75, even if the first socket scales perfectly.
+//
+// Usage: scaling_benchmark [output.json]     (the JSON is written to stdout by default)
+#include "affinity.hpp"
+#include "camera.hpp"
+#include "config.h"
+#include "image.hpp"
+#include "raytracer.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef RAYTRACER_SOURCE_DIR
+#define RAYTRACER_SOURCE_DIR "."
+#endif
+
+using benchmark_clock = std::chrono::steady_clock;
+
+const int BENCHMARK_WIDTH = 320;
+const int BENCHMARK_HEIGHT = 180;
+const int BENCHMARK_SAMPLES = 16;
+// Every render is repeated and the fastest time is kept, to hide the noise of other processes
+const int BENCHMARK_REPEATS = 2;
+const char *BENCHMARK_SCENE = "scenes/interior.scene";
+
+// A number of threads, and the number of nodes which they are spread over
+struct ThreadCount
+{
+    int threads;
+    int nodes;
+    // true if the threads use every processor of their nodes
+    bool whole_nodes;
+};
+
+/// @return Thread counts which fill the first node (1, 2, 4, ... up to all its processors), and
+/// then all the processors of the first two nodes, the first three nodes and so on
+static std::vector<ThreadCount> thread_counts(const CpuTopology &topology)
+{
+    std::vector<ThreadCount> counts;
+    int first_node = static_cast<int>(topology.nodes[0].size());
+    for (int n = 1; n < first_node; n *= 2)
+    {
+        counts.push_back(ThreadCount{n, 1, false});
+    }
+    int threads = 0;
+    for (size_t node = 0; node < topology.nodes.size(); ++node)
+    {
+        threads += static_cast<int>(topology.nodes[node].size());
+        counts.push_back(ThreadCount{threads, static_cast<int>(node) + 1, true});
+    }
+    return counts;
+}
+
+/// @return Seconds taken by the fastest of the repeated renders
+static double time_render(const Config &cfg, const Camera &cam, const Scene &scene, int threads,
+                          Framebuffer &img)
+{
+    double best = 0;
+    for (int i = 0; i < BENCHMARK_REPEATS; ++i)
+    {
+        auto start = benchmark_clock::now();
+        img = multi_threaded_render(cfg, cam, scene, threads);
+        double seconds = std::chrono::duration<double>(benchmark_clock::now() - start).count();
+        best = (i == 0) ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+/// @return true if both images have exactly the same pixels
+static bool same_image(const Framebuffer &a, const Framebuffer &b)
+{
+    if (a.width() != b.width() || a.height() != b.height())
+        return false;
+    for (int r = 0; r < a.height(); ++r)
+    {
+        if (!std::equal(a.row(r), a.row(r) + a.width() * CHANNELS, b.row(r)))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    CpuTopology topology = detect_topology();
+    Config cfg;
+    Scene scene;
+    load_scene(std::string(RAYTRACER_SOURCE_DIR) + "/" + BENCHMARK_SCENE, scene, cfg, false);
+    cfg.image_width = BENCHMARK_WIDTH;
+    cfg.image_height = BENCHMARK_HEIGHT;
+    cfg.samples_per_pixel = BENCHMARK_SAMPLES;
+    cfg.seed = 0;
+    cfg.show_progress = false;
+    MovableCamera cam(cfg);
+
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"scene\": \"" << BENCHMARK_SCENE << "\",\n";
+    json << "  \"nodes\": [";
+    for (size_t node = 0; node < topology.nodes.size(); ++node)
+    {
+        json << (node ? ", " : "") << topology.nodes[node].size();
+    }
+    json << "],\n";
+
+    std::vector<ThreadCount> counts = thread_counts(topology);
+    Framebuffer reference;
+    bool all_same = true;
+    for (int pinned = 0; pinned < 2; ++pinned)
+    {
+        cfg.pin_threads = pinned != 0;
+        std::cerr << "Rendering with " << (pinned ? "pinned" : "unpinned") << " threads..."
+                  << std::endl;
+        json << "  \"" << (pinned ? "pinned" : "unpinned") << "\": [\n";
+        double single_thread_seconds = 0;
+        // Speedup with all the processors of the first node
+        double one_socket_speedup = 1;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            Framebuffer img;
+            double seconds = time_render(cfg, cam, scene, counts[i].threads, img);
+            if (reference.width() == 0)
+                reference = img;
+            all_same = all_same && same_image(reference, img);
+            if (i == 0)
+                single_thread_seconds = seconds;
+            double speedup = single_thread_seconds / seconds;
+            if (counts[i].whole_nodes && counts[i].nodes == 1)
+                one_socket_speedup = speedup;
+            json << "    {\"threads\": " << counts[i].threads << ", \"nodes\": " << counts[i].nodes
+                 << ", \"seconds\": " << seconds << ", \"speedup\": " << speedup
+                 << ", \"efficiency\": " << speedup / counts[i].threads;
+            // Compared with the first socket, only for whole sockets
+            if (counts[i].whole_nodes)
+                json << ", \"efficiency_per_socket\": "
+                     << speedup / (counts[i].nodes * one_socket_speedup);
+            json << "}" << (i + 1 < counts.size() ? "," : "") << "\n";
+        }
+        json << "  ],\n";
+    }
+    // Pinning and the number of threads must not change the image
+    json << "  \"same_image\": " << (all_same ? "true" : "false") << "\n";
+    json << "}\n";
+
+    if (argc > 1)
+    {
+        std::ofstream out(argv[1]);
+        out << json.str();
+        std::cerr << "Results written to " << argv[1] << std::endl;
+    }
+    else
+    {
+        std::cout << json.str();
+    }
+    return all_same ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Compares the SIMD and the scalar ray-sphere tests of SphereSet, and checks that both give the
+// same results
+#include "commons.hpp"
+#include "sampler.hpp"
+#include "spheres.hpp"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using benchmark_clock = std::chrono::steady_clock;
+
+int main()
+{
+    // Number of spheres tested against each ray, small groups are what the leaves of the BVH hold
+    const int group_sizes[] = {4, 8, 64, 1024};
+    const long long tests_per_run = 200000000;
+    PCG32 rng(7);
+
+    std::cout << "SIMD width: " << SPHERE_SIMD_WIDTH << std::endl;
+    std::cout << std::left << std::setw(10) << "spheres" << std::setw(20) << "scalar(tests/s)"
+              << std::setw(20) << "simd(tests/s)" << std::setw(10) << "speedup"
+              << "identical" << std::endl;
+    for (int n : group_sizes)
+    {
+        SphereSet spheres;
+        for (int i = 0; i < n; ++i)
+        {
+            vec3 center(rng.uniform(-10, 10), rng.uniform(-10, 10), rng.uniform(-10, 10));
+            spheres.add(center, rng.uniform(0.2, 2.0));
+        }
+        spheres.finish();
+
+        const int ray_count = 4096;
+        std::vector<vec3> origins, directions;
+        for (int i = 0; i < ray_count; ++i)
+        {
+            origins.push_back(vec3(rng.uniform(-12, 12), rng.uniform(-12, 12), rng.uniform(-12, 12)));
+            directions.push_back(
+                linalg::normalize(vec3(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1))));
+        }
+        int repeats = static_cast<int>(std::max(1LL, tests_per_run / (1LL * n * ray_count)));
+
+        std::vector<PrimitiveHit> scalar_hits(ray_count), simd_hits(ray_count);
+        auto start = benchmark_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            for (int i = 0; i < ray_count; ++i)
+            {
+                PrimitiveHit hit = {INF, -1};
+                spheres.closest_hit_scalar(origins[i], directions[i], 0.001, 0, n, hit);
+                scalar_hits[i] = hit;
+            }
+        }
+        std::chrono::duration<double> scalar = benchmark_clock::now() - start;
+
+        start = benchmark_clock::now();
+        for (int r = 0; r < repeats; ++r)
+        {
+            for (int i = 0; i < ray_count; ++i)
+            {
+                PrimitiveHit hit = {INF, -1};
+                spheres.closest_hit(origins[i], directions[i], 0.001, 0, n, hit);
+                simd_hits[i] = hit;
+            }
+        }
+        std::chrono::duration<double> simd = benchmark_clock::now() - start;
+
+        bool identical = true;
+        for (int i = 0; i < ray_count; ++i)
+        {
+            if (scalar_hits[i].id != simd_hits[i].id ||
+                std::memcmp(&scalar_hits[i].t, &simd_hits[i].t, sizeof(real)) != 0)
+                identical = false;
+        }
+        double tests = 1.0 * repeats * ray_count * n;
+        std::cout << std::left << std::setw(10) << n << std::setw(20) << std::fixed
+                  << std::setprecision(0) << tests / scalar.count() << std::setw(20)
+                  << tests / simd.count() << std::setw(10) << std::setprecision(2)
+                  << scalar.count() / simd.count() << (identical ? "yes" : "NO") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Axis aligned bounding boxes, used by the acceleration structure
+#pragma once
+#include "commons.hpp"
+#include <algorithm>
+
+// An axis aligned bounding box, represented by its minimum and maximum corners
+struct AABB
+{
+    vec3 min;
+    vec3 max;
+
+    /// @brief Creates an empty box, expanding it with any point or box results in that point/box
+    AABB() : min(INF, INF, INF), max(-INF, -INF, -INF) {}
+
+    AABB(const vec3 &min, const vec3 &max) : min(min), max(max) {}
+
+    /// @brief Grows this box so that it also contains the given point
+    void expand(const vec3 &p)
+    {
+        min = linalg::min(min, p);
+        max = linalg::max(max, p);
+    }
+
+    /// @brief Grows this box so that it also contains the given box
+    void expand(const AABB &box)
+    {
+        min = linalg::min(min, box.min);
+        max = linalg::max(max, box.max);
+    }
+
+    /// @return true if no point has been added to this box
+    bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+    vec3 centroid() const { return real(0.5) * (min + max); }
+
+    vec3 extent() const { return max - min; }
+
+    /// @return Surface area of the box, used by the surface area heuristic
+    real surface_area() const
+    {
+        if (empty())
+            return 0;
+        vec3 d = extent();
+        return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    /// @return Index of the axis (0 - x, 1 - y, 2 - z) along which the box is the longest
+    int longest_axis() const
+    {
+        vec3 d = extent();
+        if (d.x > d.y && d.x > d.z)
+            return 0;
+        return (d.y > d.z) ? 1 : 2;
+    }
+
+    /// @brief Slab test between a ray and this box
+    /// @param origin Origin of the ray
+    /// @param inv_direction Component wise reciprocal of the direction of the ray
+    /// @param t_min Minimum valid value of t
+    /// @param t_max Maximum valid value of t
+    /// @return true if the ray passes through the box between t_min and t_max
+    bool hit(const vec3 &origin, const vec3 &inv_direction, real t_min, real t_max) const
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            real t0 = (min[axis] - origin[axis]) * inv_direction[axis];
+            real t1 = (max[axis] - origin[axis]) * inv_direction[axis];
+            if (inv_direction[axis] < 0)
+                std::swap(t0, t1);
+            // Written so that NaNs (0 * inf) do not reject the box
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min)
+                return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,149 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "affinity.hpp"
+#include <algorithm>
+#include <thread>
+#ifdef __linux__
+#include <cctype>
+#include <dirent.h>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#endif
+
+int CpuTopology::cpu_count() const
+{
+    int count = 0;
+    for (const auto &node : nodes)
+        count += static_cast<int>(node.size());
+    return count;
+}
+
+std::vector<int> CpuTopology::placement(int number_of_threads) const
+{
+    std::vector<int> order;
+    for (const auto &node : nodes)
+        order.insert(order.end(), node.begin(), node.end());
+    order.resize(std::min(order.size(), static_cast<size_t>(std::max(number_of_threads, 0))));
+    return order;
+}
+
+int CpuTopology::node_of(int cpu) const
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (std::binary_search(nodes[i].begin(), nodes[i].end(), cpu))
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+#ifdef __linux__
+
+/// @brief Parses a list of processors such as "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(start, end - start);
+        size_t dash = range.find('-');
+        try
+        {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        catch (const std::exception &)
+        {
+            // Whitespace, such as the newline at the end of the file
+        }
+        start = end + 1;
+    }
+    return cpus;
+}
+
+CpuTopology detect_topology()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::vector<int> node_ids;
+    if (DIR *dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent *entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+                std::all_of(name.begin() + 4, name.end(), ::isdigit))
+                node_ids.push_back(std::stoi(name.substr(4)));
+        }
+        closedir(dir);
+    }
+    std::sort(node_ids.begin(), node_ids.end());
+
+    CpuTopology topology;
+    for (int id : node_ids)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(list))
+        {
+            if (!have_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                cpus.push_back(cpu);
+        }
+        if (!cpus.empty())
+            topology.nodes.push_back(cpus);
+    }
+    // Kernels without NUMA support have no nodes in /sys, all the processors are in one node
+    if (topology.nodes.empty())
+    {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (have_mask ? CPU_ISSET(cpu, &allowed)
+                          : cpu < static_cast<int>(std::thread::hardware_concurrency()))
+                cpus.push_back(cpu);
+        }
+        if (cpus.empty())
+            cpus.push_back(0);
+        topology.nodes.push_back(cpus);
+    }
+    return topology;
+}
+
+bool pin_current_thread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+
+CpuTopology detect_topology()
+{
+    CpuTopology topology;
+    topology.nodes.resize(1);
+    int count = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    for (int cpu = 0; cpu < count; ++cpu)
+        topology.nodes[0].push_back(cpu);
+    return topology;
+}
+
+bool pin_current_thread(int) { return false; }
+
+#endif
+
+int available_processors() { return std::max(detect_topology().cpu_count(), 1); }
@@ -0,0 +1,39 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// The processors of the machine, grouped by NUMA node (on most machines a node is a socket), and
+// pinning of threads to them. A pinned thread never migrates to another processor, so its caches
+// stay warm, and the memory which it touches first is allocated on its own node.
+//
+// The topology is read from /sys on Linux. Elsewhere every processor is in a single node and
+// threads are not pinned.
+#pragma once
+#include <vector>
+
+// The processors which this process may run on
+struct CpuTopology
+{
+    // Processors of every node, in increasing order. Nodes without such processors are left out.
+    std::vector<std::vector<int>> nodes;
+
+    /// @return Total number of processors
+    int cpu_count() const;
+
+    /// @return The processor for each of the threads. The nodes are filled one after the other,
+    /// so that a few threads share the caches and memory of one node. There are no processors for
+    /// the threads beyond cpu_count(), which are better left unpinned than sharing a processor.
+    std::vector<int> placement(int number_of_threads) const;
+
+    /// @return Index of the node of the processor, -1 if it is not in the topology
+    int node_of(int cpu) const;
+};
+
+/// @brief Reads the topology of the machine, limited to the processors in the affinity mask of the
+/// process (so that taskset and cpusets are respected)
+/// @return At least one node with at least one processor
+CpuTopology detect_topology();
+
+/// @return Number of processors which this process may run on, at least 1
+int available_processors();
+
+/// @brief Pins the calling thread to a processor
+/// @return false if the thread could not be pinned, or pinning is not supported
+bool pin_current_thread(int cpu);
@@ -0,0 +1,254 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "animation.hpp"
+#include "camera.hpp"
+#include "denoise.hpp"
+#include "image.hpp"
+#include "progressive.hpp"
+#include "raytracer.hpp"
+#include "scene.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using animation_clock = std::chrono::steady_clock;
+
+/// @brief Inserts the key after the keys of earlier or equal frames
+template <typename Key> static void insert_key(std::vector<Key> &keys, const Key &key)
+{
+    auto it = std::upper_bound(keys.begin(), keys.end(), key,
+                               [](const Key &a, const Key &b) { return a.frame < b.frame; });
+    keys.insert(it, key);
+}
+
+/// @brief Finds the keys around the frame
+/// @param t Set to the position of the frame between the two keys, from 0 to 1
+/// @return Index of the key at or before the frame, the next key is used if t > 0
+template <typename Key> static size_t find_keys(const std::vector<Key> &keys, int frame, real &t)
+{
+    t = 0;
+    size_t next = 0;
+    while (next < keys.size() && keys[next].frame <= frame)
+        next++;
+    if (next == 0)
+        return 0;
+    if (next == keys.size())
+        return next - 1;
+    t = static_cast<real>(frame - keys[next - 1].frame) /
+        static_cast<real>(keys[next].frame - keys[next - 1].frame);
+    return next - 1;
+}
+
+void Animation::add_camera_key(const CameraKey &key) { insert_key(camera_keys, key); }
+
+void Animation::add_instance_key(size_t instance, const InstanceKey &key)
+{
+    if (instance >= instance_keys.size())
+        instance_keys.resize(instance + 1);
+    insert_key(instance_keys[instance], key);
+}
+
+void Animation::apply_camera(int frame, Config &cfg) const
+{
+    if (!camera_keys.empty())
+    {
+        real t;
+        size_t k = find_keys(camera_keys, frame, t);
+        const CameraKey &a = camera_keys[k];
+        const CameraKey &b = camera_keys[std::min(k + 1, camera_keys.size() - 1)];
+        cfg.camera_position = a.position + (b.position - a.position) * t;
+        cfg.camera_lookat = a.lookat + (b.lookat - a.lookat) * t;
+    }
+    if (cfg.camera_orbit != 0 && cfg.animation_frames > 0)
+    {
+        // Rodrigues' rotation of the offset from the look at point around the up direction
+        real angle = static_cast<real>(cfg.camera_orbit * frame / cfg.animation_frames);
+        vec3 axis = normalize(cfg.camera_up);
+        vec3 offset = cfg.camera_position - cfg.camera_lookat;
+        vec3 rotated = offset * std::cos(angle) + cross(axis, offset) * std::sin(angle) +
+                       axis * dot(axis, offset) * (1 - std::cos(angle));
+        cfg.camera_position = cfg.camera_lookat + rotated;
+    }
+}
+
+void Animation::apply_instances(int frame, Scene &scene) const
+{
+    bool moved = false;
+    for (size_t i = 0; i < instance_keys.size() && i < scene.instance_count(); ++i)
+    {
+        const std::vector<InstanceKey> &keys = instance_keys[i];
+        if (keys.empty())
+            continue;
+        real t;
+        size_t k = find_keys(keys, frame, t);
+        const InstanceKey &a = keys[k];
+        const InstanceKey &b = keys[std::min(k + 1, keys.size() - 1)];
+        scene.set_instance_transform(i, a.translation + (b.translation - a.translation) * t,
+                                     lerp(a.scale, b.scale, t));
+        moved = true;
+    }
+    if (moved)
+        scene.refit();
+}
+
+std::string frame_filename(const std::string &pattern, int frame)
+{
+    std::string number = std::to_string(frame);
+    // Looks for %d or %0<width>d, only the number is formatted, so any other % is kept
+    for (size_t percent = pattern.find('%'); percent != std::string::npos;
+         percent = pattern.find('%', percent + 1))
+    {
+        size_t end = percent + 1;
+        while (end < pattern.size() && isdigit(static_cast<unsigned char>(pattern[end])))
+            end++;
+        if (end == pattern.size() || pattern[end] != 'd')
+            continue;
+        size_t width = 0;
+        if (end > percent + 1)
+            width = std::stoul(pattern.substr(percent + 1, end - percent - 1));
+        if (number.size() < width)
+            number.insert(0, width - number.size(), '0');
+        return pattern.substr(0, percent) + number + pattern.substr(end + 1);
+    }
+    size_t dot = pattern.find_last_of('.');
+    size_t separator = pattern.find_last_of("/\\");
+    if (dot == std::string::npos || (separator != std::string::npos && dot < separator))
+        return pattern + "_" + number;
+    return pattern.substr(0, dot) + "_" + number + pattern.substr(dot);
+}
+
+// The stage which writes the frames, it tonemaps (if needed), encodes and writes every frame on
+// its own thread while the render threads work on the next frame
+class FrameWriter
+{
+  private:
+    struct Frame
+    {
+        std::string filename;
+        Framebuffer image;
+        DisplayImage display;
+        // The display image has not been made yet
+        bool tonemap;
+    };
+
+    ToneMap tonemap;
+    int gamma;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<Frame> frames;
+    bool finished;
+    std::thread thread;
+
+    void run()
+    {
+        while (true)
+        {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [this] { return finished || !frames.empty(); });
+                if (frames.empty())
+                    return;
+                frame = std::move(frames.front());
+                frames.pop_front();
+            }
+            changed.notify_all();
+            if (frame.tonemap)
+                frame.display = tonemap_image(frame.image, tonemap, gamma, 1);
+            write_to_file(frame.filename, frame.image, frame.display);
+        }
+    }
+
+  public:
+    FrameWriter(ToneMap tonemap, int gamma)
+        : tonemap(tonemap), gamma(gamma), finished(false), thread(&FrameWriter::run, this)
+    {
+    }
+
+    ~FrameWriter() { finish(); }
+
+    /// @brief Queues a frame, waits while MAX_QUEUED_FRAMES frames are already queued
+    /// @param display The tonemapped image, or an empty image to tonemap it on the writer thread
+    void write(const std::string &filename, Framebuffer image, DisplayImage display)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return frames.size() < MAX_QUEUED_FRAMES; });
+        Frame frame;
+        frame.filename = filename;
+        frame.tonemap = display.pixels.empty();
+        frame.image = std::move(image);
+        frame.display = std::move(display);
+        frames.push_back(std::move(frame));
+        guard.unlock();
+        changed.notify_all();
+    }
+
+    /// @brief Waits until every queued frame has been written
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            finished = true;
+        }
+        changed.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+void render_sequence(const Config &cfg, Scene &scene, const Animation &animation,
+                     int number_of_threads)
+{
+    number_of_threads = std::max(number_of_threads, 1);
+    FrameWriter writer(cfg.tonemap, cfg.gamma);
+    auto start = animation_clock::now();
+    for (int frame = 0; frame < cfg.animation_frames; ++frame)
+    {
+        auto frame_start = animation_clock::now();
+        Config frame_cfg = cfg;
+        // Every frame is short, and a checkpoint would belong to a single frame
+        frame_cfg.show_progress = false;
+        frame_cfg.checkpoint_filename.clear();
+        animation.apply_camera(frame, frame_cfg);
+        animation.apply_instances(frame, scene);
+        MovableCamera cam(frame_cfg);
+
+        AOVBuffers aovs;
+        Framebuffer img;
+        DisplayImage display;
+        if (cfg.progressive)
+        {
+            img = ProgressiveRenderer(frame_cfg).render(cam, scene, number_of_threads,
+                                                        cfg.denoise ? &aovs : nullptr);
+        }
+        else
+        {
+            // The rows are tonemapped while the rest of the frame is rendered, unless the frame
+            // is denoised first
+            img = multi_threaded_render(frame_cfg, cam, scene, number_of_threads,
+                                        cfg.denoise ? nullptr : &display, nullptr,
+                                        cfg.denoise ? &aovs : nullptr);
+        }
+        if (cfg.denoise)
+            img = denoise(img, aovs, number_of_threads);
+        writer.write(frame_filename(cfg.animation_filename, frame), std::move(img),
+                     std::move(display));
+        if (cfg.show_progress)
+        {
+            std::chrono::duration<double> seconds = animation_clock::now() - frame_start;
+            std::cout << "Frame " << frame + 1 << "/" << cfg.animation_frames << " rendered in "
+                      << seconds.count() << "s" << std::endl;
+        }
+    }
+    writer.finish();
+    if (cfg.show_progress)
+    {
+        std::chrono::duration<double> seconds = animation_clock::now() - start;
+        std::cout << cfg.animation_frames << " frames written in " << seconds.count() << "s"
+                  << std::endl;
+    }
+}
@@ -0,0 +1,68 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Animations, the camera and the instances of a scene move between keys, and the frames are
+// rendered one after the other from a scene which is built once. Between frames the acceleration
+// structure is refitted to the moved instances instead of being built again, and every frame is
+// written to disk by another thread while the next one is rendered.
+#pragma once
+#include "commons.hpp"
+#include "config.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class Scene;
+
+// Maximum number of rendered frames waiting to be written, rendering waits when the disk is slower
+constexpr int MAX_QUEUED_FRAMES = 2;
+
+// Position of the camera at a frame
+struct CameraKey
+{
+    int frame;
+    vec3 position;
+    vec3 lookat;
+};
+
+// Placement of an instance at a frame
+struct InstanceKey
+{
+    int frame;
+    vec3 translation;
+    real scale;
+};
+
+// The keys of an animation. Between two keys the values are interpolated linearly, before the
+// first key and after the last one they stay at the value of that key.
+class Animation
+{
+  private:
+    // Sorted by frame
+    std::vector<CameraKey> camera_keys;
+    // Keys of every instance, indexed like Scene::set_instance_transform, empty for the instances
+    // which do not move
+    std::vector<std::vector<InstanceKey>> instance_keys;
+
+  public:
+    void add_camera_key(const CameraKey &key);
+
+    /// @param instance Index of the instance, in the order in which they were added to the scene
+    void add_instance_key(size_t instance, const InstanceKey &key);
+
+    /// @brief Places the camera of the config at the frame. The camera is then turned around the
+    /// point it looks at by cfg.camera_orbit * frame / cfg.animation_frames.
+    void apply_camera(int frame, Config &cfg) const;
+
+    /// @brief Moves the instances of the scene to their placement at the frame, and refits the
+    /// acceleration structure if any of them has keys
+    void apply_instances(int frame, Scene &scene) const;
+};
+
+/// @return The pattern with the first %d (or %0<width>d) replaced by the frame number, as in printf.
+/// Without one, the number is inserted before the extension.
+std::string frame_filename(const std::string &pattern, int frame);
+
+/// @brief Renders the cfg.animation_frames frames of the animation into the files named by
+/// cfg.animation_filename. Frames are rendered like single images (progressive and denoised if
+/// the config says so).
+void render_sequence(const Config &cfg, Scene &scene, const Animation &animation,
+                     int number_of_threads);
@@ -0,0 +1,41 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "aov.hpp"
+#include <stdio.h>
+
+void AOVBuffers::resize(int width, int height)
+{
+    albedo = Framebuffer(width, height);
+    normal = Framebuffer(width, height);
+    depth.assign(static_cast<size_t>(width) * height, 0.0f);
+    sample_count.assign(static_cast<size_t>(width) * height, 0);
+}
+
+/// @brief Writes a single channel image to a .pfm file
+static bool write_gray_pfm(const std::string &filename, int width, int height,
+                           const std::vector<float> &values)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    const uint16_t endian_test = 1;
+    bool little_endian = *reinterpret_cast<const uint8_t *>(&endian_test) == 1;
+    // "Pf" is the grayscale variant of the format, rows are stored from the bottom to the top
+    fprintf(file, "Pf\n%d %d\n%s\n", width, height, little_endian ? "-1.0" : "1.0");
+    bool ok = true;
+    for (int r = height - 1; r >= 0 && ok; --r)
+    {
+        const float *row = values.data() + static_cast<size_t>(r) * width;
+        ok = fwrite(row, sizeof(float), width, file) == static_cast<size_t>(width);
+    }
+    return fclose(file) == 0 && ok;
+}
+
+bool write_aovs(const std::string &prefix, const AOVBuffers &aovs)
+{
+    std::vector<float> samples(aovs.sample_count.begin(), aovs.sample_count.end());
+    bool ok = write_pfm(prefix + "_albedo.pfm", aovs.albedo);
+    ok = write_pfm(prefix + "_normal.pfm", aovs.normal) && ok;
+    ok = write_gray_pfm(prefix + "_depth.pfm", aovs.width(), aovs.height(), aovs.depth) && ok;
+    ok = write_gray_pfm(prefix + "_samples.pfm", aovs.width(), aovs.height(), samples) && ok;
+    return ok;
+}
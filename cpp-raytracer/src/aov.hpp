@@ -0,0 +1,78 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Auxiliary output buffers (AOVs), images of the surfaces seen through the pixels which are
+// rendered along with the color, and used by the denoiser to find the edges of the image
+#pragma once
+#include "colors.hpp"
+#include "commons.hpp"
+#include "image.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Features of the surface seen by one sample. Mirrors and glass are looked through, the features
+// are those of the first surface which scatters light diffusely (or the sky).
+struct SurfaceFeatures
+{
+    // Color of the surface, tinted by the mirrors and glass in front of it
+    color albedo;
+    // Normal on the side of the ray, zero for the sky
+    vec3 normal;
+    // Distance from the camera to the first surface hit, zero for the sky
+    real depth;
+
+    SurfaceFeatures() : albedo(0, 0, 0), normal(0, 0, 0), depth(0) {}
+
+    SurfaceFeatures &operator+=(const SurfaceFeatures &other)
+    {
+        albedo += other.albedo;
+        normal += other.normal;
+        depth += other.depth;
+        return *this;
+    }
+
+    SurfaceFeatures operator/(real n) const
+    {
+        SurfaceFeatures f;
+        f.albedo = albedo / n;
+        f.normal = normal / n;
+        f.depth = depth / n;
+        return f;
+    }
+};
+
+// The AOVs of an image, every pixel holds the average features of its samples
+struct AOVBuffers
+{
+    Framebuffer albedo;
+    Framebuffer normal;
+    std::vector<float> depth;
+    // Number of samples taken in each pixel
+    std::vector<uint32_t> sample_count;
+
+    AOVBuffers() {}
+
+    AOVBuffers(int width, int height) { resize(width, height); }
+
+    /// @brief Resizes the buffers, and clears them
+    void resize(int width, int height);
+
+    int width() const { return albedo.width(); }
+
+    int height() const { return albedo.height(); }
+
+    /// @brief Stores the features of a pixel
+    /// @param features Average of the features of the samples
+    void set(int row, int col, const SurfaceFeatures &features, uint32_t samples)
+    {
+        size_t index = static_cast<size_t>(row) * width() + col;
+        albedo.set(row, col, features.albedo);
+        normal.set(row, col, features.normal);
+        depth[index] = static_cast<float>(features.depth);
+        sample_count[index] = samples;
+    }
+};
+
+/// @brief Writes every buffer to its own .pfm file, named <prefix>_albedo.pfm, <prefix>_normal.pfm,
+/// <prefix>_depth.pfm and <prefix>_samples.pfm. Depth and the sample counts are single channel.
+/// @return true if all the files were written
+bool write_aovs(const std::string &prefix, const AOVBuffers &aovs);
@@ -0,0 +1,86 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Memory arena, which hands out memory from a few large blocks and frees all of it at once
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Size of the blocks requested from the system, larger allocations get a block of their own
+constexpr size_t ARENA_BLOCK_SIZE = 1 << 20;
+
+// Allocates memory by moving a pointer forward in the current block. Memory is never returned to
+// the arena, it is all freed when the arena is destroyed, so the objects allocated from it must
+// not outlive it. Everything allocated one after the other lies next to each other in memory.
+class Arena
+{
+  private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *current;
+    size_t remaining;
+    size_t used;
+
+  public:
+    Arena() : current(nullptr), remaining(0), used(0) {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /// @return Memory for bytes bytes aligned to alignment (a power of two), never null
+    void *allocate(size_t bytes, size_t alignment)
+    {
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+        if (padding + bytes > remaining)
+        {
+            // The rest of the current block is abandoned
+            size_t size = std::max(ARENA_BLOCK_SIZE, bytes + alignment);
+            blocks.emplace_back(new char[size]);
+            current = blocks.back().get();
+            remaining = size;
+            padding = (alignment - reinterpret_cast<uintptr_t>(current) % alignment) % alignment;
+        }
+        char *p = current + padding;
+        current += padding + bytes;
+        remaining -= padding + bytes;
+        used += bytes;
+        return p;
+    }
+
+    /// @return Number of blocks requested from the system
+    size_t block_count() const { return blocks.size(); }
+
+    /// @return Number of bytes handed out
+    size_t bytes_used() const { return used; }
+};
+
+// Allocator for the standard containers which takes memory from an arena, deallocate does nothing.
+// Containers which grow leave their old storage behind in the arena, so they should be reserved
+// to the final size when it is known.
+template <typename T> class ArenaAllocator
+{
+  public:
+    using value_type = T;
+
+    Arena *arena;
+
+    explicit ArenaAllocator(Arena *arena) : arena(arena) {}
+
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T))); }
+
+    void deallocate(T *, size_t) {}
+
+    template <typename U> bool operator==(const ArenaAllocator<U> &other) const
+    {
+        return arena == other.arena;
+    }
+
+    template <typename U> bool operator!=(const ArenaAllocator<U> &other) const
+    {
+        return arena != other.arena;
+    }
+};
+
+template <typename T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
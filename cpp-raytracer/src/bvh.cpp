@@ -0,0 +1,181 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "bvh.hpp"
+#include <algorithm>
+
+void BVH::build(const std::vector<AABB> &bounds, int leaf_width)
+{
+    this->leaf_width = std::max(leaf_width, 1);
+    nodes.clear();
+    indices.clear();
+    if (bounds.empty())
+        return;
+
+    std::vector<BuildPrimitive> prims(bounds.size());
+    for (size_t i = 0; i < bounds.size(); ++i)
+    {
+        prims[i].bounds = bounds[i];
+        prims[i].centroid = bounds[i].centroid();
+        prims[i].index = static_cast<int>(i);
+    }
+    // A binary tree with n leaves has 2n - 1 nodes
+    nodes.reserve(2 * bounds.size());
+    indices.reserve(bounds.size());
+    build_recursive(prims, 0, static_cast<int>(prims.size()), 0);
+    nodes.shrink_to_fit();
+}
+
+void BVH::refit(const std::vector<AABB> &bounds)
+{
+    // Children are stored after their parent, so walking the nodes backwards updates both
+    // children of a node before the node itself
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i)
+    {
+        BVHNode &node = nodes[i];
+        AABB box;
+        if (node.count > 0)
+        {
+            for (int j = node.offset; j < node.offset + node.count; ++j)
+            {
+                box.expand(bounds[indices[j]]);
+            }
+        }
+        else
+        {
+            box = nodes[i + 1].bounds;
+            box.expand(nodes[node.offset].bounds);
+        }
+        node.bounds = box;
+    }
+}
+
+/// @brief Bin of a centroid along an axis. Centroids which overflowed to infinity (or are NaN) go
+/// to the first or the last bin, instead of being converted to an index out of range
+static int bin_index(double centroid, double min, double scale)
+{
+    double offset = (centroid - min) * scale;
+    if (!(offset > 0))
+        return 0;
+    return offset < BVH_BINS - 1 ? static_cast<int>(offset) : BVH_BINS - 1;
+}
+
+int BVH::build_recursive(std::vector<BuildPrimitive> &prims, int begin, int end, int depth)
+{
+    int node_index = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode());
+
+    AABB bounds, centroid_bounds;
+    for (int i = begin; i < end; ++i)
+    {
+        bounds.expand(prims[i].bounds);
+        centroid_bounds.expand(prims[i].centroid);
+    }
+    nodes[node_index].bounds = bounds;
+    nodes[node_index].axis = 0;
+
+    int count = end - begin;
+    auto make_leaf = [&]() {
+        nodes[node_index].offset = static_cast<int>(indices.size());
+        nodes[node_index].count = count;
+        for (int i = begin; i < end; ++i)
+            indices.push_back(prims[i].index);
+        return node_index;
+    };
+
+    // Cost of intersecting n primitives in groups of leaf_width
+    auto groups = [&](int n) { return static_cast<double>((n + leaf_width - 1) / leaf_width); };
+    int max_leaf_size = std::max(BVH_MAX_LEAF_SIZE, leaf_width);
+
+    if (count == 1 || depth >= BVH_MAX_DEPTH - 1)
+        return make_leaf();
+
+    // Binned surface area heuristic, the centroids are put into bins along every axis, and the
+    // split between two bins with the least cost is chosen
+    // cost = traversal cost + (area(left) * n(left) + area(right) * n(right)) / area(node)
+    // where n is the number of groups of leaf_width primitives
+    int best_axis = -1, best_split = 0;
+    double best_cost = INF;
+    vec3 extent = centroid_bounds.extent();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (extent[axis] <= 0)
+            continue;
+        AABB bin_bounds[BVH_BINS];
+        int bin_count[BVH_BINS] = {0};
+        double scale = BVH_BINS / extent[axis];
+        for (int i = begin; i < end; ++i)
+        {
+            int b = bin_index(prims[i].centroid[axis], centroid_bounds.min[axis], scale);
+            bin_count[b]++;
+            bin_bounds[b].expand(prims[i].bounds);
+        }
+        // Sweep from the right to find the area and count of every right partition
+        double right_area[BVH_BINS];
+        int right_count[BVH_BINS];
+        AABB acc;
+        int n = 0;
+        for (int b = BVH_BINS - 1; b > 0; --b)
+        {
+            acc.expand(bin_bounds[b]);
+            n += bin_count[b];
+            right_area[b] = acc.surface_area();
+            right_count[b] = n;
+        }
+        acc = AABB();
+        n = 0;
+        for (int b = 0; b < BVH_BINS - 1; ++b)
+        {
+            acc.expand(bin_bounds[b]);
+            n += bin_count[b];
+            if (n == 0 || right_count[b + 1] == 0)
+                continue;
+            double cost = acc.surface_area() * groups(n) +
+                          right_area[b + 1] * groups(right_count[b + 1]);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    double area = bounds.surface_area();
+    best_cost = (area > 0) ? 1.0 + best_cost / area : INF;
+    if (best_axis == -1)
+    {
+        // All centroids are at the same point, the primitives cannot be separated by the heuristic
+        if (count <= max_leaf_size)
+            return make_leaf();
+        // Split them into two halves so that leaves remain small
+        best_axis = bounds.longest_axis();
+    }
+    else if (count <= max_leaf_size && best_cost >= groups(count))
+    {
+        // It is cheaper to intersect all the primitives than to split them
+        return make_leaf();
+    }
+
+    int mid;
+    if (best_axis != -1 && extent[best_axis] > 0)
+    {
+        double scale = BVH_BINS / extent[best_axis];
+        double min = centroid_bounds.min[best_axis];
+        int axis = best_axis, split = best_split;
+        auto it = std::partition(prims.begin() + begin, prims.begin() + end,
+                                 [=](const BuildPrimitive &p) {
+                                     return bin_index(p.centroid[axis], min, scale) <= split;
+                                 });
+        mid = static_cast<int>(it - prims.begin());
+    }
+    else
+    {
+        mid = begin + count / 2;
+    }
+
+    nodes[node_index].axis = best_axis;
+    nodes[node_index].count = 0;
+    build_recursive(prims, begin, mid, depth + 1);
+    // The vector may have been reallocated, do not hold a reference across the recursive calls
+    nodes[node_index].offset = build_recursive(prims, mid, end, depth + 1);
+    return node_index;
+}
@@ -0,0 +1,225 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Bounding volume hierarchy, used to speed up finding the closest intersection of a ray
+#pragma once
+#include "aabb.hpp"
+#include "commons.hpp"
+#include "packet.hpp"
+#include <utility>
+#include <vector>
+
+// Number of bins used to evaluate the surface area heuristic along each axis
+constexpr int BVH_BINS = 16;
+// Maximum number of primitives stored in a leaf
+constexpr int BVH_MAX_LEAF_SIZE = 4;
+// Maximum depth of the tree, this is also the size of the traversal stack
+constexpr int BVH_MAX_DEPTH = 64;
+
+// A node of the flattened tree. Nodes are stored in depth first order, so the first child of an
+// interior node is always the node right after it, only the index of the second child is stored.
+struct BVHNode
+{
+    AABB bounds;
+    // For leaves, index of the first primitive (in BVH::primitive_indices()), for interior nodes
+    // index of the second child
+    int offset;
+    // Number of primitives in this node, 0 for interior nodes
+    int count;
+    // Axis along which the primitives of this node were split
+    int axis;
+};
+
+class BVH
+{
+  private:
+    struct BuildPrimitive
+    {
+        AABB bounds;
+        vec3 centroid;
+        int index;
+    };
+
+    std::vector<BVHNode> nodes;
+    // Indices of the primitives, ordered so that every leaf refers to a contiguous range
+    std::vector<int> indices;
+    // Number of primitives which can be intersected at the cost of one
+    int leaf_width;
+
+    int build_recursive(std::vector<BuildPrimitive> &prims, int begin, int end, int depth);
+
+  public:
+    BVH() : leaf_width(1) {}
+
+    /// @brief Builds the tree, any previously built tree is discarded
+    /// @param bounds Bounding boxes of the primitives, the index of a box is used as the id of the
+    /// primitive
+    /// @param leaf_width Number of primitives of a leaf which are intersected together (for
+    /// example with SIMD), leaves can then hold more primitives
+    void build(const std::vector<AABB> &bounds, int leaf_width = 1);
+
+    /// @brief Recomputes the bounds of the nodes after the primitives have moved, keeping the
+    /// tree as it is. This is much faster than building the tree again, but the tree gets slower
+    /// to traverse as the primitives move away from where they were when it was built.
+    /// @param bounds Bounding boxes of the primitives, in the same order as for build
+    void refit(const std::vector<AABB> &bounds);
+
+    /// @brief Replaces the tree with nodes and primitive indices which were built earlier, for
+    /// example read from a file
+    void assign(std::vector<BVHNode> nodes, std::vector<int> indices)
+    {
+        this->nodes = std::move(nodes);
+        this->indices = std::move(indices);
+    }
+
+    /// @return true if the tree has not been built or has no primitives
+    bool empty() const { return nodes.empty(); }
+
+    /// @return Bounds of all the primitives in the tree
+    AABB bounds() const { return nodes.empty() ? AABB() : nodes[0].bounds; }
+
+    const std::vector<BVHNode> &get_nodes() const { return nodes; }
+
+    const std::vector<int> &primitive_indices() const { return indices; }
+
+    /// @brief Walks the tree (without recursion) and calls leaf_fn for every leaf which is hit by
+    /// the ray. Children are visited front to back, so that t_max shrinks quickly.
+    /// @param ray The ray to be traced
+    /// @param t_min Minimum value of t which is valid
+    /// @param t_max Maximum value of t which is valid, updated by leaf_fn when a closer hit is found
+    /// @param leaf_fn Callable as bool(int first, int count, real t_min, real &t_max), the
+    /// primitives of the leaf are primitive_indices()[first] to primitive_indices()[first + count
+    /// - 1]. It returns true and shrinks t_max if a primitive was hit
+    /// @return true if any primitive was hit
+    template <typename LeafFn>
+    bool traverse(const Ray &ray, real t_min, real &t_max, LeafFn &&leaf_fn) const
+    {
+        if (nodes.empty())
+            return false;
+        const vec3 origin = ray.origin();
+        const vec3 direction = ray.direction();
+        const vec3 inv_direction(1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z);
+        const bool negative[3] = {direction.x < 0, direction.y < 0, direction.z < 0};
+
+        int stack[BVH_MAX_DEPTH];
+        int stack_size = 0;
+        int current = 0;
+        bool hit = false;
+        while (true)
+        {
+            const BVHNode &node = nodes[current];
+            if (node.bounds.hit(origin, inv_direction, t_min, t_max))
+            {
+                if (node.count > 0)
+                {
+                    if (leaf_fn(node.offset, node.count, t_min, t_max))
+                        hit = true;
+                }
+                else
+                {
+                    // Visit the child which is closer to the ray first
+                    if (negative[node.axis])
+                    {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    }
+                    else
+                    {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+        return hit;
+    }
+
+    /// @brief Walks the tree once for all the rays of a coherent packet, a node is skipped only if
+    /// no ray of the packet can pass through it. The children are visited in the same order as
+    /// traverse() visits them for every ray of the packet.
+    /// @param interval Bounds of the rays of the packet, which must be coherent
+    /// @param t_max The largest t_max of the rays, updated by leaf_fn
+    /// @param leaf_fn Callable as void(const BVHNode &leaf, real &t_max), it tests the rays which
+    /// pass through the leaf and sets t_max to the largest t_max of the rays
+    template <typename LeafFn>
+    void traverse_packet(const PacketInterval &interval, real t_min, real t_max,
+                         LeafFn &&leaf_fn) const
+    {
+        if (nodes.empty())
+            return;
+        int stack[BVH_MAX_DEPTH];
+        int stack_size = 0;
+        int current = 0;
+        while (true)
+        {
+            const BVHNode &node = nodes[current];
+            if (interval.may_hit(node.bounds, t_min, t_max))
+            {
+                if (node.count > 0)
+                {
+                    leaf_fn(node, t_max);
+                }
+                else
+                {
+                    if (interval.negative[node.axis])
+                    {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    }
+                    else
+                    {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+
+    /// @brief Walks the tree until leaf_fn reports a hit, used for shadow rays which only need to
+    /// know if anything is hit. The children are not ordered.
+    /// @param leaf_fn Callable as bool(int first, int count, real t_min, real t_max), returns true
+    /// if any primitive of the leaf is hit
+    /// @return true if any primitive was hit
+    template <typename LeafFn>
+    bool any_hit(const Ray &ray, real t_min, real t_max, LeafFn &&leaf_fn) const
+    {
+        if (nodes.empty())
+            return false;
+        const vec3 origin = ray.origin();
+        const vec3 direction = ray.direction();
+        const vec3 inv_direction(1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z);
+
+        int stack[BVH_MAX_DEPTH];
+        int stack_size = 0;
+        int current = 0;
+        while (true)
+        {
+            const BVHNode &node = nodes[current];
+            if (node.bounds.hit(origin, inv_direction, t_min, t_max))
+            {
+                if (node.count > 0)
+                {
+                    if (leaf_fn(node.offset, node.count, t_min, t_max))
+                        return true;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+        return false;
+    }
+};
@@ -1,6 +1,7 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #include "camera.hpp"
 #include "config.h"
+#include "sampling.hpp"
 
 MovableCamera::MovableCamera(const Config &conf)
     : image_width(conf.image_width), image_height(conf.image_height)
@@ -25,49 +26,105 @@ MovableCamera::MovableCamera(const Config &conf)
     up = linalg::normalize(linalg::cross(right, direction));
 
     // Some other calculations
-    aspect_ratio = static_cast<double>(image_width) / image_height;
+    aspect_ratio = static_cast<real>(image_width) / image_height;
     viewport_height = 2.0 * std::tan(fov / 2.0) * focal_length;
     viewport_width = aspect_ratio * viewport_height;
     // Spacing between two pixels on the viewport
     delta_x = viewport_width / image_width;
     delta_y = viewport_height / image_height;
+    // In PCC (Pixel coordinate system), the center is represented as
+    // image_width/2, image_height/2
+    x0 = std::max(image_width / 2.0, 1.0);
+    y0 = std::max(image_height / 2.0, 1.0);
+    to_viewport = direction * focal_length;
 }
 
-Ray MovableCamera::get_ray(int row, int col, bool sample) const
+Ray MovableCamera::get_ray(int row, int col, Sampler &sampler, bool sample) const
 {
     // Find the other point on this ray, one end point is the position of
     // the camera.
-    // In PCC (Pixel coordinate system), the center is represented as
-    // image_width/2, image_height/2
-    double x0 = std::max(image_width / 2.0, 1.0);
-    double y0 = std::max(image_height / 2.0, 1.0);
     // x and y represent the position of the pixel in cartesian system on
     // the viewport (but as pixels)
-    double x = col - x0;
-    double y = y0 - row;
+    real x = col - x0;
+    real y = y0 - row;
     // Convert the pixel values to viewport system
-    double vx = x * delta_x;
-    double vy = y * delta_y;
+    real vx = x * delta_x;
+    real vy = y * delta_y;
 
     if (sample)
     {
-        vx += (uniform() - 0.5) * delta_x;
-        vy += (uniform() - 0.5) * delta_y;
+        double u, v;
+        sampler.next_2d(u, v);
+        vx += (u - 0.5) * delta_x;
+        vy += (v - 0.5) * delta_y;
     }
     // Translate the viewport, keeping the camera's position as origin.
     // The bug resulted in not shifting the origin of the viewport.
-    auto pixel_sample = position + (up * vy) + (right * vx) + (direction * focal_length);
-    auto ray_origin = (defocus_angle <= 0) ? position : get_defocused_origin();
+    auto pixel_sample = position + (up * vy) + (right * vx) + to_viewport;
+    auto ray_origin = (defocus_angle <= 0) ? position : get_defocused_origin(sampler);
     auto ray_direction = pixel_sample - ray_origin;
 
     return Ray(ray_origin, ray_direction);
 }
 
-vec3 MovableCamera::get_defocused_origin() const
+void Camera::get_rays(const int *rows, const int *cols, Sampler *const *samplers, int count,
+                      bool sample, RayPacket &packet) const
+{
+    packet.size = count;
+    for (int i = 0; i < count; ++i)
+    {
+        packet.set(i, get_ray(rows[i], cols[i], *samplers[i], sample));
+    }
+}
+
+void MovableCamera::get_rays(const int *rows, const int *cols, Sampler *const *samplers,
+                             int count, bool sample, RayPacket &packet) const
+{
+    packet.size = count;
+    // Position of the pixels on the viewport, the same operations as get_ray
+    real vx[RAY_PACKET_SIZE], vy[RAY_PACKET_SIZE];
+    for (int i = 0; i < count; ++i)
+    {
+        vx[i] = (cols[i] - x0) * delta_x;
+        vy[i] = (y0 - rows[i]) * delta_y;
+    }
+    // Every ray draws from its own sampler, in the same order as get_ray
+    if (sample)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            double u, v;
+            samplers[i]->next_2d(u, v);
+            vx[i] += (u - 0.5) * delta_x;
+            vy[i] += (v - 0.5) * delta_y;
+        }
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        vec3 origin = (defocus_angle <= 0) ? position : get_defocused_origin(*samplers[i]);
+        packet.origin_x[i] = origin.x;
+        packet.origin_y[i] = origin.y;
+        packet.origin_z[i] = origin.z;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        real dx = position.x + up.x * vy[i] + right.x * vx[i] + to_viewport.x - packet.origin_x[i];
+        real dy = position.y + up.y * vy[i] + right.y * vx[i] + to_viewport.y - packet.origin_y[i];
+        real dz = position.z + up.z * vy[i] + right.z * vx[i] + to_viewport.z - packet.origin_z[i];
+        real length = std::sqrt(dx * dx + dy * dy + dz * dz);
+        packet.direction_x[i] = dx / length;
+        packet.direction_y[i] = dy / length;
+        packet.direction_z[i] = dz / length;
+    }
+}
+
+vec3 MovableCamera::get_defocused_origin(Sampler &sampler) const
 {
     // Get a random origin for a new ray on the plane of the actual origin of the camera
     // This acts as thin lens approximation
-    auto p = random_in_unit_disk();
+    double u, v;
+    sampler.next_2d(u, v);
+    auto p = sample_concentric_disk(static_cast<real>(u), static_cast<real>(v));
     return position + (p[0] * up * defocus_radius) + (p[1] * right * defocus_radius);
 }
 
@@ -2,6 +2,8 @@
 #pragma once
 #include "commons.hpp"
 #include "config.h"
+#include "packet.hpp"
+#include "sampler.hpp"
 #include <iostream>
 #include <ostream>
 using namespace linalg::ostream_overloads;
@@ -11,9 +13,21 @@ using namespace linalg::ostream_overloads;
 class Camera
 {
   public:
-    virtual Ray get_ray(int row, int col, bool sample = false) const = 0;
+    virtual Ray get_ray(int row, int col, Sampler &sampler, bool sample = false) const = 0;
     virtual void debug_info(std::ostream &os) const = 0;
 
+    /// @brief Generates the rays of several pixels at once, ray i is the ray which
+    /// get_ray(rows[i], cols[i], *samplers[i], sample) returns. By default get_ray is called for
+    /// every ray.
+    /// @param samplers Sampler of every ray, a sampler must not be shared by two rays
+    /// @param count Number of rays, at most RAY_PACKET_SIZE
+    /// @param packet Filled in with the rays, its size is set to count
+    virtual void get_rays(const int *rows, const int *cols, Sampler *const *samplers, int count,
+                          bool sample, RayPacket &packet) const;
+
+    /// @return Angle (in radians) between the rays of two neighbouring pixels, 0 if unknown
+    virtual real pixel_spread() const { return 0; }
+
     virtual ~Camera() {}
 };
 
@@ -31,30 +45,34 @@ class MovableCamera : public Camera
     // Position of the camera
     vec3 position;
     // Distance between the camera and the viewport screen
-    double focal_length;
+    real focal_length;
     // FOV angle
-    double fov;
+    real fov;
     // Width of the image (in pixels)
     int image_width;
     // Height of the image (in pixels)
     int image_height;
     // Aspect ratio is width / height
-    double aspect_ratio;
+    real aspect_ratio;
     // Width of the virtual viewport (in metres)
-    double viewport_width;
+    real viewport_width;
     // Height of the virtual viewport (in metres)
-    double viewport_height;
+    real viewport_height;
     // It is the horizontal spacing between two adjacent pixels in the viewport
-    double delta_x;
+    real delta_x;
     // It is the vertical spacing between two adjacent pixels in the viewport
-    double delta_y;
+    real delta_y;
     // The angle through which the rays are spread out from the origin of the camera
-    double defocus_angle;
+    real defocus_angle;
     // The radius of disk from which rays are cast to the screen
-    double defocus_radius;
+    real defocus_radius;
+    // Position of the center of the image in pixels, and the vector from the camera to the center
+    // of the viewport, the same for every ray
+    real x0, y0;
+    vec3 to_viewport;
 
     /// Returns a random origin for a new ray on the defocus disk
-    vec3 get_defocused_origin() const;
+    vec3 get_defocused_origin(Sampler &sampler) const;
 
   public:
     MovableCamera(const Config &conf);
@@ -62,9 +80,17 @@ class MovableCamera : public Camera
     /// Note: pixels start from (0,0), which is the top left corner
     /// @param row y coordinate or row of the pixel
     /// @param col x coordinate or column of the pixel
+    /// @param sampler Sampler of the current pixel, used to pick the point in the pixel and on the
+    /// lens
     /// @param sample Randomize the ray or not(by default, false)
     /// @return A ray which passes through the given pixel from the center of the camera
-    Ray get_ray(int row, int col, bool sample = false) const override;
+    Ray get_ray(int row, int col, Sampler &sampler, bool sample = false) const override;
+    /// The pixel coordinates and the normalization of the directions are computed with loops
+    /// over the structure of arrays of the packet, only the samplers are called ray by ray. The
+    /// rays are exactly the same as those of get_ray.
+    void get_rays(const int *rows, const int *cols, Sampler *const *samplers, int count,
+                  bool sample, RayPacket &packet) const override;
+    real pixel_spread() const override { return delta_y / focal_length; }
     /// Prints debug information to the given stream
     /// @param os - std::ostream object
     void debug_info(std::ostream &os) const override;
@@ -0,0 +1,167 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "checkpoint.hpp"
+#include <cstdio>
+#include <string.h>
+
+// Increase this whenever the layout of the checkpoint file changes
+const uint32_t CHECKPOINT_VERSION = 2;
+const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'H', 'E', 'C', 'K', '\0'};
+
+CheckpointHeader checkpoint_header(const Config &cfg, CheckpointKind kind, bool aovs)
+{
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.kind = static_cast<uint32_t>(kind);
+    header.real_size = sizeof(real);
+    header.aovs = aovs ? 1 : 0;
+    header.width = cfg.image_width;
+    header.height = cfg.image_height;
+    header.samples_per_pixel = cfg.samples_per_pixel;
+    header.sampler = static_cast<int32_t>(cfg.sampler);
+    header.seed = cfg.seed;
+    header.recursion_limit = cfg.recursion_limit;
+    header.light_sampling = cfg.light_sampling ? 1 : 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        header.camera_position[i] = cfg.camera_position[i];
+        header.camera_lookat[i] = cfg.camera_lookat[i];
+        header.camera_up[i] = cfg.camera_up[i];
+    }
+    header.camera_fov = cfg.camera_fov;
+    header.camera_defocus_angle = cfg.camera_defocus_angle;
+    header.camera_focal_length = cfg.camera_focal_length;
+    header.scene_size = cfg.scene_size;
+    header.scene_mtime = cfg.scene_mtime;
+    // Settings which only change the image of one kind of render
+    if (kind == CheckpointKind::Tiles)
+    {
+        header.tile_size = cfg.tile_size;
+        // The progressive renderer always traces depth first
+        header.integrator = static_cast<int32_t>(cfg.integrator);
+    }
+    else
+    {
+        header.pass_samples = cfg.pass_samples;
+        header.min_samples = cfg.min_samples;
+        header.noise_threshold = cfg.noise_threshold;
+    }
+    return header;
+}
+
+bool checkpoint_exists(const std::string &filename)
+{
+    return static_cast<bool>(std::ifstream(filename, std::ios::binary));
+}
+
+CheckpointWriter::CheckpointWriter(const std::string &filename, const CheckpointHeader &header)
+    : filename(filename), temp_filename(filename + ".tmp"),
+      file(temp_filename, std::ios::binary | std::ios::trunc)
+{
+    write(&header, 1);
+}
+
+bool CheckpointWriter::commit()
+{
+    file.close();
+    if (!file)
+        return false;
+    std::remove(filename.c_str());
+    return std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+CheckpointReader::CheckpointReader(const std::string &filename, const CheckpointHeader &expected)
+    : file(filename, std::ios::binary)
+{
+    if (!file)
+        throw std::runtime_error("Could not open checkpoint " + filename);
+    read(&header_, 1);
+    if (memcmp(header_.magic, CHECKPOINT_MAGIC, sizeof(header_.magic)) != 0 ||
+        header_.version != CHECKPOINT_VERSION)
+        throw std::runtime_error(filename + " is not a checkpoint of this version");
+    // Everything except the progress must match
+    CheckpointHeader settings = header_;
+    settings.passes = expected.passes;
+    settings.elapsed = expected.elapsed;
+    if (memcmp(&settings, &expected, sizeof(settings)) != 0)
+        throw std::runtime_error("Checkpoint " + filename +
+                                 " was made by a render with different settings");
+}
+
+/// @brief Calls fn(pointer, count) for every row of the tile in every float buffer, and
+/// count_fn(pointer, count) for every row of the sample counts, in the order of the checkpoint file
+template <typename ImageType, typename AOVType, typename Function, typename CountFunction>
+static void for_tile_rows(ImageType &img, AOVType *aovs, const Tile &tile, Function fn,
+                          CountFunction count_fn)
+{
+    size_t width = tile.width;
+    for (int r = tile.row; r < tile.row + tile.height; ++r)
+        fn(img.row(r) + tile.col * CHANNELS, width * CHANNELS);
+    if (!aovs)
+        return;
+    for (int r = tile.row; r < tile.row + tile.height; ++r)
+        fn(aovs->albedo.row(r) + tile.col * CHANNELS, width * CHANNELS);
+    for (int r = tile.row; r < tile.row + tile.height; ++r)
+        fn(aovs->normal.row(r) + tile.col * CHANNELS, width * CHANNELS);
+    size_t row_pixels = aovs->width();
+    for (int r = tile.row; r < tile.row + tile.height; ++r)
+        fn(aovs->depth.data() + r * row_pixels + tile.col, width);
+    for (int r = tile.row; r < tile.row + tile.height; ++r)
+        count_fn(aovs->sample_count.data() + r * row_pixels + tile.col, width);
+}
+
+TileCheckpoint::TileCheckpoint(const Config &cfg, const TileScheduler &scheduler, bool aovs)
+    : filename(cfg.checkpoint_filename),
+      header(checkpoint_header(cfg, CheckpointKind::Tiles, aovs)), scheduler(scheduler),
+      finished(new std::atomic<bool>[scheduler.tile_count()]),
+      restored_tiles(scheduler.tile_count(), 0)
+{
+    for (int i = 0; i < scheduler.tile_count(); ++i)
+    {
+        finished[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+int TileCheckpoint::restore(Framebuffer &img, AOVBuffers *aovs)
+{
+    if (!checkpoint_exists(filename))
+        return 0;
+    CheckpointReader reader(filename, header);
+    std::vector<uint8_t> saved(scheduler.tile_count());
+    reader.read(saved.data(), saved.size());
+    int count = 0;
+    for (int i = 0; i < scheduler.tile_count(); ++i)
+    {
+        if (!saved[i])
+            continue;
+        for_tile_rows(img, aovs, scheduler.tile_at(i),
+                      [&reader](float *p, size_t n) { reader.read(p, n); },
+                      [&reader](uint32_t *p, size_t n) { reader.read(p, n); });
+        restored_tiles[i] = 1;
+        finished[i].store(true, std::memory_order_relaxed);
+        count++;
+    }
+    return count;
+}
+
+bool TileCheckpoint::save(const Framebuffer &img, const AOVBuffers *aovs) const
+{
+    // Only the tiles finished now are saved, even if more finish while writing
+    std::vector<uint8_t> saved(scheduler.tile_count());
+    for (int i = 0; i < scheduler.tile_count(); ++i)
+    {
+        saved[i] = finished[i].load(std::memory_order_acquire) ? 1 : 0;
+    }
+    CheckpointWriter writer(filename, header);
+    writer.write(saved.data(), saved.size());
+    for (int i = 0; i < scheduler.tile_count(); ++i)
+    {
+        if (!saved[i])
+            continue;
+        for_tile_rows(img, aovs, scheduler.tile_at(i),
+                      [&writer](const float *p, size_t n) { writer.write(p, n); },
+                      [&writer](const uint32_t *p, size_t n) { writer.write(p, n); });
+    }
+    return writer.commit();
+}
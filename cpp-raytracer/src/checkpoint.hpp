@@ -0,0 +1,146 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Checkpoints of long renders. The state of a render is written to checkpoint_filename every
+// checkpoint_interval seconds, and a render with resume set continues from that file instead of
+// starting again. The samples of a pixel depend only on the seed, the position of the pixel and the
+// index of the sample, so the state of the random numbers is the number of samples taken, and the
+// resumed render produces exactly the same image as an uninterrupted one.
+#pragma once
+#include "aov.hpp"
+#include "config.h"
+#include "image.hpp"
+#include "tiles.hpp"
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum class CheckpointKind : uint32_t
+{
+    // Finished tiles of multi_threaded_render
+    Tiles = 1,
+    // Statistics of every pixel of the progressive renderer, saved between passes
+    Progressive = 2
+};
+
+// Header of a checkpoint file. The settings which change the image, and the size and modification
+// time of the scene file, are stored so that a checkpoint is never resumed by a render which would
+// produce a different image.
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    // sizeof(real), the progressive renderer saves its sums as they are
+    uint32_t real_size;
+    // 1 if the auxiliary buffers are saved as well
+    uint32_t aovs;
+    int32_t width;
+    int32_t height;
+    int32_t samples_per_pixel;
+    int32_t tile_size;
+    int32_t sampler;
+    int32_t pass_samples;
+    int32_t min_samples;
+    int32_t passes;
+    int32_t recursion_limit;
+    int32_t light_sampling;
+    int32_t integrator;
+    int32_t padding;
+    uint64_t seed;
+    double noise_threshold;
+    double camera_position[3];
+    double camera_lookat[3];
+    double camera_up[3];
+    double camera_fov;
+    double camera_defocus_angle;
+    double camera_focal_length;
+    // Size and modification time of the scene file
+    uint64_t scene_size;
+    int64_t scene_mtime;
+    // Seconds spent rendering before the checkpoint, counted against the time budget
+    double elapsed;
+};
+
+/// @return Header for the checkpoints of a render with these settings
+CheckpointHeader checkpoint_header(const Config &cfg, CheckpointKind kind, bool aovs);
+
+/// @return true if the checkpoint file exists
+bool checkpoint_exists(const std::string &filename);
+
+// Writes a checkpoint into a temporary file, which replaces the checkpoint once it is complete, so
+// that a render interrupted while writing still has the previous checkpoint
+class CheckpointWriter
+{
+  private:
+    std::string filename;
+    std::string temp_filename;
+    std::ofstream file;
+
+  public:
+    CheckpointWriter(const std::string &filename, const CheckpointHeader &header);
+
+    template <typename T> void write(const T *values, size_t count)
+    {
+        file.write(reinterpret_cast<const char *>(values), count * sizeof(T));
+    }
+
+    /// @brief Replaces the checkpoint with the temporary file
+    /// @return true if the whole checkpoint was written
+    bool commit();
+};
+
+class CheckpointReader
+{
+  private:
+    std::ifstream file;
+    CheckpointHeader header_;
+
+  public:
+    /// @brief Opens a checkpoint and checks that it was made by a render with the same settings
+    /// @throw std::runtime_error if the file cannot be read or was made with other settings
+    CheckpointReader(const std::string &filename, const CheckpointHeader &expected);
+
+    const CheckpointHeader &header() const { return header_; }
+
+    template <typename T> void read(T *values, size_t count)
+    {
+        file.read(reinterpret_cast<char *>(values), count * sizeof(T));
+        if (!file)
+            throw std::runtime_error("Checkpoint file is truncated");
+    }
+};
+
+// Checkpoints of multi_threaded_render. The render threads mark tiles as finished while another
+// thread saves the finished tiles, a resumed render only renders the tiles which are not in the
+// checkpoint.
+class TileCheckpoint
+{
+  private:
+    std::string filename;
+    CheckpointHeader header;
+    const TileScheduler &scheduler;
+    std::unique_ptr<std::atomic<bool>[]> finished;
+    std::vector<uint8_t> restored_tiles;
+
+  public:
+    TileCheckpoint(const Config &cfg, const TileScheduler &scheduler, bool aovs);
+
+    /// @brief Copies the tiles saved in the checkpoint file into the image (and aovs)
+    /// @return Number of tiles restored, 0 if there is no checkpoint file
+    /// @throw std::runtime_error if the checkpoint was made with other settings
+    int restore(Framebuffer &img, AOVBuffers *aovs);
+
+    /// @return true if the tile was restored from the checkpoint, and does not have to be rendered
+    bool restored(int tile) const { return restored_tiles[tile] != 0; }
+
+    /// @brief Marks a tile as finished, its pixels must not change after this
+    void finish(int tile) { finished[tile].store(true, std::memory_order_release); }
+
+    /// @brief Saves the finished tiles, may be called while other tiles are being rendered
+    /// @return true if the checkpoint was written
+    bool save(const Framebuffer &img, const AOVBuffers *aovs) const;
+};
@@ -14,7 +14,7 @@ using color = vec3;
 /// @return Color as represented in floating point notation
 static color color_from_rgb(int r, int g, int b)
 {
-    return color((double)r / 255, (double)g / 255, (double)b / 255);
+    return color((real)r / 255, (real)g / 255, (real)b / 255);
 }
 
 /// @brief Perform linear interpolation.
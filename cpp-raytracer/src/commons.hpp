@@ -3,21 +3,38 @@
 #pragma once
 #include "linalg.h"
 #include <limits>
-#include <random>
 #include <stdlib.h>
+
+// Scalar type used for the geometry, the colors and the shading. It is double unless the code is
+// compiled with RAYTRACER_FLOAT defined, float halves the size of vectors and hit records and
+// doubles the number of SIMD lanes.
+#ifdef RAYTRACER_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 constexpr double PI = 3.141592653589793238463;
-constexpr double ZERO_EPSILON = 1e-6;
-constexpr double EPSILON = 1e-6;
+constexpr real ZERO_EPSILON = real(1e-6);
+constexpr real EPSILON = real(1e-6);
+// Secondary rays start this far from the surface they leave, so that they do not hit it again
+// because of rounding errors (shadow acne). float rounds much earlier, so it needs a larger offset.
+#ifdef RAYTRACER_FLOAT
+constexpr real SELF_INTERSECTION_EPSILON = 1e-2f;
+#else
+constexpr real SELF_INTERSECTION_EPSILON = 1e-3;
+#endif
 
 /// @brief Performs linear interpolation
 /// @param s starting value
 /// @param e ending value
 /// @param t parameter
 /// @return an interpolated value between start and end
-inline double lerp(double s, double e, double t) { return (1 - t) * s + t * e; }
+inline real lerp(real s, real e, real t) { return (1 - t) * s + t * e; }
 
-using vec3 = linalg::vec<double, 3>;
-const double INF = std::numeric_limits<double>::infinity();
+using vec3 = linalg::vec<real, 3>;
+using vec2 = linalg::vec<real, 2>;
+const real INF = std::numeric_limits<real>::infinity();
 
 // A class for managing a single ray in a raytracer
 class Ray
@@ -53,7 +70,7 @@ class Ray
 
     /// @param t Parameter A = p + dt, to find a point on the ray at a distance t
     /// @return Returns a point on this ray at a distance t from the origin of the ray
-    vec3 at(double t) const { return rorigin + (t * rdirection); }
+    vec3 at(real t) const { return rorigin + (t * rdirection); }
 };
 
 // A struct which stores some parameters for a ray intersecting with an object
@@ -62,7 +79,7 @@ struct Intersection
     // Point of intersection with ray.
     // If there are multiple points of intersection, the one with the least
     // distance from the origin of the ray is stored
-    double parametric;
+    real parametric;
     // Point in cartesian system
     vec3 point;
     // The ray for which these values are calculated
@@ -78,6 +95,16 @@ struct Intersection
     int material_id;
     // true if the ray is outside the surface
     bool front;
+    // true for spheres, their texture coordinates are computed from o_normal when a texture needs
+    // them (see texture_coordinates in texture.hpp), since most spheres have no texture
+    bool spherical_uv;
+    // Texture coordinates of the point, (0, 0) is the bottom left corner of the image
+    real u, v;
+    // Distance on the surface which corresponds to a distance of 1 in texture coordinates, roughly
+    real uv_scale;
+    // Width of the cone of rays around the ray at the point, the integrator sets it from the
+    // spread of the pixel and the surfaces which were hit before (see ray cones in scene.hpp)
+    real cone_width;
 };
 
 // parameters for the intersect function, ray, t_min, t_max
@@ -86,68 +113,27 @@ struct RayParams
     // The ray for which intersection has to be calculated
     Ray ray;
     // Minimum value of t which is valid
-    double t_min;
+    real t_min;
     // Maximum value of t which is valid
-    double t_max;
+    real t_max;
 };
 
-/// @return A uniformly generated random number between 0 and 1
-inline double uniform()
-{
-    static std::random_device device;
-    static std::mt19937 gen(device());
-    static std::uniform_real_distribution<double> distribution(0, 1);
-
-    return distribution(gen);
-}
-
-/// @return A uniformly generated random number between -1 and 1
-inline double uniform_minus_one_to_one()
-{
-    static std::random_device device;
-    static std::mt19937 gen(device());
-    static std::uniform_real_distribution<double> distribution(-1, 1);
-
-    return distribution(gen);
-}
-
-/// @return A uniformly generated random real number between min and max
-inline double uniform(double min, double max)
-{
-    static std::uniform_real_distribution<double> distribution(min, max);
-    static std::mt19937 generator;
-    return distribution(generator);
-}
-
-/// @return A uniformly generated integer between min and max
-inline int randint(int min, int max)
+// Where a ray hits an object, found without computing anything about the surface. Candidates are
+// only tested for a hit closer than the best so far, and the Intersection is built from the record
+// once, for the closest hit (see surface() of the objects).
+struct ObjectHit
 {
-    static std::uniform_int_distribution<int> distribution(min, max);
-    static std::mt19937 generator;
-    return distribution(generator);
-}
-
-/// @return A random unit vector inside a sphere
-inline vec3 random_in_unit_sphere()
-{
-    while (1)
-    {
-        vec3 v(uniform_minus_one_to_one(), uniform_minus_one_to_one(), uniform_minus_one_to_one());
-        if (linalg::length2(v) < 1)
-            return linalg::normalize(v);
-    }
-}
-
-/// @return A random vector inside a disk(circlular plate)
-inline vec3 random_in_unit_disk()
-{
-    while (1)
-    {
-        vec3 v(uniform_minus_one_to_one(), uniform_minus_one_to_one(), 0);
-        if (linalg::length2(v) < 1)
-            return v;
-    }
-}
+    // Distance along the ray
+    real t;
+    // Slot of the object which was hit, -1 if nothing was hit
+    int slot;
+    // Instances: distance in the space of the group, and the slot of the object in the group
+    real group_t;
+    int group_slot;
+    // Meshes: the triangle which was hit, and the barycentric coordinates of the point
+    int triangle;
+    real u, v;
+};
 
 /// @param v Vector to be checked
 /// @return true if the vector is a zero vector
@@ -169,11 +155,12 @@ inline vec3 reflect(const vec3 v, const vec3 n) { return v - 2 * linalg::dot(v,
 /// @param normal Vector representing normal at the surface
 /// @param rel_i Relative refractive index of the surface with its surroundings
 /// @return The refracted ray
-inline vec3 refract(const vec3 incident, const vec3 normal, double rel_i)
+inline vec3 refract(const vec3 incident, const vec3 normal, real rel_i)
 {
-    auto cos_theta = std::min(linalg::dot(-incident, normal), 1.0);
+    auto cos_theta = std::min(linalg::dot(-incident, normal), real(1));
     vec3 refracted_perpendicular = rel_i * (incident + cos_theta * normal);
-    vec3 refracted_parallel = -sqrt(fabs(1.0 - linalg::length2(refracted_perpendicular))) * normal;
+    vec3 refracted_parallel =
+        -std::sqrt(std::fabs(1 - linalg::length2(refracted_perpendicular))) * normal;
     return refracted_perpendicular + refracted_parallel;
 }
 
@@ -183,7 +170,7 @@ inline vec3 refract(const vec3 incident, const vec3 normal, double rel_i)
 /// phenomenon.
 /// For more information
 /// https://raytracing.github.io/books/RayTracingInOneWeekend.html#dielectrics/schlickapproximation
-inline double schlick(double cosine, double ref_idx)
+inline real schlick(real cosine, real ref_idx)
 {
     auto r0 = (1 - ref_idx) / (1 + ref_idx);
     r0 = r0 * r0;
@@ -191,10 +178,11 @@ inline double schlick(double cosine, double ref_idx)
 }
 
 /// @brief  Checks if the surface will reflect or refract
+/// @param u A uniformly generated random number between 0 and 1
 /// @return true if this results in reflection instead of refraction
-inline bool schlick_reflects(double cosine, double refractive_index)
+inline bool schlick_reflects(real cosine, real refractive_index, double u)
 {
-    return schlick(cosine, refractive_index) > uniform();
+    return schlick(cosine, refractive_index) > u;
 }
 
 /// @brief Check equality between vectors
@@ -2,36 +2,125 @@
 // Some configuration options such as image width, height, samples per pixel, etc
 #pragma once
 #include "commons.hpp"
+#include "image.hpp"
+#include "sampler.hpp"
+#include "texture.hpp"
+#include <string>
 constexpr int DEFAULT_GAMMA = 2;
 constexpr int DEFAULT_IMAGE_WIDTH = 400;
 constexpr int DEFAULT_IMAGE_HEIGHT = DEFAULT_IMAGE_WIDTH * (9.0 / 16.0);
 constexpr int DEFAULT_PROGRESSBAR_WIDTH = 40;
 constexpr int DEFAULT_SAMPLES_PER_PIXEL = 100; // NOTE: MUST BE NON-ZERO AND POSITIVE
 constexpr int DEFAULT_RECURSION_LIMIT = 50;
+constexpr int DEFAULT_TILE_SIZE = 32;
+constexpr SamplerType DEFAULT_SAMPLER = SamplerType::Stratified;
+constexpr uint64_t DEFAULT_SEED = 0;
+constexpr int DEFAULT_PASS_SAMPLES = 8;
+constexpr int DEFAULT_MIN_SAMPLES = 16;
+constexpr double DEFAULT_NOISE_THRESHOLD = 0.01;
 constexpr double DEFAULT_CAMERA_FOV = radians(20);
 constexpr vec3 DEFAULT_CAMERA_POSITION = vec3(13, 2, 3);
 constexpr vec3 DEFAULT_CAMERA_LOOKAT = vec3(0, 0, 0);
 constexpr vec3 DEFAULT_CAMERA_UP = vec3(0, 1, 0);
 constexpr double DEFAULT_CAMERA_DEFOCUS_ANGLE = radians(0.6);
 constexpr double DEFAULT_CAMERA_FOCAL_LENGTH = 10.0;
+constexpr int DEFAULT_WAVEFRONT_BATCH = 1 << 12;
+constexpr double DEFAULT_CHECKPOINT_INTERVAL = 60;
 constexpr char *DEFAULT_FILENAME = "output2.png";
 
+// How the paths of a pixel are traced
+enum class Integrator
+{
+    // Every path is followed from the camera until it ends before the next one is started
+    DepthFirst,
+    // Many paths are advanced one bounce at a time, and shaded grouped by material (see
+    // wavefront.hpp). The image is the same as with DepthFirst.
+    Wavefront
+};
+
 // Configuration settings for this render
 struct Config
 {
   public:
     // Some default settings
     int gamma = DEFAULT_GAMMA;
+    // How colors brighter than white are displayed in 8 bit images
+    ToneMap tonemap = ToneMap::Clamp;
     int image_width = DEFAULT_IMAGE_WIDTH;
     int image_height = DEFAULT_IMAGE_HEIGHT;
     int progressbar_width = DEFAULT_PROGRESSBAR_WIDTH;
+    // Print the progress and other information while rendering
+    bool show_progress = true;
     int samples_per_pixel = DEFAULT_SAMPLES_PER_PIXEL; // NOTE: MUST BE NON-ZERO AND POSITIVE
     int recursion_limit = DEFAULT_RECURSION_LIMIT;
+    // Cast shadow rays towards the emissive spheres from every diffuse surface (next event
+    // estimation), combined with the paths which hit them by multiple importance sampling
+    bool light_sampling = true;
+    // The progressive renderer always traces depth first
+    Integrator integrator = Integrator::DepthFirst;
+    // Number of paths traced together by the wavefront integrator
+    int wavefront_batch = DEFAULT_WAVEFRONT_BATCH;
+    // Width and height of the tiles handed out to the render threads
+    int tile_size = DEFAULT_TILE_SIZE;
+    // Number of render threads, 0 uses every processor which the process may run on. The
+    // --threads option overrides it.
+    int threads = 0;
+    // Pin every render thread to a processor, filling one NUMA node after the other (see
+    // affinity.hpp)
+    bool pin_threads = false;
+    // How the samples in a pixel are placed
+    SamplerType sampler = DEFAULT_SAMPLER;
+    // Seed for the random numbers, the same seed produces the same image
+    uint64_t seed = DEFAULT_SEED;
+    // Progressive rendering: the image is rendered in passes, and pixels stop receiving samples
+    // once they are no longer noisy. samples_per_pixel is then the maximum number of samples.
+    bool progressive = false;
+    // Samples added to every pixel which has not converged in each pass
+    int pass_samples = DEFAULT_PASS_SAMPLES;
+    // Samples taken in every pixel before checking if it has converged
+    int min_samples = DEFAULT_MIN_SAMPLES;
+    // A pixel has converged when the 95% confidence interval of its brightness is within this
+    // fraction of the brightness
+    double noise_threshold = DEFAULT_NOISE_THRESHOLD;
+    // Stop after these many seconds (0 - no limit)
+    double time_budget = 0;
+    // Write the image rendered so far to snapshot_filename every these many seconds (0 - never)
+    double snapshot_interval = 0;
+    std::string snapshot_filename = "snapshot.png";
+    // Save the state of the render to this file every checkpoint_interval seconds, so that an
+    // interrupted render can be resumed (empty - no checkpoints)
+    std::string checkpoint_filename;
+    double checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    // Continue the render saved in checkpoint_filename, if the file exists
+    bool resume = false;
     double camera_fov = DEFAULT_CAMERA_FOV;
     vec3 camera_position = DEFAULT_CAMERA_POSITION;
     vec3 camera_lookat = DEFAULT_CAMERA_LOOKAT;
     vec3 camera_up = DEFAULT_CAMERA_UP;
     double camera_defocus_angle = DEFAULT_CAMERA_DEFOCUS_ANGLE;
     double camera_focal_length = DEFAULT_CAMERA_FOCAL_LENGTH;
+    // The image is written as a float .pfm file if the name ends with .pfm, otherwise as png
     std::string filename = DEFAULT_FILENAME;
+    // If not empty, the float image is also written to this .pfm file
+    std::string hdr_filename;
+    // Remove the noise from the image with the auxiliary buffers (albedo, normal, depth) before
+    // writing it
+    bool denoise = false;
+    // If not empty, the auxiliary buffers are written to <aov_filename>_albedo.pfm and so on
+    std::string aov_filename;
+    // If not empty, the cost of every pixel is written to <profile_filename>_time.png and so on,
+    // with a summary in <profile_filename>.json (only in builds with RAYTRACER_PROFILE)
+    std::string profile_filename;
+    // Memory (in MB) which the tiles of the image textures may use
+    int texture_cache_size = static_cast<int>(DEFAULT_TEXTURE_CACHE_SIZE >> 20);
+    // Number of frames of the animation (see animation.hpp), 0 renders a single image
+    int animation_frames = 0;
+    // Names of the frames, %d (or %04d and so on) is replaced by the number of the frame
+    std::string animation_filename = "frame_%04d.png";
+    // Angle (in radians) by which the camera turns around camera_lookat over the animation
+    double camera_orbit = 0;
+    // Size and modification time of the scene file, set by load_scene, so that a checkpoint is
+    // not resumed after the scene has changed (0 for the sample scene)
+    uint64_t scene_size = 0;
+    int64_t scene_mtime = 0;
 };
@@ -0,0 +1,206 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "denoise.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Albedos are clamped to this before the lighting is separated from them, so that black surfaces
+// do not divide by zero
+const float MIN_ALBEDO = 0.01f;
+
+// Weights of the taps of the B3 spline kernel used by every pass
+const float KERNEL[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+/// @brief Squared distance between two RGB pixels
+static inline float distance2(const float *a, const float *b)
+{
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+/// @brief Maps every channel from [0, inf) to [0, 1), so that bright pixels do not dominate the
+/// color differences
+static inline void compress(const float *in, float *out)
+{
+    for (int k = 0; k < CHANNELS; ++k)
+    {
+        out[k] = in[k] / (1.0f + in[k]);
+    }
+}
+
+/// @brief One pass of the filter over the rows [first_row, last_row)
+/// @param step Spacing between the taps, in pixels
+/// @param color_sigma Sigma of the color differences for this pass
+static void filter_rows(const Framebuffer &in, const AOVBuffers &aovs,
+                        const DenoiseSettings &settings, int step, float color_sigma,
+                        int first_row, int last_row, Framebuffer &out)
+{
+    const int width = in.width();
+    const int height = in.height();
+    const float inv_color = 1.0f / (color_sigma * color_sigma);
+    const float inv_normal = 1.0f / (settings.normal_sigma * settings.normal_sigma);
+    const float inv_albedo = 1.0f / (settings.albedo_sigma * settings.albedo_sigma);
+    for (int r = first_row; r < last_row; ++r)
+    {
+        float *out_row = out.row(r);
+        for (int c = 0; c < width; ++c)
+        {
+            const float *p = in.row(r) + c * CHANNELS;
+            const float *p_normal = aovs.normal.row(r) + c * CHANNELS;
+            const float *p_albedo = aovs.albedo.row(r) + c * CHANNELS;
+            const float p_depth = aovs.depth[static_cast<size_t>(r) * width + c];
+            // Depths are compared relative to the depth of the pixel, neighbours further away
+            // are allowed proportionally larger differences
+            const float inv_depth = 1.0f / (settings.depth_sigma * step * p_depth + 1e-4f);
+            float p_compressed[CHANNELS];
+            compress(p, p_compressed);
+
+            float sum[CHANNELS] = {0, 0, 0};
+            float weight_sum = 0;
+            for (int dy = -2; dy <= 2; ++dy)
+            {
+                int qr = r + dy * step;
+                if (qr < 0 || qr >= height)
+                    continue;
+                for (int dx = -2; dx <= 2; ++dx)
+                {
+                    int qc = c + dx * step;
+                    if (qc < 0 || qc >= width)
+                        continue;
+                    const float *q = in.row(qr) + qc * CHANNELS;
+                    float q_compressed[CHANNELS];
+                    compress(q, q_compressed);
+                    float q_depth = aovs.depth[static_cast<size_t>(qr) * width + qc];
+                    float exponent =
+                        distance2(p_compressed, q_compressed) * inv_color +
+                        distance2(p_normal, aovs.normal.row(qr) + qc * CHANNELS) * inv_normal +
+                        distance2(p_albedo, aovs.albedo.row(qr) + qc * CHANNELS) * inv_albedo +
+                        std::fabs(p_depth - q_depth) * inv_depth;
+                    float weight = KERNEL[dx + 2] * KERNEL[dy + 2] * std::exp(-exponent);
+                    for (int k = 0; k < CHANNELS; ++k)
+                    {
+                        sum[k] += weight * q[k];
+                    }
+                    weight_sum += weight;
+                }
+            }
+            // The center tap always has a weight of at least KERNEL[2]^2
+            for (int k = 0; k < CHANNELS; ++k)
+            {
+                out_row[c * CHANNELS + k] = sum[k] / weight_sum;
+            }
+        }
+    }
+}
+
+/// @brief Clamps every channel of the pixels of the rows [first_row, last_row) to the largest value
+/// of the 8 neighbours. This removes isolated very bright pixels (fireflies), which the edge
+/// avoiding filter would otherwise keep as features, but not edges or lights which cover several
+/// pixels.
+static void remove_outliers(const Framebuffer &in, int first_row, int last_row, Framebuffer &out)
+{
+    const int width = in.width();
+    const int height = in.height();
+    for (int r = first_row; r < last_row; ++r)
+    {
+        for (int c = 0; c < width; ++c)
+        {
+            float limit[CHANNELS] = {0, 0, 0};
+            for (int qr = std::max(r - 1, 0); qr <= std::min(r + 1, height - 1); ++qr)
+            {
+                for (int qc = std::max(c - 1, 0); qc <= std::min(c + 1, width - 1); ++qc)
+                {
+                    if (qr == r && qc == c)
+                        continue;
+                    const float *q = in.row(qr) + qc * CHANNELS;
+                    for (int k = 0; k < CHANNELS; ++k)
+                    {
+                        limit[k] = std::max(limit[k], q[k]);
+                    }
+                }
+            }
+            const float *p = in.row(r) + c * CHANNELS;
+            float *o = out.row(r) + c * CHANNELS;
+            for (int k = 0; k < CHANNELS; ++k)
+            {
+                o[k] = std::min(p[k], limit[k]);
+            }
+        }
+    }
+}
+
+/// @brief Calls fn(first_row, last_row) for blocks of rows on several threads
+static void for_rows(int height, int number_of_threads, const std::function<void(int, int)> &fn)
+{
+    number_of_threads = std::max(1, std::min(number_of_threads, height));
+    int rows_per_thread = (height + number_of_threads - 1) / number_of_threads;
+    std::vector<std::thread> threads;
+    for (int first = rows_per_thread; first < height; first += rows_per_thread)
+    {
+        threads.emplace_back(fn, first, std::min(first + rows_per_thread, height));
+    }
+    // The calling thread filters the first block
+    fn(0, std::min(rows_per_thread, height));
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+Framebuffer denoise(const Framebuffer &image, const AOVBuffers &aovs, int number_of_threads,
+                    const DenoiseSettings &settings)
+{
+    const int width = image.width();
+    const int height = image.height();
+    if (aovs.width() != width || aovs.height() != height)
+        return image;
+
+    // Filter the lighting (the color divided by the albedo) instead of the color, so that the
+    // texture of the surfaces is kept
+    Framebuffer current(width, height);
+    for_rows(height, number_of_threads, [&](int first, int last) {
+        for (int r = first; r < last; ++r)
+        {
+            const float *in = image.row(r);
+            const float *albedo = aovs.albedo.row(r);
+            float *out = current.row(r);
+            for (int i = 0; i < width * CHANNELS; ++i)
+            {
+                out[i] = in[i] / std::max(albedo[i], MIN_ALBEDO);
+            }
+        }
+    });
+
+    Framebuffer next(width, height);
+    if (settings.remove_outliers)
+    {
+        for_rows(height, number_of_threads,
+                 [&](int first, int last) { remove_outliers(current, first, last, next); });
+        std::swap(current, next);
+    }
+    float color_sigma = settings.color_sigma;
+    for (int pass = 0; pass < settings.iterations; ++pass)
+    {
+        int step = 1 << pass;
+        for_rows(height, number_of_threads, [&](int first, int last) {
+            filter_rows(current, aovs, settings, step, color_sigma, first, last, next);
+        });
+        std::swap(current, next);
+        color_sigma *= 0.5f;
+    }
+
+    for_rows(height, number_of_threads, [&](int first, int last) {
+        for (int r = first; r < last; ++r)
+        {
+            const float *albedo = aovs.albedo.row(r);
+            float *out = current.row(r);
+            for (int i = 0; i < width * CHANNELS; ++i)
+            {
+                out[i] *= std::max(albedo[i], MIN_ALBEDO);
+            }
+        }
+    });
+    return current;
+}
@@ -0,0 +1,35 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Removes the noise of images rendered with few samples per pixel, using the auxiliary buffers to
+// keep the edges sharp
+#pragma once
+#include "aov.hpp"
+#include "image.hpp"
+
+// Parameters of the edge avoiding filter, larger sigmas smooth more across differences in the
+// corresponding buffer
+struct DenoiseSettings
+{
+    // Number of passes, every pass doubles the spacing of the filter taps (1, 2, ...,
+    // 2^(iterations - 1)), so the filter covers 4 * (2^iterations - 1) + 1 pixels
+    int iterations = 5;
+    // Color differences are compared after mapping the colors to [0, 1) with x / (1 + x). This is
+    // halved after every pass, so that the later, wider passes do not blur details.
+    float color_sigma = 0.3f;
+    float normal_sigma = 0.3f;
+    float albedo_sigma = 0.1f;
+    // Relative to the depth of the pixel and the spacing of the taps
+    float depth_sigma = 0.02f;
+    // Clamp single pixels which are brighter than all their neighbours before filtering (this
+    // darkens the image slightly, but the filter would spread them into blotches)
+    bool remove_outliers = true;
+};
+
+/// @brief Denoises the image with an edge avoiding à-trous wavelet filter (Dammertz et al.,
+/// "Edge-Avoiding À-Trous Wavelet Transform for fast Global Illumination Filtering"). The lighting
+/// is separated from the texture by dividing by the albedo before filtering, so that textures are
+/// not blurred. The rows are split between the threads.
+/// @param image The noisy image
+/// @param aovs Auxiliary buffers of the image, of the same size
+/// @return The denoised image
+Framebuffer denoise(const Framebuffer &image, const AOVBuffers &aovs, int number_of_threads,
+                    const DenoiseSettings &settings = DenoiseSettings());
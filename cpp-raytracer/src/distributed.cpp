@@ -0,0 +1,689 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "distributed.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+
+Framebuffer coordinate_render(const Config &, const std::string &, const std::string &,
+                              AOVBuffers *, const CoordinatorOptions &)
+{
+    throw std::runtime_error("Distributed rendering is not supported on Windows");
+}
+
+void run_worker(const std::string &, int, bool)
+{
+    throw std::runtime_error("Distributed rendering is not supported on Windows");
+}
+
+#else
+
+#include "affinity.hpp"
+#include "network.hpp"
+#include "progressbar.hpp"
+#include "raytracer.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "tiles.hpp"
+#include "wavefront.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <stdint.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using network_clock = std::chrono::steady_clock;
+
+// Workers started before the coordinator keep on trying to connect for this long
+const double CONNECT_RETRY_SECONDS = 10;
+// How often the coordinator checks for dead and slow workers when no messages arrive
+const int POLL_INTERVAL_MS = 100;
+
+enum MessageType : uint32_t
+{
+    // Coordinator to worker: scene file (empty for the sample scene), width, height, samples per
+    // pixel, seed and whether the auxiliary buffers are rendered
+    MESSAGE_JOB,
+    // Worker to coordinator: the scene is loaded, followed by the number of render threads
+    MESSAGE_READY,
+    // Coordinator to worker: index of a tile, followed by its row, column, height and width
+    MESSAGE_TILE,
+    // Worker to coordinator: index of a tile, followed by its pixels row by row, and then the
+    // albedo, normal, depth and sample count of its pixels if the job asked for them
+    MESSAGE_RESULT,
+    // Coordinator to worker: the image is finished
+    MESSAGE_DONE,
+    // Worker to coordinator: the job failed, followed by the reason
+    MESSAGE_ERROR,
+};
+
+static double seconds_since(network_clock::time_point start)
+{
+    return std::chrono::duration<double>(network_clock::now() - start).count();
+}
+
+// ---------------------------------------------------------------------------------------------
+// Coordinator
+
+// A worker connected to the coordinator
+struct RemoteWorker
+{
+    std::unique_ptr<Connection> connection;
+    // Zero until the worker has loaded the scene
+    int threads = 0;
+    // Tiles handed to the worker which it has not yet sent back
+    std::vector<int> tiles;
+    // When the worker last sent something, or was handed tiles while it had none
+    network_clock::time_point last_heard;
+    bool alive = true;
+};
+
+struct TileProgress
+{
+    bool done = false;
+    // Number of workers rendering the tile
+    int copies = 0;
+    // When the tile was first handed out
+    network_clock::time_point started;
+};
+
+class Coordinator
+{
+  private:
+    const Config &cfg;
+    const CoordinatorOptions &options;
+    AOVBuffers *aovs;
+    std::vector<char> job;
+    TileScheduler scheduler;
+    Framebuffer img;
+    std::vector<TileProgress> progress;
+    // Tiles which no worker is rendering, in the order in which they are handed out
+    std::deque<int> pending;
+    std::vector<std::unique_ptr<RemoteWorker>> workers;
+    int finished;
+    // Time from handing out a tile to receiving it, summed over the finished tiles
+    double tile_seconds;
+
+    void send(RemoteWorker &worker, uint32_t type, const std::vector<char> &payload)
+    {
+        try
+        {
+            worker.connection->send(type, payload);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Worker lost: " << e.what() << std::endl;
+            worker.alive = false;
+        }
+    }
+
+    void receive_result(RemoteWorker &worker, const std::vector<char> &payload)
+    {
+        MessageReader reader(payload);
+        int index = reader.read<int32_t>();
+        auto held = std::find(worker.tiles.begin(), worker.tiles.end(), index);
+        if (held == worker.tiles.end())
+            throw std::runtime_error("Result for a tile which was not handed out");
+
+        // The whole message is read before anything is changed, so that the tile is handed out
+        // again if the message is malformed
+        Tile tile = scheduler.tile_at(index);
+        size_t pixels = static_cast<size_t>(tile.width) * tile.height;
+        std::vector<float> colors(pixels * CHANNELS);
+        reader.read_array(colors.data(), colors.size());
+        std::vector<float> albedo, normal, depth;
+        std::vector<uint32_t> samples;
+        if (aovs)
+        {
+            albedo.resize(pixels * CHANNELS);
+            normal.resize(pixels * CHANNELS);
+            depth.resize(pixels);
+            samples.resize(pixels);
+            reader.read_array(albedo.data(), albedo.size());
+            reader.read_array(normal.data(), normal.size());
+            reader.read_array(depth.data(), depth.size());
+            reader.read_array(samples.data(), samples.size());
+        }
+        reader.finish();
+        worker.tiles.erase(held);
+        TileProgress &tile_progress = progress[index];
+        tile_progress.copies--;
+        if (tile_progress.done)
+            return;
+
+        for (int r = 0; r < tile.height; ++r)
+        {
+            size_t offset = static_cast<size_t>(r) * tile.width;
+            std::copy(colors.begin() + offset * CHANNELS,
+                      colors.begin() + (offset + tile.width) * CHANNELS,
+                      img.row(tile.row + r) + tile.col * CHANNELS);
+            if (aovs)
+            {
+                size_t pixel = static_cast<size_t>(tile.row + r) * img.width() + tile.col;
+                std::copy(albedo.begin() + offset * CHANNELS,
+                          albedo.begin() + (offset + tile.width) * CHANNELS,
+                          aovs->albedo.row(tile.row + r) + tile.col * CHANNELS);
+                std::copy(normal.begin() + offset * CHANNELS,
+                          normal.begin() + (offset + tile.width) * CHANNELS,
+                          aovs->normal.row(tile.row + r) + tile.col * CHANNELS);
+                std::copy(depth.begin() + offset, depth.begin() + offset + tile.width,
+                          aovs->depth.begin() + pixel);
+                std::copy(samples.begin() + offset, samples.begin() + offset + tile.width,
+                          aovs->sample_count.begin() + pixel);
+            }
+        }
+        tile_progress.done = true;
+        tile_seconds += seconds_since(tile_progress.started);
+        finished++;
+    }
+
+    void receive(RemoteWorker &worker, const Message &message)
+    {
+        switch (message.type)
+        {
+        case MESSAGE_READY:
+        {
+            MessageReader reader(message.payload);
+            worker.threads = std::max(reader.read<int32_t>(), 1);
+            reader.finish();
+            if (cfg.show_progress)
+                std::cout << "\nWorker ready with " << worker.threads << " threads" << std::endl;
+            break;
+        }
+        case MESSAGE_RESULT:
+            receive_result(worker, message.payload);
+            break;
+        case MESSAGE_ERROR:
+        {
+            MessageReader reader(message.payload);
+            std::cerr << "\nWorker failed: " << reader.read_string() << std::endl;
+            worker.alive = false;
+            break;
+        }
+        default:
+            throw std::runtime_error("Unexpected message from a worker");
+        }
+    }
+
+    /// @brief Hands the unfinished tiles of a dead worker to the other workers, before any other
+    /// tile
+    void drop_worker(RemoteWorker &worker)
+    {
+        for (auto it = worker.tiles.rbegin(); it != worker.tiles.rend(); ++it)
+        {
+            TileProgress &tile_progress = progress[*it];
+            tile_progress.copies--;
+            if (!tile_progress.done && tile_progress.copies == 0)
+                pending.push_front(*it);
+        }
+        worker.tiles.clear();
+    }
+
+    /// @return A tile which has been rendered by another worker for much longer than the average
+    /// tile, or -1 if there is none
+    int find_straggler(const RemoteWorker &worker) const
+    {
+        if (finished == 0)
+            return -1;
+        double threshold = options.straggler_factor * tile_seconds / finished;
+        int slowest = -1;
+        for (int i = 0; i < static_cast<int>(progress.size()); ++i)
+        {
+            const TileProgress &p = progress[i];
+            if (p.done || p.copies != 1 || seconds_since(p.started) <= threshold)
+                continue;
+            if (std::find(worker.tiles.begin(), worker.tiles.end(), i) != worker.tiles.end())
+                continue;
+            if (slowest < 0 || p.started < progress[slowest].started)
+                slowest = i;
+        }
+        return slowest;
+    }
+
+    void assign_tiles(RemoteWorker &worker)
+    {
+        size_t capacity = static_cast<size_t>(worker.threads) * options.tiles_per_thread;
+        while (worker.alive && worker.tiles.size() < capacity)
+        {
+            int index;
+            if (!pending.empty())
+            {
+                index = pending.front();
+                pending.pop_front();
+            }
+            else
+            {
+                index = find_straggler(worker);
+                if (index < 0)
+                    break;
+            }
+            TileProgress &tile_progress = progress[index];
+            if (tile_progress.copies == 0)
+                tile_progress.started = network_clock::now();
+            tile_progress.copies++;
+            if (worker.tiles.empty())
+                worker.last_heard = network_clock::now();
+            worker.tiles.push_back(index);
+
+            Tile tile = scheduler.tile_at(index);
+            MessageWriter message;
+            message.write(static_cast<int32_t>(index))
+                .write(static_cast<int32_t>(tile.row))
+                .write(static_cast<int32_t>(tile.col))
+                .write(static_cast<int32_t>(tile.height))
+                .write(static_cast<int32_t>(tile.width));
+            send(worker, MESSAGE_TILE, message.payload());
+        }
+    }
+
+    void accept_worker(int listener)
+    {
+        int fd = accept_connection(listener);
+        if (fd < 0)
+            return;
+        std::unique_ptr<RemoteWorker> worker(new RemoteWorker);
+        worker->connection.reset(new Connection(fd));
+        worker->last_heard = network_clock::now();
+        send(*worker, MESSAGE_JOB, job);
+        if (worker->alive)
+            workers.push_back(std::move(worker));
+    }
+
+    /// @brief Reads the messages which have arrived from a worker
+    void service(RemoteWorker &worker)
+    {
+        try
+        {
+            if (!worker.connection->receive_available())
+            {
+                if (!worker.tiles.empty())
+                    std::cerr << "\nWorker disconnected" << std::endl;
+                worker.alive = false;
+                return;
+            }
+            worker.last_heard = network_clock::now();
+            Message message;
+            while (worker.alive && worker.connection->next_message(message))
+                receive(worker, message);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "\nWorker lost: " << e.what() << std::endl;
+            worker.alive = false;
+        }
+    }
+
+  public:
+    Coordinator(const Config &cfg, const std::string &scene_filename, AOVBuffers *aovs,
+                const CoordinatorOptions &options)
+        : cfg(cfg), options(options), aovs(aovs),
+          scheduler(cfg.image_width, cfg.image_height, cfg.tile_size),
+          img(cfg.image_width, cfg.image_height), progress(scheduler.tile_count()), finished(0),
+          tile_seconds(0)
+    {
+        MessageWriter message;
+        message.write_string(scene_filename)
+            .write(static_cast<int32_t>(cfg.image_width))
+            .write(static_cast<int32_t>(cfg.image_height))
+            .write(static_cast<int32_t>(cfg.samples_per_pixel))
+            .write(static_cast<uint64_t>(cfg.seed))
+            .write(static_cast<uint8_t>(aovs != nullptr));
+        job = message.payload();
+        for (int i = 0; i < scheduler.tile_count(); ++i)
+        {
+            pending.push_back(i);
+        }
+        if (aovs)
+            aovs->resize(cfg.image_width, cfg.image_height);
+    }
+
+    Framebuffer render(int listener)
+    {
+        std::unique_ptr<ProgressBar> progress_bar;
+        if (cfg.show_progress)
+        {
+            progress_bar.reset(
+                new ProgressBar(scheduler.tile_count(), cfg.progressbar_width, true));
+            progress_bar->hide_cursor(std::cout);
+        }
+        int displayed = 0;
+        std::vector<pollfd> fds;
+        while (finished < scheduler.tile_count())
+        {
+            fds.assign(1, pollfd{listener, POLLIN, 0});
+            for (const auto &worker : workers)
+            {
+                fds.push_back(pollfd{worker->connection->descriptor(), POLLIN, 0});
+            }
+            if (poll(fds.data(), fds.size(), POLL_INTERVAL_MS) < 0 && errno != EINTR)
+                throw std::runtime_error(socket_error("Cannot wait for the workers"));
+
+            // Workers accepted below are not in fds, they are serviced in the next iteration
+            size_t polled = workers.size();
+            if (fds[0].revents & POLLIN)
+                accept_worker(listener);
+            for (size_t i = 0; i < polled; ++i)
+            {
+                if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+                    service(*workers[i]);
+            }
+
+            for (auto &worker : workers)
+            {
+                if (worker->alive && !worker->tiles.empty() &&
+                    seconds_since(worker->last_heard) > options.worker_timeout)
+                {
+                    std::cerr << "\nWorker timed out" << std::endl;
+                    worker->alive = false;
+                }
+                if (!worker->alive)
+                    drop_worker(*worker);
+            }
+            workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                         [](const std::unique_ptr<RemoteWorker> &worker)
+                                         { return !worker->alive; }),
+                          workers.end());
+
+            for (auto &worker : workers)
+            {
+                if (worker->threads > 0)
+                    assign_tiles(*worker);
+            }
+
+            if (progress_bar && finished != displayed)
+            {
+                progress_bar->tick(finished - displayed);
+                progress_bar->display(std::cout);
+                displayed = finished;
+            }
+        }
+        if (progress_bar)
+        {
+            progress_bar->show_cursor(std::cout);
+            std::cout << std::endl;
+        }
+
+        // Workers still rendering copies of slow tiles stop as well
+        for (auto &worker : workers)
+        {
+            send(*worker, MESSAGE_DONE, std::vector<char>());
+        }
+        workers.clear();
+        return img;
+    }
+};
+
+Framebuffer coordinate_render(const Config &cfg, const std::string &scene_filename,
+                              const std::string &address, AOVBuffers *aovs,
+                              const CoordinatorOptions &options)
+{
+    int listener = open_socket(address, true);
+    if (cfg.show_progress)
+        std::cout << "Waiting for workers on " << address << std::endl;
+    Framebuffer img;
+    try
+    {
+        img = Coordinator(cfg, scene_filename, aovs, options).render(listener);
+    }
+    catch (...)
+    {
+        close(listener);
+        throw;
+    }
+    close_listener(listener, address);
+    return img;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Worker
+
+// Tiles received from the coordinator, waiting for a render thread
+class TileQueue
+{
+  private:
+    std::mutex lock;
+    std::condition_variable available;
+    std::deque<std::pair<int, Tile>> tiles;
+    bool closed = false;
+
+  public:
+    void push(int index, const Tile &tile)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tiles.push_back(std::make_pair(index, tile));
+        }
+        available.notify_one();
+    }
+
+    /// @brief Waits for a tile
+    /// @return false once the queue is closed, the tiles still queued are dropped
+    bool pop(int &index, Tile &tile)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        available.wait(guard, [this] { return closed || !tiles.empty(); });
+        if (closed)
+            return false;
+        index = tiles.front().first;
+        tile = tiles.front().second;
+        tiles.pop_front();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        available.notify_all();
+    }
+};
+
+/// @brief Appends the values of the pixels of a tile to a message, row by row
+template <typename T>
+static void write_tile(MessageWriter &message, const Tile &tile, int channels,
+                       const std::function<const T *(int row)> &row)
+{
+    for (int r = tile.row; r < tile.row + tile.height; ++r)
+    {
+        message.write_array(row(r) + static_cast<size_t>(tile.col) * channels,
+                            static_cast<size_t>(tile.width) * channels);
+    }
+}
+
+static void render_worker_tiles(const Config &cfg, const Camera &cam, const Scene &scene,
+                                TileQueue *queue, Connection *connection, std::mutex *send_lock,
+                                Framebuffer *img, AOVBuffers *aovs, int cpu)
+{
+    if (cpu >= 0)
+        pin_current_thread(cpu);
+    Renderer renderer(cfg);
+    // The wavefront integrator keeps its queues between the tiles of the thread
+    std::unique_ptr<WavefrontIntegrator> wavefront;
+    if (cfg.integrator == Integrator::Wavefront)
+        wavefront.reset(new WavefrontIntegrator(cfg, scene));
+    int index;
+    Tile tile;
+    while (queue->pop(index, tile))
+    {
+        if (wavefront)
+            wavefront->render_tile(cam, tile, *img, aovs);
+        else
+            renderer.render_tile(cam, scene, tile, *img, aovs);
+        try
+        {
+            scene.get_texture_cache().check_read_errors();
+        }
+        catch (const std::exception &e)
+        {
+            // The tile is not sent, the coordinator stops giving tiles to this worker
+            try
+            {
+                std::lock_guard<std::mutex> guard(*send_lock);
+                connection->send(MESSAGE_ERROR, MessageWriter().write_string(e.what()).payload());
+            }
+            catch (const std::exception &)
+            {
+            }
+            queue->close();
+            return;
+        }
+
+        MessageWriter message;
+        message.write(static_cast<int32_t>(index));
+        write_tile<float>(message, tile, CHANNELS, [img](int r) { return img->row(r); });
+        if (aovs)
+        {
+            int width = aovs->width();
+            write_tile<float>(message, tile, CHANNELS,
+                              [aovs](int r) { return aovs->albedo.row(r); });
+            write_tile<float>(message, tile, CHANNELS,
+                              [aovs](int r) { return aovs->normal.row(r); });
+            write_tile<float>(message, tile, 1, [aovs, width](int r)
+                              { return aovs->depth.data() + static_cast<size_t>(r) * width; });
+            write_tile<uint32_t>(message, tile, 1, [aovs, width](int r) {
+                return aovs->sample_count.data() + static_cast<size_t>(r) * width;
+            });
+        }
+        try
+        {
+            std::lock_guard<std::mutex> guard(*send_lock);
+            connection->send(MESSAGE_RESULT, message.payload());
+        }
+        catch (const std::exception &)
+        {
+            // The coordinator has gone away, the main thread sees the connection close
+            queue->close();
+        }
+    }
+}
+
+void run_worker(const std::string &address, int threads, bool pin)
+{
+    threads = std::max(threads, 1);
+    int fd = -1;
+    auto start = network_clock::now();
+    while (fd < 0)
+    {
+        try
+        {
+            fd = open_socket(address, false);
+        }
+        catch (const std::exception &)
+        {
+            if (seconds_since(start) > CONNECT_RETRY_SECONDS)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+        }
+    }
+    Connection connection(fd);
+    std::cout << "Connected to " << address << std::endl;
+
+    Message message;
+    if (!connection.receive(message) || message.type != MESSAGE_JOB)
+        throw std::runtime_error("The coordinator did not send a job");
+    MessageReader reader(message.payload);
+    std::string scene_filename = reader.read_string();
+    int width = reader.read<int32_t>();
+    int height = reader.read<int32_t>();
+    int samples_per_pixel = reader.read<int32_t>();
+    uint64_t seed = reader.read<uint64_t>();
+    bool render_aovs = reader.read<uint8_t>() != 0;
+    reader.finish();
+
+    // The scene file gives the settings which the coordinator did not send, the same way as
+    // it does on the coordinator
+    Config cfg;
+    Scene scene;
+    try
+    {
+        if (!scene_filename.empty())
+            load_scene(scene_filename, scene, cfg);
+        else
+            load_sample_scene(scene, seed);
+    }
+    catch (const std::exception &e)
+    {
+        connection.send(MESSAGE_ERROR, MessageWriter().write_string(e.what()).payload());
+        throw;
+    }
+    cfg.image_width = width;
+    cfg.image_height = height;
+    cfg.samples_per_pixel = samples_per_pixel;
+    cfg.seed = seed;
+    cfg.show_progress = false;
+    MovableCamera cam(cfg);
+    std::cout << "Rendering " << (scene_filename.empty() ? "the sample scene" : scene_filename)
+              << " (" << width << "x" << height << ", " << samples_per_pixel
+              << " samples per pixel) with " << threads << " threads" << std::endl;
+
+    // Tiles are rendered into an image of the full size, so that the renderers can be used as
+    // they are
+    Framebuffer img(width, height);
+    std::unique_ptr<AOVBuffers> aovs;
+    if (render_aovs)
+        aovs.reset(new AOVBuffers(width, height));
+    TileQueue queue;
+    std::mutex send_lock;
+    std::vector<std::thread> render_threads;
+    std::vector<int> cpus;
+    if (pin || cfg.pin_threads)
+        cpus = detect_topology().placement(threads);
+    for (int i = 0; i < threads; ++i)
+    {
+        render_threads.emplace_back(render_worker_tiles, std::cref(cfg), std::cref(cam),
+                                    std::cref(scene), &queue, &connection, &send_lock, &img,
+                                    aovs.get(), i < static_cast<int>(cpus.size()) ? cpus[i] : -1);
+    }
+    {
+        std::lock_guard<std::mutex> guard(send_lock);
+        connection.send(MESSAGE_READY, MessageWriter().write(static_cast<int32_t>(threads)).payload());
+    }
+
+    int rendered = 0;
+    try
+    {
+        while (connection.receive(message) && message.type == MESSAGE_TILE)
+        {
+            MessageReader tile_reader(message.payload);
+            int index = tile_reader.read<int32_t>();
+            Tile tile;
+            tile.row = tile_reader.read<int32_t>();
+            tile.col = tile_reader.read<int32_t>();
+            tile.height = tile_reader.read<int32_t>();
+            tile.width = tile_reader.read<int32_t>();
+            tile_reader.finish();
+            if (tile.row < 0 || tile.col < 0 || tile.height <= 0 || tile.width <= 0 ||
+                tile.row + tile.height > height || tile.col + tile.width > width)
+                throw std::runtime_error("Tile outside the image");
+            queue.push(index, tile);
+            rendered++;
+        }
+    }
+    catch (...)
+    {
+        queue.close();
+        for (auto &t : render_threads)
+        {
+            t.join();
+        }
+        throw;
+    }
+    queue.close();
+    for (auto &t : render_threads)
+    {
+        t.join();
+    }
+    std::cout << "Finished, received " << rendered << " tiles" << std::endl;
+}
+
+#endif
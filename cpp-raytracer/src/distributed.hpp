@@ -0,0 +1,50 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Rendering one image with several processes, which may run on different machines. A coordinator
+// splits the image into tiles and hands them out to worker processes over sockets, the workers
+// render them with their own threads and send the float pixels back. The samples of a pixel depend
+// only on the seed and the position of the pixel, so the image is the same as a local render.
+//
+// Every message is a fixed header (magic number, type, size of the payload) followed by the
+// payload. Numbers are sent in the byte order of the machine, so all the machines must have the
+// same byte order, the magic number detects a mismatch.
+#pragma once
+#include "aov.hpp"
+#include "config.h"
+#include "image.hpp"
+#include <string>
+
+// Settings of the coordinator
+struct CoordinatorOptions
+{
+    // Tiles handed to a worker ahead of time for every one of its render threads, so that its
+    // threads do not wait for the coordinator between tiles
+    int tiles_per_thread = 2;
+    // A worker which has tiles but sends nothing for this many seconds is considered dead, and its
+    // tiles are handed to the other workers
+    double worker_timeout = 60;
+    // Once every tile has been handed out, workers which run out of work also render the tiles
+    // which have taken more than this many times the average time of a tile, the first copy to
+    // arrive is used
+    double straggler_factor = 3;
+};
+
+/// @brief Renders the image with the workers which connect to the address, and returns once every
+/// tile has been received. Workers may connect and disconnect at any time during the render.
+/// @param address "unix:<path>" for a Unix socket, or "<host>:<port>" for TCP, the host may be
+/// empty or * to listen on every interface
+/// @param scene_filename Scene file which the workers load from their own file system, empty for
+/// the sample scene
+/// @param aovs If not null, the workers also render the auxiliary buffers, which are resized to the
+/// image and filled in
+/// @throw std::runtime_error if the socket cannot be opened
+Framebuffer coordinate_render(const Config &cfg, const std::string &scene_filename,
+                              const std::string &address, AOVBuffers *aovs = nullptr,
+                              const CoordinatorOptions &options = CoordinatorOptions());
+
+/// @brief Connects to a coordinator, loads the scene it names and renders the tiles it sends until
+/// the image is finished
+/// @param threads Number of render threads
+/// @param pin Pin the render threads to processors, they are also pinned if the scene file sets
+/// pin_threads
+/// @throw std::runtime_error if the coordinator cannot be reached or the scene cannot be loaded
+void run_worker(const std::string &address, int threads, bool pin = false);
@@ -1,38 +1,229 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #include "image.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
 // #define STB_IMAGE_IMPLEMENTATION
 // #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-void write_to_file(const std::string &filename,const image& img)
+Framebuffer::Framebuffer() : width_(0), height_(0), origin_row_(0), origin_col_(0), pixels(nullptr)
 {
-    size_t height = img.size();
-    size_t width = (img.empty()) ? 0 : img[0].size();
-    uint8_t *data = static_cast<uint8_t *>(malloc(width * height * CHANNELS));
-    if (data == NULL)
-    {
-        // Note: TODO: Try to save the float pixel data before exiting to save
-        // the rendered image.
-        std::cerr << "Error while allocating memory for image!\n";
-        exit(1);
-    }
-    memset(data, 0, width * height * CHANNELS);
+}
+
+Framebuffer::Framebuffer(int width, int height) : Framebuffer(width, height, 0, 0) {}
+
+Framebuffer::Framebuffer(int width, int height, int origin_row, int origin_col)
+    : width_(width), height_(height), origin_row_(origin_row), origin_col_(origin_col),
+      pixels(nullptr)
+{
+    allocate();
+    // The thread which clears the pixels touches the pages first, so on NUMA machines they are
+    // allocated on its node
+    memset(pixels, 0, sizeof(float) * width_ * height_ * CHANNELS);
+}
+
+Framebuffer::Framebuffer(const Framebuffer &other)
+    : width_(other.width_), height_(other.height_), origin_row_(other.origin_row_),
+      origin_col_(other.origin_col_), pixels(nullptr)
+{
+    allocate();
+    memcpy(pixels, other.pixels, sizeof(float) * width_ * height_ * CHANNELS);
+}
+
+Framebuffer::Framebuffer(Framebuffer &&other)
+    : width_(other.width_), height_(other.height_), origin_row_(other.origin_row_),
+      origin_col_(other.origin_col_), pixels(other.pixels)
+{
+    other.width_ = other.height_ = 0;
+    other.origin_row_ = other.origin_col_ = 0;
+    other.pixels = nullptr;
+}
+
+Framebuffer &Framebuffer::operator=(Framebuffer other)
+{
+    std::swap(width_, other.width_);
+    std::swap(height_, other.height_);
+    std::swap(origin_row_, other.origin_row_);
+    std::swap(origin_col_, other.origin_col_);
+    std::swap(pixels, other.pixels);
+    return *this;
+}
 
-    for (size_t i = 0; i < height; ++i)
+Framebuffer::~Framebuffer()
+{
+#ifdef _WIN32
+    _aligned_free(pixels);
+#else
+    free(pixels);
+#endif
+}
+
+void Framebuffer::allocate()
+{
+    // Allocate at least one pixel, so that the pointer is never null
+    size_t bytes = std::max<size_t>(sizeof(float) * width_ * height_ * CHANNELS, sizeof(float));
+    bytes = (bytes + FRAMEBUFFER_ALIGNMENT - 1) / FRAMEBUFFER_ALIGNMENT * FRAMEBUFFER_ALIGNMENT;
+#ifdef _WIN32
+    void *p = _aligned_malloc(bytes, FRAMEBUFFER_ALIGNMENT);
+#else
+    void *p = nullptr;
+    if (posix_memalign(&p, FRAMEBUFFER_ALIGNMENT, bytes) != 0)
+        p = nullptr;
+#endif
+    if (p == nullptr)
+        throw std::bad_alloc();
+    pixels = static_cast<float *>(p);
+}
+
+/// @brief Tonemaps and clamps a single channel, NaN becomes 0
+/// Note: Performs the same operations as the SIMD code, so that both give the same results
+static inline float tonemap_channel(float v, ToneMap tonemap, int gamma)
+{
+    v = (v > 0.0f) ? v : 0.0f;
+    if (tonemap == ToneMap::Reinhard)
+        v = v / (1.0f + v);
+    v = (v < 1.0f) ? v : 1.0f;
+    if (gamma == 2)
+        v = std::sqrt(v);
+    else if (gamma == 3)
+        v = std::cbrt(v);
+    else if (gamma != 1)
+        v = std::pow(v, 1.0f / gamma);
+    return v;
+}
+
+void tonemap_rows(const Framebuffer &fb, int first_row, int last_row, ToneMap tonemap, int gamma,
+                  DisplayImage &out)
+{
+    assert(out.width == fb.width() && out.height == fb.height());
+    if (first_row >= last_row)
+        return;
+    // Rows are stored one after the other, so the range can be processed as a single array
+    const float *in = fb.row(first_row);
+    uint8_t *dest = out.pixels.data() + static_cast<size_t>(first_row) * out.width * CHANNELS;
+    size_t n = static_cast<size_t>(last_row - first_row) * fb.width() * CHANNELS;
+    size_t i = 0;
+#if defined(__AVX__)
+    if (gamma == 1 || gamma == 2)
     {
-        for (size_t j = 0; j < width; ++j)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 scale = _mm256_set1_ps(SCALE_FACTOR);
+        for (; i + 8 <= n; i += 8)
         {
-            // Convert from floating point representation to RGB[0, 255]
-            data[(i * width + j) * CHANNELS] =
-                static_cast<uint8_t>((int)(SCALE_FACTOR * img[i][j].x) % 256);
-            data[(i * width + j) * CHANNELS + 1] =
-                static_cast<uint8_t>((int)(SCALE_FACTOR * img[i][j].y) % 256);
-            data[(i * width + j) * CHANNELS + 2] =
-                static_cast<uint8_t>((int)(SCALE_FACTOR * img[i][j].z) % 256);
+            // max and min return the second operand for NaN, so NaN becomes 0
+            __m256 v = _mm256_max_ps(_mm256_loadu_ps(in + i), zero);
+            if (tonemap == ToneMap::Reinhard)
+                v = _mm256_div_ps(v, _mm256_add_ps(one, v));
+            v = _mm256_min_ps(v, one);
+            if (gamma == 2)
+                v = _mm256_sqrt_ps(v);
+            __m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(v, scale));
+            __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(q),
+                                             _mm256_extractf128_si256(q, 1));
+            __m128i bytes = _mm_packus_epi16(words, words);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + i), bytes);
         }
     }
-    // Write the image to png file
-    stbi_write_png(filename.c_str(), width, height, CHANNELS, data, width * CHANNELS);
-    free(data);
+#endif
+    for (; i < n; ++i)
+    {
+        dest[i] = static_cast<uint8_t>(static_cast<int>(tonemap_channel(in[i], tonemap, gamma) *
+                                                        SCALE_FACTOR));
+    }
+}
+
+DisplayImage tonemap_image(const Framebuffer &fb, ToneMap tonemap, int gamma,
+                           int number_of_threads)
+{
+    DisplayImage out;
+    out.resize(fb.width(), fb.height());
+    number_of_threads = std::max(1, std::min(number_of_threads, fb.height()));
+    int rows_per_thread = (fb.height() + number_of_threads - 1) / std::max(number_of_threads, 1);
+    std::vector<std::thread> threads;
+    for (int first = rows_per_thread; first < fb.height(); first += rows_per_thread)
+    {
+        threads.emplace_back(tonemap_rows, std::cref(fb), first,
+                             std::min(first + rows_per_thread, fb.height()), tonemap, gamma,
+                             std::ref(out));
+    }
+    // The calling thread converts the first block
+    tonemap_rows(fb, 0, std::min(rows_per_thread, fb.height()), tonemap, gamma, out);
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    return out;
+}
+
+BandTonemapper::BandTonemapper(const Framebuffer &fb, DisplayImage &out, ToneMap tonemap,
+                               int gamma, int band_height, int tiles_per_band)
+    : fb(fb), out(out), tonemap(tonemap), gamma(gamma), band_height(std::max(band_height, 1))
+{
+    int bands = (fb.height() + this->band_height - 1) / this->band_height;
+    remaining.reset(new std::atomic<int>[bands]);
+    for (int i = 0; i < bands; ++i)
+    {
+        remaining[i].store(tiles_per_band);
+    }
+}
+
+void BandTonemapper::tile_finished(int band)
+{
+    // acq_rel so that the thread converting the band sees the pixels written by the other threads
+    if (remaining[band].fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        int first = band * band_height;
+        tonemap_rows(fb, first, std::min(first + band_height, fb.height()), tonemap, gamma, out);
+    }
+}
+
+bool write_png(const std::string &filename, const DisplayImage &img)
+{
+    return stbi_write_png(filename.c_str(), img.width, img.height, CHANNELS, img.pixels.data(),
+                          img.width * CHANNELS) != 0;
+}
+
+bool write_pfm(const std::string &filename, const Framebuffer &fb)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    // A negative scale means that the floats are little endian
+    const uint16_t endian_test = 1;
+    bool little_endian = *reinterpret_cast<const uint8_t *>(&endian_test) == 1;
+    fprintf(file, "PF\n%d %d\n%s\n", fb.width(), fb.height(), little_endian ? "-1.0" : "1.0");
+    // Rows are stored from the bottom of the image to the top
+    bool ok = true;
+    for (int r = fb.height() - 1; r >= 0 && ok; --r)
+    {
+        size_t count = static_cast<size_t>(fb.width()) * CHANNELS;
+        ok = fwrite(fb.row(r), sizeof(float), count, file) == count;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+/// @return true if the string ends with the suffix, ignoring case
+static bool ends_with(const std::string &s, const std::string &suffix)
+{
+    if (s.size() < suffix.size())
+        return false;
+    return std::equal(suffix.begin(), suffix.end(), s.end() - suffix.size(),
+                      [](char a, char b) { return tolower(a) == tolower(b); });
+}
+
+void write_to_file(const std::string &filename, const Framebuffer &fb, const DisplayImage &img)
+{
+    bool ok = ends_with(filename, ".pfm") ? write_pfm(filename, fb) : write_png(filename, img);
+    if (!ok)
+    {
+        std::cerr << "Error while writing the image to " << filename << std::endl;
+    }
 }
@@ -1,21 +1,157 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
-// Function to write images
+// Float framebuffer, conversion to 8 bit images and functions to write images
 #pragma once
 #include "colors.hpp"
 #include "commons.hpp"
 #include <assert.h>
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string>
 #include <vector>
 
 const int CHANNELS = 3;
-const double SCALE_FACTOR = 255.99;
-// Pixels are represented in floating point format, with values from 0 to 1.0
-// corresponding to 0 to 255
-using image_row = std::vector<color>;
-using image = std::vector<image_row>;
-// Writes the floating point image data to the file after converting it to
-// integer format.
-void write_to_file(const std::string &filename, const image& img);
+const float SCALE_FACTOR = 255.99f;
+// Alignment of the rows of the framebuffer, in bytes
+const size_t FRAMEBUFFER_ALIGNMENT = 64;
+
+// How colors brighter than 1.0 are brought into the displayable range
+enum class ToneMap
+{
+    // Clamp every channel to [0, 1]
+    Clamp,
+    // x / (1 + x) on every channel, keeps some detail in the highlights
+    Reinhard
+};
+
+// Linear (not gamma corrected) colors of the pixels, stored as 32 bit floats in one contiguous,
+// aligned block. The channels of a pixel are next to each other, and rows follow each other
+// without padding.
+class Framebuffer
+{
+  private:
+    int width_;
+    int height_;
+    // Row and column of the image at which the framebuffer starts, see set_origin
+    int origin_row_;
+    int origin_col_;
+    float *pixels;
+
+    void allocate();
+
+  public:
+    Framebuffer();
+
+    /// @brief Creates a black framebuffer of the given size
+    Framebuffer(int width, int height);
+
+    /// @brief Creates a black framebuffer which holds a part of a larger image, starting at
+    /// (origin_row, origin_col)
+    Framebuffer(int width, int height, int origin_row, int origin_col);
+
+    Framebuffer(const Framebuffer &other);
+    Framebuffer(Framebuffer &&other);
+    Framebuffer &operator=(Framebuffer other);
+    ~Framebuffer();
+
+    int width() const { return width_; }
+
+    int height() const { return height_; }
+
+    /// @brief Moves the framebuffer to another part of the image, rows and columns are then
+    /// counted from (row, col), so a small framebuffer can hold any tile of the image while it is
+    /// addressed with the coordinates of the image. The pixels are not changed.
+    void set_origin(int row, int col)
+    {
+        origin_row_ = row;
+        origin_col_ = col;
+    }
+
+    /// @return Pointer to the first channel of the first pixel of the row (the pixel at the column
+    /// of the origin)
+    float *row(int r)
+    {
+        return pixels + static_cast<size_t>(r - origin_row_) * width_ * CHANNELS;
+    }
+
+    const float *row(int r) const
+    {
+        return pixels + static_cast<size_t>(r - origin_row_) * width_ * CHANNELS;
+    }
+
+    color get(int r, int c) const
+    {
+        const float *p = row(r) + (c - origin_col_) * CHANNELS;
+        return color(p[0], p[1], p[2]);
+    }
+
+    void set(int r, int c, const color &value)
+    {
+        float *p = row(r) + (c - origin_col_) * CHANNELS;
+        p[0] = static_cast<float>(value.x);
+        p[1] = static_cast<float>(value.y);
+        p[2] = static_cast<float>(value.z);
+    }
+};
+
+// An 8 bit RGB image, ready to be written to a png file
+struct DisplayImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        pixels.assign(static_cast<size_t>(w) * h * CHANNELS, 0);
+    }
+};
+
+/// @brief Tonemaps, gamma corrects and quantizes the rows [first_row, last_row) of the
+/// framebuffer into the display image, which must have the same size. Values are clamped to
+/// [0, 255]. Gamma 1 and 2 use SIMD when available and give the same results as the scalar code.
+void tonemap_rows(const Framebuffer &fb, int first_row, int last_row, ToneMap tonemap, int gamma,
+                  DisplayImage &out);
+
+/// @brief Converts the whole framebuffer to 8 bit, the rows are split between the threads
+DisplayImage tonemap_image(const Framebuffer &fb, ToneMap tonemap, int gamma,
+                           int number_of_threads);
+
+// Converts horizontal bands of a framebuffer to 8 bit as soon as all the tiles of the band have
+// been rendered, so that the conversion overlaps with the rendering of the rest of the image. The
+// thread which finishes the last tile of a band converts it.
+class BandTonemapper
+{
+  private:
+    const Framebuffer &fb;
+    DisplayImage &out;
+    ToneMap tonemap;
+    int gamma;
+    int band_height;
+    // Number of tiles of each band which have not been rendered yet
+    std::unique_ptr<std::atomic<int>[]> remaining;
+
+  public:
+    /// @param band_height Height of a band (the tile size)
+    /// @param tiles_per_band Number of tiles in each band
+    BandTonemapper(const Framebuffer &fb, DisplayImage &out, ToneMap tonemap, int gamma,
+                   int band_height, int tiles_per_band);
+
+    /// @brief Must be called once for every tile after the tile has been written to the
+    /// framebuffer
+    void tile_finished(int band);
+};
+
+/// @brief Writes a 8 bit image to a png file
+bool write_png(const std::string &filename, const DisplayImage &img);
+
+/// @brief Writes the framebuffer without any loss to a portable float map (.pfm) file
+bool write_pfm(const std::string &filename, const Framebuffer &fb);
+
+/// @brief Writes the framebuffer to a .pfm file if the filename ends with .pfm, otherwise the
+/// 8 bit image is written as a png file
+void write_to_file(const std::string &filename, const Framebuffer &fb, const DisplayImage &img);
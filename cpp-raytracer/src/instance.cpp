@@ -0,0 +1,60 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "instance.hpp"
+#include "primitives.hpp"
+
+Instance::Instance(const ObjectGroup *group, vec3 translation, real scale)
+    : group(group), translation(translation), scale(scale)
+{
+}
+
+Intersection Instance::intersect(const RayParams &params) const
+{
+    ObjectHit hit;
+    if (!this->hit(params, hit))
+    {
+        Intersection details;
+        details.occured = false;
+        return details;
+    }
+    return surface(params.ray, hit);
+}
+
+bool Instance::hit(const RayParams &params, ObjectHit &hit) const
+{
+    // In the space of the group, distances are divided by the scale, the direction of the ray
+    // does not change since the scaling is uniform
+    Ray local_ray((params.ray.origin() - translation) / scale, params.ray.direction(), true);
+    ObjectHit local;
+    if (!group->closest_hit(RayParams({local_ray, params.t_min / scale, params.t_max / scale}),
+                            local))
+        return false;
+    hit.t = local.t * scale;
+    hit.group_t = local.t;
+    hit.group_slot = local.slot;
+    hit.triangle = local.triangle;
+    hit.u = local.u;
+    hit.v = local.v;
+    return true;
+}
+
+Intersection Instance::surface(const Ray &ray, const ObjectHit &hit) const
+{
+    Ray local_ray((ray.origin() - translation) / scale, ray.direction(), true);
+    ObjectHit local = hit;
+    local.t = hit.group_t;
+    local.slot = hit.group_slot;
+    auto details = group->surface(local_ray, local);
+    details.parametric = hit.t;
+    details.point = ray.at(details.parametric);
+    details.ray = ray;
+    details.uv_scale *= scale;
+    return details;
+}
+
+AABB Instance::bounds() const
+{
+    AABB local = group->bounds();
+    if (local.empty())
+        return local;
+    return AABB(local.min * scale + translation, local.max * scale + translation);
+}
@@ -0,0 +1,43 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Instances, which place a group of objects (see primitives.hpp) which is stored once many times in
+// a scene
+#pragma once
+#include "aabb.hpp"
+#include "commons.hpp"
+
+class ObjectGroup;
+
+// A copy of a group, moved by translation and uniformly scaled by scale (about the origin of the
+// group). The objects of the group are not copied.
+class Instance
+{
+  private:
+    const ObjectGroup *group;
+    vec3 translation;
+    real scale;
+
+  public:
+    /// @param group The group to be placed, it must outlive the instance
+    /// @param translation Position of the origin of the group in the scene
+    /// @param scale Size of the instance relative to the group, must be positive
+    Instance(const ObjectGroup *group, vec3 translation, real scale = 1.0);
+
+    /// @brief Transforms the ray into the space of the group, and the intersection back
+    Intersection intersect(const RayParams &params) const;
+
+    /// @brief Finds the closest object of the group which is hit by the ray, without computing the
+    /// details. hit.group_t and hit.group_slot are set to the hit in the space of the group.
+    bool hit(const RayParams &params, ObjectHit &hit) const;
+
+    /// @brief Computes the details of a hit found by hit()
+    Intersection surface(const Ray &ray, const ObjectHit &hit) const;
+
+    AABB bounds() const;
+
+    /// @brief Moves the instance, the acceleration structure which contains it must be updated
+    void set_transform(const vec3 &translation, real scale)
+    {
+        this->translation = translation;
+        this->scale = scale;
+    }
+};
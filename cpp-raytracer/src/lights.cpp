@@ -0,0 +1,53 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "lights.hpp"
+#include "sampling.hpp"
+#include <algorithm>
+#include <cmath>
+
+/// @brief Computes 1 - cos(theta_max) of the cone of directions in which a sphere is seen
+/// @param distance2 Squared distance to the center of the sphere, greater than radius2
+static real cone_width(real distance2, real radius2)
+{
+    real sin2 = radius2 / distance2;
+    real cos_max = std::sqrt(std::max(real(0), 1 - sin2));
+    // 1 - cos_max loses all its digits for small or distant spheres, this form does not
+    return sin2 / (1 + cos_max);
+}
+
+bool SphereLight::sample(const vec3 &point, Sampler &sampler, vec3 &direction, real &distance,
+                         real &pdf) const
+{
+    vec3 to_center = center - point;
+    real distance2 = linalg::length2(to_center);
+    real radius2 = radius * radius;
+    if (distance2 <= radius2)
+        return false;
+    real width = cone_width(distance2, radius2);
+    real cos_theta = 1 - static_cast<real>(sampler.uniform()) * width;
+    real sin_theta = std::sqrt(std::max(real(0), 1 - cos_theta * cos_theta));
+    real phi = static_cast<real>(2 * PI * sampler.uniform());
+
+    // The cone is around the direction to the center
+    Frame frame(to_center / std::sqrt(distance2));
+    direction = linalg::normalize(frame.to_world(
+        vec3(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta)));
+
+    // Distance to the nearer intersection with the sphere, the direction lies inside the cone so
+    // the discriminant is only negative due to rounding at the edge of the cone
+    vec3 oc = point - center;
+    real h = linalg::dot(direction, oc);
+    vec3 l = oc - h * direction;
+    real discriminant = std::max(real(0), radius2 - linalg::dot(l, l));
+    distance = -h - std::sqrt(discriminant);
+    pdf = 1 / (2 * static_cast<real>(PI) * width);
+    return true;
+}
+
+real SphereLight::pdf(const vec3 &point) const
+{
+    real distance2 = linalg::length2(center - point);
+    real radius2 = radius * radius;
+    if (distance2 <= radius2)
+        return 0;
+    return 1 / (2 * static_cast<real>(PI) * cone_width(distance2, radius2));
+}
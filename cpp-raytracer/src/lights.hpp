@@ -0,0 +1,50 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Light sources which can be sampled directly, so that small bright lights are found by the
+// shadow rays cast from every diffuse surface instead of only by paths which happen to hit them
+#pragma once
+#include "colors.hpp"
+#include "commons.hpp"
+#include "sampler.hpp"
+
+// A sphere with an emissive material, which is placed directly in the scene
+class SphereLight
+{
+  private:
+    vec3 center;
+    real radius;
+    // Radiance emitted by the surface of the sphere
+    color radiance;
+
+  public:
+    SphereLight(const vec3 &center, real radius, const color &radiance)
+        : center(center), radius(radius), radiance(radiance)
+    {
+    }
+
+    color get_radiance() const { return radiance; }
+
+    /// @brief Picks a direction from the point towards the sphere, uniformly from the cone of
+    /// directions in which the sphere is seen
+    /// @param direction Set to the unit vector pointing towards the sphere
+    /// @param distance Set to the distance from the point to the surface of the sphere along the
+    /// direction
+    /// @param pdf Set to the probability density (per unit solid angle) of the direction
+    /// @return false if the point is inside the sphere, which cannot be sampled
+    bool sample(const vec3 &point, Sampler &sampler, vec3 &direction, real &distance,
+                real &pdf) const;
+
+    /// @return Probability density with which sample() picks a direction that hits the sphere
+    /// from the point, 0 if the point is inside the sphere
+    real pdf(const vec3 &point) const;
+};
+
+/// @brief Power heuristic of multiple importance sampling (with an exponent of 2)
+/// @param pdf Probability density of the technique which produced the sample
+/// @param other_pdf Probability density of the other technique for the same sample
+/// @return Weight of the sample
+inline real power_heuristic(real pdf, real other_pdf)
+{
+    real a = pdf * pdf;
+    real b = other_pdf * other_pdf;
+    return a / (a + b);
+}
@@ -1,54 +1,286 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "affinity.hpp"
+#include "animation.hpp"
 #include "camera.hpp"
 #include "colors.hpp"
 #include "config.h"
+#include "denoise.hpp"
+#include "distributed.hpp"
 #include "frombook.hpp"
 #include "image.hpp"
 #include "progressbar.hpp"
+#include "progressive.hpp"
 #include "raytracer.hpp"
 #include "scene.hpp"
+#include "scene_file.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
-#include <thread>
+#include <string>
 
-void gammacorrect(image &img, int gamma)
+static void print_usage(const char *program)
 {
-    for (auto &i : img)
+    std::cerr << "Usage: " << program
+              << " [--threads N] [--pin] [--checkpoint <file>] [--resume] [scene]\n"
+              << "       " << program << " --coordinator <address> [scene]\n"
+              << "       " << program << " --worker <address> [--threads N] [--pin]\n"
+              << "       " << program << " --server <address> [--threads N] [--pin]\n"
+              << "       " << program
+              << " --submit <address> [--width N] [--height N] [--spp N] [--priority N]\n"
+              << "         [--camera <x> <y> <z> <look at x> <look at y> <look at z>]"
+              << " [--output <file>] <scene>\n"
+              << "The address is unix:<path> or <host>:<port>" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    // TODO: Set VT terminal when compiling on windows
+    std::string scene_filename, coordinator_address, worker_address, checkpoint_filename;
+    std::string server_address, submit_address, output_filename = "render.png";
+    RenderRequest request;
+    bool resume = false, pin_threads = false;
+    // 0 until --threads is given, the scene file may then set the number of threads
+    int number_of_threads = 0;
+    for (int i = 1; i < argc; ++i)
     {
-        for (auto &j : i)
+        std::string arg = argv[i];
+        if (arg == "--coordinator" && i + 1 < argc)
+            coordinator_address = argv[++i];
+        else if (arg == "--worker" && i + 1 < argc)
+            worker_address = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            number_of_threads = std::max(std::atoi(argv[++i]), 1);
+        else if (arg == "--checkpoint" && i + 1 < argc)
+            checkpoint_filename = argv[++i];
+        else if (arg == "--resume")
+            resume = true;
+        else if (arg == "--pin")
+            pin_threads = true;
+        else if (arg == "--server" && i + 1 < argc)
+            server_address = argv[++i];
+        else if (arg == "--submit" && i + 1 < argc)
+            submit_address = argv[++i];
+        else if (arg == "--width" && i + 1 < argc)
+            request.width = std::max(std::atoi(argv[++i]), 0);
+        else if (arg == "--height" && i + 1 < argc)
+            request.height = std::max(std::atoi(argv[++i]), 0);
+        else if (arg == "--spp" && i + 1 < argc)
+            request.samples_per_pixel = std::max(std::atoi(argv[++i]), 0);
+        else if (arg == "--priority" && i + 1 < argc)
+            request.priority = std::atoi(argv[++i]);
+        else if (arg == "--camera" && i + 6 < argc)
         {
-            j = gamma_correction(j, gamma);
+            request.move_camera = true;
+            for (int k = 0; k < 3; ++k)
+                request.camera_position[k] = std::atof(argv[++i]);
+            for (int k = 0; k < 3; ++k)
+                request.camera_lookat[k] = std::atof(argv[++i]);
+        }
+        else if (arg == "--output" && i + 1 < argc)
+            output_filename = argv[++i];
+        else if (arg.compare(0, 2, "--") != 0 && scene_filename.empty())
+            scene_filename = arg;
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
         }
     }
-}
+    if (!server_address.empty())
+    {
+        // The clients name the scenes they want rendered
+        try
+        {
+            ServerOptions options;
+            options.pin_threads = pin_threads;
+            run_server(server_address, number_of_threads > 0 ? number_of_threads
+                                                             : available_processors(),
+                       options);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!submit_address.empty())
+    {
+        if (scene_filename.empty())
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        try
+        {
+            request.scene_filename = scene_filename;
+            RenderResult result = RenderClient(submit_address).render(request);
+            std::cout << "Rendered by the server in " << result.seconds << "s"
+                      << (result.scene_cached ? "" : " (scene loaded)") << std::endl;
+            write_to_file(output_filename, result.image,
+                          tonemap_image(result.image, result.tonemap, result.gamma, 1));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!worker_address.empty())
+    {
+        // The coordinator tells the worker which scene to render
+        try
+        {
+            run_worker(worker_address,
+                       number_of_threads > 0 ? number_of_threads : available_processors(),
+                       pin_threads);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-int main()
-{
-    // TODO: Modify the random code so that each thread has a different random generator.
-    // TODO: Set VT terminal when compiling on windows
     Config cfg;
     cfg.samples_per_pixel = 100;
     cfg.image_width = 400;
     cfg.image_height = cfg.image_width * (9.0 / 16.0);
     cfg.filename = "render.png";
-    MovableCamera cam(cfg);
     Scene scene;
+    Animation animation;
+    if (!scene_filename.empty())
+    {
+        // The scene file can override the settings above
+        try
+        {
+            load_scene(scene_filename, scene, cfg, true, &animation);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        load_sample_scene(scene, cfg.seed);
+    }
+    // The command line overrides the checkpoint settings of the scene file
+    if (!checkpoint_filename.empty())
+        cfg.checkpoint_filename = checkpoint_filename;
+    cfg.resume = cfg.resume || resume;
+    cfg.pin_threads = cfg.pin_threads || pin_threads;
+    if (number_of_threads == 0)
+        number_of_threads = cfg.threads > 0 ? cfg.threads : available_processors();
+    if (cfg.resume && cfg.checkpoint_filename.empty())
+    {
+        std::cerr << "--resume needs a checkpoint file (--checkpoint or checkpoint_filename)"
+                  << std::endl;
+        return 1;
+    }
+    bool distributed = !coordinator_address.empty();
+    if (cfg.animation_frames > 0 && !distributed)
+    {
+        try
+        {
+            render_sequence(cfg, scene, animation, number_of_threads);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (cfg.animation_frames > 0)
+        std::cerr << "Animations are not distributed, rendering a single frame" << std::endl;
+    MovableCamera cam(cfg);
     cam.debug_info(std::cout);
-    image rendered_img;
+    Framebuffer rendered_img;
+    DisplayImage display_img;
+    bool need_aovs = cfg.denoise || !cfg.aov_filename.empty();
+    AOVBuffers aovs;
+    // Profiles are recorded by the tiles of a local render
+    PixelProfile profile;
+    bool profiling = !cfg.profile_filename.empty();
+    if (profiling && (!profiling_enabled() || distributed || cfg.progressive))
+    {
+        std::cerr << (profiling_enabled() ? "Only single tiled renders are profiled"
+                                          : "Built without RAYTRACER_PROFILE, not profiling")
+                  << std::endl;
+        profiling = false;
+    }
 
     // A multi threaded render
-    int number_of_threads = std::max(std::thread::hardware_concurrency(), (unsigned int)1);
-    rendered_img = multi_threaded_render(cfg, cam, scene, number_of_threads);
-    gammacorrect(rendered_img, cfg.gamma);
+    try
+    {
+        if (distributed)
+        {
+            if (cfg.progressive)
+                std::cerr << "Progressive rendering is not distributed, rendering all the samples"
+                          << std::endl;
+            if (!cfg.checkpoint_filename.empty())
+                std::cerr << "Distributed renders are not checkpointed" << std::endl;
+            rendered_img = coordinate_render(cfg, scene_filename, coordinator_address,
+                                             need_aovs ? &aovs : nullptr);
+        }
+        else if (cfg.progressive)
+        {
+            rendered_img = ProgressiveRenderer(cfg).render(cam, scene, number_of_threads,
+                                                           need_aovs ? &aovs : nullptr);
+        }
+        else
+        {
+            // The rows are tonemapped while the rest of the image is rendered, unless the image
+            // is denoised first
+            rendered_img = multi_threaded_render(cfg, cam, scene, number_of_threads,
+                                                 cfg.denoise ? nullptr : &display_img, nullptr,
+                                                 need_aovs ? &aovs : nullptr,
+                                                 profiling ? &profile : nullptr);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (scene.texture_count() > 0 && !distributed)
+    {
+        TextureCacheStats stats = scene.get_texture_cache().stats();
+        std::cout << "Texture cache: " << stats.tile_reads << " tiles read, " << stats.evictions
+                  << " evicted, " << (stats.peak_bytes >> 10) << " KB used at most" << std::endl;
+    }
+    if (cfg.denoise)
+    {
+        std::cout << "Denoising....." << std::endl;
+        rendered_img = denoise(rendered_img, aovs, number_of_threads);
+    }
+    if (cfg.progressive || cfg.denoise || distributed)
+        display_img = tonemap_image(rendered_img, cfg.tonemap, cfg.gamma, number_of_threads);
     std::cout << "Writing to disk....." << std::endl;
-    write_to_file(cfg.filename, rendered_img);
+    write_to_file(cfg.filename, rendered_img, display_img);
+    if (!cfg.hdr_filename.empty())
+        write_pfm(cfg.hdr_filename, rendered_img);
+    if (!cfg.aov_filename.empty() && !write_aovs(cfg.aov_filename, aovs))
+        std::cerr << "Error while writing the auxiliary buffers to " << cfg.aov_filename << std::endl;
+    if (profiling && !write_profile(cfg.profile_filename, profile, cfg.samples_per_pixel))
+        std::cerr << "Error while writing the profile to " << cfg.profile_filename << std::endl;
+    // The render is complete, a later render must not resume it
+    if (!cfg.checkpoint_filename.empty() && !distributed)
+        std::remove(cfg.checkpoint_filename.c_str());
 
     // A single threaded render
     // cfg.filename = "output2-single.png";
     // // cfg.samples_per_pixel *= number_of_threads;
     // rendered_img = Renderer(cfg).render(cam, scene, true);
-    // gammacorrect(rendered_img, cfg.gamma);
     // std::cout << "Writing to disk....." << std::endl;
-    // write_to_file(cfg.filename, rendered_img);
+    // write_to_file(cfg.filename, rendered_img,
+    //               tonemap_image(rendered_img, cfg.tonemap, cfg.gamma, 1));
     return 0;
 }
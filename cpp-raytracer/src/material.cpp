@@ -1,12 +1,15 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #include "material.hpp"
 
-LambertianDiffuse::LambertianDiffuse() : albedo(color(0.5, 0.5, 0.5)) {}
+LambertianDiffuse::LambertianDiffuse() : albedo(color(0.5, 0.5, 0.5)), albedo_texture(nullptr) {}
 
-LambertianDiffuse::LambertianDiffuse(const color &albedo) : albedo(albedo) {}
+LambertianDiffuse::LambertianDiffuse(const color &albedo, const ImageTexture *albedo_texture)
+    : albedo(albedo), albedo_texture(albedo_texture)
+{
+}
 
-MaterialInteraction LambertianDiffuse::interact(const RayParams params,
-                                                const Intersection &intersect) const
+MaterialInteraction LambertianDiffuse::interact(const Intersection &intersect,
+                                                Sampler &sampler) const
 {
     // Diffuse materials
     // -----------------
@@ -14,31 +17,46 @@ MaterialInteraction LambertianDiffuse::interact(const RayParams params,
     // different directions. These materials are rough and do not produce a clear reflection.
     // Examples: plastic, wood, etc.
     MaterialInteraction interaction;
-    auto scatter_direction = intersect.local_normal + random_in_unit_sphere();
-    // To prevent cases where the direction becomes zero when the random vector is exactly opposite
-    // to the normal
-    if (is_zero_vector(scatter_direction))
-        scatter_direction = intersect.local_normal;
-    // If the unit vector and the ray are not on the same side, flip the
-    // vector
-    if (linalg::dot(intersect.local_normal, scatter_direction) < 0.0)
-    {
-        scatter_direction = -scatter_direction;
-    }
+    // Directions are picked with a density proportional to their cosine with the normal, which
+    // cancels the cosine in the rendering equation
+    double u, v;
+    sampler.next_2d(u, v);
+    vec3 local = sample_cosine_hemisphere(static_cast<real>(u), static_cast<real>(v));
     interaction.additional_rays = true;
-    interaction.attenuation = albedo;
-    interaction.ray = Ray(intersect.point, scatter_direction);
+    interaction.attenuation = get_albedo(intersect);
+    interaction.ray = Ray(intersect.point, Frame(intersect.local_normal).to_world(local));
+    interaction.pdf = cosine_hemisphere_pdf(local.z);
+    interaction.diffuse = true;
     return interaction;
 }
 
-Metal::Metal() : albedo(color(0.5, 0.5, 0.5)), fuzziness(0.0) {}
+color LambertianDiffuse::evaluate(const Intersection &intersect, const vec3 &direction,
+                                  real &pdf) const
+{
+    real cosine = linalg::dot(intersect.local_normal, direction);
+    if (cosine <= 0)
+    {
+        pdf = 0;
+        return BLACK;
+    }
+    pdf = cosine_hemisphere_pdf(cosine);
+    return get_albedo(intersect) * pdf;
+}
 
-Metal::Metal(const color &albedo, double fuzziness)
-    : albedo(albedo), fuzziness(fuzziness < 1 ? fuzziness : 1)
+Metal::Metal()
+    : albedo(color(0.5, 0.5, 0.5)), fuzziness(0.0), albedo_texture(nullptr),
+      roughness_texture(nullptr), distribution(MicrofacetDistribution::GGX)
 {
 }
 
-MaterialInteraction Metal::interact(const RayParams params, const Intersection &intersect) const
+Metal::Metal(const color &albedo, real fuzziness, const ImageTexture *albedo_texture,
+             const ImageTexture *roughness_texture, MicrofacetDistribution distribution)
+    : albedo(albedo), fuzziness(fuzziness < 1 ? fuzziness : 1), albedo_texture(albedo_texture),
+      roughness_texture(roughness_texture), distribution(distribution)
+{
+}
+
+MaterialInteraction Metal::interact(const Intersection &intersect, Sampler &sampler) const
 {
     // Metals
     // ------
@@ -46,48 +64,92 @@ MaterialInteraction Metal::interact(const RayParams params, const Intersection &
     // laws of reflection. All rays which are incident with the same angle are reflected
     // with the same angle.
     MaterialInteraction interaction;
-    auto reflect_direction = reflect(intersect.ray.direction(), intersect.local_normal);
-    auto scattered = linalg::normalize(reflect_direction + fuzziness * random_in_unit_sphere());
-    // If the scattered ray passes into the surface, ignore it
-    if (linalg::dot(scattered, intersect.local_normal) < 0)
+    // Rough metals are made of tiny mirrors (microfacets), the ray is reflected about the normal
+    // of one of them, picked from the distribution of their normals
+    real fuzz = roughness(intersect);
+    double u, v;
+    sampler.next_2d(u, v);
+    vec3 local = sample_microfacet(distribution, fuzz, static_cast<real>(u), static_cast<real>(v));
+    vec3 microfacet = Frame(intersect.local_normal).to_world(local);
+    auto scattered = reflect(intersect.ray.direction(), microfacet);
+    real cos_in = linalg::dot(-intersect.ray.direction(), intersect.local_normal);
+    real cos_out = linalg::dot(scattered, intersect.local_normal);
+    real cos_half = linalg::dot(scattered, microfacet);
+    interaction.pdf = 0;
+    interaction.diffuse = false;
+    // If the scattered ray passes into the surface, or the microfacet faces away from the ray,
+    // ignore it
+    if (cos_out < 0 || (fuzz > 0 && (cos_in <= 0 || cos_half <= 0)))
     {
         interaction.additional_rays = false;
         interaction.attenuation = BLACK;
+        return interaction;
     }
-    else
+    interaction.additional_rays = true;
+    interaction.ray = Ray(intersect.point, scattered);
+    interaction.attenuation = get_albedo(intersect);
+    if (fuzz > 0)
     {
-        interaction.additional_rays = true;
-        interaction.ray = Ray(intersect.point, scattered);
-        interaction.attenuation = albedo;
+        // The BRDF times the cosine, divided by the density of the reflection, leaves the
+        // microfacets which are neither masked nor shadowed (G) and the Jacobian of the reflection
+        real g = microfacet_masking(distribution, fuzz, cos_in) *
+                 microfacet_masking(distribution, fuzz, cos_out);
+        interaction.attenuation *= g * cos_half / (cos_in * local.z);
+        interaction.pdf = microfacet_reflection_pdf(microfacet_pdf(distribution, fuzz, local.z),
+                                                    cos_half);
     }
     return interaction;
 }
 
+color Metal::evaluate(const Intersection &intersect, const vec3 &direction, real &pdf) const
+{
+    real fuzz = roughness(intersect);
+    vec3 incoming = -intersect.ray.direction();
+    real cos_in = linalg::dot(incoming, intersect.local_normal);
+    real cos_out = linalg::dot(direction, intersect.local_normal);
+    pdf = 0;
+    if (fuzz <= 0 || cos_in <= 0 || cos_out <= 0)
+        return BLACK;
+    // The only microfacets which reflect the ray into the direction are those along the half
+    // vector
+    vec3 microfacet = linalg::normalize(incoming + direction);
+    real cos_normal = linalg::dot(microfacet, intersect.local_normal);
+    real cos_half = linalg::dot(direction, microfacet);
+    real d = microfacet_distribution(distribution, fuzz, cos_normal);
+    pdf = microfacet_reflection_pdf(d * cos_normal, cos_half);
+    real g = microfacet_masking(distribution, fuzz, cos_in) *
+             microfacet_masking(distribution, fuzz, cos_out);
+    // D G / (4 cos_in cos_out), times cos_out
+    return get_albedo(intersect) * (d * g / (4 * cos_in));
+}
+
 Glass::Glass() : albedo(WHITE), r_index(1.5) {}
 
-Glass::Glass(const color &albedo, double r_index) : albedo(albedo), r_index(r_index) {}
+Glass::Glass(const color &albedo, real r_index) : albedo(albedo), r_index(r_index) {}
 
-MaterialInteraction Glass::interact(const RayParams params, const Intersection &intersect) const
+MaterialInteraction Glass::interact(const Intersection &intersect, Sampler &sampler) const
 {
     MaterialInteraction interaction;
     interaction.attenuation = albedo;
     interaction.additional_rays = true;
+    interaction.pdf = 0;
+    interaction.diffuse = false;
 
-    double cos_theta = fmin(linalg::dot(-params.ray.direction(), intersect.local_normal), 1.0);
-    double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+    real cos_theta = fmin(linalg::dot(-intersect.ray.direction(), intersect.local_normal), 1.0);
+    real sin_theta = sqrt(1.0 - cos_theta * cos_theta);
     // Calculate the refractive index
-    double ri = intersect.front ? (1.0 / r_index) : r_index;
+    real ri = intersect.front ? (1.0 / r_index) : r_index;
     // Also apply schlick approximation
-    if (ri * sin_theta > 1.0 || schlick_reflects(cos_theta, ri))
+    if (ri * sin_theta > 1.0 || schlick_reflects(cos_theta, ri, sampler.uniform()))
     {
         // There is no solution to Snell's law, so only reflection is possible
-        auto reflected = reflect(params.ray.direction(), intersect.local_normal);
+        auto reflected = reflect(intersect.ray.direction(), intersect.local_normal);
         interaction.ray = Ray(intersect.point, reflected);
     }
     else
     {
         // The ray gets refracted
-        auto refracted = refract(params.ray.direction(), intersect.local_normal, ri);
+        auto refracted = refract(intersect.ray.direction(), intersect.local_normal, ri);
         interaction.ray = Ray(intersect.point, refracted);
     }
 
@@ -2,6 +2,9 @@
 #pragma once
 #include "colors.hpp"
 #include "commons.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
+#include "texture.hpp"
 
 struct MaterialInteraction
 {
@@ -11,77 +14,273 @@ struct MaterialInteraction
     Ray ray;
     // Color due to this material
     color attenuation;
+    // Probability density (per unit solid angle) with which the direction of ray was chosen. 0 if
+    // the direction was not chosen from a known distribution (mirrors, glass), lights are then not
+    // sampled at this point.
+    real pdf;
+    // true if the material scatters light over the whole hemisphere, the features of the
+    // denoiser are taken at such surfaces and the cone of rays of the path opens there
+    bool diffuse;
 };
 
-// An abstract class for any material
-class Material
-{
-  public:
-    virtual MaterialInteraction interact(const RayParams params,
-                                         const Intersection &intersect) const = 0;
-
-    virtual ~Material() {}
-};
+// The materials are plain values without virtual functions, Material below holds any one of them
 
-class LambertianDiffuse : public Material
+class LambertianDiffuse
 {
   public:
     // By default the color of the material is gray, (0.5, 0.5, 0.5)
     LambertianDiffuse();
 
-    LambertianDiffuse(const color &albedo);
+    /// @param albedo_texture If not null, the albedo is multiplied by the texture, which must
+    /// outlive the material
+    LambertianDiffuse(const color &albedo, const ImageTexture *albedo_texture = nullptr);
+
+    MaterialInteraction interact(const Intersection &intersect, Sampler &sampler) const;
 
-    MaterialInteraction interact(const RayParams params,
-                                 const Intersection &intersect) const override;
+    /// @brief Evaluates the material for light leaving the intersection in the given direction
+    /// @param direction Unit vector pointing away from the surface
+    /// @param pdf Set to the probability density with which interact() picks this direction
+    /// @return The BRDF multiplied by the cosine of the angle with the normal
+    color evaluate(const Intersection &intersect, const vec3 &direction, real &pdf) const;
+
+    /// @return Albedo at the intersection
+    color get_albedo(const Intersection &intersect) const
+    {
+        return albedo_texture ? linalg::cmul(albedo, albedo_texture->sample(intersect)) : albedo;
+    }
 
   private:
     // Albedo or color of this material
     color albedo;
+    const ImageTexture *albedo_texture;
 };
 
-class NormalShader : public Material
+class NormalShader
 {
   public:
-    MaterialInteraction interact(const RayParams params,
-                                 const Intersection &intersect) const override
+    MaterialInteraction interact(const Intersection &intersect, Sampler &sampler) const
     {
 
         // Shade the normals
         MaterialInteraction interaction;
-        auto v = 0.5 * (intersect.local_normal + vec3(1, 1, 1));
+        color v = real(0.5) * (intersect.local_normal + vec3(1, 1, 1));
         interaction.additional_rays = false;
         interaction.attenuation = v;
+        interaction.pdf = 0;
+        interaction.diffuse = false;
         return interaction;
     }
 };
 
-class Metal : public Material
+class Metal
 {
   public:
     // By default the color of the material is gray
     Metal();
 
-    Metal(const color &albedo, double fuzziness = 0.0);
+    /// @param fuzziness Roughness (alpha) of the microfacets, 0 is a perfect mirror
+    /// @param albedo_texture If not null, the albedo is multiplied by the texture
+    /// @param roughness_texture If not null, the fuzziness is multiplied by the red channel of the
+    /// texture. The textures must outlive the material.
+    /// @param distribution Distribution of the normals of the microfacets
+    Metal(const color &albedo, real fuzziness = 0.0, const ImageTexture *albedo_texture = nullptr,
+          const ImageTexture *roughness_texture = nullptr,
+          MicrofacetDistribution distribution = MicrofacetDistribution::GGX);
+
+    MaterialInteraction interact(const Intersection &intersect, Sampler &sampler) const;
 
-    MaterialInteraction interact(const RayParams params,
-                                 const Intersection &intersect) const override;
+    /// @brief Evaluates the microfacet BRDF (Walter et al.) for light leaving the intersection in
+    /// the given direction, perfect mirrors reflect a single direction and return black
+    /// @param direction Unit vector pointing away from the surface
+    /// @param pdf Set to the probability density with which interact() picks this direction
+    /// @return The BRDF multiplied by the cosine of the angle with the normal
+    color evaluate(const Intersection &intersect, const vec3 &direction, real &pdf) const;
+
+    /// @return Albedo at the intersection
+    color get_albedo(const Intersection &intersect) const
+    {
+        return albedo_texture ? linalg::cmul(albedo, albedo_texture->sample(intersect)) : albedo;
+    }
 
   private:
     // Albedo or color of this material
     color albedo;
-    double fuzziness;
+    real fuzziness;
+    const ImageTexture *albedo_texture;
+    const ImageTexture *roughness_texture;
+    MicrofacetDistribution distribution;
+
+    /// @return Roughness (alpha) at the intersection
+    real roughness(const Intersection &intersect) const
+    {
+        return roughness_texture ? fuzziness * roughness_texture->sample(intersect).x : fuzziness;
+    }
 };
 
-class Glass : public Material
+class Glass
 {
   public:
     Glass();
-    Glass(const color &albedo, double r_index = 1.5);
-    MaterialInteraction interact(const RayParams params,
-                                 const Intersection &intersect) const override;
+    Glass(const color &albedo, real r_index = 1.5);
+    MaterialInteraction interact(const Intersection &intersect, Sampler &sampler) const;
+
+    color get_albedo() const { return albedo; }
 
   private:
     // Albedo or color of this material
     color albedo;
-    double r_index;
-};
\ No newline at end of file
+    real r_index;
+};
+
+// A light source, the front side of the surface emits light of the given radiance. It does not
+// reflect any light.
+class Emissive
+{
+  public:
+    Emissive(const color &radiance) : radiance(radiance) {}
+
+    MaterialInteraction interact(const Intersection &intersect, Sampler &sampler) const
+    {
+        MaterialInteraction interaction;
+        interaction.additional_rays = false;
+        interaction.attenuation = BLACK;
+        interaction.pdf = 0;
+        interaction.diffuse = false;
+        return interaction;
+    }
+
+    color get_radiance() const { return radiance; }
+
+  private:
+    color radiance;
+};
+
+// Any of the materials above, stored by value with a tag which tells which one it is. Calls to
+// interact are dispatched with a switch on the tag instead of a virtual call, and the materials of
+// a scene can be stored next to each other in a single array.
+class Material
+{
+  public:
+    enum Type
+    {
+        LAMBERTIAN,
+        NORMAL,
+        METAL,
+        GLASS,
+        EMISSIVE
+    };
+
+    Material(const LambertianDiffuse &m) : type(LAMBERTIAN), lambertian(m) {}
+
+    Material(const NormalShader &m) : type(NORMAL), normal(m) {}
+
+    Material(const Metal &m) : type(METAL), metal(m) {}
+
+    Material(const Glass &m) : type(GLASS), glass(m) {}
+
+    Material(const Emissive &m) : type(EMISSIVE), emissive(m) {}
+
+    Type get_type() const { return type; }
+
+    /// @brief Computes how the ray which produced the intersection interacts with this material
+    MaterialInteraction interact(const Intersection &intersect, Sampler &sampler) const
+    {
+        switch (type)
+        {
+        case LAMBERTIAN:
+            return lambertian.interact(intersect, sampler);
+        case METAL:
+            return metal.interact(intersect, sampler);
+        case GLASS:
+            return glass.interact(intersect, sampler);
+        case EMISSIVE:
+            return emissive.interact(intersect, sampler);
+        default:
+            return normal.interact(intersect, sampler);
+        }
+    }
+
+    /// @brief Same as interact, for count intersections which all have this material. The type is
+    /// checked once, so the loop runs the code of a single material.
+    /// @param samplers Sampler of the path of each intersection
+    void interact(const Intersection *intersects, Sampler *const *samplers,
+                  MaterialInteraction *interactions, int count) const
+    {
+        switch (type)
+        {
+        case LAMBERTIAN:
+            interact_all(lambertian, intersects, samplers, interactions, count);
+            break;
+        case METAL:
+            interact_all(metal, intersects, samplers, interactions, count);
+            break;
+        case GLASS:
+            interact_all(glass, intersects, samplers, interactions, count);
+            break;
+        case EMISSIVE:
+            interact_all(emissive, intersects, samplers, interactions, count);
+            break;
+        default:
+            interact_all(normal, intersects, samplers, interactions, count);
+            break;
+        }
+    }
+
+    /// @brief Evaluates the material for light leaving the intersection in the given direction,
+    /// only diffuse materials and rough metals can be evaluated, the others return black with a
+    /// pdf of 0
+    /// @see LambertianDiffuse::evaluate, Metal::evaluate
+    color evaluate(const Intersection &intersect, const vec3 &direction, real &pdf) const
+    {
+        if (type == LAMBERTIAN)
+            return lambertian.evaluate(intersect, direction, pdf);
+        if (type == METAL)
+            return metal.evaluate(intersect, direction, pdf);
+        pdf = 0;
+        return BLACK;
+    }
+
+    /// @return Radiance emitted by the front side of the surface, black if the material is not a
+    /// light
+    color emission() const { return type == EMISSIVE ? emissive.get_radiance() : BLACK; }
+
+    /// @return Color of the surface at the intersection, white for materials without one (lights,
+    /// normals)
+    color albedo(const Intersection &intersect) const
+    {
+        switch (type)
+        {
+        case LAMBERTIAN:
+            return lambertian.get_albedo(intersect);
+        case METAL:
+            return metal.get_albedo(intersect);
+        case GLASS:
+            return glass.get_albedo();
+        default:
+            return WHITE;
+        }
+    }
+
+  private:
+    Type type;
+
+    template <typename M>
+    static void interact_all(const M &material, const Intersection *intersects,
+                             Sampler *const *samplers, MaterialInteraction *interactions, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            interactions[i] = material.interact(intersects[i], *samplers[i]);
+        }
+    }
+
+    // All the materials are trivially copyable, so the union needs no special members
+    union
+    {
+        LambertianDiffuse lambertian;
+        NormalShader normal;
+        Metal metal;
+        Glass glass;
+        Emissive emissive;
+    };
+};
@@ -0,0 +1,193 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "mesh.hpp"
+#include "stats.hpp"
+#include <utility>
+
+// Rays which are almost parallel to the plane of a triangle do not hit it
+#ifdef RAYTRACER_FLOAT
+const real TRIANGLE_PARALLEL_EPSILON = 1e-8f;
+#else
+const real TRIANGLE_PARALLEL_EPSILON = 1e-12;
+#endif
+
+TriangleMesh::TriangleMesh(MeshData data, int material_id)
+    : data(std::move(data)), material_id(material_id)
+{
+    bvh = build_bvh(this->data);
+    store_triangles();
+}
+
+TriangleMesh::TriangleMesh(MeshData data, BVH bvh, int material_id)
+    : data(std::move(data)), bvh(std::move(bvh)), material_id(material_id)
+{
+    store_triangles();
+}
+
+BVH TriangleMesh::build_bvh(const MeshData &data)
+{
+    size_t count = data.triangle_count();
+    std::vector<AABB> boxes(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            boxes[i].expand(data.positions[data.position_indices[3 * i + k]]);
+        }
+    }
+    BVH bvh;
+    bvh.build(boxes);
+    return bvh;
+}
+
+void TriangleMesh::store_triangles()
+{
+    const MeshData &d = data;
+    // Store the triangles in the order in which the leaves refer to them, so that the triangles
+    // of a leaf are next to each other in memory
+    const auto &order = bvh.primitive_indices();
+    triangles.resize(order.size());
+    triangle_ids.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        int id = order[i];
+        vec3 p0 = d.positions[d.position_indices[3 * id]];
+        vec3 p1 = d.positions[d.position_indices[3 * id + 1]];
+        vec3 p2 = d.positions[d.position_indices[3 * id + 2]];
+        triangles[i].v0 = p0;
+        triangles[i].edge1 = p1 - p0;
+        triangles[i].edge2 = p2 - p0;
+        triangle_ids[i] = id;
+    }
+}
+
+Intersection TriangleMesh::intersect(const RayParams &params) const
+{
+    ObjectHit hit;
+    if (!this->hit(params, hit))
+    {
+        Intersection details;
+        details.occured = false;
+        return details;
+    }
+    return surface(params.ray, hit);
+}
+
+bool TriangleMesh::hit(const RayParams &params, ObjectHit &hit) const
+{
+    const vec3 origin = params.ray.origin();
+    const vec3 direction = params.ray.direction();
+    real t_max = params.t_max;
+    int closest = -1;
+    real closest_u = 0, closest_v = 0;
+    RenderStats *stats = thread_stats();
+    bvh.traverse(params.ray, params.t_min, t_max, [&](int first, int count, real lo, real &hi) {
+        if (stats)
+            stats->intersection_tests += count;
+        bool hit = false;
+        for (int i = first; i < first + count; ++i)
+        {
+            // Möller–Trumbore, solves origin + t * direction = v0 + u * edge1 + v * edge2
+            const Triangle &tri = triangles[i];
+            vec3 p = linalg::cross(direction, tri.edge2);
+            real det = linalg::dot(tri.edge1, p);
+            if (std::fabs(det) < TRIANGLE_PARALLEL_EPSILON)
+                continue;
+            real inv_det = 1 / det;
+            vec3 s = origin - tri.v0;
+            real u = linalg::dot(s, p) * inv_det;
+            if (u < 0 || u > 1)
+                continue;
+            vec3 q = linalg::cross(s, tri.edge1);
+            real v = linalg::dot(direction, q) * inv_det;
+            if (v < 0 || u + v > 1)
+                continue;
+            real t = linalg::dot(tri.edge2, q) * inv_det;
+            if (t < lo || t >= hi)
+                continue;
+            hi = t;
+            closest = i;
+            closest_u = u;
+            closest_v = v;
+            hit = true;
+        }
+        return hit;
+    });
+    if (closest == -1)
+        return false;
+    hit.t = t_max;
+    hit.triangle = closest;
+    hit.u = closest_u;
+    hit.v = closest_v;
+    return true;
+}
+
+Intersection TriangleMesh::surface(const Ray &ray, const ObjectHit &hit) const
+{
+    const int index = hit.triangle;
+    const real t = hit.t, u = hit.u, v = hit.v;
+    const Triangle &tri = triangles[index];
+    Intersection details;
+    details.occured = true;
+    details.parametric = t;
+    details.point = ray.at(t);
+    details.ray = ray;
+    details.material_id = material_id;
+    // The geometric normal decides which side of the triangle the ray is on, the winding of the
+    // vertices (counter clockwise seen from outside) gives the outward side
+    vec3 cross = linalg::cross(tri.edge1, tri.edge2);
+    real area = linalg::length(cross);
+    vec3 geometric = cross / area;
+    details.o_normal = geometric;
+    texture_coordinates(details, triangle_ids[index], u, v, area);
+    if (!data.normal_indices.empty())
+    {
+        int id = triangle_ids[index];
+        int n0 = data.normal_indices[3 * id];
+        int n1 = data.normal_indices[3 * id + 1];
+        int n2 = data.normal_indices[3 * id + 2];
+        if (n0 >= 0 && n1 >= 0 && n2 >= 0)
+        {
+            vec3 n = (1 - u - v) * data.normals[n0] + u * data.normals[n1] +
+                     v * data.normals[n2];
+            if (!is_zero_vector(n))
+            {
+                n = linalg::normalize(n);
+                // Keep the interpolated normal on the same side as the triangle
+                details.o_normal = (linalg::dot(n, geometric) < 0) ? -n : n;
+            }
+        }
+    }
+    details.front = linalg::dot(geometric, ray.direction()) < 0.0;
+    details.local_normal = details.front ? details.o_normal : -details.o_normal;
+    return details;
+}
+
+void TriangleMesh::texture_coordinates(Intersection &details, int id, real u, real v,
+                                       real area) const
+{
+    details.spherical_uv = false;
+    details.cone_width = 0;
+    if (!data.texcoord_indices.empty())
+    {
+        int t0 = data.texcoord_indices[3 * id];
+        int t1 = data.texcoord_indices[3 * id + 1];
+        int t2 = data.texcoord_indices[3 * id + 2];
+        if (t0 >= 0 && t1 >= 0 && t2 >= 0)
+        {
+            const vec2 &uv0 = data.texcoords[t0];
+            vec2 e1 = data.texcoords[t1] - uv0;
+            vec2 e2 = data.texcoords[t2] - uv0;
+            vec2 uv = uv0 + u * e1 + v * e2;
+            details.u = uv.x;
+            details.v = uv.y;
+            // Ratio of the areas of the triangle in space and in texture coordinates
+            real uv_area = std::fabs(linalg::cross(e1, e2));
+            details.uv_scale = uv_area > 0 ? std::sqrt(area / uv_area) : std::sqrt(area);
+            return;
+        }
+    }
+    // Without texture coordinates the texture is stretched over every triangle
+    details.u = u;
+    details.v = v;
+    details.uv_scale = std::sqrt(area);
+}
@@ -0,0 +1,93 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Triangle meshes, every mesh has its own BVH over its triangles, and is placed as a single object
+// in the BVH of the scene
+#pragma once
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "commons.hpp"
+#include <stdint.h>
+#include <vector>
+
+// Vertices and faces of a mesh, vertices are shared by the triangles which use them
+struct MeshData
+{
+    std::vector<vec3> positions;
+    // Vertex normals, may be empty
+    std::vector<vec3> normals;
+    // Vertex texture coordinates, may be empty
+    std::vector<vec2> texcoords;
+    // Three indices into positions for every triangle
+    std::vector<int32_t> position_indices;
+    // Three indices into normals for every triangle, -1 for vertices without a normal. Empty if
+    // the mesh has no normals
+    std::vector<int32_t> normal_indices;
+    // Three indices into texcoords for every triangle, -1 for vertices without texture
+    // coordinates. Empty if the mesh has none, the barycentric coordinates are used instead
+    std::vector<int32_t> texcoord_indices;
+
+    size_t triangle_count() const { return position_indices.size() / 3; }
+};
+
+// An indexed triangle mesh with a single material. Rays are intersected with the triangles using
+// the Möller–Trumbore algorithm.
+class TriangleMesh
+{
+  private:
+    // A triangle stored as one vertex and the two edges starting from it, which is what the
+    // intersection test needs
+    struct Triangle
+    {
+        vec3 v0;
+        vec3 edge1;
+        vec3 edge2;
+    };
+
+    MeshData data;
+    // The triangles, in the order of the leaves of the BVH
+    std::vector<Triangle> triangles;
+    // Index (in data) of each triangle of triangles
+    std::vector<int32_t> triangle_ids;
+    BVH bvh;
+    int material_id;
+
+    /// @brief Sets the texture coordinates of an intersection with the triangle id (in data) at
+    /// barycentric coordinates (u, v)
+    /// @param area Twice the area of the triangle
+    void texture_coordinates(Intersection &details, int id, real u, real v, real area) const;
+
+    /// @brief Stores the triangles in the order of the leaves of the BVH
+    void store_triangles();
+
+  public:
+    /// @brief Creates the mesh and builds its BVH
+    /// @param data Vertices and triangles of the mesh
+    /// @param material_id index of the material of the mesh in the materials array/vector
+    TriangleMesh(MeshData data, int material_id);
+
+    /// @brief Creates the mesh with a BVH built earlier by build_bvh for the same data, for
+    /// example read from the scene cache
+    TriangleMesh(MeshData data, BVH bvh, int material_id);
+
+    /// @brief Builds the BVH over the triangles of a mesh
+    static BVH build_bvh(const MeshData &data);
+
+    /// @brief Finds the closest intersection between the triangles of this mesh and the ray
+    Intersection intersect(const RayParams &params) const;
+
+    /// @brief Finds the closest triangle which is hit by the ray, without computing the details
+    /// @param hit Set to the distance, the triangle and the barycentric coordinates of the hit
+    /// @return true if a triangle is hit between t_min and t_max (excluded)
+    bool hit(const RayParams &params, ObjectHit &hit) const;
+
+    /// @brief Computes the details of a hit found by hit()
+    Intersection surface(const Ray &ray, const ObjectHit &hit) const;
+
+    /// @return Bounding box of all the triangles
+    AABB bounds() const { return bvh.bounds(); }
+
+    size_t triangle_count() const { return triangles.size(); }
+
+    const MeshData &mesh_data() const { return data; }
+
+    const BVH &get_bvh() const { return bvh; }
+};
@@ -0,0 +1,216 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#ifndef _WIN32
+
+#include "network.hpp"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const uint32_t MESSAGE_MAGIC = 0x52544d53;
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+std::string socket_error(const std::string &what) { return what + ": " + strerror(errno); }
+
+Connection::~Connection() { close(fd); }
+
+void Connection::send(uint32_t type, const std::vector<char> &payload)
+{
+    MessageHeader header;
+    header.magic = MESSAGE_MAGIC;
+    header.type = type;
+    header.size = payload.size();
+    std::vector<char> data(reinterpret_cast<const char *>(&header),
+                           reinterpret_cast<const char *>(&header) + sizeof(header));
+    data.insert(data.end(), payload.begin(), payload.end());
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw std::runtime_error(socket_error("Cannot send a message"));
+        sent += n;
+    }
+}
+
+bool Connection::receive_available()
+{
+    char chunk[1 << 16];
+    ssize_t n;
+    do
+    {
+        n = recv(fd, chunk, sizeof(chunk), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        throw std::runtime_error(socket_error("Cannot receive a message"));
+    buffer.insert(buffer.end(), chunk, chunk + n);
+    return n > 0;
+}
+
+bool Connection::next_message(Message &message)
+{
+    if (buffer.size() < sizeof(MessageHeader))
+        return false;
+    MessageHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (header.magic != MESSAGE_MAGIC)
+        throw std::runtime_error("Invalid message, the other end may use another byte order");
+    if (header.size > MAX_MESSAGE_SIZE)
+        throw std::runtime_error("Message too large");
+    if (buffer.size() - sizeof(header) < header.size)
+        return false;
+    message.type = header.type;
+    auto begin = buffer.begin() + sizeof(header);
+    message.payload.assign(begin, begin + header.size);
+    buffer.erase(buffer.begin(), begin + header.size);
+    return true;
+}
+
+bool Connection::receive(Message &message)
+{
+    while (!next_message(message))
+    {
+        if (!receive_available())
+            return false;
+    }
+    return true;
+}
+
+static void set_socket_options(int fd, int family)
+{
+    int one = 1;
+    if (family != AF_UNIX)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+int open_socket(const std::string &address, bool listening)
+{
+    const std::string unix_prefix = "unix:";
+    if (address.compare(0, unix_prefix.size(), unix_prefix) == 0)
+    {
+        std::string path = address.substr(unix_prefix.size());
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("Invalid Unix socket path: " + path);
+        memcpy(addr.sun_path, path.c_str(), path.size());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::runtime_error(socket_error("Cannot create a socket"));
+        int result;
+        if (listening)
+        {
+            // A socket file left behind by an earlier process would make bind fail
+            unlink(path.c_str());
+            result = bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+            if (result == 0)
+                result = listen(fd, SOMAXCONN);
+        }
+        else
+        {
+            result = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        }
+        if (result != 0)
+        {
+            std::string error = socket_error("Cannot open " + address);
+            close(fd);
+            throw std::runtime_error(error);
+        }
+        set_socket_options(fd, AF_UNIX);
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error("Invalid address (expected unix:<path> or <host>:<port>): " +
+                                 address);
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    // Brackets around IPv6 addresses
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    bool any_host = host.empty() || host == "*";
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (listening)
+        hints.ai_flags = AI_PASSIVE;
+    addrinfo *addresses = nullptr;
+    int status =
+        getaddrinfo(any_host ? (listening ? nullptr : "localhost") : host.c_str(), port.c_str(),
+                    &hints, &addresses);
+    if (status != 0)
+        throw std::runtime_error("Cannot resolve " + address + ": " + gai_strerror(status));
+
+    int fd = -1;
+    std::string error = "Cannot open " + address;
+    for (addrinfo *a = addresses; a; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        int result;
+        if (listening)
+        {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            result = bind(fd, a->ai_addr, a->ai_addrlen);
+            if (result == 0)
+                result = listen(fd, SOMAXCONN);
+        }
+        else
+        {
+            result = connect(fd, a->ai_addr, a->ai_addrlen);
+        }
+        if (result == 0)
+        {
+            set_socket_options(fd, a->ai_family);
+            break;
+        }
+        error = socket_error("Cannot open " + address);
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0)
+        throw std::runtime_error(error);
+    return fd;
+}
+
+int accept_connection(int listener)
+{
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0)
+        return -1;
+    sockaddr_storage addr;
+    socklen_t length = sizeof(addr);
+    getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length);
+    set_socket_options(fd, addr.ss_family);
+    return fd;
+}
+
+void close_listener(int listener, const std::string &address)
+{
+    close(listener);
+    const std::string unix_prefix = "unix:";
+    if (address.compare(0, unix_prefix.size(), unix_prefix) == 0)
+        unlink(address.substr(unix_prefix.size()).c_str());
+}
+
+#endif
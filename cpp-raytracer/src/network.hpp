@@ -0,0 +1,161 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Messages sent over sockets, used by distributed rendering and by the render server. Every
+// message is a fixed header (magic number, type, size of the payload) followed by the payload.
+// Numbers are sent in the byte order of the machine, so both ends must have the same byte order,
+// the magic number detects a mismatch. Only available on POSIX systems.
+#pragma once
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Larger messages are treated as a corrupted stream
+const uint64_t MAX_MESSAGE_SIZE = uint64_t(1) << 30;
+
+struct MessageHeader
+{
+    uint32_t magic;
+    uint32_t type;
+    uint64_t size;
+};
+
+struct Message
+{
+    uint32_t type;
+    std::vector<char> payload;
+};
+
+// Builds the payload of a message
+class MessageWriter
+{
+  private:
+    std::vector<char> data;
+
+  public:
+    template <typename T> MessageWriter &write(const T &value)
+    {
+        const char *p = reinterpret_cast<const char *>(&value);
+        data.insert(data.end(), p, p + sizeof(T));
+        return *this;
+    }
+
+    template <typename T> MessageWriter &write_array(const T *values, size_t count)
+    {
+        const char *p = reinterpret_cast<const char *>(values);
+        data.insert(data.end(), p, p + count * sizeof(T));
+        return *this;
+    }
+
+    MessageWriter &write_string(const std::string &s)
+    {
+        write(static_cast<uint32_t>(s.size()));
+        data.insert(data.end(), s.begin(), s.end());
+        return *this;
+    }
+
+    const std::vector<char> &payload() const { return data; }
+};
+
+// Reads the payload of a message, reading past its end throws an exception
+class MessageReader
+{
+  private:
+    const std::vector<char> &data;
+    size_t position;
+
+    void check(size_t bytes) const
+    {
+        if (bytes > data.size() - position)
+            throw std::runtime_error("Truncated message");
+    }
+
+  public:
+    explicit MessageReader(const std::vector<char> &data) : data(data), position(0) {}
+
+    template <typename T> T read()
+    {
+        T value;
+        read_array(&value, 1);
+        return value;
+    }
+
+    template <typename T> void read_array(T *values, size_t count)
+    {
+        if (count > data.size() / sizeof(T))
+            throw std::runtime_error("Truncated message");
+        check(count * sizeof(T));
+        memcpy(values, data.data() + position, count * sizeof(T));
+        position += count * sizeof(T);
+    }
+
+    std::string read_string()
+    {
+        uint32_t size = read<uint32_t>();
+        check(size);
+        std::string s(data.data() + position, size);
+        position += size;
+        return s;
+    }
+
+    /// @brief Checks that the whole payload has been read
+    void finish() const
+    {
+        if (position != data.size())
+            throw std::runtime_error("Unexpected data at the end of a message");
+    }
+};
+
+// A connected socket which sends and receives whole messages
+class Connection
+{
+  private:
+    int fd;
+    // Bytes received which do not yet form a whole message
+    std::vector<char> buffer;
+
+  public:
+    explicit Connection(int fd) : fd(fd) {}
+
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    int descriptor() const { return fd; }
+
+    /// @brief Sends a message, waiting until all of it has been written to the socket
+    /// @throw std::runtime_error if the connection is broken
+    void send(uint32_t type, const std::vector<char> &payload = std::vector<char>());
+
+    /// @brief Reads the bytes which have arrived, waiting for at least one
+    /// @return false if the other end closed the connection
+    /// @throw std::runtime_error if the connection is broken
+    bool receive_available();
+
+    /// @brief Takes the next message out of the bytes received so far
+    /// @return false if no whole message has been received yet
+    /// @throw std::runtime_error if the bytes are not a valid message
+    bool next_message(Message &message);
+
+    /// @brief Waits for the next message
+    /// @return false if the other end closed the connection
+    bool receive(Message &message);
+};
+
+/// @return The description of errno, after what
+std::string socket_error(const std::string &what);
+
+/// @brief Opens a socket which listens on the address, or which is connected to it
+/// @param address "unix:<path>" for a Unix socket, or "<host>:<port>" for TCP, the host may be
+/// empty or * to listen on every interface (or to connect to localhost)
+/// @throw std::runtime_error if the address is invalid or the socket cannot be opened
+int open_socket(const std::string &address, bool listening);
+
+/// @brief Accepts a connection on a listening socket
+/// @return The connected socket, or -1 if no connection could be accepted
+int accept_connection(int listener);
+
+/// @brief Closes a listening socket opened by open_socket, and removes the file of a Unix socket
+void close_listener(int listener, const std::string &address);
@@ -0,0 +1,201 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "obj_loader.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Size of the blocks in which the file is read, the buffer grows if a line is longer than this
+const size_t OBJ_BLOCK_SIZE = 1 << 20;
+
+static const char *skip_spaces(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        ++p;
+    return p;
+}
+
+/// @return true if the line starts with the keyword followed by a space
+static bool has_keyword(const char *line, const char *keyword)
+{
+    size_t n = strlen(keyword);
+    return strncmp(line, keyword, n) == 0 && (line[n] == ' ' || line[n] == '\t');
+}
+
+template <int N> static linalg::vec<real, N> parse_vec(const char *p)
+{
+    linalg::vec<real, N> v;
+    for (int i = 0; i < N; ++i)
+    {
+        char *end;
+        v[i] = strtod(p, &end);
+        if (end == p)
+            throw std::runtime_error("Expected a number");
+        p = end;
+    }
+    return v;
+}
+
+/// @brief Converts a 1 based (or negative, relative to the end) OBJ index to a 0 based index
+static int32_t resolve_index(long index, size_t count)
+{
+    long resolved = (index > 0) ? index - 1 : static_cast<long>(count) + index;
+    if (index == 0 || resolved < 0 || resolved >= static_cast<long>(count))
+        throw std::runtime_error("Index " + std::to_string(index) + " is out of range");
+    return static_cast<int32_t>(resolved);
+}
+
+/// @brief Appends the indices of a triangle to an optional array of indices (normals or texture
+/// coordinates), which is created the first time a vertex has an index
+static void add_optional(std::vector<int32_t> &indices, size_t triangles, const int32_t i[3])
+{
+    if (indices.empty())
+    {
+        if (i[0] < 0 && i[1] < 0 && i[2] < 0)
+            return;
+        // The first index, the triangles read so far have none
+        indices.assign(3 * triangles, -1);
+    }
+    indices.insert(indices.end(), i, i + 3);
+}
+
+static void add_triangle(MeshData &mesh, const int32_t p[3], const int32_t t[3],
+                         const int32_t n[3])
+{
+    size_t triangles = mesh.triangle_count();
+    add_optional(mesh.normal_indices, triangles, n);
+    add_optional(mesh.texcoord_indices, triangles, t);
+    mesh.position_indices.insert(mesh.position_indices.end(), p, p + 3);
+}
+
+/// @brief Parses the vertices of a face (v, v/vt, v//vn or v/vt/vn), and splits it into a fan of
+/// triangles
+static void parse_face(MeshData &mesh, const char *p)
+{
+    int32_t first_p = -1, first_t = -1, first_n = -1, prev_p = -1, prev_t = -1, prev_n = -1;
+    int vertices = 0;
+    while (*(p = skip_spaces(p)))
+    {
+        char *end;
+        long position = strtol(p, &end, 10);
+        if (end == p)
+            throw std::runtime_error("Expected a vertex index");
+        p = end;
+        long texcoord = 0, normal = 0;
+        if (*p == '/')
+        {
+            ++p;
+            // May be empty (v//vn)
+            texcoord = strtol(p, &end, 10);
+            p = end;
+            if (*p == '/')
+            {
+                ++p;
+                normal = strtol(p, &end, 10);
+                if (end == p)
+                    throw std::runtime_error("Expected a normal index");
+                p = end;
+            }
+        }
+        if (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+            throw std::runtime_error("Invalid face vertex");
+
+        int32_t current_p = resolve_index(position, mesh.positions.size());
+        int32_t current_t = (texcoord != 0) ? resolve_index(texcoord, mesh.texcoords.size()) : -1;
+        int32_t current_n = (normal != 0) ? resolve_index(normal, mesh.normals.size()) : -1;
+        if (vertices == 0)
+        {
+            first_p = current_p;
+            first_t = current_t;
+            first_n = current_n;
+        }
+        else if (vertices >= 2)
+        {
+            const int32_t tri_p[3] = {first_p, prev_p, current_p};
+            const int32_t tri_t[3] = {first_t, prev_t, current_t};
+            const int32_t tri_n[3] = {first_n, prev_n, current_n};
+            add_triangle(mesh, tri_p, tri_t, tri_n);
+        }
+        prev_p = current_p;
+        prev_t = current_t;
+        prev_n = current_n;
+        vertices++;
+    }
+    if (vertices < 3)
+        throw std::runtime_error("A face needs at least 3 vertices");
+}
+
+static void parse_line(MeshData &mesh, const char *line)
+{
+    line = skip_spaces(line);
+    if (has_keyword(line, "v"))
+        mesh.positions.push_back(parse_vec<3>(line + 1));
+    else if (has_keyword(line, "vn"))
+        mesh.normals.push_back(parse_vec<3>(line + 2));
+    else if (has_keyword(line, "vt"))
+        mesh.texcoords.push_back(parse_vec<2>(line + 2));
+    else if (has_keyword(line, "f"))
+        parse_face(mesh, line + 1);
+    // Everything else (comments, groups, materials, ...) is ignored, and so is the optional third
+    // texture coordinate
+}
+
+MeshData load_obj(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+        throw std::runtime_error("Could not open mesh file " + filename);
+
+    MeshData mesh;
+    // One extra byte so that the last line can always be terminated
+    std::vector<char> buffer(OBJ_BLOCK_SIZE + 1);
+    size_t filled = 0;
+    int line_number = 0;
+    bool eof = false;
+    try
+    {
+        while (!eof)
+        {
+            size_t n = fread(buffer.data() + filled, 1, buffer.size() - 1 - filled, file);
+            if (n == 0)
+            {
+                if (ferror(file))
+                    throw std::runtime_error("Error while reading the file");
+                eof = true;
+            }
+            filled += n;
+
+            // Parse the complete lines in place, the incomplete last line is kept for the next
+            // block
+            char *start = buffer.data();
+            char *end = start + filled;
+            while (start < end)
+            {
+                char *newline = static_cast<char *>(memchr(start, '\n', end - start));
+                if (newline == NULL)
+                {
+                    if (!eof)
+                        break;
+                    newline = end;
+                }
+                *newline = '\0';
+                line_number++;
+                parse_line(mesh, start);
+                start = newline + 1;
+            }
+            if (start > end)
+                start = end;
+            filled = end - start;
+            memmove(buffer.data(), start, filled);
+            // A single line which does not fit in the buffer
+            if (filled == buffer.size() - 1)
+                buffer.resize(buffer.size() * 2);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fclose(file);
+        throw std::runtime_error(filename + ":" + std::to_string(line_number) + ": " + e.what());
+    }
+    fclose(file);
+    return mesh;
+}
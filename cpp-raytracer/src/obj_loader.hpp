@@ -0,0 +1,14 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Reading triangle meshes from Wavefront OBJ files
+#pragma once
+#include "mesh.hpp"
+#include <stdexcept>
+#include <string>
+
+/// @brief Reads the vertices, vertex normals, texture coordinates and faces of an OBJ file. The
+/// file is read in large blocks and parsed in place, the only allocations are the growth of the
+/// arrays of the mesh, so meshes with millions of triangles load quickly. Polygons are split into
+/// triangles, objects, groups and materials are ignored.
+/// @throws std::runtime_error if the file cannot be read or is not valid, the message contains the
+/// line number
+MeshData load_obj(const std::string &filename);
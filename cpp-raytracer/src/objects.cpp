@@ -1,50 +1,69 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #include "objects.hpp"
 
-Sphere::Sphere() : center(vec3(0, 0, 0)), radius(0), material_id(0) {}
+Sphere::Sphere() : Sphere(vec3(0, 0, 0), 0, 0) {}
 
-Sphere::Sphere(vec3 center, double radius, int material_id)
-    : center(center), radius(radius), material_id(material_id)
+Sphere::Sphere(vec3 center, real radius, int material_id)
+    : center(center), radius(radius), radius2(radius * radius),
+      inv_radius(radius != 0 ? 1 / radius : 0), material_id(material_id)
 {
 }
 
 Intersection Sphere::intersect(const RayParams &params) const
 {
-    Intersection details;
-    // No intersections are expected, so by default occured is set to false
-    details.occured = false;
-    auto ray = params.ray;
-    // Solving sphere-ray quadratic equation
-    vec3 AC = ray.origin() - center;
-    double a = linalg::dot(ray.direction(), ray.direction());
-    double b = 2.0 * linalg::dot(ray.direction(), AC);
-    double c = linalg::dot(AC, AC) - radius * radius;
-    double discriminant = b * b - 4 * a * c;
-    if (discriminant < 0)
+    real t;
+    if (!hit(params, t))
     {
-        // There is no solution, the ray does not intersect the sphere
+        Intersection details;
+        // There is no solution, or it is out of range
+        details.occured = false;
         return details;
     }
-    double sqd = std::sqrt(discriminant);
-    double root = (-b - sqd) / (2.0 * a);
-    // Check if the root does not lie within the given range
-    if (root < params.t_min || root > params.t_max)
-    {
-        root = (-b + sqd) / (2.0 * a);
-        // Check if the other root does not lie in the range
-        if (root < params.t_min || root > params.t_max)
-        {
-            // Both roots do not lie in range, there is no solution
-            return details;
-        }
-    }
+    return surface(params.ray, t);
+}
+
+bool Sphere::hit(const RayParams &params, real &t) const
+{
+    // Solving sphere-ray quadratic equation, in the form -h -+ sqrt(r^2 - |l|^2) where l is the
+    // vector from the center to the point of the ray closest to it. This is more precise than the
+    // textbook b^2 - 4ac when the sphere is small compared to its distance from the ray origin.
+    // The direction is normalized, so the a of the textbook is 1. These are the operations of
+    // SphereSet::closest_hit_scalar, so both give the same hits.
+    const vec3 origin = params.ray.origin();
+    const vec3 direction = params.ray.direction();
+    real ocx = origin.x - center.x;
+    real ocy = origin.y - center.y;
+    real ocz = origin.z - center.z;
+    real h = direction.x * ocx + direction.y * ocy + direction.z * ocz;
+    real lx = ocx - h * direction.x;
+    real ly = ocy - h * direction.y;
+    real lz = ocz - h * direction.z;
+    real discriminant = radius2 - (lx * lx + ly * ly + lz * lz);
+    if (!(discriminant >= 0))
+        return false;
+    real sqd = std::sqrt(discriminant);
+    t = -h - sqd;
+    if (!(t >= params.t_min))
+        t = -h + sqd;
+    return t >= params.t_min && t < params.t_max;
+}
+
+Intersection Sphere::surface(const Ray &ray, real t) const
+{
+    Intersection details;
     details.occured = true;
-    details.parametric = root;
-    details.point = ray.at(root);
+    details.parametric = t;
+    details.point = ray.at(t);
     // Find the outward normal or the normal which always points out of the sphere
-    details.o_normal = (details.point - center) / radius;
+    details.o_normal = (details.point - center) * inv_radius;
     details.material_id = material_id;
-    details.ray = params.ray;
+    details.ray = ray;
+    // The texture coordinates are the longitude and latitude of the normal, the equator is 2 pi r
+    // long and a meridian pi r
+    details.spherical_uv = true;
+    details.u = details.v = 0;
+    details.uv_scale = static_cast<real>(PI) * std::fabs(radius);
+    details.cone_width = 0;
     // Find the local normal, or the normal on the side of the ray
     if (linalg::dot(details.o_normal, ray.direction()) > 0.0)
     {
@@ -61,4 +80,10 @@ Intersection Sphere::intersect(const RayParams &params) const
     return details;
 }
 
+AABB Sphere::bounds() const
+{
+    vec3 r(std::fabs(radius), std::fabs(radius), std::fabs(radius));
+    return AABB(center - r, center + r);
+}
+
 void Sphere::set_material_id(int id) { material_id = id; }
\ No newline at end of file
@@ -1,23 +1,17 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #pragma once
+#include "aabb.hpp"
 #include "commons.hpp"
-#include <vector>
-
-// A class to represent any object which can be rendered on the screen
-class Object
-{
-  public:
-    virtual Intersection intersect(const RayParams &params) const = 0;
-
-    virtual ~Object() {}
-};
 
 // A class for a sphere object, has center, radius and material as parameters
-class Sphere : public Object
+class Sphere
 {
   private:
     vec3 center;
-    double radius;
+    real radius;
+    // Computed once from the radius, the hit test needs the square and the normal the inverse
+    real radius2;
+    real inv_radius;
     int material_id;
 
   public:
@@ -28,12 +22,33 @@ class Sphere : public Object
     /// @param center Center of the sphere
     /// @param radius Radius of the sphere
     /// @param material_id index of the material of the sphere in the materials array/vector
-    Sphere(vec3 center, double radius, int material_id);
+    Sphere(vec3 center, real radius, int material_id);
 
     /// @brief Finds the intersection between this sphere and the given ray
     /// @param RayParams Ray parameters, such as the ray, minimum allowed t and max allowed t
     Intersection intersect(const RayParams &params) const;
 
+    /// @brief Tests if the ray hits the sphere, without computing the details of the hit
+    /// Note: The direction of the ray must be normalized, as it is for every Ray
+    /// @param t Set to the distance of the hit, the nearer root unless it is before t_min. It is
+    /// also overwritten when the sphere is missed
+    /// @return true if the sphere is hit between t_min and t_max (excluded)
+    bool hit(const RayParams &params, real &t) const;
+
+    /// @brief Computes the details of an intersection which is already known to occur
+    /// @param ray The ray which hits the sphere
+    /// @param t Distance along the ray at which it hits the sphere
+    Intersection surface(const Ray &ray, real t) const;
+
+    vec3 get_center() const { return center; }
+
+    real get_radius() const { return radius; }
+
+    int get_material_id() const { return material_id; }
+
+    /// @return Bounding box of the sphere
+    AABB bounds() const;
+
     /// @brief Sets the material of the sphere from the materials array/vector
     void set_material_id(int id);
 };
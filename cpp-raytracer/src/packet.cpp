@@ -0,0 +1,39 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "packet.hpp"
+#include <cmath>
+
+PacketInterval::PacketInterval(const RayPacket &packet)
+    : origin_min(INF, INF, INF), origin_max(-INF, -INF, -INF), inv_min(INF, INF, INF),
+      inv_max(-INF, -INF, -INF), negative{false, false, false}, coherent(packet.size > 0)
+{
+    const real *origins[3] = {packet.origin_x, packet.origin_y, packet.origin_z};
+    const real *directions[3] = {packet.direction_x, packet.direction_y, packet.direction_z};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const real *origin = origins[axis];
+        const real *direction = directions[axis];
+        real *inv = inv_direction[axis];
+        real o_min = INF, o_max = -INF, i_min = INF, i_max = -INF;
+        int positive = 0, negative_count = 0;
+        for (int i = 0; i < packet.size; ++i)
+        {
+            // The same reciprocal as BVH::traverse, so that the bounds hold for its slab tests
+            inv[i] = static_cast<real>(1.0 / direction[i]);
+            o_min = std::min(o_min, origin[i]);
+            o_max = std::max(o_max, origin[i]);
+            i_min = std::min(i_min, inv[i]);
+            i_max = std::max(i_max, inv[i]);
+            positive += direction[i] > 0;
+            negative_count += direction[i] < 0;
+        }
+        origin_min[axis] = o_min;
+        origin_max[axis] = o_max;
+        inv_min[axis] = i_min;
+        inv_max[axis] = i_max;
+        negative[axis] = negative_count > 0;
+        // Infinite inverse directions (rays parallel to the axis) would give NaNs at the corners
+        if ((positive != packet.size && negative_count != packet.size) || std::isinf(i_min) ||
+            std::isinf(i_max))
+            coherent = false;
+    }
+}
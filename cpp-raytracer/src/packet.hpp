@@ -0,0 +1,135 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Packets of rays which are traced through the acceleration structure together. The camera rays
+// of a block of pixels start from (nearly) the same point and go in nearly the same direction, so
+// one test of a node of the BVH against the whole packet replaces a test per ray.
+#pragma once
+#include "aabb.hpp"
+#include "commons.hpp"
+#include <algorithm>
+
+// Side of the square block of pixels whose camera rays are put into one packet
+constexpr int RAY_PACKET_BLOCK = 8;
+// Maximum number of rays in a packet
+constexpr int RAY_PACKET_SIZE = RAY_PACKET_BLOCK * RAY_PACKET_BLOCK;
+
+// Up to RAY_PACKET_SIZE rays, stored as a structure of arrays so that the rays are generated and
+// bounded with loops that the compiler vectorizes. The directions are normalized.
+struct RayPacket
+{
+    int size;
+    real origin_x[RAY_PACKET_SIZE];
+    real origin_y[RAY_PACKET_SIZE];
+    real origin_z[RAY_PACKET_SIZE];
+    real direction_x[RAY_PACKET_SIZE];
+    real direction_y[RAY_PACKET_SIZE];
+    real direction_z[RAY_PACKET_SIZE];
+
+    RayPacket() : size(0) {}
+
+    /// @return Ray i of the packet
+    Ray ray(int i) const
+    {
+        return Ray(vec3(origin_x[i], origin_y[i], origin_z[i]),
+                   vec3(direction_x[i], direction_y[i], direction_z[i]), true);
+    }
+
+    /// @brief Stores a ray at index i, the direction must be normalized
+    void set(int i, const Ray &ray)
+    {
+        const vec3 origin = ray.origin();
+        const vec3 direction = ray.direction();
+        origin_x[i] = origin.x;
+        origin_y[i] = origin.y;
+        origin_z[i] = origin.z;
+        direction_x[i] = direction.x;
+        direction_y[i] = direction.y;
+        direction_z[i] = direction.z;
+    }
+};
+
+// The ranges of the origins and of the inverse directions of the rays of a packet. A box is tested
+// against the ranges with interval arithmetic, which gives bounds on where every ray of the packet
+// enters and leaves the box.
+struct PacketInterval
+{
+    vec3 origin_min, origin_max;
+    vec3 inv_min, inv_max;
+    // Reciprocals of the directions of every ray along x, y and z, computed as in BVH::traverse
+    real inv_direction[3][RAY_PACKET_SIZE];
+    // Sign of the directions along every axis, the same for all the rays of a coherent packet
+    bool negative[3];
+    // false if some rays go the opposite way of the others along an axis (or parallel to it), the
+    // ranges of the inverse directions are then unbounded and the rays must be traced one by one
+    bool coherent;
+
+    explicit PacketInterval(const RayPacket &packet);
+
+    /// @brief Conservative slab test of the whole packet, it never rejects a box which a ray of
+    /// the packet passes through according to AABB::hit (even with rounding)
+    /// @param t_max The largest t_max of the rays
+    /// @return false if no ray of the packet passes through the box between t_min and t_max
+    bool may_hit(const AABB &box, real t_min, real t_max) const
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // Distances from the origins to the planes of the box, over all the origins
+            real near_min = box.min[axis] - origin_max[axis];
+            real near_max = box.min[axis] - origin_min[axis];
+            real far_min = box.max[axis] - origin_max[axis];
+            real far_max = box.max[axis] - origin_min[axis];
+            if (negative[axis])
+            {
+                std::swap(near_min, far_min);
+                std::swap(near_max, far_max);
+            }
+            // The products are monotonic in both factors, so their bounds are at the corners
+            real entry = std::min(std::min(near_min * inv_min[axis], near_min * inv_max[axis]),
+                                  std::min(near_max * inv_min[axis], near_max * inv_max[axis]));
+            real exit = std::max(std::max(far_min * inv_min[axis], far_min * inv_max[axis]),
+                                 std::max(far_max * inv_min[axis], far_max * inv_max[axis]));
+            t_min = std::max(entry, t_min);
+            t_max = std::min(exit, t_max);
+            if (t_max < t_min)
+                return false;
+        }
+        return true;
+    }
+};
+
+/// @brief Slab tests of all the rays of a coherent packet against a box, with the same operations
+/// (and so the same results) as AABB::hit for every ray. All the rays go the same way, so the
+/// order of the planes is picked once for the packet and the loops over the rays are vectorized.
+/// @param t_max t_max of every ray
+/// @param hit Set to 1 for the rays which pass through the box between t_min and their t_max
+inline void packet_hits_box(const RayPacket &packet, const PacketInterval &interval,
+                            const AABB &box, real t_min, const real *t_max, char *hit)
+{
+    real near_t[RAY_PACKET_SIZE], far_t[RAY_PACKET_SIZE];
+    const real *origins[3] = {packet.origin_x, packet.origin_y, packet.origin_z};
+    // A local copy, the stores to hit could alias packet.size
+    const int size = packet.size;
+    for (int i = 0; i < size; ++i)
+    {
+        near_t[i] = t_min;
+        far_t[i] = t_max[i];
+    }
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const real near_plane = interval.negative[axis] ? box.max[axis] : box.min[axis];
+        const real far_plane = interval.negative[axis] ? box.min[axis] : box.max[axis];
+        const real *origin = origins[axis];
+        const real *inv = interval.inv_direction[axis];
+        for (int i = 0; i < size; ++i)
+        {
+            real t0 = (near_plane - origin[i]) * inv[i];
+            real t1 = (far_plane - origin[i]) * inv[i];
+            near_t[i] = t0 > near_t[i] ? t0 : near_t[i];
+            far_t[i] = t1 < far_t[i] ? t1 : far_t[i];
+        }
+    }
+    // AABB::hit returns as soon as t_max < t_min, the bounds only get tighter after that
+    for (int i = 0; i < size; ++i)
+    {
+        hit[i] = !(far_t[i] < near_t[i]);
+    }
+}
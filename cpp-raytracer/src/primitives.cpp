@@ -0,0 +1,208 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "primitives.hpp"
+#include "stats.hpp"
+#include <utility>
+
+/// @brief Rearranges the elements in place so that element i becomes the element which was at
+/// source[i], by following the cycles of the permutation
+template <typename T, typename Allocator>
+static void permute(std::vector<T, Allocator> &values, const std::vector<int> &source)
+{
+    std::vector<char> done(values.size(), 0);
+    for (size_t start = 0; start < values.size(); ++start)
+    {
+        if (done[start])
+            continue;
+        T first = std::move(values[start]);
+        size_t i = start;
+        while (true)
+        {
+            done[i] = 1;
+            size_t from = static_cast<size_t>(source[i]);
+            if (from == start)
+            {
+                values[i] = std::move(first);
+                break;
+            }
+            values[i] = std::move(values[from]);
+            i = from;
+        }
+    }
+}
+
+PrimitiveStore::PrimitiveStore(Arena &arena)
+    : spheres(ArenaAllocator<Sphere>(&arena)), meshes(ArenaAllocator<TriangleMesh>(&arena)),
+      instances(ArenaAllocator<Instance>(&arena)), slots(ArenaAllocator<PrimitiveRef>(&arena))
+{
+}
+
+void PrimitiveStore::reserve(size_t sphere_count, size_t mesh_count, size_t instance_count)
+{
+    spheres.reserve(spheres.size() + sphere_count);
+    meshes.reserve(meshes.size() + mesh_count);
+    instances.reserve(instances.size() + instance_count);
+    slots.reserve(slots.size() + sphere_count + mesh_count + instance_count);
+}
+
+void PrimitiveStore::add(const Sphere &sphere)
+{
+    slots.push_back({PrimitiveType::Sphere, static_cast<int32_t>(spheres.size())});
+    spheres.push_back(sphere);
+}
+
+void PrimitiveStore::add(TriangleMesh &&mesh)
+{
+    slots.push_back({PrimitiveType::Mesh, static_cast<int32_t>(meshes.size())});
+    meshes.push_back(std::move(mesh));
+}
+
+void PrimitiveStore::add(const Instance &instance)
+{
+    slots.push_back({PrimitiveType::Instance, static_cast<int32_t>(instances.size())});
+    instances.push_back(instance);
+}
+
+AABB PrimitiveStore::bounds(size_t slot) const
+{
+    const PrimitiveRef &ref = slots[slot];
+    switch (ref.type)
+    {
+    case PrimitiveType::Sphere:
+        return spheres[ref.index].bounds();
+    case PrimitiveType::Mesh:
+        return meshes[ref.index].bounds();
+    default:
+        return instances[ref.index].bounds();
+    }
+}
+
+std::vector<AABB> PrimitiveStore::all_bounds() const
+{
+    std::vector<AABB> boxes;
+    boxes.reserve(slots.size());
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        boxes.push_back(bounds(i));
+    }
+    return boxes;
+}
+
+Intersection PrimitiveStore::intersect(size_t slot, const RayParams &params) const
+{
+    const PrimitiveRef &ref = slots[slot];
+    switch (ref.type)
+    {
+    case PrimitiveType::Sphere:
+        return spheres[ref.index].intersect(params);
+    case PrimitiveType::Mesh:
+        return meshes[ref.index].intersect(params);
+    default:
+        return instances[ref.index].intersect(params);
+    }
+}
+
+bool PrimitiveStore::hit(size_t slot, const RayParams &params, ObjectHit &hit) const
+{
+    const PrimitiveRef &ref = slots[slot];
+    bool found;
+    switch (ref.type)
+    {
+    case PrimitiveType::Sphere:
+    {
+        // Sphere::hit sets t even when it misses, which must not overwrite the closest hit so far
+        real t;
+        found = spheres[ref.index].hit(params, t);
+        if (found)
+            hit.t = t;
+        break;
+    }
+    case PrimitiveType::Mesh:
+        found = meshes[ref.index].hit(params, hit);
+        break;
+    default:
+        found = instances[ref.index].hit(params, hit);
+        break;
+    }
+    if (found)
+        hit.slot = static_cast<int>(slot);
+    return found;
+}
+
+Intersection PrimitiveStore::surface(const Ray &ray, const ObjectHit &hit) const
+{
+    const PrimitiveRef &ref = slots[hit.slot];
+    switch (ref.type)
+    {
+    case PrimitiveType::Sphere:
+        return spheres[ref.index].surface(ray, hit.t);
+    case PrimitiveType::Mesh:
+        return meshes[ref.index].surface(ray, hit);
+    default:
+        return instances[ref.index].surface(ray, hit);
+    }
+}
+
+void PrimitiveStore::reorder(const std::vector<int> &order)
+{
+    // The objects of each type keep the relative order of their slots
+    std::vector<int> sphere_order, mesh_order, instance_order;
+    sphere_order.reserve(spheres.size());
+    mesh_order.reserve(meshes.size());
+    instance_order.reserve(instances.size());
+    ArenaVector<PrimitiveRef> sorted(slots.get_allocator());
+    sorted.reserve(slots.size());
+    for (int slot : order)
+    {
+        PrimitiveRef ref = slots[slot];
+        std::vector<int> *type_order;
+        switch (ref.type)
+        {
+        case PrimitiveType::Sphere:
+            type_order = &sphere_order;
+            break;
+        case PrimitiveType::Mesh:
+            type_order = &mesh_order;
+            break;
+        default:
+            type_order = &instance_order;
+            break;
+        }
+        sorted.push_back({ref.type, static_cast<int32_t>(type_order->size())});
+        type_order->push_back(ref.index);
+    }
+    permute(spheres, sphere_order);
+    permute(meshes, mesh_order);
+    permute(instances, instance_order);
+    // The old slots are left in the arena, they are small compared to the objects
+    slots.swap(sorted);
+}
+
+void ObjectGroup::finalize()
+{
+    bvh.build(objects.all_bounds());
+    // The leaves then refer to consecutive slots
+    objects.reorder(bvh.primitive_indices());
+}
+
+bool ObjectGroup::closest_hit(const RayParams &params, ObjectHit &hit) const
+{
+    hit.slot = -1;
+    real t_max = params.t_max;
+    RenderStats *stats = thread_stats();
+    bvh.traverse(params.ray, params.t_min, t_max, [&](int first, int count, real lo, real &hi) {
+        if (stats)
+            stats->intersection_tests += count;
+        bool found = false;
+        for (int i = first; i < first + count; ++i)
+        {
+            // hi shrinks with every hit, so only closer objects can be hit afterwards
+            if (objects.hit(i, RayParams({params.ray, lo, hi}), hit))
+            {
+                hi = hit.t;
+                found = true;
+            }
+        }
+        return found;
+    });
+    return hit.slot != -1;
+}
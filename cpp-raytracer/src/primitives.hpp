@@ -0,0 +1,131 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Storage for the objects of a scene: one contiguous array per type of object, allocated from the
+// arena of the scene, and groups of objects which can be placed many times by instances
+#pragma once
+#include "aabb.hpp"
+#include "arena.hpp"
+#include "bvh.hpp"
+#include "commons.hpp"
+#include "instance.hpp"
+#include "mesh.hpp"
+#include "objects.hpp"
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+enum class PrimitiveType : int32_t
+{
+    Sphere,
+    Mesh,
+    Instance
+};
+
+// Type of the object in a slot, and its index in the array of that type
+struct PrimitiveRef
+{
+    PrimitiveType type;
+    int32_t index;
+};
+
+// Objects stored by value in one array per type, without virtual calls. Objects are referred to by
+// their slot, which is the order in which they were added until reorder() is called.
+class PrimitiveStore
+{
+  private:
+    ArenaVector<Sphere> spheres;
+    ArenaVector<TriangleMesh> meshes;
+    ArenaVector<Instance> instances;
+    ArenaVector<PrimitiveRef> slots;
+
+  public:
+    explicit PrimitiveStore(Arena &arena);
+
+    PrimitiveStore(const PrimitiveStore &) = delete;
+    PrimitiveStore &operator=(const PrimitiveStore &) = delete;
+
+    /// @brief Reserves space for the given number of objects of every type, so that the arrays
+    /// are allocated once
+    void reserve(size_t sphere_count, size_t mesh_count, size_t instance_count);
+
+    void add(const Sphere &sphere);
+    void add(TriangleMesh &&mesh);
+    void add(const Instance &instance);
+
+    /// @return Number of objects (slots)
+    size_t size() const { return slots.size(); }
+
+    PrimitiveType type(size_t slot) const { return slots[slot].type; }
+
+    /// @return The sphere in the slot, which must hold a sphere
+    const Sphere &sphere(size_t slot) const { return spheres[slots[slot].index]; }
+
+    /// @return The instance in the slot, which must hold an instance
+    Instance &instance(size_t slot) { return instances[slots[slot].index]; }
+
+    /// @return Bounding box of the object in the slot
+    AABB bounds(size_t slot) const;
+
+    /// @return Bounding boxes of all the objects, in the order of the slots
+    std::vector<AABB> all_bounds() const;
+
+    /// @brief Intersects the ray with the object in the slot, dispatched with a switch on its type
+    Intersection intersect(size_t slot, const RayParams &params) const;
+
+    /// @brief Tests if the ray hits the object in the slot, without computing the details
+    /// @param hit Set if the object is hit between t_min and t_max (excluded), hit.slot is set to
+    /// the slot
+    bool hit(size_t slot, const RayParams &params, ObjectHit &hit) const;
+
+    /// @brief Computes the details of a hit found by hit(), on the object in hit.slot
+    Intersection surface(const Ray &ray, const ObjectHit &hit) const;
+
+    /// @brief Moves the objects so that slot i holds the object which was in slot order[i]. The
+    /// arrays of every type are sorted in the same order, so that objects which are visited one
+    /// after the other (for example the objects of a BVH leaf) are next to each other in memory.
+    /// @param order A permutation of the slots
+    void reorder(const std::vector<int> &order);
+};
+
+// A group of objects with its own acceleration structure, every instance of the group shares it
+class ObjectGroup
+{
+  private:
+    // Sorted in the order of the leaves of the BVH by finalize()
+    PrimitiveStore objects;
+    BVH bvh;
+
+  public:
+    /// @param arena Arena from which the objects are allocated, it must outlive the group
+    explicit ObjectGroup(Arena &arena) : objects(arena) {}
+
+    // The group is referred to by its instances, so it cannot be copied
+    ObjectGroup(const ObjectGroup &) = delete;
+    ObjectGroup &operator=(const ObjectGroup &) = delete;
+
+    /// @see PrimitiveStore::reserve
+    void reserve(size_t sphere_count, size_t mesh_count)
+    {
+        objects.reserve(sphere_count, mesh_count, 0);
+    }
+
+    /// @brief Adds an object to the group
+    void add_object(const Sphere &sphere) { objects.add(sphere); }
+    void add_object(TriangleMesh &&mesh) { objects.add(std::move(mesh)); }
+
+    /// @brief Builds the acceleration structure of the group, call after adding all the objects
+    void finalize();
+
+    /// @return Bounds of all the objects of the group
+    AABB bounds() const { return bvh.bounds(); }
+
+    /// @brief Finds the object which is closest to the ray's origin, only the closer objects are
+    /// tested as the traversal goes on
+    /// @return true if an object is hit, hit is then set (hit.slot is the slot in the group)
+    bool closest_hit(const RayParams &params, ObjectHit &hit) const;
+
+    /// @brief Computes the details of a hit found by closest_hit()
+    Intersection surface(const Ray &ray, const ObjectHit &hit) const
+    {
+        return objects.surface(ray, hit);
+    }
+};
@@ -0,0 +1,148 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "profile.hpp"
+#include "image.hpp"
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+void PixelProfile::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    size_t pixels = static_cast<size_t>(width) * height;
+    seconds.assign(pixels, 0);
+    bounces.assign(pixels, 0);
+    intersection_tests.assign(pixels, 0);
+    shading_calls.assign(pixels, 0);
+}
+
+void PixelProfile::record(int row, int col, double pixel_seconds, const RenderStats &before,
+                          const RenderStats &after)
+{
+    size_t i = static_cast<size_t>(row) * width_ + col;
+    seconds[i] = static_cast<float>(pixel_seconds);
+    // Every camera ray is the first segment of a path, the other segments are bounces
+    bounces[i] = (after.rays - before.rays) - (after.camera_rays - before.camera_rays);
+    intersection_tests[i] = after.intersection_tests - before.intersection_tests;
+    shading_calls[i] = after.shading_calls - before.shading_calls;
+}
+
+// Colors of the heatmaps from no cost to the highest cost, spaced evenly
+static const float HEATMAP_COLORS[][3] = {
+    {0.0f, 0.0f, 0.0f}, {0.3f, 0.0f, 0.5f}, {0.8f, 0.1f, 0.3f},
+    {1.0f, 0.6f, 0.0f}, {1.0f, 1.0f, 1.0f},
+};
+static const int HEATMAP_STOPS = sizeof(HEATMAP_COLORS) / sizeof(HEATMAP_COLORS[0]);
+
+/// @return The value at the fraction p of the sorted values
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// Statistics of one cost over all the pixels
+struct CostSummary
+{
+    std::vector<double> sorted;
+    double total;
+};
+
+template <typename T> static CostSummary summarize(const std::vector<T> &values)
+{
+    CostSummary summary;
+    summary.sorted.assign(values.begin(), values.end());
+    std::sort(summary.sorted.begin(), summary.sorted.end());
+    summary.total = std::accumulate(summary.sorted.begin(), summary.sorted.end(), 0.0);
+    return summary;
+}
+
+/// @brief Writes a heatmap of the values, the scale is the value which is shown as white
+template <typename T>
+static bool write_heatmap(const std::string &filename, const PixelProfile &profile,
+                          const std::vector<T> &values, double scale)
+{
+    DisplayImage img;
+    img.resize(profile.width(), profile.height());
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        double t = scale > 0 ? std::min(static_cast<double>(values[i]) / scale, 1.0) : 0.0;
+        double position = t * (HEATMAP_STOPS - 1);
+        int stop = std::min(static_cast<int>(position), HEATMAP_STOPS - 2);
+        double f = position - stop;
+        for (int c = 0; c < 3; ++c)
+        {
+            double v = HEATMAP_COLORS[stop][c] * (1 - f) + HEATMAP_COLORS[stop + 1][c] * f;
+            img.pixels[i * CHANNELS + c] = static_cast<uint8_t>(v * 255 + 0.5);
+        }
+    }
+    return write_png(filename, img);
+}
+
+static void write_summary(std::ostream &json, const char *name, const CostSummary &summary,
+                          double samples)
+{
+    size_t pixels = std::max<size_t>(summary.sorted.size(), 1);
+    json << "  \"" << name << "\": {\"total\": " << summary.total
+         << ", \"per_pixel\": " << summary.total / pixels
+         << ", \"per_sample\": " << summary.total / (pixels * samples)
+         << ", \"p50\": " << percentile(summary.sorted, 0.5)
+         << ", \"p90\": " << percentile(summary.sorted, 0.9)
+         << ", \"p99\": " << percentile(summary.sorted, 0.99)
+         << ", \"max\": " << (summary.sorted.empty() ? 0 : summary.sorted.back()) << "},\n";
+}
+
+bool write_profile(const std::string &prefix, const PixelProfile &profile, int samples_per_pixel)
+{
+    CostSummary seconds = summarize(profile.seconds);
+    CostSummary bounces = summarize(profile.bounces);
+    CostSummary tests = summarize(profile.intersection_tests);
+    CostSummary shading = summarize(profile.shading_calls);
+
+    // A few very expensive pixels would make the rest of the heatmap black
+    bool ok = write_heatmap(prefix + "_time.png", profile, profile.seconds,
+                            percentile(seconds.sorted, 0.99));
+    ok = write_heatmap(prefix + "_bounces.png", profile, profile.bounces,
+                       percentile(bounces.sorted, 0.99)) &&
+         ok;
+    ok = write_heatmap(prefix + "_tests.png", profile, profile.intersection_tests,
+                       percentile(tests.sorted, 0.99)) &&
+         ok;
+    ok = write_heatmap(prefix + "_shading.png", profile, profile.shading_calls,
+                       percentile(shading.sorted, 0.99)) &&
+         ok;
+
+    std::vector<size_t> hottest(profile.seconds.size());
+    std::iota(hottest.begin(), hottest.end(), 0);
+    size_t listed = std::min<size_t>(PROFILE_HOTTEST_PIXELS, hottest.size());
+    std::partial_sort(hottest.begin(), hottest.begin() + listed, hottest.end(),
+                      [&profile](size_t a, size_t b)
+                      { return profile.seconds[a] > profile.seconds[b]; });
+
+    std::ofstream json(prefix + ".json");
+    double samples = std::max(samples_per_pixel, 1);
+    json << "{\n";
+    json << "  \"width\": " << profile.width() << ",\n";
+    json << "  \"height\": " << profile.height() << ",\n";
+    json << "  \"samples_per_pixel\": " << samples_per_pixel << ",\n";
+    // Seconds are summed over the threads, so they add up to more than the time of the render
+    write_summary(json, "seconds", seconds, samples);
+    write_summary(json, "bounces", bounces, samples);
+    write_summary(json, "intersection_tests", tests, samples);
+    write_summary(json, "shading_calls", shading, samples);
+    json << "  \"hottest_pixels\": [\n";
+    for (size_t k = 0; k < listed; ++k)
+    {
+        size_t i = hottest[k];
+        json << "    {\"row\": " << i / profile.width() << ", \"col\": " << i % profile.width()
+             << ", \"seconds\": " << profile.seconds[i] << ", \"bounces\": " << profile.bounces[i]
+             << ", \"intersection_tests\": " << profile.intersection_tests[i]
+             << ", \"shading_calls\": " << profile.shading_calls[i] << "}"
+             << (k + 1 < listed ? ",\n" : "\n");
+    }
+    json << "  ]\n";
+    json << "}\n";
+    return ok && static_cast<bool>(json);
+}
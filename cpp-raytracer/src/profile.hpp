@@ -0,0 +1,123 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Profiles of the cost of every pixel: the time spent on it, and the bounces, intersection tests
+// and shading calls of its samples. They are written as heatmaps and a JSON summary, to find the
+// parts of an image which are expensive to render.
+//
+// Recording is compiled in only when RAYTRACER_PROFILE is defined (the cmake option of the same
+// name), otherwise the render loop has no extra work at all and profiles stay empty.
+#pragma once
+#include "stats.hpp"
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Number of the most expensive pixels listed in the summary
+constexpr int PROFILE_HOTTEST_PIXELS = 16;
+
+// Costs of every pixel, summed over its samples
+class PixelProfile
+{
+  private:
+    int width_ = 0;
+    int height_ = 0;
+
+  public:
+    std::vector<float> seconds;
+    // Rays which continued a path after it hit a surface
+    std::vector<uint64_t> bounces;
+    std::vector<uint64_t> intersection_tests;
+    std::vector<uint64_t> shading_calls;
+
+    /// @brief Resizes the profile to the image and sets every cost to zero
+    void resize(int width, int height);
+
+    int width() const { return width_; }
+
+    int height() const { return height_; }
+
+    /// @brief Sets the costs of a pixel, from the counters of the thread which rendered it
+    /// @param before The counters when the thread started the pixel
+    /// @param after The counters when it finished the pixel
+    void record(int row, int col, double pixel_seconds, const RenderStats &before,
+                const RenderStats &after);
+};
+
+/// @return true if this build records profiles
+constexpr bool profiling_enabled()
+{
+#ifdef RAYTRACER_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Records the cost of one pixel, from its creation to its destruction. The thread must be counting
+// into a RenderStats (see ProfileCounters).
+class PixelProbe
+{
+  private:
+    PixelProfile *profile;
+    int row;
+    int col;
+    RenderStats before;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    /// @param profile Does nothing if it is null
+    PixelProbe(PixelProfile *profile, int row, int col) : profile(profile), row(row), col(col)
+    {
+        if (profile)
+        {
+            before = *thread_stats();
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    PixelProbe(const PixelProbe &) = delete;
+    PixelProbe &operator=(const PixelProbe &) = delete;
+
+    ~PixelProbe()
+    {
+        if (profile)
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            profile->record(row, col, elapsed.count(), before, *thread_stats());
+        }
+    }
+};
+
+// Makes the thread count into a RenderStats of its own while a profile is recorded, unless it
+// already counts into one (when the benchmarks collect statistics)
+class ProfileCounters
+{
+  private:
+    RenderStats counters;
+    bool installed;
+
+  public:
+    explicit ProfileCounters(const PixelProfile *profile)
+        : installed(profile != nullptr && thread_stats() == nullptr)
+    {
+        if (installed)
+            thread_stats() = &counters;
+    }
+
+    ProfileCounters(const ProfileCounters &) = delete;
+    ProfileCounters &operator=(const ProfileCounters &) = delete;
+
+    ~ProfileCounters()
+    {
+        if (installed)
+            thread_stats() = nullptr;
+    }
+};
+
+/// @brief Writes <prefix>_time.png, <prefix>_bounces.png, <prefix>_tests.png and
+/// <prefix>_shading.png, heatmaps of the costs scaled so that the 99th percentile is white, and
+/// <prefix>.json with the totals, percentiles and the most expensive pixels
+/// @param samples_per_pixel Samples rendered for every pixel, used for the costs per sample
+/// @return false if a file could not be written
+bool write_profile(const std::string &prefix, const PixelProfile &profile, int samples_per_pixel);
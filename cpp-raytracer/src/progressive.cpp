@@ -0,0 +1,247 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "progressive.hpp"
+#include "checkpoint.hpp"
+#include "raytracer.hpp"
+#include "tiles.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+using progressive_clock = std::chrono::steady_clock;
+
+/// @return Seconds elapsed since the given time point
+static double seconds_since(progressive_clock::time_point start)
+{
+    return std::chrono::duration<double>(progressive_clock::now() - start).count();
+}
+
+/// @return Relative luminance of the color
+static double luminance(const color &c) { return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z; }
+
+void PixelStatistics::add(const color &c)
+{
+    double l = luminance(c);
+    sum += c;
+    luminance_sum += l;
+    luminance_sum2 += l * l;
+    samples++;
+}
+
+double PixelStatistics::error() const
+{
+    if (samples < 2)
+        return INF;
+    double mean = luminance_sum / samples;
+    double variance = std::max(0.0, (luminance_sum2 - mean * luminance_sum) / (samples - 1));
+    return 1.96 * std::sqrt(variance / samples);
+}
+
+ProgressiveRenderer::ProgressiveRenderer(const Config &config)
+    : config(config), pixels(config.image_width * config.image_height)
+{
+}
+
+int ProgressiveRenderer::active_pixels() const
+{
+    int active = 0;
+    for (const auto &p : pixels)
+    {
+        if (!p.converged)
+            active++;
+    }
+    return active;
+}
+
+Framebuffer ProgressiveRenderer::current_image() const
+{
+    Framebuffer img(config.image_width, config.image_height);
+    for (int i = 0; i < config.image_height; ++i)
+    {
+        for (int j = 0; j < config.image_width; ++j)
+        {
+            img.set(i, j, pixels[i * config.image_width + j].mean());
+        }
+    }
+    return img;
+}
+
+/// @brief Takes the next samples of the pixels of the tiles, until no tiles are left or the
+/// deadline passes
+static void render_pass_tiles(const Renderer &renderer, const Camera &cam, const Scene &scene,
+                              TileScheduler *scheduler, std::vector<PixelStatistics> *pixels,
+                              std::vector<SurfaceFeatures> *feature_sums,
+                              progressive_clock::time_point start, double deadline)
+{
+    const Config cfg = renderer.get_config();
+    Sampler sampler(cfg.sampler, cfg.samples_per_pixel, cfg.seed);
+    Tile tile;
+    while ((deadline <= 0 || seconds_since(start) < deadline) && scheduler->next(tile))
+    {
+        for (int i = tile.row; i < tile.row + tile.height; ++i)
+        {
+            for (int j = tile.col; j < tile.col + tile.width; ++j)
+            {
+                PixelStatistics &pixel = (*pixels)[i * cfg.image_width + j];
+                if (pixel.converged)
+                    continue;
+                sampler.start_pixel(i, j);
+                // The first pass takes min_samples samples so that the variance estimate is
+                // reliable, every pass after that adds pass_samples
+                int target = (pixel.samples == 0) ? std::max(cfg.min_samples, cfg.pass_samples)
+                                                  : pixel.samples + cfg.pass_samples;
+                target = std::min(target, cfg.samples_per_pixel);
+                SurfaceFeatures features;
+                SurfaceFeatures *feature_sum =
+                    feature_sums->empty() ? nullptr : &(*feature_sums)[i * cfg.image_width + j];
+                for (int sample = pixel.samples; sample < target; ++sample)
+                {
+                    sampler.start_sample(sample);
+                    pixel.add(renderer.render_sample(cam, scene, i, j, sampler,
+                                                     feature_sum ? &features : nullptr));
+                    if (feature_sum)
+                        *feature_sum += features;
+                }
+                double tolerance =
+                    cfg.noise_threshold * std::max(pixel.luminance_sum / pixel.samples,
+                                                   DARK_LUMINANCE);
+                if (pixel.samples >= cfg.samples_per_pixel ||
+                    (pixel.samples >= cfg.min_samples && pixel.error() <= tolerance))
+                {
+                    pixel.converged = true;
+                }
+            }
+        }
+        scheduler->finish();
+    }
+}
+
+void ProgressiveRenderer::render_pass(const Camera &cam, const Scene &scene, ThreadPool &pool,
+                                      double deadline)
+{
+    Renderer renderer(config);
+    TileScheduler scheduler(config.image_width, config.image_height, config.tile_size);
+    auto start = progressive_clock::now();
+    for (int i = 0; i < pool.size(); ++i)
+    {
+        pool.submit(0, [&] {
+            render_pass_tiles(renderer, cam, scene, &scheduler, &pixels, &feature_sums, start,
+                              deadline);
+        });
+    }
+    pool.wait();
+    scene.get_texture_cache().check_read_errors();
+}
+
+bool ProgressiveRenderer::save_checkpoint(int passes, double elapsed) const
+{
+    CheckpointHeader header =
+        checkpoint_header(config, CheckpointKind::Progressive, !feature_sums.empty());
+    header.passes = passes;
+    header.elapsed = elapsed;
+    CheckpointWriter writer(config.checkpoint_filename, header);
+    writer.write(pixels.data(), pixels.size());
+    writer.write(feature_sums.data(), feature_sums.size());
+    return writer.commit();
+}
+
+bool ProgressiveRenderer::load_checkpoint(int &passes, double &elapsed)
+{
+    if (!checkpoint_exists(config.checkpoint_filename))
+        return false;
+    CheckpointReader reader(
+        config.checkpoint_filename,
+        checkpoint_header(config, CheckpointKind::Progressive, !feature_sums.empty()));
+    reader.read(pixels.data(), pixels.size());
+    reader.read(feature_sums.data(), feature_sums.size());
+    passes = reader.header().passes;
+    elapsed = reader.header().elapsed;
+    return true;
+}
+
+Framebuffer ProgressiveRenderer::render(const Camera &cam, const Scene &scene, int number_of_threads,
+                                        AOVBuffers *aovs)
+{
+    number_of_threads = std::max(number_of_threads, 1);
+    if (aovs)
+        feature_sums.assign(pixels.size(), SurfaceFeatures());
+    if (config.samples_per_pixel <= 0)
+        return current_image();
+    config.pass_samples = std::max(config.pass_samples, 1);
+
+    // A resumed render continues after the passes in the checkpoint, and counts the time spent
+    // on them against the time budget
+    int passes = 0;
+    double resumed_seconds = 0;
+    if (!config.checkpoint_filename.empty() && config.resume &&
+        load_checkpoint(passes, resumed_seconds) && config.show_progress)
+    {
+        std::cout << "Resumed " << passes << " passes from " << config.checkpoint_filename
+                  << std::endl;
+    }
+    bool checkpointing = !config.checkpoint_filename.empty() && config.checkpoint_interval > 0;
+
+    auto start = progressive_clock::now() -
+                 std::chrono::duration_cast<progressive_clock::duration>(
+                     std::chrono::duration<double>(resumed_seconds));
+    double last_snapshot = resumed_seconds;
+    double last_checkpoint = resumed_seconds;
+    int total_pixels = static_cast<int>(pixels.size());
+    // The threads are started once, and pinned once, for all the passes
+    ThreadPool pool(number_of_threads, config.pin_threads);
+    for (int pass = passes + 1;; ++pass)
+    {
+        double deadline = 0;
+        if (config.time_budget > 0)
+        {
+            deadline = config.time_budget - seconds_since(start);
+            if (deadline <= 0)
+                break;
+        }
+        render_pass(cam, scene, pool, deadline);
+
+        int active = active_pixels();
+        double elapsed = seconds_since(start);
+        if (config.show_progress)
+        {
+            std::cout << "Pass " << pass << ": " << total_pixels - active << "/" << total_pixels
+                      << " pixels converged (" << elapsed << "s)" << std::endl;
+        }
+        if (active == 0)
+            break;
+        if (config.snapshot_interval > 0 && elapsed - last_snapshot >= config.snapshot_interval)
+        {
+            Framebuffer snapshot = current_image();
+            write_to_file(config.snapshot_filename, snapshot,
+                          tonemap_image(snapshot, config.tonemap, config.gamma,
+                                        number_of_threads));
+            last_snapshot = elapsed;
+        }
+        if (checkpointing && elapsed - last_checkpoint >= config.checkpoint_interval)
+        {
+            if (!save_checkpoint(pass, elapsed))
+                std::cerr << "Error while writing the checkpoint " << config.checkpoint_filename
+                          << std::endl;
+            last_checkpoint = elapsed;
+        }
+    }
+    if (aovs)
+    {
+        aovs->resize(config.image_width, config.image_height);
+        for (int i = 0; i < config.image_height; ++i)
+        {
+            for (int j = 0; j < config.image_width; ++j)
+            {
+                size_t index = static_cast<size_t>(i) * config.image_width + j;
+                int samples = pixels[index].samples;
+                aovs->set(i, j,
+                          samples > 0 ? feature_sums[index] / static_cast<real>(samples)
+                                      : SurfaceFeatures(),
+                          samples);
+            }
+        }
+    }
+    return current_image();
+}
@@ -0,0 +1,81 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Progressive rendering, the image is rendered in passes and samples are only added to the pixels
+// which are still noisy
+#pragma once
+#include "aov.hpp"
+#include "camera.hpp"
+#include "colors.hpp"
+#include "config.h"
+#include "image.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+#include <vector>
+
+// Brightness below which the noise of a pixel is compared with this value instead, so that dark
+// pixels do not need a huge number of samples
+constexpr double DARK_LUMINANCE = 0.05;
+
+// Running statistics of the samples taken in a pixel
+struct PixelStatistics
+{
+    // Sum of the colors of the samples
+    color sum;
+    // Sum and sum of squares of the luminance of the samples, used to estimate the variance
+    double luminance_sum;
+    double luminance_sum2;
+    int samples;
+    // true once the pixel does not need any more samples
+    bool converged;
+
+    PixelStatistics() : sum(0, 0, 0), luminance_sum(0), luminance_sum2(0), samples(0), converged(false)
+    {
+    }
+
+    /// @brief Adds a sample to the pixel
+    void add(const color &c);
+
+    /// @return Average color of the samples taken so far
+    color mean() const { return samples > 0 ? sum / static_cast<real>(samples) : color(0, 0, 0); }
+
+    /// @return Half width of the 95% confidence interval of the mean luminance
+    double error() const;
+};
+
+class ProgressiveRenderer
+{
+  private:
+    Config config;
+    std::vector<PixelStatistics> pixels;
+    // Sums of the surface features of the samples of every pixel, empty if no AOVs are rendered
+    std::vector<SurfaceFeatures> feature_sums;
+
+    /// @brief Renders one pass over the pixels which have not converged on every thread of the
+    /// pool
+    /// @param deadline The pass stops after these many seconds (0 - no limit)
+    void render_pass(const Camera &cam, const Scene &scene, ThreadPool &pool, double deadline);
+
+    /// @brief Saves the statistics of the pixels to checkpoint_filename
+    /// @param passes Number of passes rendered
+    /// @param elapsed Seconds spent rendering them
+    bool save_checkpoint(int passes, double elapsed) const;
+
+    /// @brief Loads the statistics of the pixels saved by save_checkpoint
+    /// @return false if there is no checkpoint file
+    /// @throw std::runtime_error if the checkpoint was made with other settings
+    bool load_checkpoint(int &passes, double &elapsed);
+
+  public:
+    ProgressiveRenderer(const Config &config);
+
+    /// @brief Renders passes until every pixel has converged, samples_per_pixel samples have been
+    /// taken, or the time budget runs out
+    /// @param aovs If not null, filled in with the auxiliary buffers of the image
+    Framebuffer render(const Camera &cam, const Scene &scene, int number_of_threads,
+                       AOVBuffers *aovs = nullptr);
+
+    /// @return The image rendered so far
+    Framebuffer current_image() const;
+
+    /// @return Number of pixels which still need samples
+    int active_pixels() const;
+};
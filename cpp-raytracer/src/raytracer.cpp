@@ -1,8 +1,15 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #include "raytracer.hpp"
+#include "checkpoint.hpp"
 #include "progressbar.hpp"
+#include "thread_pool.hpp"
+#include "wavefront.hpp"
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 Renderer::Renderer(const Config &config) : config(config) {}
@@ -11,7 +18,8 @@ void Renderer::set_config(const Config cfg) { config = cfg; }
 
 Config Renderer::get_config() const { return config; }
 
-image Renderer::render(const Camera &cam, const Scene &scene, bool show_progress) const
+Framebuffer Renderer::render(const Camera &cam, const Scene &scene, bool show_progress,
+                             AOVBuffers *aovs) const
 {
     ProgressBar progress_bar(config.image_height, config.progressbar_width, true);
     if (show_progress)
@@ -19,7 +27,9 @@ image Renderer::render(const Camera &cam, const Scene &scene, bool show_progress
         progress_bar.hide_cursor(std::cout);
         progress_bar.display(std::cout);
     }
-    image img(config.image_height, image_row(config.image_width, color()));
+    Framebuffer img(config.image_width, config.image_height);
+    if (aovs)
+        aovs->resize(config.image_width, config.image_height);
     try
     {
         // For each pixel in the image, generate a ray from the camera,
@@ -29,19 +39,27 @@ image Renderer::render(const Camera &cam, const Scene &scene, bool show_progress
         if (config.samples_per_pixel <= 0)
             return img;
 
+        Sampler sampler(config.sampler, config.samples_per_pixel, config.seed);
+        std::unique_ptr<WavefrontIntegrator> wavefront;
+        if (config.integrator == Integrator::Wavefront)
+            wavefront.reset(new WavefrontIntegrator(config, scene));
         for (int i = 0; i < config.image_height; ++i)
         {
-            for (int j = 0; j < config.image_width; ++j)
+            if (wavefront)
             {
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < config.samples_per_pixel; ++sample)
+                wavefront->render_tile(cam, Tile({i, 0, 1, config.image_width}), img, aovs);
+            }
+            else
+            {
+                for (int j = 0; j < config.image_width; ++j)
                 {
-                    auto ray = cam.get_ray(i, j, config.samples_per_pixel > 1);
-                    pixel_color += scene.color_at(ray, config.recursion_limit);
+                    // Apply gamma correction at the time of saving
+                    SurfaceFeatures features;
+                    img.set(i, j,
+                            render_pixel(cam, scene, i, j, sampler, aovs ? &features : nullptr));
+                    if (aovs)
+                        aovs->set(i, j, features, config.samples_per_pixel);
                 }
-                pixel_color /= config.samples_per_pixel;
-                // Apply gamma correction at the time of saving
-                img[i][j] = pixel_color;
             }
             if (show_progress)
             {
@@ -63,79 +81,209 @@ image Renderer::render(const Camera &cam, const Scene &scene, bool show_progress
     return img;
 }
 
-void render(const Renderer &renderer, const Camera &camera, const Scene &scene, image *im)
+color Renderer::render_sample(const Camera &cam, const Scene &scene, int row, int col,
+                              Sampler &sampler, SurfaceFeatures *features) const
 {
-    if (im != nullptr)
+    Ray ray;
     {
-        *im = renderer.render(camera, scene, false);
+        StageTimer timer(&RenderStats::camera_seconds);
+        ray = cam.get_ray(row, col, sampler, config.samples_per_pixel > 1);
     }
+    count_stat(&RenderStats::camera_rays);
+    return scene.color_at(ray, config.recursion_limit, sampler, config.light_sampling, features,
+                          cam.pixel_spread());
 }
 
-image multi_threaded_render(const Config &cfg, const Camera &cam, const Scene &scene,
-                            int number_of_threads)
+color Renderer::render_pixel(const Camera &cam, const Scene &scene, int row, int col,
+                             Sampler &sampler, SurfaceFeatures *features) const
 {
-    std::cout << "Using " << number_of_threads << " threads" << std::endl;
-    auto def_img = image(cfg.image_height, image_row(cfg.image_width, color()));
-
-    // Uses a lot of memory, for each thread a new image is created
-    // try optimizing it.
-    std::vector<std::thread> threads(number_of_threads);
-    std::vector<image> images(number_of_threads, def_img);
-    std::vector<Renderer> renderers;
-    auto base_spp = cfg.samples_per_pixel / number_of_threads;
-    int rem = cfg.samples_per_pixel % number_of_threads;
-    // sample per pixel for each of the threads
-    std::vector<int> spps(number_of_threads, base_spp);
-    int i = 0;
-    while (i < rem)
+    color pixel_color(0, 0, 0);
+    SurfaceFeatures feature_sum, sample_features;
+    // The samples of a pixel depend only on the seed and the position of the pixel, so it does
+    // not matter which thread renders it
+    sampler.start_pixel(row, col);
+    for (int sample = 0; sample < config.samples_per_pixel; ++sample)
     {
-        spps[i]++;
-        ++i;
+        sampler.start_sample(sample);
+        pixel_color +=
+            render_sample(cam, scene, row, col, sampler, features ? &sample_features : nullptr);
+        if (features)
+            feature_sum += sample_features;
     }
-    Config local_cfg = cfg;
+    if (features)
+        *features = feature_sum / static_cast<real>(config.samples_per_pixel);
+    return pixel_color / static_cast<real>(config.samples_per_pixel);
+}
 
-    // Create the renderers
-    std::cout << "Using SPP: ";
-    for (int i = 0; i < number_of_threads; ++i)
+void Renderer::render_tile(const Camera &cam, const Scene &scene, const Tile &tile,
+                           Framebuffer &img, AOVBuffers *aovs, PixelProfile *profile) const
+{
+    Sampler sampler(config.sampler, config.samples_per_pixel, config.seed);
+#ifdef RAYTRACER_PROFILE
+    ProfileCounters counters(profile);
+#endif
+    for (int i = tile.row; i < tile.row + tile.height; ++i)
     {
-        local_cfg.samples_per_pixel = spps[i];
-        std::cout << local_cfg.samples_per_pixel << " ";
-        renderers.emplace_back(Renderer(local_cfg));
+        for (int j = tile.col; j < tile.col + tile.width; ++j)
+        {
+#ifdef RAYTRACER_PROFILE
+            PixelProbe probe(profile, i, j);
+#endif
+            SurfaceFeatures features;
+            img.set(i, j, render_pixel(cam, scene, i, j, sampler, aovs ? &features : nullptr));
+            if (aovs)
+                aovs->set(i, j, features, config.samples_per_pixel);
+        }
     }
-    std::cout << std::endl;
+}
 
-    for (int i = 0; i < number_of_threads; ++i)
+void render_tiles(const Renderer &renderer, const Camera &camera, const Scene &scene,
+                  TileScheduler *scheduler, Framebuffer *im, AOVBuffers *aovs,
+                  BandTonemapper *bands, TileCheckpoint *checkpoint, RenderStats *stats,
+                  std::mutex *stats_mutex, PixelProfile *profile)
+{
+    // Count into a statistics object owned by this thread, and add it to the total at the end
+    RenderStats thread_total;
+    if (stats)
+        thread_stats() = &thread_total;
+    // The wavefront integrator keeps its queues between the tiles of the thread
+    std::unique_ptr<WavefrontIntegrator> wavefront;
+    if (renderer.get_config().integrator == Integrator::Wavefront && !profile)
+        wavefront.reset(new WavefrontIntegrator(renderer.get_config(), scene));
+    // The tiles are rendered into a buffer of this thread and then copied into the image, the
+    // buffer is allocated and cleared here, so it is on the NUMA node of the thread if it is
+    // pinned, and only the copy writes to the pages of the image
+    int tile_size = scheduler->band_height();
+    Framebuffer buffer(tile_size, tile_size);
+    Tile tile;
+    while (scheduler->next(tile))
+    {
+        int index = scheduler->index_of(tile);
+        // Tiles restored from a checkpoint are already in the image
+        if (!checkpoint || !checkpoint->restored(index))
+        {
+            buffer.set_origin(tile.row, tile.col);
+            if (wavefront)
+                wavefront->render_tile(camera, tile, buffer, aovs);
+            else
+                renderer.render_tile(camera, scene, tile, buffer, aovs, profile);
+            for (int r = tile.row; r < tile.row + tile.height; ++r)
+            {
+                std::copy(buffer.row(r), buffer.row(r) + tile.width * CHANNELS,
+                          im->row(r) + tile.col * CHANNELS);
+            }
+            if (checkpoint)
+                checkpoint->finish(index);
+        }
+        if (bands)
+            bands->tile_finished(scheduler->band(tile));
+        scheduler->finish();
+    }
+    if (stats)
     {
-        std::cout << "Running thread " << i + 1 << std::endl;
-        threads[i] =
-            std::thread(render, std::ref(renderers[i]), std::ref(cam), std::ref(scene), &images[i]);
+        thread_stats() = nullptr;
+        std::lock_guard<std::mutex> lock(*stats_mutex);
+        stats->add(thread_total);
     }
+}
+
+Framebuffer multi_threaded_render(const Config &cfg, const Camera &cam, const Scene &scene,
+                                  int number_of_threads, DisplayImage *display, RenderStats *stats,
+                                  AOVBuffers *aovs, PixelProfile *profile)
+{
+    number_of_threads = std::max(number_of_threads, 1);
+    if (cfg.show_progress)
+        std::cout << "Using " << number_of_threads << " threads" << std::endl;
+    // All the threads write to this image, each pixel belongs to exactly one tile so no
+    // synchronization is required
+    Framebuffer rendered_img(cfg.image_width, cfg.image_height);
+    if (display)
+        display->resize(cfg.image_width, cfg.image_height);
+    if (aovs)
+        aovs->resize(cfg.image_width, cfg.image_height);
+    if (profile)
+        profile->resize(cfg.image_width, cfg.image_height);
+    if (cfg.samples_per_pixel <= 0)
+        return rendered_img;
 
-    // Wait for all threads to finish
-    for (auto &t : threads)
+    Renderer renderer(cfg);
+    TileScheduler scheduler(cfg.image_width, cfg.image_height, cfg.tile_size);
+    if (cfg.show_progress)
     {
-        t.join();
+        std::cout << "Rendering " << scheduler.tile_count() << " tiles of size " << cfg.tile_size
+                  << std::endl;
     }
-    // Count number of threads with samples per pixels > 0
-    int nonzero = 0;
-    for (const auto &k : spps)
+    std::unique_ptr<TileCheckpoint> checkpoint;
+    if (!cfg.checkpoint_filename.empty())
     {
-        if (k > 0)
+        checkpoint.reset(new TileCheckpoint(cfg, scheduler, aovs != nullptr));
+        if (cfg.resume)
         {
-            nonzero++;
+            int restored = checkpoint->restore(rendered_img, aovs);
+            if (cfg.show_progress)
+                std::cout << "Resumed " << restored << " tiles from " << cfg.checkpoint_filename
+                          << std::endl;
         }
     }
-    std::cout << "All threads finished" << std::endl;
-    image rendered_img(cfg.image_height, image_row(cfg.image_width, color()));
-    for (int i = 0; i < cfg.image_height; ++i)
+    std::unique_ptr<BandTonemapper> bands;
+    if (display)
     {
-        for (int j = 0; j < cfg.image_width; ++j)
+        bands.reset(new BandTonemapper(rendered_img, *display, cfg.tonemap, cfg.gamma,
+                                       scheduler.band_height(), scheduler.tiles_per_row()));
+    }
+
+    std::mutex stats_mutex;
+    ThreadPool pool(number_of_threads, cfg.pin_threads);
+    if (cfg.show_progress && cfg.pin_threads)
+        std::cout << "Pinned " << pool.processors().size() << " threads" << std::endl;
+    for (int i = 0; i < number_of_threads; ++i)
+    {
+        pool.submit(0, [&] {
+            render_tiles(renderer, cam, scene, &scheduler, &rendered_img, aovs, bands.get(),
+                         checkpoint.get(), stats, &stats_mutex, profile);
+        });
+    }
+
+    // Display the progress and save checkpoints while the threads are rendering
+    bool checkpointing = checkpoint && cfg.checkpoint_interval > 0;
+    if (cfg.show_progress || checkpointing)
+    {
+        ProgressBar progress_bar(scheduler.tile_count(), cfg.progressbar_width, true);
+        if (cfg.show_progress)
+            progress_bar.hide_cursor(std::cout);
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        int displayed = 0;
+        while (displayed < scheduler.tile_count())
         {
-            for (int k = 0; k < number_of_threads; ++k)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            int finished = scheduler.finished();
+            if (cfg.show_progress)
+            {
+                progress_bar.tick(finished - displayed);
+                progress_bar.display(std::cout);
+            }
+            displayed = finished;
+            auto now = std::chrono::steady_clock::now();
+            if (checkpointing && displayed < scheduler.tile_count() &&
+                std::chrono::duration<double>(now - last_checkpoint).count() >=
+                    cfg.checkpoint_interval)
             {
-                rendered_img[i][j] += images[k][i][j] / (double)nonzero;
+                if (!checkpoint->save(rendered_img, aovs))
+                    std::cerr << "Error while writing the checkpoint " << cfg.checkpoint_filename
+                              << std::endl;
+                last_checkpoint = now;
             }
         }
+        if (cfg.show_progress)
+        {
+            progress_bar.show_cursor(std::cout);
+            std::cout << std::endl;
+        }
     }
+
+    pool.wait();
+    if (cfg.show_progress)
+        std::cout << "All threads finished" << std::endl;
+    scene.get_texture_cache().check_read_errors();
     return rendered_img;
 }
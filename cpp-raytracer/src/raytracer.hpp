@@ -1,10 +1,14 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #pragma once
 #include "camera.hpp"
+#include "aov.hpp"
 #include "colors.hpp"
 #include "config.h"
 #include "image.hpp"
+#include "profile.hpp"
 #include "scene.hpp"
+#include "stats.hpp"
+#include "tiles.hpp"
 
 class Renderer
 {
@@ -13,9 +17,44 @@ class Renderer
 
   public:
     Renderer(const Config &config);
-    image render(const Camera &cam, const Scene &scene, bool show_progress = true) const;
+
+    /// @param aovs If not null, the auxiliary buffers are resized to the image and filled in
+    Framebuffer render(const Camera &cam, const Scene &scene, bool show_progress = true,
+                       AOVBuffers *aovs = nullptr) const;
+
+    /// @brief Traces one sample of a pixel, the sampler must already be started for this pixel and
+    /// sample
+    /// @param features If not null, set to the features of the surface seen by the sample
+    color render_sample(const Camera &cam, const Scene &scene, int row, int col, Sampler &sampler,
+                        SurfaceFeatures *features = nullptr) const;
+
+    /// @brief Renders a single pixel, averaging samples_per_pixel samples
+    /// @param sampler Sampler owned by the calling thread
+    /// @param features If not null, set to the average features of the samples
+    color render_pixel(const Camera &cam, const Scene &scene, int row, int col, Sampler &sampler,
+                       SurfaceFeatures *features = nullptr) const;
+
+    /// @brief Renders the pixels of the tile and writes them directly into img (and aovs if it is
+    /// not null). Different threads may render different tiles of the same image at the same time
+    /// @param profile If not null, the cost of every pixel is recorded into it (only in builds with
+    /// RAYTRACER_PROFILE)
+    void render_tile(const Camera &cam, const Scene &scene, const Tile &tile, Framebuffer &img,
+                     AOVBuffers *aovs = nullptr, PixelProfile *profile = nullptr) const;
     void set_config(const Config cfg);
     Config get_config() const;
 };
 
-image multi_threaded_render(const Config &cfg, const Camera &cam, const Scene &scene, int number_of_threads);
\ No newline at end of file
+/// @brief Renders the image using the given number of threads (pinned to processors if
+/// cfg.pin_threads is set), the threads take tiles of the image from a shared scheduler, render
+/// each one into a tile buffer of their own and copy it into a single image
+/// @param display If not null, every row of tiles is tonemapped into it (using cfg.tonemap and
+/// cfg.gamma) as soon as it is finished, while the other rows are still being rendered
+/// @param stats If not null, the work done by all the threads is added to it
+/// @param aovs If not null, the auxiliary buffers are resized to the image and filled in
+/// @param profile If not null, it is resized to the image and the cost of every pixel is recorded
+/// into it (only in builds with RAYTRACER_PROFILE). The pixels are then rendered one path at a time
+/// even with the wavefront integrator, whose batches have no cost per pixel.
+Framebuffer multi_threaded_render(const Config &cfg, const Camera &cam, const Scene &scene,
+                                  int number_of_threads, DisplayImage *display = nullptr,
+                                  RenderStats *stats = nullptr, AOVBuffers *aovs = nullptr,
+                                  PixelProfile *profile = nullptr);
@@ -0,0 +1,161 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "sampler.hpp"
+#include <cmath>
+
+// Bases of the dimensions of the Halton sequence, higher dimensions use random numbers since the
+// sequence is poorly distributed for large bases
+static const int HALTON_PRIMES[] = {2,  3,  5,  7,  11, 13, 17, 19, 23, 29, 31,
+                                    37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79};
+static const int HALTON_DIMENSIONS = sizeof(HALTON_PRIMES) / sizeof(HALTON_PRIMES[0]);
+
+/// @brief Computes the position of element i of a random permutation of [0, l) which is decided
+/// by the pattern p, without storing the permutation
+/// Taken from "Correlated Multi-Jittered Sampling", Andrew Kensler, 2013
+static uint32_t permute(uint32_t i, uint32_t l, uint32_t p)
+{
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do
+    {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+/// @return The digits of index (written in the given base) mirrored around the decimal point
+static double radical_inverse(int base, uint32_t index)
+{
+    const double inv_base = 1.0 / base;
+    double inv = inv_base;
+    double result = 0;
+    while (index > 0)
+    {
+        uint32_t next = index / base;
+        result += (index - next * base) * inv;
+        inv *= inv_base;
+        index = next;
+    }
+    return result;
+}
+
+Sampler::Sampler(SamplerType type, int samples_per_pixel, uint64_t seed)
+    : type(type), samples_per_pixel(samples_per_pixel > 0 ? samples_per_pixel : 1), seed(seed),
+      pixel_seed(0), sample_index(0), dimension(0)
+{
+    strata_width = static_cast<int>(std::sqrt(static_cast<double>(this->samples_per_pixel)));
+    if (strata_width < 1)
+        strata_width = 1;
+}
+
+void Sampler::start_pixel(int row, int col)
+{
+    uint64_t pixel = (static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32) |
+                     static_cast<uint32_t>(col);
+    pixel_seed = hash64(pixel ^ hash64(seed));
+    rng.seed_with(pixel_seed, seed);
+    sample_index = 0;
+    dimension = 0;
+}
+
+void Sampler::start_sample(int index)
+{
+    // Every sample has its own random stream, so that a sample does not depend on the samples
+    // taken before it (samples of a pixel can be taken in separate passes)
+    rng.seed_with(hash64(pixel_seed + static_cast<uint64_t>(index)), seed);
+    sample_index = index;
+    dimension = 0;
+}
+
+double Sampler::stratified_1d()
+{
+    // Each sample falls in a different one of samples_per_pixel strata, the strata are visited in
+    // a different (random) order in every dimension so that the dimensions are not correlated
+    if (sample_index >= samples_per_pixel)
+        return rng.uniform();
+    uint32_t stratum = permute(sample_index, samples_per_pixel, dimension_hash(dimension));
+    return (stratum + rng.uniform()) / samples_per_pixel;
+}
+
+void Sampler::stratified_2d(double &u, double &v)
+{
+    int strata = strata_width * strata_width;
+    if (sample_index >= strata)
+    {
+        u = rng.uniform();
+        v = rng.uniform();
+        return;
+    }
+    uint32_t stratum = permute(sample_index, strata, dimension_hash(dimension));
+    u = (stratum % strata_width + rng.uniform()) / strata_width;
+    v = (stratum / strata_width + rng.uniform()) / strata_width;
+}
+
+double Sampler::halton(int dim)
+{
+    if (dim >= HALTON_DIMENSIONS)
+        return rng.uniform();
+    // The same sequence is used in every pixel, so it is shifted by a random offset for each pixel
+    // (Cranley-Patterson rotation) to prevent visible patterns
+    double offset = dimension_hash(dim) * (1.0 / 4294967296.0);
+    double value = radical_inverse(HALTON_PRIMES[dim], sample_index) + offset;
+    return value >= 1.0 ? value - 1.0 : value;
+}
+
+double Sampler::next_1d()
+{
+    double value;
+    switch (type)
+    {
+    case SamplerType::Stratified:
+        value = stratified_1d();
+        break;
+    case SamplerType::Halton:
+        value = halton(dimension);
+        break;
+    default:
+        value = rng.uniform();
+        break;
+    }
+    dimension++;
+    return value;
+}
+
+void Sampler::next_2d(double &u, double &v)
+{
+    switch (type)
+    {
+    case SamplerType::Stratified:
+        stratified_2d(u, v);
+        break;
+    case SamplerType::Halton:
+        u = halton(dimension);
+        v = halton(dimension + 1);
+        break;
+    default:
+        u = rng.uniform();
+        v = rng.uniform();
+        break;
+    }
+    dimension += 2;
+}
@@ -0,0 +1,139 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Random number generation and samplers used while rendering
+#pragma once
+#include "commons.hpp"
+#include <stdint.h>
+
+/// @brief Mixes the bits of a 64 bit integer (splitmix64 finalizer), used to derive seeds
+inline uint64_t hash64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// A small and fast random number generator (PCG32, https://www.pcg-random.org)
+// Its state is only 16 bytes, so every thread (and every pixel) can have its own generator
+class PCG32
+{
+  private:
+    uint64_t state;
+    uint64_t increment;
+
+  public:
+    PCG32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t sequence = 0xda3e39cb94b95bdbULL)
+    {
+        seed_with(seed, sequence);
+    }
+
+    /// @brief Restarts the generator, generators with different sequences produce independent
+    /// streams of numbers even if they have the same seed
+    void seed_with(uint64_t seed, uint64_t sequence = 0xda3e39cb94b95bdbULL)
+    {
+        state = 0;
+        increment = (sequence << 1) | 1;
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    /// @return A uniformly distributed 32 bit integer
+    uint32_t next_uint()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+    }
+
+    /// @return A uniformly generated random number in [0, 1)
+    double uniform() { return next_uint() * (1.0 / 4294967296.0); }
+
+    /// @return A uniformly generated random real number between min and max
+    double uniform(double min, double max) { return min + (max - min) * uniform(); }
+
+    /// @return A uniformly generated integer between min and max (both inclusive)
+    int randint(int min, int max)
+    {
+        uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - min) + 1;
+        return static_cast<int>(min + static_cast<int64_t>((next_uint() * range) >> 32));
+    }
+};
+
+// How the sampler chooses the sample points of a pixel
+enum class SamplerType
+{
+    // Independent uniform random numbers
+    Random,
+    // The pixel (and every pair of dimensions) is divided into a grid and one sample is placed
+    // randomly inside each cell (jittered sampling)
+    Stratified,
+    // Halton low discrepancy sequence, randomized for each pixel
+    Halton
+};
+
+// Generates the random numbers used to render a pixel. Each render thread has its own sampler, so
+// no state is shared between threads. The sequence of numbers depends only on the seed, the
+// pixel and the sample index, so renders are reproducible irrespective of the number of threads,
+// and the samples of a pixel can be taken in any order.
+//
+// Values are requested in dimensions, every call to next_1d uses one dimension and next_2d uses
+// two. Stratified and Halton samples are only distributed well if the same dimension is used for
+// the same purpose in every sample, for example dimensions 0 and 1 for the position in the pixel.
+// uniform() draws a plain random number, which is meant for rejection sampling and such, where
+// the number of values drawn varies. The warps in sampling.hpp turn pairs of dimensions into
+// directions.
+class Sampler
+{
+  private:
+    SamplerType type;
+    int samples_per_pixel;
+    // Width of the grid used for stratifying two dimensions
+    int strata_width;
+    uint64_t seed;
+    uint64_t pixel_seed;
+    int sample_index;
+    int dimension;
+    PCG32 rng;
+
+    /// @return A random 32 bit value which depends only on the pixel and the dimension
+    uint32_t dimension_hash(int dim) const
+    {
+        return static_cast<uint32_t>(hash64(pixel_seed ^ (0x9e3779b97f4a7c15ULL * (dim + 1))));
+    }
+
+    double stratified_1d();
+
+    void stratified_2d(double &u, double &v);
+
+    double halton(int dim);
+
+  public:
+    /// @param type The type of the samples to generate
+    /// @param samples_per_pixel Number of samples which will be taken in each pixel
+    /// @param seed Seed for the whole image, different seeds produce different noise
+    Sampler(SamplerType type, int samples_per_pixel, uint64_t seed = 0);
+
+    /// @brief Starts generating samples for a new pixel
+    void start_pixel(int row, int col);
+
+    /// @brief Starts a new sample of the current pixel, samples are numbered from 0 to
+    /// samples_per_pixel - 1
+    void start_sample(int index);
+
+    /// @return The next dimension of the current sample, in [0, 1)
+    double next_1d();
+
+    /// @brief Gets the next two dimensions of the current sample, in [0, 1)
+    void next_2d(double &u, double &v);
+
+    /// @return A uniformly generated random number in [0, 1), this does not use up a dimension
+    double uniform() { return rng.uniform(); }
+
+    /// @return A uniformly generated random number between min and max
+    double uniform(double min, double max) { return rng.uniform(min, max); }
+};
@@ -0,0 +1,142 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Closed form warps of uniform numbers in [0, 1)^2 to points and directions, each with its
+// probability density. They take exactly two numbers and have no rejection loops, so every sample
+// costs the same, and since the warps are continuous, stratified and low discrepancy numbers stay
+// well distributed after warping. The choices between cases are plain selects which the compiler
+// turns into conditional moves.
+//
+// Directions in a local frame have the normal along +z, Frame converts them to world space.
+#pragma once
+#include "commons.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Distributions of the normals of the microfacets of rough surfaces
+enum class MicrofacetDistribution
+{
+    // Trowbridge-Reitz, long tails which give a glow around highlights
+    GGX,
+    // Gaussian slopes, highlights fall off sooner
+    Beckmann
+};
+
+// An orthonormal basis around a unit vector (Duff et al., "Building an Orthonormal Basis,
+// Revisited"), without branches
+struct Frame
+{
+    vec3 u;
+    vec3 v;
+    vec3 w;
+
+    explicit Frame(const vec3 &w) : w(w)
+    {
+        real sign = std::copysign(real(1), w.z);
+        real a = -1 / (sign + w.z);
+        real b = w.x * w.y * a;
+        u = vec3(1 + sign * w.x * w.x * a, sign * b, -sign * w.x);
+        v = vec3(b, sign + w.y * w.y * a, -w.y);
+    }
+
+    /// @return The direction given in the frame (z along w) in world space
+    vec3 to_world(const vec3 &local) const { return u * local.x + v * local.y + w * local.z; }
+};
+
+/// @brief Maps the unit square to the unit disk, keeping the area of every region (Shirley and
+/// Chiu's concentric mapping), so strata of the square become strata of the disk
+/// @return Point of the disk, with z = 0
+inline vec3 sample_concentric_disk(real u, real v)
+{
+    real a = 2 * u - 1;
+    real b = 2 * v - 1;
+    // The square is split into four triangles by its diagonals, the larger coordinate gives the
+    // radius and the ratio of the two the angle inside the triangle
+    bool horizontal = a * a > b * b;
+    real radius = horizontal ? a : b;
+    real numerator = horizontal ? b : a;
+    real ratio = radius != 0 ? numerator / radius : 0;
+    real phi = horizontal ? real(PI / 4) * ratio : real(PI / 2) - real(PI / 4) * ratio;
+    return vec3(radius * std::cos(phi), radius * std::sin(phi), 0);
+}
+
+/// @return Direction in the upper hemisphere of the local frame, with a density proportional to
+/// its cosine with the normal (Malley's method, the disk is projected up onto the hemisphere)
+inline vec3 sample_cosine_hemisphere(real u, real v)
+{
+    vec3 d = sample_concentric_disk(u, v);
+    d.z = std::sqrt(std::max(real(0), 1 - d.x * d.x - d.y * d.y));
+    return d;
+}
+
+/// @return Density of sample_cosine_hemisphere per unit solid angle
+inline real cosine_hemisphere_pdf(real cos_theta)
+{
+    return std::max(cos_theta, real(0)) * real(1 / PI);
+}
+
+/// @brief Samples the normal of a microfacet with a density of D(m) cos(theta_m)
+/// @param alpha Roughness, 0 is a perfect mirror
+/// @return Normal in the local frame of the surface
+inline vec3 sample_microfacet(MicrofacetDistribution distribution, real alpha, real u, real v)
+{
+    real alpha2 = alpha * alpha;
+    // Squared tangent of the angle with the normal, by inverting the cdf of each distribution
+    real tan2 = distribution == MicrofacetDistribution::GGX
+                    ? alpha2 * u / std::max(1 - u, real(1e-7))
+                    : -alpha2 * std::log(std::max(1 - u, real(1e-7)));
+    real cos_theta = 1 / std::sqrt(1 + tan2);
+    real sin_theta = std::sqrt(std::max(real(0), 1 - cos_theta * cos_theta));
+    real phi = real(2 * PI) * v;
+    return vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+/// @return The distribution of normals D(m), for a microfacet at cos_theta from the normal
+inline real microfacet_distribution(MicrofacetDistribution distribution, real alpha,
+                                    real cos_theta)
+{
+    if (cos_theta <= 0 || alpha <= 0)
+        return 0;
+    real alpha2 = alpha * alpha;
+    real cos2 = cos_theta * cos_theta;
+    real tan2 = (1 - cos2) / cos2;
+    if (distribution == MicrofacetDistribution::GGX)
+    {
+        real d = alpha2 + tan2;
+        return alpha2 / (real(PI) * cos2 * cos2 * d * d);
+    }
+    return std::exp(-tan2 / alpha2) / (real(PI) * alpha2 * cos2 * cos2);
+}
+
+/// @return Density of sample_microfacet per unit solid angle of the normal, 0 for alpha = 0 whose
+/// normal is not a density but always the normal of the surface
+inline real microfacet_pdf(MicrofacetDistribution distribution, real alpha, real cos_theta)
+{
+    return microfacet_distribution(distribution, alpha, cos_theta) * cos_theta;
+}
+
+/// @brief Smith's masking function G1, the fraction of the microfacets facing a direction which
+/// are not hidden from it by other microfacets
+/// @param cos_theta Cosine between the direction and the normal of the surface
+inline real microfacet_masking(MicrofacetDistribution distribution, real alpha, real cos_theta)
+{
+    if (alpha <= 0)
+        return 1;
+    if (cos_theta <= 0)
+        return 0;
+    real cos2 = cos_theta * cos_theta;
+    real tan2 = std::max(real(0), 1 - cos2) / cos2;
+    if (distribution == MicrofacetDistribution::GGX)
+        return 2 / (1 + std::sqrt(1 + alpha * alpha * tan2));
+    // Beckmann has no closed form, this is the rational approximation of Walter et al.
+    real a = tan2 > 0 ? 1 / (alpha * std::sqrt(tan2)) : real(1.6);
+    if (a >= real(1.6))
+        return 1;
+    return (real(3.535) * a + real(2.181) * a * a) / (1 + real(2.276) * a + real(2.577) * a * a);
+}
+
+/// @brief Converts the density of a microfacet normal to the density of the direction reflected
+/// about it
+/// @param cos_out Cosine between the reflected direction and the microfacet normal
+inline real microfacet_reflection_pdf(real normal_pdf, real cos_out)
+{
+    return cos_out > 0 ? normal_pdf / (4 * cos_out) : 0;
+}
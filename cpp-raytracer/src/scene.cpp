@@ -1,39 +1,175 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #include "scene.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
 
 Scene::Scene()
+    : objects(arena), materials(ArenaAllocator<Material>(&arena)),
+      lights(ArenaAllocator<SphereLight>(&arena)), light_index(ArenaAllocator<int>(&arena)),
+      instance_slots(ArenaAllocator<int>(&arena)), has_other_objects(false), finalized(false)
 {
+}
+
+void Scene::reserve(size_t material_count, size_t sphere_count, size_t mesh_count,
+                    size_t instance_count)
+{
+    materials.reserve(materials.size() + material_count);
+    objects.reserve(sphere_count, mesh_count, instance_count);
+}
+
+int Scene::add_material(const Material &material)
+{
+    materials.push_back(material);
+    return static_cast<int>(materials.size()) - 1;
+}
+
+void Scene::add_object(const Sphere &sphere)
+{
+    if (finalized)
+        throw std::logic_error("Cannot add objects to a finalized scene");
+    objects.add(sphere);
+}
+
+void Scene::add_object(TriangleMesh &&mesh)
+{
+    if (finalized)
+        throw std::logic_error("Cannot add objects to a finalized scene");
+    objects.add(std::move(mesh));
+}
+
+void Scene::add_object(const Instance &instance)
+{
+    if (finalized)
+        throw std::logic_error("Cannot add objects to a finalized scene");
+    instance_slots.push_back(static_cast<int>(objects.size()));
+    objects.add(instance);
+}
+
+void Scene::set_instance_transform(size_t instance, const vec3 &translation, real scale)
+{
+    objects.instance(instance_slots[instance]).set_transform(translation, scale);
+}
+
+void Scene::refit()
+{
+    // The BVH refers to the objects by the order in which they were added
+    const std::vector<int> &indices = bvh.primitive_indices();
+    std::vector<AABB> bounds(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        bounds[indices[i]] = objects.bounds(i);
+    }
+    bvh.refit(bounds);
+}
+
+const ImageTexture *Scene::add_texture(const std::string &image_filename, bool srgb)
+{
+    int texture = texture_cache.add_texture(make_tiled_texture(image_filename, srgb));
+    textures.emplace_back(&texture_cache, texture);
+    return &textures.back();
+}
+
+ObjectGroup &Scene::add_group()
+{
+    groups.emplace_back(arena);
+    return groups.back();
+}
+
+void Scene::finalize()
+{
+    bvh.build(objects.all_bounds(), SPHERE_SIMD_WIDTH);
+    organize_objects();
+}
+
+void Scene::finalize(const BVH &prebuilt)
+{
+    if (prebuilt.primitive_indices().size() != objects.size())
+        throw std::invalid_argument("The BVH does not match the objects of the scene");
+    bvh = prebuilt;
+    organize_objects();
+}
+
+void Scene::organize_objects()
+{
+    // Sort the objects in the order of the leaves, so that the objects of a leaf are contiguous
+    // and can be tested together
+    const std::vector<int> &order = bvh.primitive_indices();
+    objects.reorder(order);
+    std::vector<int> new_slot(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        new_slot[order[i]] = static_cast<int>(i);
+    }
+    for (auto &slot : instance_slots)
+    {
+        slot = new_slot[slot];
+    }
+
+    spheres.clear();
+    lights.clear();
+    light_index.assign(objects.size(), -1);
+    has_other_objects = false;
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        if (objects.type(i) == PrimitiveType::Sphere)
+        {
+            const Sphere &sphere = objects.sphere(i);
+            spheres.add(sphere.get_center(), sphere.get_radius());
+            const Material &material = materials[sphere.get_material_id()];
+            if (material.get_type() == Material::EMISSIVE)
+            {
+                light_index[i] = static_cast<int>(lights.size());
+                lights.push_back(SphereLight(sphere.get_center(), std::fabs(sphere.get_radius()),
+                                             material.emission()));
+            }
+        }
+        else
+        {
+            spheres.add_empty();
+            has_other_objects = true;
+        }
+    }
+    spheres.finish();
+    finalized = true;
+}
+
+void load_sample_scene(Scene &scene, uint64_t seed)
+{
+    PCG32 rng(seed);
     // A sample render scene
-    materials.push_back(new LambertianDiffuse(color(0.5, 0.5, 0.5)));
-    materials.push_back(new Glass(WHITE, 1.5));
-    materials.push_back(new LambertianDiffuse(color(0.4, 0.2, 0.1)));
-    materials.push_back(new Metal(color(0.7, 0.6, 0.5), 0.0));
+    scene.add_material(LambertianDiffuse(color(0.5, 0.5, 0.5)));
+    scene.add_material(Glass(WHITE, 1.5));
+    scene.add_material(LambertianDiffuse(color(0.4, 0.2, 0.1)));
+    scene.add_material(Metal(color(0.7, 0.6, 0.5), 0.0));
 
-    objects.push_back(new Sphere(vec3(0, -1000, 0), 1000, 0));
-    objects.push_back(new Sphere(vec3(0, 1, 0), 1.0, 1));
-    objects.push_back(new Sphere(vec3(-4, 1, 0), 1.0, 2));
-    objects.push_back(new Sphere(vec3(4, 1, 0), 1.0, 3));
+    scene.add_object(Sphere(vec3(0, -1000, 0), 1000, 0));
+    scene.add_object(Sphere(vec3(0, 1, 0), 1.0, 1));
+    scene.add_object(Sphere(vec3(-4, 1, 0), 1.0, 2));
+    scene.add_object(Sphere(vec3(4, 1, 0), 1.0, 3));
 
     // Generate 50 materials
+    int last_material = 0;
     for (int i = 0; i < 50; ++i)
     {
-        double u = uniform();
-        double x = uniform(), y = uniform(), z = uniform();
-        double p = uniform(0, 0.5);
+        double u = rng.uniform();
+        double x = rng.uniform(), y = rng.uniform(), z = rng.uniform();
+        double p = rng.uniform(0, 0.5);
         if (u < 0.5)
         {
             // 50 % of all spheres are diffuse
-            materials.push_back(new LambertianDiffuse(color(x, y, z)));
+            last_material = scene.add_material(LambertianDiffuse(color(x, y, z)));
         }
         else if (u < 0.9)
         {
             // Metals, 40 % chance
-            materials.push_back(new Metal(color(x, y, z), p));
+            last_material = scene.add_material(Metal(color(x, y, z), p));
         }
         else
         {
             // Glass with refractive indices between 1.1 and 1.6
-            materials.push_back(new Glass(WHITE, 1.1 + p));
+            last_material = scene.add_material(Glass(WHITE, 1.1 + p));
         }
     }
 
@@ -44,72 +180,328 @@ Scene::Scene()
     {
         for (int b = -3; b < 3; b++)
         {
-            vec3 center(a + 0.9 * uniform(), 0.2, b + 0.9 * uniform());
+            vec3 center(a + 0.9 * rng.uniform(), 0.2, b + 0.9 * rng.uniform());
             if (linalg::length((center - vec3(4, 0.2, 0))) > 0.9)
             {
-                int material = randint(4, materials.size() - 1);
-                objects.push_back(new Sphere(center, 0.2, material));
+                int material = rng.randint(4, last_material);
+                scene.add_object(Sphere(center, 0.2, material));
             }
         }
     }
+    scene.finalize();
 }
 
-color Scene::color_at(const Ray &ray, int recursion_limit) const
+color Scene::color_at(const Ray &ray, int recursion_limit, Sampler &sampler,
+                      bool sample_lights, SurfaceFeatures *features, real pixel_spread) const
 {
-    if (recursion_limit == 0)
-    {
-        // The function has reached recursion limit, so no more light can be
-        // gathered, so return black.
-        return color(0, 0, 0);
-    }
-    // 0.001 is used to prevent intersection of the ray with the same surface
-    // from which it is cast, to prevent shadow acne
-    auto params = RayParams({ray, 0.001, INFINITY});
-    // Find the closest intersection of this ray in this given scene
-    Intersection intersect = closest_intersect(params);
-    if (intersect.occured)
+    if (features)
+        *features = SurfaceFeatures();
+    sample_lights = sample_lights && !lights.empty();
+    // The path is followed bounce by bounce, throughput is the fraction of the light at the
+    // current vertex which reaches the camera, and radiance is the light gathered so far
+    color throughput(1, 1, 1);
+    color radiance(0, 0, 0);
+    // Probability density with which the direction of the current ray was picked, 0 if the
+    // lights were not sampled at its origin
+    real direction_pdf = 0;
+    // Width of the cone of rays at the origin of the current ray, and the angle by which it grows
+    real cone_width = 0;
+    real cone_spread = pixel_spread;
+    Ray current = ray;
+    for (int depth = 0; depth < recursion_limit; ++depth)
     {
+        // The ray starts a little away from the surface from which it is cast, to prevent
+        // shadow acne
+        Intersection intersect;
+        int object;
+        {
+            StageTimer timer(&RenderStats::traversal_seconds);
+            intersect =
+                find_closest(RayParams({current, SELF_INTERSECTION_EPSILON, INF}), object);
+        }
+        if (!intersect.occured)
+        {
+            // The ray does not intersect with any object, so return the sky color
+            color sky = linalg::cmul(throughput, sky_color(current.direction()));
+            if (features)
+            {
+                features->albedo = sky;
+                features = nullptr;
+            }
+            return radiance + sky;
+        }
+        if (features && depth == 0)
+            features->depth = intersect.parametric;
+        cone_width += cone_spread * intersect.parametric;
+        intersect.cone_width = cone_width;
+        const Material &material = materials[intersect.material_id];
+        if (material.get_type() == Material::EMISSIVE && intersect.front)
+        {
+            real weight = emission_weight(object, current.origin(), direction_pdf);
+            radiance += weight * linalg::cmul(throughput, material.emission());
+        }
         // Perform material-ray interactions, such as reflection, refraction, etc
-        auto interaction = materials[intersect.material_id]->interact(params, intersect);
-        if (interaction.additional_rays)
+        MaterialInteraction interaction;
+        {
+            StageTimer timer(&RenderStats::shading_seconds);
+            count_stat(&RenderStats::shading_calls);
+            interaction = material.interact(intersect, sampler);
+        }
+        if (features && (interaction.diffuse || !interaction.additional_rays))
         {
-            return linalg::cmul(interaction.attenuation,
-                                color_at(interaction.ray, recursion_limit - 1));
+            // Mirrors and glass are looked through, until a surface which scatters diffusely
+            features->albedo = linalg::cmul(throughput, material.albedo(intersect));
+            features->normal = intersect.local_normal;
+            features = nullptr;
         }
-        return interaction.attenuation;
+        if (!interaction.additional_rays)
+            return radiance + linalg::cmul(throughput, interaction.attenuation);
+        if (sample_lights && interaction.pdf > 0)
+            radiance += linalg::cmul(throughput, sample_light(intersect, material, sampler));
+        throughput = linalg::cmul(throughput, interaction.attenuation);
+        direction_pdf = sample_lights ? interaction.pdf : 0;
+        if (interaction.diffuse)
+            cone_spread = std::max(cone_spread, DIFFUSE_CONE_SPREAD);
+
+        if (!survives_roulette(depth, throughput, sampler))
+            return radiance;
+        current = interaction.ray;
+    }
+    // The path has reached the bounce limit, so no more light can be gathered
+    return radiance;
+}
+
+real Scene::emission_weight(int object, const vec3 &origin, real direction_pdf) const
+{
+    // If the light could also have been sampled from the previous vertex, both ways of finding it
+    // are weighted so that the light is counted once
+    if (direction_pdf > 0 && light_index[object] >= 0)
+    {
+        real light_pdf =
+            lights[light_index[object]].pdf(origin) / static_cast<real>(lights.size());
+        return power_heuristic(direction_pdf, light_pdf);
     }
-    // The ray does not intersect with any object, so return the sky color
-    double t = 0.5 * (ray.direction().y + 1.0);
-    return lerp(WHITE, SKY_COLOR_2, t);
+    return 1;
+}
+
+color Scene::sample_light(const Intersection &intersect, const Material &material,
+                          Sampler &sampler) const
+{
+    RayParams shadow;
+    color contribution;
+    if (!light_sample(intersect, material, sampler, shadow, contribution))
+        return BLACK;
+    {
+        StageTimer timer(&RenderStats::traversal_seconds);
+        if (occluded(shadow))
+            return BLACK;
+    }
+    return contribution;
+}
+
+bool Scene::light_sample(const Intersection &intersect, const Material &material,
+                         Sampler &sampler, RayParams &shadow, color &contribution) const
+{
+    int count = static_cast<int>(lights.size());
+    int chosen = std::min(static_cast<int>(sampler.uniform() * count), count - 1);
+    const SphereLight &light = lights[chosen];
+    vec3 direction;
+    real distance, light_pdf;
+    if (!light.sample(intersect.point, sampler, direction, distance, light_pdf))
+        return false;
+    light_pdf /= static_cast<real>(count);
+    real material_pdf;
+    color f = material.evaluate(intersect, direction, material_pdf);
+    if (material_pdf <= 0)
+        return false;
+    shadow = RayParams({Ray(intersect.point, direction, true), SELF_INTERSECTION_EPSILON,
+                        distance - SELF_INTERSECTION_EPSILON});
+    real weight = power_heuristic(light_pdf, material_pdf);
+    contribution = (weight / light_pdf) * linalg::cmul(f, light.get_radiance());
+    return true;
 }
 
 Intersection Scene::closest_intersect(const RayParams &params) const
 {
-    double intersect_distance = INF;
-    Intersection closest;
-    closest.occured = false;
-    for (const auto &obj : objects)
+    int object;
+    return find_closest(params, object);
+}
+
+bool Scene::leaf_closest(const Ray &ray, int first, int count, real t_min,
+                         PrimitiveHit &closest, ObjectHit &other) const
+{
+    bool hit = spheres.closest_hit(ray.origin(), ray.direction(), t_min, first, count, closest);
+    if (has_other_objects && other_closest(ray, first, count, t_min, closest, other))
+        hit = true;
+    return hit;
+}
+
+bool Scene::other_closest(const Ray &ray, int first, int count, real t_min,
+                          PrimitiveHit &closest, ObjectHit &other) const
+{
+    bool hit = false;
+    for (int i = first; i < first + count; ++i)
     {
-        auto i = obj->intersect(params);
-        // If this intersection is closer to the ray's origin, choose it as the closest
-        // intersection
-        if (i.occured && i.parametric < intersect_distance)
+        if (objects.type(i) == PrimitiveType::Sphere)
+            continue;
+        if (objects.hit(i, RayParams({ray, t_min, closest.t}), other))
         {
-            intersect_distance = i.parametric;
-            closest = i;
+            closest.t = other.t;
+            closest.id = i;
+            hit = true;
         }
     }
-    return closest;
+    return hit;
 }
 
-Scene::~Scene()
+Intersection Scene::closest_surface(const Ray &ray, const PrimitiveHit &closest,
+                                    const ObjectHit &other) const
 {
-    for (size_t i = 0; i < materials.size(); ++i)
+    if (closest.id == -1)
     {
-        delete materials[i];
+        Intersection none;
+        none.occured = false;
+        return none;
     }
-    for (size_t i = 0; i < objects.size(); ++i)
+    if (objects.type(closest.id) != PrimitiveType::Sphere)
+        return objects.surface(ray, other);
+    return objects.sphere(closest.id).surface(ray, closest.t);
+}
+
+Intersection Scene::find_closest(const RayParams &params, int &object) const
+{
+    object = -1;
+    if (!finalized)
+        return closest_intersect_linear(params);
+    // Only the distance and the index of the closest object are tracked while traversing, the
+    // full intersection is computed once at the end
+    PrimitiveHit closest = {params.t_max, -1};
+    // The last hit on an object which is not a sphere, it is only used if that object is closest
+    ObjectHit other;
+    real t_max = params.t_max;
+    RenderStats *stats = thread_stats();
+    if (stats)
+        stats->rays++;
+    bvh.traverse(params.ray, params.t_min, t_max, [&](int first, int count, real lo, real &hi) {
+        if (stats)
+            stats->intersection_tests += count;
+        bool hit = leaf_closest(params.ray, first, count, lo, closest, other);
+        hi = closest.t;
+        return hit;
+    });
+    object = closest.id;
+    return closest_surface(params.ray, closest, other);
+}
+
+void Scene::find_closest(const RayPacket &packet, real t_min, Intersection *hits,
+                         int *objects) const
+{
+    PacketInterval interval(packet);
+    if (!finalized || !interval.coherent)
+    {
+        for (int i = 0; i < packet.size; ++i)
+        {
+            hits[i] = find_closest(RayParams({packet.ray(i), t_min, INF}), objects[i]);
+        }
+        return;
+    }
+    Ray rays[RAY_PACKET_SIZE];
+    // Closest hit of every ray, as in find_closest
+    real closest_t[RAY_PACKET_SIZE];
+    int closest_id[RAY_PACKET_SIZE];
+    ObjectHit other[RAY_PACKET_SIZE];
+    for (int i = 0; i < packet.size; ++i)
+    {
+        rays[i] = packet.ray(i);
+        closest_t[i] = INF;
+        closest_id[i] = -1;
+    }
+    RenderStats *stats = thread_stats();
+    if (stats)
+        stats->rays += packet.size;
+    bvh.traverse_packet(interval, t_min, INF, [&](const BVHNode &leaf, real &t_max) {
+        // The rays which traverse() would not take to this leaf are skipped, so the rays hit
+        // exactly the same objects as when they are traced one by one
+        char active[RAY_PACKET_SIZE];
+        packet_hits_box(packet, interval, leaf.bounds, t_min, closest_t, active);
+        spheres.closest_hits(packet, active, t_min, leaf.offset, leaf.count, closest_t,
+                             closest_id);
+        real packet_t_max = -INF;
+        for (int i = 0; i < packet.size; ++i)
+        {
+            if (active[i])
+            {
+                if (stats)
+                    stats->intersection_tests += leaf.count;
+                if (has_other_objects)
+                {
+                    PrimitiveHit closest = {closest_t[i], closest_id[i]};
+                    other_closest(rays[i], leaf.offset, leaf.count, t_min, closest, other[i]);
+                    closest_t[i] = closest.t;
+                    closest_id[i] = closest.id;
+                }
+            }
+            packet_t_max = std::max(packet_t_max, closest_t[i]);
+        }
+        t_max = packet_t_max;
+    });
+    for (int i = 0; i < packet.size; ++i)
+    {
+        objects[i] = closest_id[i];
+        hits[i] = closest_surface(rays[i], PrimitiveHit{closest_t[i], closest_id[i]}, other[i]);
+    }
+}
+
+bool Scene::occluded(const RayParams &params) const
+{
+    if (!finalized)
+        return closest_intersect_linear(params).occured;
+    const vec3 origin = params.ray.origin();
+    const vec3 direction = params.ray.direction();
+    RenderStats *stats = thread_stats();
+    if (stats)
+        stats->shadow_rays++;
+    auto leaf_hit = [&](int first, int count, real lo, real hi) {
+        if (stats)
+            stats->intersection_tests += count;
+        PrimitiveHit closest = {hi, -1};
+        if (spheres.closest_hit(origin, direction, lo, first, count, closest))
+            return true;
+        if (has_other_objects)
+        {
+            ObjectHit hit;
+            for (int i = first; i < first + count; ++i)
+            {
+                if (objects.type(i) != PrimitiveType::Sphere &&
+                    objects.hit(i, RayParams({params.ray, lo, hi}), hit))
+                    return true;
+            }
+        }
+        return false;
+    };
+    return bvh.any_hit(params.ray, params.t_min, params.t_max, leaf_hit);
+}
+
+Intersection Scene::closest_intersect_linear(const RayParams &params) const
+{
+    // Every object is tested only for a hit closer than the closest one so far, the details are
+    // computed once for the closest hit
+    RayParams closer = params;
+    ObjectHit closest = {0, -1, 0, -1, -1, 0, 0};
+    ObjectHit hit;
+    for (size_t slot = 0; slot < objects.size(); ++slot)
+    {
+        if (objects.hit(slot, closer, hit))
+        {
+            closer.t_max = hit.t;
+            closest = hit;
+        }
+    }
+    if (closest.slot == -1)
     {
-        delete objects[i];
+        Intersection none;
+        none.occured = false;
+        return none;
     }
+    return objects.surface(params.ray, closest);
 }
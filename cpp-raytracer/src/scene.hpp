@@ -1,27 +1,252 @@
 // Homepage: https://github.com/ananthvk/cpp-raytracer
 #pragma once
+#include "aov.hpp"
+#include "arena.hpp"
+#include "bvh.hpp"
 #include "colors.hpp"
 #include "commons.hpp"
+#include "lights.hpp"
 #include "material.hpp"
-#include "objects.hpp"
+#include "primitives.hpp"
+#include "spheres.hpp"
+#include "texture.hpp"
+#include <algorithm>
+#include <deque>
+#include <string>
+
+// Number of bounces after which paths may be stopped by Russian roulette
+constexpr int RUSSIAN_ROULETTE_DEPTH = 3;
+// Paths survive with at most this probability after RUSSIAN_ROULETTE_DEPTH bounces, even if they
+// are still bright, so that paths between mirrors or inside glass end
+constexpr real RUSSIAN_ROULETTE_MAX_SURVIVAL = real(0.95);
+
+// Paths carry a cone of rays around them (ray cones), its width where the path hits a surface
+// picks the mip map level of the textures there. The cone starts with the spread of a pixel, and
+// opens to at least this angle (in radians) after a diffuse bounce, since the light reflected
+// there comes from a wide area.
+constexpr real DIFFUSE_CONE_SPREAD = real(0.1);
+
+/// @brief Russian roulette: after a few bounces, paths which carry little light are stopped at
+/// random, and the paths which survive are made brighter by the same factor so that the average
+/// stays the same
+/// @param depth Number of bounces so far, starting from 0
+/// @return false if the path has to be stopped
+inline bool survives_roulette(int depth, color &throughput, Sampler &sampler)
+{
+    if (depth + 1 < RUSSIAN_ROULETTE_DEPTH)
+        return true;
+    real survival = std::min(linalg::maxelem(throughput), RUSSIAN_ROULETTE_MAX_SURVIVAL);
+    if (!(sampler.uniform() < survival))
+        return false;
+    throughput /= survival;
+    return true;
+}
 
 class Scene
 {
   private:
-    std::vector<Object *> objects;
-    std::vector<Material *> materials;
+    // The objects, materials and groups are allocated from the arena, so building a scene takes a
+    // few large allocations. It is declared first, so that it is destroyed last.
+    Arena arena;
+    // One array per type of object, sorted in the order of the leaves of the BVH by finalize()
+    PrimitiveStore objects;
+    // Stored by value, objects refer to them by index
+    ArenaVector<Material> materials;
+    // Tiles of the image textures, read on demand
+    TextureCache texture_cache;
+    // Textures used by the materials, a deque does not move them when it grows
+    std::deque<ImageTexture> textures;
+    // Groups which are shared by the instances in the scene, a deque does not move them when it
+    // grows
+    std::deque<ObjectGroup> groups;
+    // Acceleration structure over the objects, built by finalize()
+    BVH bvh;
+    // The spheres, in the same order as objects, slots of objects which are not spheres are left
+    // empty
+    SphereSet spheres;
+    // Spheres with an emissive material which are placed directly in the scene, they are sampled
+    // directly by the shadow rays. Other emissive objects only add light when paths hit them.
+    ArenaVector<SphereLight> lights;
+    // Index in lights of the sphere in each slot of objects, -1 if the object is not a light
+    ArenaVector<int> light_index;
+    // Slot (in objects) of every instance placed directly in the scene, in the order in which they
+    // were added
+    ArenaVector<int> instance_slots;
+    bool has_other_objects;
+    bool finalized;
+
+    /// @brief Sorts the objects in the order of the leaves of the BVH and prepares the spheres
+    void organize_objects();
+
+    /// @brief Tests the ray against the objects of a leaf of the BVH, for hits closer than
+    /// closest.t
+    /// @param other Set to the hit if the closest object is not a sphere
+    /// @return true if a closer object was hit, closest is then updated
+    bool leaf_closest(const Ray &ray, int first, int count, real t_min, PrimitiveHit &closest,
+                      ObjectHit &other) const;
+
+    /// @brief Same as leaf_closest, but only tests the objects which are not spheres
+    bool other_closest(const Ray &ray, int first, int count, real t_min, PrimitiveHit &closest,
+                       ObjectHit &other) const;
+
+    /// @brief Builds the intersection of the closest hit found by leaf_closest
+    Intersection closest_surface(const Ray &ray, const PrimitiveHit &closest,
+                                 const ObjectHit &other) const;
+
+    /// @brief Estimates the light arriving directly from a randomly chosen light at the
+    /// intersection and reflected towards the origin of the ray, weighted by multiple importance
+    /// sampling against the direction picked by the material
+    color sample_light(const Intersection &intersect, const Material &material,
+                       Sampler &sampler) const;
 
   public:
+    /// @brief Creates an empty scene
     Scene();
 
+    // The scene owns the objects, so it cannot be copied
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+
+    /// @brief Adds a copy of the material to the scene
+    /// @return id(index) of the material, to be used by objects
+    int add_material(const Material &material);
+
+    /// @brief Adds an image texture, the image is converted into a tiled file next to it the first
+    /// time it is used (see make_tiled_texture)
+    /// @param srgb true for colors, false for data such as roughness
+    /// @return The texture, owned by the scene, to be used by materials
+    /// @throw std::runtime_error if the image cannot be read or converted
+    const ImageTexture *add_texture(const std::string &image_filename, bool srgb);
+
+    /// @return The cache from which the textures read their tiles
+    TextureCache &get_texture_cache() { return texture_cache; }
+    const TextureCache &get_texture_cache() const { return texture_cache; }
+
+    /// @return Number of textures in the scene
+    size_t texture_count() const { return textures.size(); }
+
+    /// @brief Reserves space for the given number of materials and objects placed directly in the
+    /// scene, so that their arrays are allocated once
+    void reserve(size_t material_count, size_t sphere_count, size_t mesh_count,
+                 size_t instance_count);
+
+    /// @brief Adds an empty group to the scene, which can then be used by instances. Its objects
+    /// are allocated from the arena of the scene.
+    /// @return The group, which is owned by the scene
+    ObjectGroup &add_group();
+
+    /// @brief Adds a copy of an object to the scene
+    /// Objects cannot be added after the scene has been finalized
+    void add_object(const Sphere &sphere);
+    void add_object(TriangleMesh &&mesh);
+    void add_object(const Instance &instance);
+
+    /// @return The arena from which the scene is allocated
+    const Arena &get_arena() const { return arena; }
+
+    /// @brief Builds the acceleration structure, must be called once after all the objects
+    /// have been added and before rendering
+    void finalize();
+
+    /// @brief Finalizes the scene with an acceleration structure which was built earlier (for
+    /// example read from a cache), its primitives must be the objects in the order they were added
+    void finalize(const BVH &prebuilt);
+
+    /// @return The acceleration structure, its primitive indices refer to the order in which the
+    /// objects were added
+    const BVH &get_bvh() const { return bvh; }
+
+    /// @return Number of objects in the scene
+    size_t object_count() const { return objects.size(); }
+
+    /// @return Number of instances placed directly in the scene
+    size_t instance_count() const { return instance_slots.size(); }
+
+    /// @brief Moves an instance of a finalized scene, refit() must be called after moving the
+    /// instances and before rendering
+    /// @param instance Index of the instance, in the order in which the instances were added
+    void set_instance_transform(size_t instance, const vec3 &translation, real scale);
+
+    /// @brief Updates the acceleration structure after instances have moved, without building it
+    /// again (see BVH::refit)
+    void refit();
+
     /// @param ray Input ray
     /// @param recursion_limit Number of times this ray can bounce, after every bounce it is
     /// decreased by one
+    /// @param sampler Sampler of the pixel which is being rendered
+    /// @param sample_lights Sample the lights at every diffuse or rough surface (next event
+    /// estimation), otherwise lights only add light when paths hit them
+    /// @param features If not null, set to the features of the surface seen by the ray
+    /// @param pixel_spread Angle between the rays of neighbouring pixels, the width of the cone
+    /// of rays which picks the detail of the textures starts from it
     /// @return The color of the ray when it passes through this scene
-    color color_at(const Ray &ray, int recursion_limit) const;
+    color color_at(const Ray &ray, int recursion_limit, Sampler &sampler,
+                   bool sample_lights = true, SurfaceFeatures *features = nullptr,
+                   real pixel_spread = 0) const;
 
     /// @param params Ray parameters
     /// @return The intersection which is closest to the ray's origin
     Intersection closest_intersect(const RayParams &params) const;
-    ~Scene();
-};
\ No newline at end of file
+
+    /// @brief Finds the closest intersection, and the slot (in objects) of the object which was hit
+    Intersection find_closest(const RayParams &params, int &object) const;
+
+    /// @brief Finds the closest intersections of all the rays of a packet (between t_min and
+    /// infinity), walking the BVH once for the whole packet. The intersections are the same as
+    /// those found by find_closest for every ray, packets which are not coherent are traced ray
+    /// by ray.
+    /// @param hits Set to the intersection of every ray of the packet
+    /// @param objects Set to the slot of the object hit by every ray, -1 if nothing was hit
+    void find_closest(const RayPacket &packet, real t_min, Intersection *hits,
+                      int *objects) const;
+
+    // The functions below are the steps of color_at, so that other integrators (see
+    // wavefront.hpp) trace exactly the same paths
+
+    /// @return The material with the given id
+    const Material &get_material(int id) const { return materials[id]; }
+
+    /// @return Number of materials in the scene
+    size_t material_count() const { return materials.size(); }
+
+    /// @return Color of the sky seen in the direction
+    static color sky_color(const vec3 &direction)
+    {
+        real t = real(0.5) * (direction.y + 1);
+        return lerp(WHITE, SKY_COLOR_2, t);
+    }
+
+    /// @brief Weight of the light emitted by an object which was hit by a path, so that lights
+    /// which can also be sampled directly are counted once
+    /// @param object Slot of the object which was hit
+    /// @param origin Origin of the ray which hit it
+    /// @param direction_pdf Probability density of the direction of the ray, 0 if the lights were
+    /// not sampled at its origin
+    real emission_weight(int object, const vec3 &origin, real direction_pdf) const;
+
+    /// @brief Prepares the shadow ray of sample_light, the light is added only if the shadow ray
+    /// is not occluded
+    /// @param shadow Set to the shadow ray
+    /// @param contribution Set to the light which arrives if nothing is in the way
+    /// @return false if the light cannot contribute, no shadow ray has to be traced
+    bool light_sample(const Intersection &intersect, const Material &material, Sampler &sampler,
+                      RayParams &shadow, color &contribution) const;
+
+    /// @param params Ray parameters
+    /// @return true if the ray hits any object between t_min and t_max, the traversal stops at
+    /// the first hit
+    bool occluded(const RayParams &params) const;
+
+    /// @return Number of lights which are sampled directly
+    size_t light_count() const { return lights.size(); }
+
+    /// @brief Same as closest_intersect, but tests every object in the scene without using
+    /// the acceleration structure
+    Intersection closest_intersect_linear(const RayParams &params) const;
+};
+
+/// @brief Fills the scene with the sample scene (a few large spheres surrounded by smaller random
+/// spheres) and finalizes it
+/// @param seed Seed used to place the random spheres
+void load_sample_scene(Scene &scene, uint64_t seed = 0);
@@ -0,0 +1,1162 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "scene_file.hpp"
+#include "instance.hpp"
+#include "material.hpp"
+#include "mesh.hpp"
+#include "obj_loader.hpp"
+#include "objects.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Increase this whenever the layout of the cache file changes
+const uint32_t SCENE_CACHE_VERSION = 5;
+const char SCENE_CACHE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+// Sections of the cache file start at multiples of this, so that they can be used in place
+const uint64_t SCENE_CACHE_ALIGNMENT = 64;
+
+enum CacheSection
+{
+    SECTION_SETTINGS,
+    SECTION_MATERIALS,
+    SECTION_SPHERES,
+    SECTION_MESHES,
+    SECTION_MESH_FILENAMES,
+    SECTION_MESH_SIZES,
+    SECTION_MESH_POSITIONS,
+    SECTION_MESH_NORMALS,
+    SECTION_MESH_TEXCOORDS,
+    SECTION_MESH_INDICES,
+    SECTION_MESH_BVH_NODES,
+    SECTION_MESH_BVH_INDICES,
+    SECTION_INSTANCES,
+    SECTION_TEXTURES,
+    SECTION_TEXTURE_FILENAMES,
+    SECTION_KEYS,
+    SECTION_BVH_NODES,
+    SECTION_BVH_INDICES,
+    SECTION_COUNT
+};
+
+// Number of elements of the arrays of a mesh. The arrays of all the meshes are stored one after
+// the other in the mesh sections, in the order of the meshes
+struct MeshSizeRecord
+{
+    uint64_t positions;
+    uint64_t normals;
+    uint64_t texcoords;
+    // Number of position indices, the normal and texture coordinate indices are either as many or
+    // none. The indices are stored in this order in SECTION_MESH_INDICES
+    uint64_t position_indices;
+    uint64_t normal_indices;
+    uint64_t texcoord_indices;
+    uint64_t bvh_nodes;
+    uint64_t bvh_indices;
+};
+
+// Size of one element of each section
+const uint64_t SECTION_ELEMENT_SIZE[SECTION_COUNT] = {
+    1, sizeof(MaterialRecord), sizeof(SphereRecord), sizeof(MeshRecord), 1, sizeof(MeshSizeRecord),
+    sizeof(vec3), sizeof(vec3), sizeof(vec2), sizeof(int32_t), sizeof(BVHNode), sizeof(int),
+    sizeof(InstanceRecord), sizeof(TextureRecord), 1, sizeof(KeyRecord), sizeof(BVHNode),
+    sizeof(int)};
+
+struct SceneCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    // Sizes of the records, a cache written by a build with a different layout is rejected
+    uint32_t record_sizes;
+    uint64_t source_size;
+    int64_t source_mtime;
+    int32_t group_count;
+    int32_t padding;
+    // Number of elements in each section
+    uint64_t counts[SECTION_COUNT];
+    // Offset of each section from the start of the file
+    uint64_t offsets[SECTION_COUNT];
+};
+
+/// @brief Gets the size and modification time of a file
+/// @return false if the file does not exist
+static bool file_info(const std::string &filename, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+/// @return The string without leading and trailing whitespace
+static std::string trim(const std::string &s)
+{
+    const char *whitespace = " \t\r\n";
+    size_t start = s.find_first_not_of(whitespace);
+    if (start == std::string::npos)
+        return "";
+    size_t end = s.find_last_not_of(whitespace);
+    return s.substr(start, end - start + 1);
+}
+
+/// @brief Reads values of the given types from a string, and checks that nothing else is left
+class ValueReader
+{
+  private:
+    std::istringstream stream;
+
+  public:
+    ValueReader(const std::string &value) : stream(value) {}
+
+    template <typename T> ValueReader &operator>>(T &out)
+    {
+        if (!(stream >> out))
+            throw std::invalid_argument("Missing or invalid value");
+        return *this;
+    }
+
+    ValueReader &operator>>(vec3 &out) { return *this >> out.x >> out.y >> out.z; }
+
+    ValueReader &operator>>(bool &out)
+    {
+        std::string s;
+        *this >> s;
+        if (s == "True" || s == "true" || s == "1")
+            out = true;
+        else if (s == "False" || s == "false" || s == "0")
+            out = false;
+        else
+            throw std::invalid_argument("Invalid boolean value " + s);
+        return *this;
+    }
+
+    /// @return true if there are more values in the string
+    bool has_more()
+    {
+        stream >> std::ws;
+        return !stream.eof();
+    }
+
+    /// @brief Throws an error if there are more values in the string
+    void finish()
+    {
+        if (has_more())
+            throw std::invalid_argument("Too many values");
+    }
+};
+
+template <typename T> static T read_value(const std::string &value)
+{
+    T out;
+    ValueReader reader(value);
+    reader >> out;
+    reader.finish();
+    return out;
+}
+
+void set_config_value(Config &cfg, const std::string &key, const std::string &value)
+{
+    if (key == "gamma")
+        cfg.gamma = read_value<int>(value);
+    else if (key == "tonemap")
+    {
+        std::string type = read_value<std::string>(value);
+        if (type == "clamp")
+            cfg.tonemap = ToneMap::Clamp;
+        else if (type == "reinhard")
+            cfg.tonemap = ToneMap::Reinhard;
+        else
+            throw std::invalid_argument("Unknown tonemap " + type);
+    }
+    else if (key == "image_width")
+        cfg.image_width = read_value<int>(value);
+    else if (key == "image_height")
+        cfg.image_height = read_value<int>(value);
+    else if (key == "progressbar_width")
+        cfg.progressbar_width = read_value<int>(value);
+    else if (key == "show_progress")
+        cfg.show_progress = read_value<bool>(value);
+    else if (key == "samples_per_pixel")
+        cfg.samples_per_pixel = read_value<int>(value);
+    else if (key == "recursion_limit")
+        cfg.recursion_limit = read_value<int>(value);
+    else if (key == "light_sampling")
+        cfg.light_sampling = read_value<bool>(value);
+    else if (key == "integrator")
+    {
+        std::string type = read_value<std::string>(value);
+        if (type == "depth_first")
+            cfg.integrator = Integrator::DepthFirst;
+        else if (type == "wavefront")
+            cfg.integrator = Integrator::Wavefront;
+        else
+            throw std::invalid_argument("Unknown integrator " + type);
+    }
+    else if (key == "wavefront_batch")
+        cfg.wavefront_batch = read_value<int>(value);
+    else if (key == "tile_size")
+        cfg.tile_size = read_value<int>(value);
+    else if (key == "threads")
+        cfg.threads = std::max(read_value<int>(value), 0);
+    else if (key == "pin_threads")
+        cfg.pin_threads = read_value<bool>(value);
+    else if (key == "seed")
+        cfg.seed = read_value<uint64_t>(value);
+    else if (key == "sampler")
+    {
+        std::string type = read_value<std::string>(value);
+        if (type == "random")
+            cfg.sampler = SamplerType::Random;
+        else if (type == "stratified")
+            cfg.sampler = SamplerType::Stratified;
+        else if (type == "halton")
+            cfg.sampler = SamplerType::Halton;
+        else
+            throw std::invalid_argument("Unknown sampler " + type);
+    }
+    else if (key == "progressive")
+        cfg.progressive = read_value<bool>(value);
+    else if (key == "pass_samples")
+        cfg.pass_samples = read_value<int>(value);
+    else if (key == "min_samples")
+        cfg.min_samples = read_value<int>(value);
+    else if (key == "noise_threshold")
+        cfg.noise_threshold = read_value<double>(value);
+    else if (key == "time_budget")
+        cfg.time_budget = read_value<double>(value);
+    else if (key == "snapshot_interval")
+        cfg.snapshot_interval = read_value<double>(value);
+    else if (key == "snapshot_filename")
+        cfg.snapshot_filename = value;
+    else if (key == "checkpoint_filename")
+        cfg.checkpoint_filename = value;
+    else if (key == "checkpoint_interval")
+        cfg.checkpoint_interval = read_value<double>(value);
+    else if (key == "resume")
+        cfg.resume = read_value<bool>(value);
+    else if (key == "camera_fov")
+        cfg.camera_fov = radians(read_value<double>(value));
+    else if (key == "camera_position")
+        cfg.camera_position = read_value<vec3>(value);
+    else if (key == "camera_lookat")
+        cfg.camera_lookat = read_value<vec3>(value);
+    else if (key == "camera_up")
+        cfg.camera_up = read_value<vec3>(value);
+    else if (key == "camera_defocus_angle")
+        cfg.camera_defocus_angle = radians(read_value<double>(value));
+    else if (key == "camera_focal_length")
+        cfg.camera_focal_length = read_value<double>(value);
+    else if (key == "filename")
+        cfg.filename = value;
+    else if (key == "hdr_filename")
+        cfg.hdr_filename = value;
+    else if (key == "denoise")
+        cfg.denoise = read_value<bool>(value);
+    else if (key == "aov_filename")
+        cfg.aov_filename = value;
+    else if (key == "profile_filename")
+        cfg.profile_filename = value;
+    else if (key == "texture_cache_size")
+        cfg.texture_cache_size = read_value<int>(value);
+    else if (key == "animation_frames")
+        cfg.animation_frames = read_value<int>(value);
+    else if (key == "animation_filename")
+        cfg.animation_filename = value;
+    else if (key == "camera_orbit")
+        cfg.camera_orbit = radians(read_value<double>(value));
+    else
+        throw std::invalid_argument("Unknown setting " + key);
+}
+
+/// @brief Reads the name of an optional texture of a material
+/// @return Index of the texture, -1 if there is none or it is -
+static int32_t read_texture(ValueReader &reader, const std::map<std::string, int> &texture_ids)
+{
+    if (!reader.has_more())
+        return -1;
+    std::string name;
+    reader >> name;
+    if (name == "-")
+        return -1;
+    auto it = texture_ids.find(name);
+    if (it == texture_ids.end())
+        throw std::invalid_argument("Unknown texture " + name);
+    return it->second;
+}
+
+/// @brief Parses the value of a material line
+static MaterialRecord parse_material(const std::string &type, ValueReader &reader,
+                                     const std::map<std::string, int> &texture_ids)
+{
+    MaterialRecord m;
+    memset(&m, 0, sizeof(m));
+    m.albedo_texture = m.roughness_texture = -1;
+    if (type == "normal")
+    {
+        m.type = MATERIAL_NORMAL;
+        return m;
+    }
+    reader >> m.albedo[0] >> m.albedo[1] >> m.albedo[2];
+    if (type == "lambertian")
+    {
+        m.type = MATERIAL_LAMBERTIAN;
+        m.albedo_texture = read_texture(reader, texture_ids);
+    }
+    else if (type == "metal")
+    {
+        m.type = MATERIAL_METAL;
+        reader >> m.parameter;
+        m.albedo_texture = read_texture(reader, texture_ids);
+        m.roughness_texture = read_texture(reader, texture_ids);
+        m.distribution = static_cast<int32_t>(MicrofacetDistribution::GGX);
+        if (reader.has_more())
+        {
+            std::string distribution;
+            reader >> distribution;
+            if (distribution == "beckmann")
+                m.distribution = static_cast<int32_t>(MicrofacetDistribution::Beckmann);
+            else if (distribution != "ggx")
+                throw std::invalid_argument("Unknown microfacet distribution " + distribution);
+        }
+    }
+    else if (type == "glass")
+    {
+        m.type = MATERIAL_GLASS;
+        reader >> m.parameter;
+    }
+    else if (type == "emissive")
+    {
+        m.type = MATERIAL_EMISSIVE;
+        reader >> m.parameter;
+    }
+    else
+    {
+        throw std::invalid_argument("Unknown material type " + type);
+    }
+    return m;
+}
+
+/// @return path if it is absolute, otherwise path relative to the directory of base_filename
+static std::string relative_to(const std::string &base_filename, const std::string &path)
+{
+    size_t separator = base_filename.find_last_of("/\\");
+    if (separator == std::string::npos || path.empty() || path[0] == '/' || path[0] == '\\' ||
+        (path.size() > 1 && path[1] == ':'))
+        return path;
+    return base_filename.substr(0, separator + 1) + path;
+}
+
+SceneDescription parse_scene_file(const std::string &filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+        throw scene_parse_error("Could not open scene file " + filename);
+
+    SceneDescription description;
+    std::map<std::string, int> material_ids;
+    std::map<std::string, int> group_ids;
+    std::map<std::string, int> texture_ids;
+    std::map<std::string, int> instance_ids;
+    // Group which is being defined, -1 outside group definitions
+    int current_group = -1;
+    std::string current_group_name;
+    // The settings are checked on a scratch config so that errors are reported with line numbers
+    Config scratch;
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        size_t comment = line.find_first_of("#;");
+        if (comment != std::string::npos)
+            line.erase(comment);
+        line = trim(line);
+        if (line.empty())
+            continue;
+        try
+        {
+            size_t equals = line.find('=');
+            if (equals == std::string::npos)
+                throw std::invalid_argument("Expected key = value");
+            std::string key = trim(line.substr(0, equals));
+            std::string value = trim(line.substr(equals + 1));
+            ValueReader reader(value);
+
+            if (key == "material")
+            {
+                std::string name, type;
+                reader >> name >> type;
+                if (material_ids.count(name))
+                    throw std::invalid_argument("Material " + name + " is already defined");
+                description.materials.push_back(parse_material(type, reader, texture_ids));
+                reader.finish();
+                material_ids[name] = static_cast<int>(description.materials.size()) - 1;
+            }
+            else if (key == "texture")
+            {
+                std::string name, image_filename;
+                reader >> name >> image_filename;
+                reader.finish();
+                if (texture_ids.count(name))
+                    throw std::invalid_argument("Texture " + name + " is already defined");
+                image_filename = relative_to(filename, image_filename);
+                uint64_t size;
+                int64_t mtime;
+                if (!file_info(image_filename, size, mtime))
+                    throw std::invalid_argument("Could not find texture file " + image_filename);
+                TextureRecord texture;
+                texture.filename_offset = description.texture_filenames.size();
+                texture.filename_length = image_filename.size();
+                description.texture_filenames += image_filename;
+                description.textures.push_back(texture);
+                texture_ids[name] = static_cast<int>(description.textures.size()) - 1;
+            }
+            else if (key == "sphere")
+            {
+                SphereRecord s;
+                std::string material;
+                reader >> s.center[0] >> s.center[1] >> s.center[2] >> s.radius >> material;
+                reader.finish();
+                auto it = material_ids.find(material);
+                if (it == material_ids.end())
+                    throw std::invalid_argument("Unknown material " + material);
+                s.material = it->second;
+                s.group = current_group;
+                description.spheres.push_back(s);
+            }
+            else if (key == "mesh")
+            {
+                std::string mesh_filename, material;
+                reader >> mesh_filename >> material;
+                reader.finish();
+                auto it = material_ids.find(material);
+                if (it == material_ids.end())
+                    throw std::invalid_argument("Unknown material " + material);
+                mesh_filename = relative_to(filename, mesh_filename);
+                MeshRecord mesh;
+                memset(&mesh, 0, sizeof(mesh));
+                if (!file_info(mesh_filename, mesh.file_size, mesh.file_mtime))
+                    throw std::invalid_argument("Could not find mesh file " + mesh_filename);
+                mesh.filename_offset = description.mesh_filenames.size();
+                mesh.filename_length = mesh_filename.size();
+                mesh.material = it->second;
+                mesh.group = current_group;
+                description.mesh_filenames += mesh_filename;
+                description.meshes.push_back(mesh);
+            }
+            else if (key == "group")
+            {
+                std::string name = read_value<std::string>(value);
+                if (current_group != -1)
+                    throw std::invalid_argument("Groups cannot be nested");
+                if (group_ids.count(name))
+                    throw std::invalid_argument("Group " + name + " is already defined");
+                current_group = description.group_count++;
+                current_group_name = name;
+                group_ids[name] = current_group;
+            }
+            else if (key == "end")
+            {
+                std::string name = read_value<std::string>(value);
+                if (current_group == -1 || name != current_group_name)
+                    throw std::invalid_argument("end does not match a group");
+                current_group = -1;
+            }
+            else if (key == "instance")
+            {
+                InstanceRecord instance;
+                memset(&instance, 0, sizeof(instance));
+                std::string name, instance_name;
+                instance.scale = 1.0;
+                reader >> name >> instance.translation[0] >> instance.translation[1] >>
+                    instance.translation[2];
+                // The scale and the name are both optional, a name is never a number
+                if (reader.has_more())
+                {
+                    std::string scale_or_name;
+                    reader >> scale_or_name;
+                    std::istringstream scale(scale_or_name);
+                    if (scale >> instance.scale && (scale >> std::ws).eof())
+                    {
+                        if (reader.has_more())
+                            reader >> instance_name;
+                    }
+                    else
+                    {
+                        instance.scale = 1.0;
+                        instance_name = scale_or_name;
+                    }
+                }
+                reader.finish();
+                if (current_group != -1)
+                    throw std::invalid_argument("Instances cannot be placed inside groups");
+                auto it = group_ids.find(name);
+                if (it == group_ids.end())
+                    throw std::invalid_argument("Unknown group " + name);
+                if (!(instance.scale > 0))
+                    throw std::invalid_argument("The scale of an instance must be positive");
+                instance.group = it->second;
+                if (!instance_name.empty())
+                {
+                    if (instance_ids.count(instance_name))
+                        throw std::invalid_argument("Instance " + instance_name +
+                                                    " is already defined");
+                    instance_ids[instance_name] = static_cast<int>(description.instances.size());
+                }
+                description.instances.push_back(instance);
+            }
+            else if (key == "key")
+            {
+                KeyRecord k;
+                memset(&k, 0, sizeof(k));
+                std::string target;
+                reader >> k.frame >> target;
+                if (k.frame < 0)
+                    throw std::invalid_argument("The frame of a key cannot be negative");
+                if (target == "camera")
+                {
+                    k.instance = -1;
+                    reader >> k.position[0] >> k.position[1] >> k.position[2] >> k.lookat[0] >>
+                        k.lookat[1] >> k.lookat[2];
+                }
+                else
+                {
+                    auto it = instance_ids.find(target);
+                    if (it == instance_ids.end())
+                        throw std::invalid_argument("Unknown instance " + target);
+                    k.instance = it->second;
+                    k.scale = 1.0;
+                    reader >> k.position[0] >> k.position[1] >> k.position[2];
+                    if (reader.has_more())
+                        reader >> k.scale;
+                    if (!(k.scale > 0))
+                        throw std::invalid_argument("The scale of an instance must be positive");
+                }
+                reader.finish();
+                description.keys.push_back(k);
+            }
+            else
+            {
+                set_config_value(scratch, key, value);
+                description.settings += key + "=" + value + "\n";
+            }
+        }
+        catch (const std::exception &e)
+        {
+            throw scene_parse_error(filename + ":" + std::to_string(line_number) + ": " +
+                                    e.what());
+        }
+    }
+    if (current_group != -1)
+        throw scene_parse_error(filename + ": group " + current_group_name + " is not ended");
+    return description;
+}
+
+/// @return Name of the OBJ file of a mesh
+static std::string mesh_filename(const SceneDescription &description, const MeshRecord &mesh)
+{
+    return description.mesh_filenames.substr(static_cast<size_t>(mesh.filename_offset),
+                                             static_cast<size_t>(mesh.filename_length));
+}
+
+/// @brief Reads the OBJ files of the meshes and builds their BVHs, so that they can be cached
+static void load_meshes(SceneDescription &description)
+{
+    description.mesh_data.clear();
+    description.mesh_bvhs.clear();
+    for (const auto &m : description.meshes)
+    {
+        description.mesh_data.push_back(load_obj(mesh_filename(description, m)));
+        description.mesh_bvhs.push_back(TriangleMesh::build_bvh(description.mesh_data.back()));
+    }
+}
+
+void build_scene(SceneDescription description, Scene &scene, Config &cfg, const BVH *bvh,
+                 Animation *animation)
+{
+    std::istringstream settings(description.settings);
+    std::string line;
+    while (std::getline(settings, line))
+    {
+        size_t equals = line.find('=');
+        set_config_value(cfg, line.substr(0, equals), line.substr(equals + 1));
+    }
+    scene.get_texture_cache().set_budget(static_cast<size_t>(cfg.texture_cache_size) << 20);
+
+    // A texture is converted once for every way it is used, as colors or as data
+    std::map<std::pair<int, bool>, const ImageTexture *> textures;
+    auto texture = [&](int index, bool srgb) -> const ImageTexture * {
+        if (index < 0)
+            return nullptr;
+        auto key = std::make_pair(index, srgb);
+        auto it = textures.find(key);
+        if (it != textures.end())
+            return it->second;
+        const TextureRecord &t = description.textures[index];
+        return textures[key] = scene.add_texture(
+                   description.texture_filenames.substr(static_cast<size_t>(t.filename_offset),
+                                                        static_cast<size_t>(t.filename_length)),
+                   srgb);
+    };
+
+    for (const auto &m : description.materials)
+    {
+        color albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        switch (m.type)
+        {
+        case MATERIAL_LAMBERTIAN:
+            scene.add_material(LambertianDiffuse(albedo, texture(m.albedo_texture, true)));
+            break;
+        case MATERIAL_METAL:
+            scene.add_material(Metal(albedo, m.parameter, texture(m.albedo_texture, true),
+                                     texture(m.roughness_texture, false),
+                                     static_cast<MicrofacetDistribution>(m.distribution)));
+            break;
+        case MATERIAL_GLASS:
+            scene.add_material(Glass(albedo, m.parameter));
+            break;
+        case MATERIAL_EMISSIVE:
+            scene.add_material(Emissive(static_cast<real>(m.parameter) * albedo));
+            break;
+        default:
+            scene.add_material(NormalShader());
+            break;
+        }
+    }
+
+    // Count the objects of the scene and of every group, so that their arrays are allocated once
+    std::vector<size_t> group_spheres(description.group_count, 0);
+    std::vector<size_t> group_meshes(description.group_count, 0);
+    size_t scene_spheres = 0, scene_meshes = 0;
+    for (const auto &s : description.spheres)
+    {
+        if (s.group == -1)
+            scene_spheres++;
+        else
+            group_spheres[s.group]++;
+    }
+    for (const auto &m : description.meshes)
+    {
+        if (m.group == -1)
+            scene_meshes++;
+        else
+            group_meshes[m.group]++;
+    }
+    scene.reserve(description.materials.size(), scene_spheres, scene_meshes,
+                  description.instances.size());
+    std::vector<ObjectGroup *> groups(description.group_count);
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        groups[i] = &scene.add_group();
+        groups[i]->reserve(group_spheres[i], group_meshes[i]);
+    }
+    // The objects are added in the same order every time, the cached BVH depends on it
+    for (const auto &s : description.spheres)
+    {
+        Sphere sphere(vec3(s.center[0], s.center[1], s.center[2]), s.radius, s.material);
+        if (s.group == -1)
+            scene.add_object(sphere);
+        else
+            groups[s.group]->add_object(sphere);
+    }
+    const bool meshes_loaded = description.mesh_data.size() == description.meshes.size() &&
+                               description.mesh_bvhs.size() == description.meshes.size();
+    for (size_t i = 0; i < description.meshes.size(); ++i)
+    {
+        const MeshRecord &m = description.meshes[i];
+        TriangleMesh mesh = meshes_loaded
+                                ? TriangleMesh(std::move(description.mesh_data[i]),
+                                               std::move(description.mesh_bvhs[i]), m.material)
+                                : TriangleMesh(load_obj(mesh_filename(description, m)), m.material);
+        if (m.group == -1)
+            scene.add_object(std::move(mesh));
+        else
+            groups[m.group]->add_object(std::move(mesh));
+    }
+    for (auto &group : groups)
+    {
+        group->finalize();
+    }
+    for (const auto &instance : description.instances)
+    {
+        vec3 translation(instance.translation[0], instance.translation[1],
+                         instance.translation[2]);
+        scene.add_object(Instance(groups[instance.group], translation, instance.scale));
+    }
+
+    if (bvh)
+        scene.finalize(*bvh);
+    else
+        scene.finalize();
+
+    if (animation)
+    {
+        for (const auto &k : description.keys)
+        {
+            vec3 position(k.position[0], k.position[1], k.position[2]);
+            if (k.instance == -1)
+                animation->add_camera_key(
+                    {k.frame, position, vec3(k.lookat[0], k.lookat[1], k.lookat[2])});
+            else
+                animation->add_instance_key(k.instance,
+                                            {k.frame, position, static_cast<real>(k.scale)});
+        }
+    }
+}
+
+static uint32_t record_sizes()
+{
+    return static_cast<uint32_t>(sizeof(MaterialRecord) ^ (sizeof(SphereRecord) << 8) ^
+                                 (sizeof(InstanceRecord) << 16) ^ (sizeof(BVHNode) << 24));
+}
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+}
+
+bool write_scene_cache(const std::string &cache_filename, const std::string &source_filename,
+                       const SceneDescription &description, const BVH &bvh)
+{
+    SceneCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_CACHE_VERSION;
+    header.record_sizes = record_sizes();
+    if (!file_info(source_filename, header.source_size, header.source_mtime))
+        return false;
+    header.group_count = description.group_count;
+    if (description.mesh_data.size() != description.meshes.size() ||
+        description.mesh_bvhs.size() != description.meshes.size())
+        return false;
+
+    // The arrays of the meshes, one mesh after the other
+    std::vector<MeshSizeRecord> mesh_sizes;
+    std::vector<vec3> positions, normals;
+    std::vector<vec2> texcoords;
+    std::vector<int32_t> mesh_indices;
+    std::vector<BVHNode> mesh_nodes;
+    std::vector<int> mesh_bvh_indices;
+    for (size_t i = 0; i < description.meshes.size(); ++i)
+    {
+        const MeshData &mesh = description.mesh_data[i];
+        const BVH &mesh_bvh = description.mesh_bvhs[i];
+        mesh_sizes.push_back({mesh.positions.size(), mesh.normals.size(), mesh.texcoords.size(),
+                              mesh.position_indices.size(), mesh.normal_indices.size(),
+                              mesh.texcoord_indices.size(), mesh_bvh.get_nodes().size(),
+                              mesh_bvh.primitive_indices().size()});
+        positions.insert(positions.end(), mesh.positions.begin(), mesh.positions.end());
+        normals.insert(normals.end(), mesh.normals.begin(), mesh.normals.end());
+        texcoords.insert(texcoords.end(), mesh.texcoords.begin(), mesh.texcoords.end());
+        mesh_indices.insert(mesh_indices.end(), mesh.position_indices.begin(),
+                            mesh.position_indices.end());
+        mesh_indices.insert(mesh_indices.end(), mesh.normal_indices.begin(),
+                            mesh.normal_indices.end());
+        mesh_indices.insert(mesh_indices.end(), mesh.texcoord_indices.begin(),
+                            mesh.texcoord_indices.end());
+        mesh_nodes.insert(mesh_nodes.end(), mesh_bvh.get_nodes().begin(),
+                          mesh_bvh.get_nodes().end());
+        mesh_bvh_indices.insert(mesh_bvh_indices.end(), mesh_bvh.primitive_indices().begin(),
+                                mesh_bvh.primitive_indices().end());
+    }
+
+    const void *data[SECTION_COUNT] = {
+        description.settings.data(), description.materials.data(), description.spheres.data(),
+        description.meshes.data(), description.mesh_filenames.data(), mesh_sizes.data(),
+        positions.data(), normals.data(), texcoords.data(), mesh_indices.data(),
+        mesh_nodes.data(), mesh_bvh_indices.data(), description.instances.data(),
+        description.textures.data(), description.texture_filenames.data(),
+        description.keys.data(), bvh.get_nodes().data(), bvh.primitive_indices().data()};
+    header.counts[SECTION_SETTINGS] = description.settings.size();
+    header.counts[SECTION_MATERIALS] = description.materials.size();
+    header.counts[SECTION_SPHERES] = description.spheres.size();
+    header.counts[SECTION_MESHES] = description.meshes.size();
+    header.counts[SECTION_MESH_FILENAMES] = description.mesh_filenames.size();
+    header.counts[SECTION_MESH_SIZES] = mesh_sizes.size();
+    header.counts[SECTION_MESH_POSITIONS] = positions.size();
+    header.counts[SECTION_MESH_NORMALS] = normals.size();
+    header.counts[SECTION_MESH_TEXCOORDS] = texcoords.size();
+    header.counts[SECTION_MESH_INDICES] = mesh_indices.size();
+    header.counts[SECTION_MESH_BVH_NODES] = mesh_nodes.size();
+    header.counts[SECTION_MESH_BVH_INDICES] = mesh_bvh_indices.size();
+    header.counts[SECTION_INSTANCES] = description.instances.size();
+    header.counts[SECTION_TEXTURES] = description.textures.size();
+    header.counts[SECTION_TEXTURE_FILENAMES] = description.texture_filenames.size();
+    header.counts[SECTION_KEYS] = description.keys.size();
+    header.counts[SECTION_BVH_NODES] = bvh.get_nodes().size();
+    header.counts[SECTION_BVH_INDICES] = bvh.primitive_indices().size();
+    uint64_t offset = align_offset(sizeof(header));
+    for (int i = 0; i < SECTION_COUNT; ++i)
+    {
+        header.offsets[i] = offset;
+        offset = align_offset(offset + header.counts[i] * SECTION_ELEMENT_SIZE[i]);
+    }
+
+    // Write to a temporary file first, so that a partially written cache is never read
+    std::string temp_filename = cache_filename + ".tmp";
+    {
+        std::ofstream file(temp_filename, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        const char zeros[SCENE_CACHE_ALIGNMENT] = {0};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        uint64_t position = sizeof(header);
+        for (int i = 0; i < SECTION_COUNT; ++i)
+        {
+            file.write(zeros, header.offsets[i] - position);
+            uint64_t bytes = header.counts[i] * SECTION_ELEMENT_SIZE[i];
+            if (bytes > 0)
+                file.write(static_cast<const char *>(data[i]), bytes);
+            position = header.offsets[i] + bytes;
+        }
+        if (!file)
+            return false;
+    }
+    std::remove(cache_filename.c_str());
+    return std::rename(temp_filename.c_str(), cache_filename.c_str()) == 0;
+}
+
+// A read only view of a whole file, memory mapped where possible
+class MappedFile
+{
+  private:
+    const char *data_;
+    size_t size_;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+
+  public:
+    MappedFile(const std::string &filename) : data_(nullptr), size_(0)
+    {
+#ifdef _WIN32
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+            return;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data_ = buffer.data();
+        size_ = buffer.size();
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                data_ = static_cast<const char *>(p);
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (data_)
+            munmap(const_cast<char *>(data_), size_);
+#endif
+    }
+};
+
+/// @brief Copies a section of the cache into a vector
+template <typename T>
+static void read_section(const MappedFile &file, const SceneCacheHeader &header, int section,
+                         std::vector<T> &out)
+{
+    out.resize(header.counts[section]);
+    if (!out.empty())
+        memcpy(out.data(), file.data() + header.offsets[section], out.size() * sizeof(T));
+}
+
+/// @brief Copies count elements of a section, starting at element first, and moves first past them
+/// @return false if the section has fewer elements
+template <typename T>
+static bool read_range(const MappedFile &file, const SceneCacheHeader &header, int section,
+                       uint64_t &first, uint64_t count, std::vector<T> &out)
+{
+    if (first > header.counts[section] || count > header.counts[section] - first)
+        return false;
+    out.resize(count);
+    if (!out.empty())
+        memcpy(out.data(), file.data() + header.offsets[section] + first * sizeof(T),
+               out.size() * sizeof(T));
+    first += count;
+    return true;
+}
+
+/// @return true if all the indices are at least min and less than size
+static bool indices_in_range(const std::vector<int32_t> &indices, int32_t min, size_t size)
+{
+    for (int32_t index : indices)
+    {
+        if (index < min || (index >= 0 && static_cast<size_t>(index) >= size))
+            return false;
+    }
+    return true;
+}
+
+/// @brief Checks that the triangles of a mesh read from the cache only refer to vertices which
+/// exist
+static bool valid_mesh(const MeshData &mesh)
+{
+    const size_t count = mesh.position_indices.size();
+    if (count % 3 != 0 || (!mesh.normal_indices.empty() && mesh.normal_indices.size() != count) ||
+        (!mesh.texcoord_indices.empty() && mesh.texcoord_indices.size() != count))
+        return false;
+    return indices_in_range(mesh.position_indices, 0, mesh.positions.size()) &&
+           indices_in_range(mesh.normal_indices, -1, mesh.normals.size()) &&
+           indices_in_range(mesh.texcoord_indices, -1, mesh.texcoords.size());
+}
+
+/// @return true if none of the values is infinite or NaN, which the BVH builder can not bin
+static bool all_finite(const double *values, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (!std::isfinite(values[i]))
+            return false;
+    }
+    return true;
+}
+
+/// @brief Checks that the nodes of a BVH read from the cache only refer to nodes and primitives
+/// which exist, and that the tree fits in the traversal stack
+/// @param primitive_count Number of primitives, the primitive indices must be a permutation of them
+static bool valid_bvh(const std::vector<BVHNode> &nodes, const std::vector<int> &indices,
+                      size_t primitive_count)
+{
+    if (indices.size() != primitive_count)
+        return false;
+    std::vector<char> seen(primitive_count, 0);
+    for (int index : indices)
+    {
+        if (index < 0 || static_cast<size_t>(index) >= primitive_count || seen[index])
+            return false;
+        seen[index] = 1;
+    }
+    // Children are stored after their parent, so the depth of a node is known when it is reached
+    std::vector<int> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const BVHNode &node = nodes[i];
+        if (node.axis < 0 || node.axis > 2 || node.count < 0 || depth[i] >= BVH_MAX_DEPTH)
+            return false;
+        if (node.count > 0)
+        {
+            if (node.offset < 0 ||
+                static_cast<size_t>(node.offset) + static_cast<size_t>(node.count) > indices.size())
+                return false;
+        }
+        else
+        {
+            if (i + 1 >= nodes.size() || node.offset <= static_cast<int>(i) ||
+                static_cast<size_t>(node.offset) >= nodes.size())
+                return false;
+            depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+            depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+        }
+    }
+    return true;
+}
+
+bool read_scene_cache(const std::string &cache_filename, const std::string &source_filename,
+                      SceneDescription &description, BVH &bvh)
+{
+    MappedFile file(cache_filename);
+    if (file.data() == nullptr || file.size() < sizeof(SceneCacheHeader))
+        return false;
+    SceneCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SCENE_CACHE_VERSION || header.record_sizes != record_sizes() ||
+        !file_info(source_filename, source_size, source_mtime) ||
+        source_size != header.source_size || source_mtime != header.source_mtime)
+        return false;
+
+    for (int i = 0; i < SECTION_COUNT; ++i)
+    {
+        if (header.offsets[i] > file.size() ||
+            header.counts[i] > (file.size() - header.offsets[i]) / SECTION_ELEMENT_SIZE[i])
+            return false;
+    }
+
+    description.settings.assign(file.data() + header.offsets[SECTION_SETTINGS],
+                                header.counts[SECTION_SETTINGS]);
+    // Every group is declared on a line of its own in the scene file
+    if (header.group_count < 0 || static_cast<uint64_t>(header.group_count) > header.source_size)
+        return false;
+    description.group_count = header.group_count;
+    // Every index read from the cache is checked against its table, a damaged or stale cache is
+    // treated as a miss instead of being read out of bounds
+    read_section(file, header, SECTION_MATERIALS, description.materials);
+    read_section(file, header, SECTION_TEXTURES, description.textures);
+    const int32_t material_count = static_cast<int32_t>(description.materials.size());
+    const int32_t texture_count = static_cast<int32_t>(description.textures.size());
+    for (const auto &m : description.materials)
+    {
+        if (m.albedo_texture < -1 || m.albedo_texture >= texture_count ||
+            m.roughness_texture < -1 || m.roughness_texture >= texture_count)
+            return false;
+    }
+    auto valid_object = [&](int32_t material, int32_t group) {
+        return material >= 0 && material < material_count && group >= -1 &&
+               group < description.group_count;
+    };
+    // Number of objects placed directly in the scene, which are the primitives of its BVH
+    size_t scene_objects = 0;
+    read_section(file, header, SECTION_SPHERES, description.spheres);
+    for (const auto &s : description.spheres)
+    {
+        if (!valid_object(s.material, s.group) || !all_finite(s.center, 3) ||
+            !all_finite(&s.radius, 1))
+            return false;
+        scene_objects += s.group == -1;
+    }
+    read_section(file, header, SECTION_MESHES, description.meshes);
+    for (const auto &m : description.meshes)
+    {
+        if (!valid_object(m.material, m.group))
+            return false;
+        scene_objects += m.group == -1;
+    }
+    description.mesh_filenames.assign(file.data() + header.offsets[SECTION_MESH_FILENAMES],
+                                      header.counts[SECTION_MESH_FILENAMES]);
+    // The triangles of the meshes are in the cache, so it is stale if a mesh file has changed
+    for (const auto &m : description.meshes)
+    {
+        uint64_t size;
+        int64_t mtime;
+        if (m.filename_offset > description.mesh_filenames.size() ||
+            m.filename_length > description.mesh_filenames.size() - m.filename_offset ||
+            !file_info(description.mesh_filenames.substr(m.filename_offset, m.filename_length),
+                       size, mtime) ||
+            size != m.file_size || mtime != m.file_mtime)
+            return false;
+    }
+    // The triangles and the BVH of every mesh, so that the OBJ files are neither parsed nor are
+    // their BVHs built again
+    std::vector<MeshSizeRecord> mesh_sizes;
+    read_section(file, header, SECTION_MESH_SIZES, mesh_sizes);
+    if (mesh_sizes.size() != description.meshes.size())
+        return false;
+    // Position of the arrays of the next mesh in every section
+    uint64_t next[SECTION_COUNT] = {0};
+    description.mesh_data.resize(mesh_sizes.size());
+    description.mesh_bvhs.resize(mesh_sizes.size());
+    for (size_t i = 0; i < mesh_sizes.size(); ++i)
+    {
+        const MeshSizeRecord &sizes = mesh_sizes[i];
+        MeshData &mesh = description.mesh_data[i];
+        std::vector<BVHNode> mesh_nodes;
+        std::vector<int> mesh_bvh_indices;
+        if (!read_range(file, header, SECTION_MESH_POSITIONS, next[SECTION_MESH_POSITIONS],
+                        sizes.positions, mesh.positions) ||
+            !read_range(file, header, SECTION_MESH_NORMALS, next[SECTION_MESH_NORMALS],
+                        sizes.normals, mesh.normals) ||
+            !read_range(file, header, SECTION_MESH_TEXCOORDS, next[SECTION_MESH_TEXCOORDS],
+                        sizes.texcoords, mesh.texcoords) ||
+            !read_range(file, header, SECTION_MESH_INDICES, next[SECTION_MESH_INDICES],
+                        sizes.position_indices, mesh.position_indices) ||
+            !read_range(file, header, SECTION_MESH_INDICES, next[SECTION_MESH_INDICES],
+                        sizes.normal_indices, mesh.normal_indices) ||
+            !read_range(file, header, SECTION_MESH_INDICES, next[SECTION_MESH_INDICES],
+                        sizes.texcoord_indices, mesh.texcoord_indices) ||
+            !read_range(file, header, SECTION_MESH_BVH_NODES, next[SECTION_MESH_BVH_NODES],
+                        sizes.bvh_nodes, mesh_nodes) ||
+            !read_range(file, header, SECTION_MESH_BVH_INDICES, next[SECTION_MESH_BVH_INDICES],
+                        sizes.bvh_indices, mesh_bvh_indices) ||
+            !valid_mesh(mesh) || !valid_bvh(mesh_nodes, mesh_bvh_indices, mesh.triangle_count()))
+            return false;
+        description.mesh_bvhs[i].assign(std::move(mesh_nodes), std::move(mesh_bvh_indices));
+    }
+    read_section(file, header, SECTION_INSTANCES, description.instances);
+    for (const auto &instance : description.instances)
+    {
+        if (instance.group < 0 || instance.group >= description.group_count ||
+            !all_finite(instance.translation, 3) || !all_finite(&instance.scale, 1))
+            return false;
+    }
+    scene_objects += description.instances.size();
+    description.texture_filenames.assign(file.data() + header.offsets[SECTION_TEXTURE_FILENAMES],
+                                         header.counts[SECTION_TEXTURE_FILENAMES]);
+    for (const auto &t : description.textures)
+    {
+        if (t.filename_offset > description.texture_filenames.size() ||
+            t.filename_length > description.texture_filenames.size() - t.filename_offset)
+            return false;
+    }
+    read_section(file, header, SECTION_KEYS, description.keys);
+    for (const auto &k : description.keys)
+    {
+        if (k.instance < -1 || k.instance >= static_cast<int32_t>(description.instances.size()) ||
+            !all_finite(k.position, 3) || !all_finite(k.lookat, 3) || !all_finite(&k.scale, 1))
+            return false;
+    }
+    std::vector<BVHNode> nodes;
+    std::vector<int> indices;
+    read_section(file, header, SECTION_BVH_NODES, nodes);
+    read_section(file, header, SECTION_BVH_INDICES, indices);
+    if (!valid_bvh(nodes, indices, scene_objects))
+        return false;
+    bvh.assign(std::move(nodes), std::move(indices));
+    return true;
+}
+
+void load_scene(const std::string &filename, Scene &scene, Config &cfg, bool use_cache,
+                Animation *animation)
+{
+    // A missing file is reported by the parser
+    file_info(filename, cfg.scene_size, cfg.scene_mtime);
+    std::string cache_filename = filename + ".cache";
+    if (use_cache)
+    {
+        SceneDescription description;
+        BVH bvh;
+        if (read_scene_cache(cache_filename, filename, description, bvh))
+        {
+            build_scene(std::move(description), scene, cfg, &bvh, animation);
+            return;
+        }
+    }
+    SceneDescription description = parse_scene_file(filename);
+    if (!use_cache)
+    {
+        build_scene(std::move(description), scene, cfg, nullptr, animation);
+        return;
+    }
+    // The meshes are kept in the description to be written to the cache
+    load_meshes(description);
+    build_scene(description, scene, cfg, nullptr, animation);
+    if (!write_scene_cache(cache_filename, filename, description, scene.get_bvh()))
+    {
+        std::cerr << "Warning: could not write the scene cache " << cache_filename << std::endl;
+    }
+}
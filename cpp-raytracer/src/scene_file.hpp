@@ -0,0 +1,186 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Reading scenes from scene description files, and caching the parsed scene in a binary file
+//
+// A scene file has one "key = value" setting per line, # and ; start comments. Keys are either
+// fields of Config, or describe the scene:
+//
+//   image_width = 400                           any field of Config, angles are in degrees
+//   camera_position = 13 2 3
+//   texture = <name> <image filename>           relative to the scene file, no spaces in the name
+//   material = <name> lambertian <r> <g> <b> [albedo texture]
+//   material = <name> metal <r> <g> <b> <fuzziness> [albedo texture] [roughness texture]
+//                                               [ggx|beckmann]
+//                                               a texture can be - when it is not used, the
+//                                               microfacets are ggx by default
+//   material = <name> glass <r> <g> <b> <refractive index>
+//   material = <name> normal
+//   material = <name> emissive <r> <g> <b> <strength>  a light, emits strength * color
+//   sphere = <x> <y> <z> <radius> <material name>
+//   mesh = <obj filename> <material name>       relative to the scene file, no spaces in the name
+//   group = <name>                              objects up to "end = <name>" belong to the group
+//   end = <name>
+//   instance = <group name> <x> <y> <z> [scale] [name]
+//                                               places a copy of the group, sharing its objects,
+//                                               the name (not a number) is used by the keys
+//   key = <frame> camera <x> <y> <z> <look at x> <look at y> <look at z>
+//   key = <frame> <instance name> <x> <y> <z> [scale]
+//                                               position of the camera or of an instance at a
+//                                               frame of the animation (see animation.hpp)
+//
+// See scenes/ for examples.
+#pragma once
+#include "animation.hpp"
+#include "bvh.hpp"
+#include "config.h"
+#include "scene.hpp"
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class scene_parse_error : public std::runtime_error
+{
+  public:
+    scene_parse_error(const std::string &message) : std::runtime_error(message) {}
+};
+
+enum MaterialType : int32_t
+{
+    MATERIAL_LAMBERTIAN = 0,
+    MATERIAL_METAL = 1,
+    MATERIAL_GLASS = 2,
+    MATERIAL_NORMAL = 3,
+    MATERIAL_EMISSIVE = 4
+};
+
+// The records below are written to the cache file as they are, so they only contain fixed size
+// fields
+
+struct MaterialRecord
+{
+    int32_t type;
+    // Index of the albedo texture of lambertian and metal materials, -1 for none
+    int32_t albedo_texture;
+    double albedo[3];
+    // Fuzziness for metals, refractive index for glass, strength for emissive materials
+    double parameter;
+    // Index of the roughness texture of metals, -1 for none
+    int32_t roughness_texture;
+    // MicrofacetDistribution of metals
+    int32_t distribution;
+};
+
+struct TextureRecord
+{
+    // Position and length of the name of the image in SceneDescription::texture_filenames
+    uint64_t filename_offset;
+    uint64_t filename_length;
+};
+
+struct SphereRecord
+{
+    double center[3];
+    double radius;
+    int32_t material;
+    // Index of the group the sphere belongs to, -1 if it is placed directly in the scene
+    int32_t group;
+};
+
+struct MeshRecord
+{
+    // Position and length of the name of the OBJ file in SceneDescription::mesh_filenames
+    uint64_t filename_offset;
+    uint64_t filename_length;
+    // Size and modification time of the OBJ file when the scene was parsed, a cache is not used
+    // if the mesh has changed since then
+    uint64_t file_size;
+    int64_t file_mtime;
+    int32_t material;
+    int32_t group;
+};
+
+struct InstanceRecord
+{
+    double translation[3];
+    double scale;
+    int32_t group;
+    int32_t padding;
+};
+
+struct KeyRecord
+{
+    int32_t frame;
+    // Index of the instance (in SceneDescription::instances), -1 for the camera
+    int32_t instance;
+    // Position of the camera, or translation of the instance
+    double position[3];
+    // Point the camera looks at, unused for instances
+    double lookat[3];
+    // Scale of the instance, unused for the camera
+    double scale;
+};
+
+// A parsed scene file
+struct SceneDescription
+{
+    // Config settings as "key=value" lines
+    std::string settings;
+    std::vector<MaterialRecord> materials;
+    std::vector<SphereRecord> spheres;
+    std::vector<MeshRecord> meshes;
+    // Names of the mesh files, one after the other
+    std::string mesh_filenames;
+    std::vector<InstanceRecord> instances;
+    std::vector<TextureRecord> textures;
+    // Names of the images of the textures, one after the other
+    std::string texture_filenames;
+    std::vector<KeyRecord> keys;
+    int32_t group_count = 0;
+    // Vertices, triangles and BVH of every mesh (in the order of meshes), read from the cache or
+    // from the OBJ files by load_scene. Empty when only the scene file has been parsed
+    std::vector<MeshData> mesh_data;
+    std::vector<BVH> mesh_bvhs;
+};
+
+/// @brief Sets a field of the config from its text representation
+/// @throw std::invalid_argument if the key is not a field of Config or the value is invalid
+void set_config_value(Config &cfg, const std::string &key, const std::string &value);
+
+/// @brief Parses a scene file
+/// @throw scene_parse_error if the file cannot be read or has errors
+SceneDescription parse_scene_file(const std::string &filename);
+
+/// @brief Creates the objects and materials of the description in the scene and finalizes it, and
+/// applies the settings to the config. The meshes are read from their files unless their data is
+/// in the description, and the images of the textures are converted to tiled files if needed.
+/// @param description Taken by value, so that the mesh data can be moved into the scene
+/// @param bvh An acceleration structure built earlier for this description, or nullptr to build it
+/// @param animation If not null, the keys of the description are added to it
+void build_scene(SceneDescription description, Scene &scene, Config &cfg,
+                 const BVH *bvh = nullptr, Animation *animation = nullptr);
+
+/// @brief Writes the description (including the triangles and the BVH of every mesh, which must
+/// have been loaded) and the acceleration structure of the scene built from it to a binary cache
+/// file
+/// @param source_filename The scene file, the cache stores its size and modification time so that
+/// stale caches are detected
+/// @return false if the file could not be written
+bool write_scene_cache(const std::string &cache_filename, const std::string &source_filename,
+                       const SceneDescription &description, const BVH &bvh);
+
+/// @brief Reads a cache file written by write_scene_cache, the file is memory mapped and the
+/// arrays (including the meshes, which are not read from their OBJ files) are copied out of it
+/// directly
+/// @return false if the file does not exist, is invalid, or is older than the scene file or one of
+/// the meshes
+bool read_scene_cache(const std::string &cache_filename, const std::string &source_filename,
+                      SceneDescription &description, BVH &bvh);
+
+/// @brief Loads a scene file into the scene and config. If an up to date cache exists (the scene
+/// filename followed by .cache) it is used instead of parsing the file, otherwise the cache is
+/// written after parsing.
+/// @throw scene_parse_error if the file cannot be read or has errors, std::runtime_error if a mesh
+/// or a texture cannot be read
+/// @param animation If not null, the keys of the scene are added to it
+void load_scene(const std::string &filename, Scene &scene, Config &cfg, bool use_cache = true,
+                Animation *animation = nullptr);
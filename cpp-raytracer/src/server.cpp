@@ -0,0 +1,406 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "server.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+
+class Connection
+{
+};
+
+void run_server(const std::string &, int, const ServerOptions &)
+{
+    throw std::runtime_error("The render server is not supported on Windows");
+}
+
+RenderClient::RenderClient(const std::string &)
+{
+    throw std::runtime_error("The render server is not supported on Windows");
+}
+
+RenderClient::~RenderClient() {}
+
+RenderResult RenderClient::render(const RenderRequest &)
+{
+    throw std::runtime_error("The render server is not supported on Windows");
+}
+
+#else
+
+#include "camera.hpp"
+#include "config.h"
+#include "network.hpp"
+#include "raytracer.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "thread_pool.hpp"
+#include "tiles.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <limits.h>
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+using server_clock = std::chrono::steady_clock;
+
+// Largest width or height of a requested image
+const int MAX_REQUEST_SIZE = 1 << 14;
+// Size of the reply to a render request before the pixels
+const uint64_t IMAGE_REPLY_HEADER_SIZE = 4 * sizeof(int32_t) + sizeof(double) + sizeof(uint8_t);
+
+// Distinct from the types used by distributed rendering, so that a client which connects to a
+// coordinator (or a worker to the server) fails with an error
+enum ServerMessageType : uint32_t
+{
+    // Client to server: scene file, width, height, samples per pixel, priority, whether the camera
+    // is moved, and its position and the point it looks at
+    MESSAGE_RENDER = 100,
+    // Server to client: width, height, tonemap, gamma, seconds taken, whether the scene was
+    // cached, followed by the pixels row by row
+    MESSAGE_IMAGE,
+    // Server to client: the request failed, followed by the reason
+    MESSAGE_FAILED,
+};
+
+// A scene loaded by the server, which stays in memory between requests
+struct CachedScene
+{
+    Scene scene;
+    // Settings from the scene file
+    Config cfg;
+    // Size and modification time of the scene file when it was loaded
+    int64_t size;
+    int64_t mtime;
+};
+
+/// @return false if the file does not exist
+static bool file_info(const std::string &filename, int64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    size = static_cast<int64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+// The scenes in memory, the most recently used first. Scenes are shared with the requests which
+// render them, so a scene dropped from the cache lives until its last render finishes.
+class SceneCache
+{
+  private:
+    std::mutex lock;
+    // Scenes are loaded one at a time, so that two requests for the same scene load it only once
+    std::mutex load_lock;
+    std::list<std::pair<std::string, std::shared_ptr<const CachedScene>>> scenes;
+    size_t capacity;
+
+    /// @return The scene if it is in memory and the file has not changed since it was loaded
+    std::shared_ptr<const CachedScene> find(const std::string &filename, int64_t size,
+                                            int64_t mtime)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = scenes.begin(); it != scenes.end(); ++it)
+        {
+            if (it->first != filename)
+                continue;
+            if (it->second->size != size || it->second->mtime != mtime)
+            {
+                scenes.erase(it);
+                return nullptr;
+            }
+            scenes.splice(scenes.begin(), scenes, it);
+            return scenes.front().second;
+        }
+        return nullptr;
+    }
+
+  public:
+    explicit SceneCache(int capacity) : capacity(std::max(capacity, 1)) {}
+
+    /// @param cached Set to true if the scene was already in memory
+    /// @throw std::exception if the scene cannot be loaded
+    std::shared_ptr<const CachedScene> get(const std::string &filename, bool &cached)
+    {
+        // Different names of the same file share one scene
+        char resolved[PATH_MAX];
+        std::string path = realpath(filename.c_str(), resolved) ? resolved : filename;
+        int64_t size, mtime;
+        if (!file_info(path, size, mtime))
+            throw std::runtime_error("Cannot open scene file " + filename);
+        cached = true;
+        std::shared_ptr<const CachedScene> scene = find(path, size, mtime);
+        if (scene)
+            return scene;
+
+        std::lock_guard<std::mutex> loading(load_lock);
+        // Another request may have loaded it while this one waited
+        scene = find(path, size, mtime);
+        if (scene)
+            return scene;
+        cached = false;
+        std::shared_ptr<CachedScene> loaded(new CachedScene);
+        // The same defaults as a render started from the command line
+        loaded->cfg.samples_per_pixel = 100;
+        loaded->cfg.image_width = 400;
+        loaded->cfg.image_height = loaded->cfg.image_width * (9.0 / 16.0);
+        load_scene(path, loaded->scene, loaded->cfg);
+        loaded->size = size;
+        loaded->mtime = mtime;
+        std::lock_guard<std::mutex> guard(lock);
+        scenes.emplace_front(path, loaded);
+        while (scenes.size() > capacity)
+            scenes.pop_back();
+        return loaded;
+    }
+};
+
+// Counts the tiles of a request which are still being rendered
+class PendingTiles
+{
+  private:
+    std::mutex lock;
+    std::condition_variable finished;
+    int remaining;
+
+  public:
+    explicit PendingTiles(int count) : remaining(count) {}
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (--remaining == 0)
+            finished.notify_all();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this] { return remaining == 0; });
+    }
+};
+
+// State shared by the threads of the server, kept alive by the connections which use it
+struct ServerState
+{
+    ThreadPool pool;
+    SceneCache scenes;
+    std::mutex log_lock;
+
+    ServerState(int threads, const ServerOptions &options)
+        : pool(threads, options.pin_threads), scenes(options.max_cached_scenes)
+    {
+    }
+};
+
+/// @return true if the reply with an image of this size fits in a message, larger images are
+/// rejected before they are rendered
+static bool image_fits_message(int width, int height)
+{
+    uint64_t pixels = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+    return IMAGE_REPLY_HEADER_SIZE + pixels * CHANNELS * sizeof(float) <= MAX_MESSAGE_SIZE;
+}
+
+static RenderRequest read_request(const Message &message)
+{
+    MessageReader reader(message.payload);
+    RenderRequest request;
+    request.scene_filename = reader.read_string();
+    request.width = reader.read<int32_t>();
+    request.height = reader.read<int32_t>();
+    request.samples_per_pixel = reader.read<int32_t>();
+    request.priority = reader.read<int32_t>();
+    request.move_camera = reader.read<uint8_t>() != 0;
+    double camera[6];
+    reader.read_array(camera, 6);
+    reader.finish();
+    request.camera_position = vec3(camera[0], camera[1], camera[2]);
+    request.camera_lookat = vec3(camera[3], camera[4], camera[5]);
+    if (request.width < 0 || request.height < 0 || request.samples_per_pixel < 0 ||
+        request.width > MAX_REQUEST_SIZE || request.height > MAX_REQUEST_SIZE)
+        throw std::runtime_error("Invalid size or number of samples");
+    // A size of 0 is the size in the scene file, which is checked once the scene is loaded
+    if (!image_fits_message(request.width, request.height))
+        throw std::runtime_error("The image is too large to be sent");
+    return request;
+}
+
+/// @brief Renders a request with the threads of the pool
+/// @param img Reused between the requests of a connection, reallocated if the size changes
+/// @return The message with the image
+static std::vector<char> render_request(ServerState &state, const RenderRequest &request,
+                                        Framebuffer &img)
+{
+    auto start = server_clock::now();
+    bool cached;
+    std::shared_ptr<const CachedScene> scene = state.scenes.get(request.scene_filename, cached);
+    Config cfg = scene->cfg;
+    if (request.width > 0)
+        cfg.image_width = request.width;
+    if (request.height > 0)
+        cfg.image_height = request.height;
+    if (request.samples_per_pixel > 0)
+        cfg.samples_per_pixel = request.samples_per_pixel;
+    if (request.move_camera)
+    {
+        cfg.camera_position = request.camera_position;
+        cfg.camera_lookat = request.camera_lookat;
+    }
+    cfg.show_progress = false;
+    if (cfg.image_width <= 0 || cfg.image_height <= 0 || cfg.image_width > MAX_REQUEST_SIZE ||
+        cfg.image_height > MAX_REQUEST_SIZE)
+        throw std::runtime_error("Invalid image size");
+    if (!image_fits_message(cfg.image_width, cfg.image_height))
+        throw std::runtime_error("The image is too large to be sent");
+    MovableCamera cam(cfg);
+    if (img.width() != cfg.image_width || img.height() != cfg.image_height)
+        img = Framebuffer(cfg.image_width, cfg.image_height);
+
+    // Every tile is a task of the pool, the request waits until all of them are rendered
+    Renderer renderer(cfg);
+    TileScheduler scheduler(cfg.image_width, cfg.image_height, cfg.tile_size);
+    PendingTiles pending(scheduler.tile_count());
+    // Only the tiles which this request could not read fail it
+    uint64_t read_errors = scene->scene.get_texture_cache().stats().read_errors;
+    for (int i = 0; i < scheduler.tile_count(); ++i)
+    {
+        Tile tile = scheduler.tile_at(i);
+        state.pool.submit(request.priority, [&renderer, &cam, &scene, &img, &pending, tile] {
+            renderer.render_tile(cam, scene->scene, tile, img);
+            pending.finish();
+        });
+    }
+    pending.wait();
+    scene->scene.get_texture_cache().check_read_errors(read_errors);
+    double seconds = std::chrono::duration<double>(server_clock::now() - start).count();
+
+    MessageWriter message;
+    message.write(static_cast<int32_t>(cfg.image_width))
+        .write(static_cast<int32_t>(cfg.image_height))
+        .write(static_cast<int32_t>(cfg.tonemap))
+        .write(static_cast<int32_t>(cfg.gamma))
+        .write(seconds)
+        .write(static_cast<uint8_t>(cached))
+        .write_array(img.row(0),
+                     static_cast<size_t>(cfg.image_width) * cfg.image_height * CHANNELS);
+    {
+        std::lock_guard<std::mutex> guard(state.log_lock);
+        std::cout << "Rendered " << request.scene_filename << " (" << cfg.image_width << "x"
+                  << cfg.image_height << ", " << cfg.samples_per_pixel
+                  << " samples per pixel, priority " << request.priority << ") in " << seconds
+                  << "s" << (cached ? "" : ", scene loaded") << std::endl;
+    }
+    return message.payload();
+}
+
+/// @brief Answers the requests of a client until it disconnects
+static void serve_client(std::shared_ptr<ServerState> state, int fd)
+{
+    Connection connection(fd);
+    Framebuffer img;
+    Message message;
+    try
+    {
+        while (connection.receive(message))
+        {
+            if (message.type != MESSAGE_RENDER)
+                throw std::runtime_error("Unexpected message");
+            std::vector<char> reply;
+            try
+            {
+                reply = render_request(*state, read_request(message), img);
+            }
+            catch (const std::exception &e)
+            {
+                // The client may send more requests after a failed one
+                connection.send(MESSAGE_FAILED, MessageWriter().write_string(e.what()).payload());
+                continue;
+            }
+            connection.send(MESSAGE_IMAGE, reply);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::lock_guard<std::mutex> guard(state->log_lock);
+        std::cerr << "Client lost: " << e.what() << std::endl;
+    }
+}
+
+void run_server(const std::string &address, int threads, const ServerOptions &options)
+{
+    int listener = open_socket(address, true);
+    std::shared_ptr<ServerState> state(new ServerState(threads, options));
+    std::cout << "Render server listening on " << address << " with " << state->pool.size()
+              << " threads" << (options.pin_threads ? " (pinned)" : "") << std::endl;
+    while (true)
+    {
+        int fd = accept_connection(listener);
+        if (fd < 0)
+        {
+            // Interrupted, or out of file descriptors until other clients disconnect
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        std::thread(serve_client, state, fd).detach();
+    }
+}
+
+RenderClient::RenderClient(const std::string &address)
+    : connection(new Connection(open_socket(address, false)))
+{
+}
+
+RenderClient::~RenderClient() {}
+
+RenderResult RenderClient::render(const RenderRequest &request)
+{
+    // The server resolves relative paths from its own directory
+    char resolved[PATH_MAX];
+    std::string scene_filename = request.scene_filename;
+    if (realpath(scene_filename.c_str(), resolved))
+        scene_filename = resolved;
+    double camera[6] = {request.camera_position.x, request.camera_position.y,
+                        request.camera_position.z, request.camera_lookat.x,
+                        request.camera_lookat.y,   request.camera_lookat.z};
+    MessageWriter message;
+    message.write_string(scene_filename)
+        .write(static_cast<int32_t>(request.width))
+        .write(static_cast<int32_t>(request.height))
+        .write(static_cast<int32_t>(request.samples_per_pixel))
+        .write(static_cast<int32_t>(request.priority))
+        .write(static_cast<uint8_t>(request.move_camera))
+        .write_array(camera, 6);
+    connection->send(MESSAGE_RENDER, message.payload());
+
+    Message reply;
+    if (!connection->receive(reply))
+        throw std::runtime_error("The server closed the connection");
+    MessageReader reader(reply.payload);
+    if (reply.type == MESSAGE_FAILED)
+        throw std::runtime_error("The server could not render the image: " + reader.read_string());
+    if (reply.type != MESSAGE_IMAGE)
+        throw std::runtime_error("Unexpected message from the server");
+    int width = reader.read<int32_t>();
+    int height = reader.read<int32_t>();
+    if (width <= 0 || height <= 0 || width > MAX_REQUEST_SIZE || height > MAX_REQUEST_SIZE)
+        throw std::runtime_error("Invalid image size from the server");
+    RenderResult result;
+    result.tonemap = static_cast<ToneMap>(reader.read<int32_t>());
+    result.gamma = reader.read<int32_t>();
+    result.seconds = reader.read<double>();
+    result.scene_cached = reader.read<uint8_t>() != 0;
+    result.image = Framebuffer(width, height);
+    reader.read_array(result.image.row(0), static_cast<size_t>(width) * height * CHANNELS);
+    reader.finish();
+    return result;
+}
+
+#endif
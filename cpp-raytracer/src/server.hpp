@@ -0,0 +1,77 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// A render server, a long running process which renders images for clients which connect to it.
+// The scenes are loaded once and kept in memory with their BVH, so a request only pays for the
+// render itself, and the tiles of every request are rendered by one pool of threads, in the order
+// of the priorities of the requests. A client may send any number of requests over one
+// connection, the server answers them one after the other with the float pixels of the image.
+#pragma once
+#include "commons.hpp"
+#include "image.hpp"
+#include <memory>
+#include <string>
+
+class Connection;
+
+// Settings of the server
+struct ServerOptions
+{
+    // Number of scenes kept in memory, the scene used least recently is dropped when another one
+    // is loaded
+    int max_cached_scenes = 8;
+    // Pin the render threads to processors, one NUMA node after the other
+    bool pin_threads = false;
+};
+
+// An image which a client asks the server to render
+struct RenderRequest
+{
+    // Scene file, read from the file system of the server
+    std::string scene_filename;
+    // Size of the image and samples per pixel, 0 keeps the value from the scene file
+    int width = 0;
+    int height = 0;
+    int samples_per_pixel = 0;
+    // If set, the camera is moved to position and looks at lookat, the other settings of the
+    // camera come from the scene file
+    bool move_camera = false;
+    vec3 camera_position;
+    vec3 camera_lookat;
+    // Requests with a higher priority are rendered first
+    int priority = 0;
+};
+
+struct RenderResult
+{
+    Framebuffer image;
+    // Tonemapping settings of the scene file
+    ToneMap tonemap;
+    int gamma;
+    // Time taken by the server, from receiving the request to finishing the image
+    double seconds;
+    // true if the scene was already in memory
+    bool scene_cached;
+};
+
+/// @brief Listens on the address and renders the requests of every client which connects, until
+/// the process is stopped
+/// @param address "unix:<path>" for a Unix socket, or "<host>:<port>" for TCP
+/// @param threads Number of render threads, shared by all the requests
+/// @throw std::runtime_error if the socket cannot be opened
+void run_server(const std::string &address, int threads,
+                const ServerOptions &options = ServerOptions());
+
+// A connection to a render server
+class RenderClient
+{
+  private:
+    std::unique_ptr<Connection> connection;
+
+  public:
+    /// @throw std::runtime_error if the server cannot be reached
+    explicit RenderClient(const std::string &address);
+    ~RenderClient();
+
+    /// @brief Sends a request and waits for the image
+    /// @throw std::runtime_error if the server cannot render it, with the reason
+    RenderResult render(const RenderRequest &request);
+};
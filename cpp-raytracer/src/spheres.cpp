@@ -0,0 +1,355 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "spheres.hpp"
+#include <algorithm>
+#include <cmath>
+#if SPHERE_SIMD_WIDTH > 1
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC 12 reports false positives inside the AVX-512 intrinsics headers
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+/// @return Index of the lowest set bit of a non zero mask
+static inline int lowest_bit(unsigned mask)
+{
+    int index = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+}
+#endif
+
+void SphereSet::clear()
+{
+    center_x.clear();
+    center_y.clear();
+    center_z.clear();
+    radius2.clear();
+    count = 0;
+}
+
+void SphereSet::add(const vec3 &center, real radius)
+{
+    center_x.push_back(center.x);
+    center_y.push_back(center.y);
+    center_z.push_back(center.z);
+    radius2.push_back(radius * radius);
+    count++;
+}
+
+void SphereSet::add_empty()
+{
+    // Every comparison with NaN is false, so the discriminant test always fails
+    real nan = std::numeric_limits<real>::quiet_NaN();
+    center_x.push_back(nan);
+    center_y.push_back(nan);
+    center_z.push_back(nan);
+    radius2.push_back(nan);
+    count++;
+}
+
+void SphereSet::finish()
+{
+    real nan = std::numeric_limits<real>::quiet_NaN();
+    size_t padded = count + SPHERE_SIMD_WIDTH - 1;
+    center_x.resize(padded, nan);
+    center_y.resize(padded, nan);
+    center_z.resize(padded, nan);
+    radius2.resize(padded, nan);
+}
+
+// Ray-sphere intersection for a normalized direction
+// With oc = origin - center and h = dot(direction, oc) the roots are t = -h -+ sqrt(r^2 - |l|^2),
+// where l = oc - h * direction is the vector from the center to the point of the ray closest to
+// it. This loses much less precision than h^2 - (|oc|^2 - r^2) when the sphere is small compared
+// to its distance, which matters with float. The nearer root is used unless it lies before t_min.
+bool SphereSet::closest_hit_scalar(const vec3 &origin, const vec3 &direction, real t_min,
+                                   int first, int n, PrimitiveHit &closest) const
+{
+    bool hit = false;
+    for (int i = first; i < first + n; ++i)
+    {
+        real ocx = origin.x - center_x[i];
+        real ocy = origin.y - center_y[i];
+        real ocz = origin.z - center_z[i];
+        real h = direction.x * ocx + direction.y * ocy + direction.z * ocz;
+        real lx = ocx - h * direction.x;
+        real ly = ocy - h * direction.y;
+        real lz = ocz - h * direction.z;
+        real discriminant = radius2[i] - (lx * lx + ly * ly + lz * lz);
+        if (!(discriminant >= 0))
+            continue;
+        real sqd = std::sqrt(discriminant);
+        real t = -h - sqd;
+        if (!(t >= t_min))
+            t = -h + sqd;
+        if (t >= t_min && t < closest.t)
+        {
+            closest.t = t;
+            closest.id = i;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+void SphereSet::closest_hits(const RayPacket &packet, const char *active, real t_min, int first,
+                             int n, real *closest_t, int *closest_id) const
+{
+    // A local copy, the stores to closest_id could alias packet.size
+    const int size = packet.size;
+    for (int s = first; s < first + n; ++s)
+    {
+        const real cx = center_x[s], cy = center_y[s], cz = center_z[s], r2 = radius2[s];
+        // Written without branches so that the loop over the rays is vectorized, the square root
+        // of a negative discriminant is NaN and the ray is then not updated
+        for (int i = 0; i < size; ++i)
+        {
+            real ocx = packet.origin_x[i] - cx;
+            real ocy = packet.origin_y[i] - cy;
+            real ocz = packet.origin_z[i] - cz;
+            real dx = packet.direction_x[i], dy = packet.direction_y[i],
+                 dz = packet.direction_z[i];
+            real h = dx * ocx + dy * ocy + dz * ocz;
+            real lx = ocx - h * dx;
+            real ly = ocy - h * dy;
+            real lz = ocz - h * dz;
+            real discriminant = r2 - (lx * lx + ly * ly + lz * lz);
+            real sqd = std::sqrt(discriminant);
+            real t = -h - sqd;
+            t = (t >= t_min) ? t : -h + sqd;
+            bool closer = active[i] && discriminant >= 0 && t >= t_min && t < closest_t[i];
+            closest_t[i] = closer ? t : closest_t[i];
+            closest_id[i] = closer ? s : closest_id[i];
+        }
+    }
+}
+
+// The SIMD versions are written once, in terms of the wrappers below which map to the double or
+// the float intrinsics
+
+#if SPHERE_SIMD_WIDTH > 1 && defined(__AVX512F__)
+
+#ifdef RAYTRACER_FLOAT
+typedef __m512 simd_real;
+typedef __mmask16 simd_mask;
+static inline simd_real simd_set1(real x) { return _mm512_set1_ps(x); }
+static inline simd_real simd_load(const real *p) { return _mm512_loadu_ps(p); }
+static inline simd_real simd_add(simd_real a, simd_real b) { return _mm512_add_ps(a, b); }
+static inline simd_real simd_sub(simd_real a, simd_real b) { return _mm512_sub_ps(a, b); }
+static inline simd_real simd_mul(simd_real a, simd_real b) { return _mm512_mul_ps(a, b); }
+static inline simd_real simd_sqrt(simd_real a) { return _mm512_sqrt_ps(a); }
+static inline simd_real simd_neg(simd_real a) { return _mm512_xor_ps(a, _mm512_set1_ps(-0.0f)); }
+static inline simd_mask simd_ge(simd_real a, simd_real b)
+{
+    return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ);
+}
+static inline simd_mask simd_lt(simd_real a, simd_real b)
+{
+    return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+}
+static inline simd_mask simd_eq(simd_real a, simd_real b)
+{
+    return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ);
+}
+static inline simd_real simd_blend(simd_mask m, simd_real a, simd_real b)
+{
+    return _mm512_mask_blend_ps(m, a, b);
+}
+static inline real simd_reduce_min(simd_real a) { return _mm512_reduce_min_ps(a); }
+#else
+typedef __m512d simd_real;
+typedef __mmask8 simd_mask;
+static inline simd_real simd_set1(real x) { return _mm512_set1_pd(x); }
+static inline simd_real simd_load(const real *p) { return _mm512_loadu_pd(p); }
+static inline simd_real simd_add(simd_real a, simd_real b) { return _mm512_add_pd(a, b); }
+static inline simd_real simd_sub(simd_real a, simd_real b) { return _mm512_sub_pd(a, b); }
+static inline simd_real simd_mul(simd_real a, simd_real b) { return _mm512_mul_pd(a, b); }
+static inline simd_real simd_sqrt(simd_real a) { return _mm512_sqrt_pd(a); }
+static inline simd_real simd_neg(simd_real a) { return _mm512_xor_pd(a, _mm512_set1_pd(-0.0)); }
+static inline simd_mask simd_ge(simd_real a, simd_real b)
+{
+    return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ);
+}
+static inline simd_mask simd_lt(simd_real a, simd_real b)
+{
+    return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);
+}
+static inline simd_mask simd_eq(simd_real a, simd_real b)
+{
+    return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ);
+}
+static inline simd_real simd_blend(simd_mask m, simd_real a, simd_real b)
+{
+    return _mm512_mask_blend_pd(m, a, b);
+}
+static inline real simd_reduce_min(simd_real a) { return _mm512_reduce_min_pd(a); }
+#endif
+
+bool SphereSet::closest_hit(const vec3 &origin, const vec3 &direction, real t_min, int first,
+                            int n, PrimitiveHit &closest) const
+{
+    const int width = SPHERE_SIMD_WIDTH;
+    const simd_real ox = simd_set1(origin.x), oy = simd_set1(origin.y), oz = simd_set1(origin.z);
+    const simd_real dx = simd_set1(direction.x), dy = simd_set1(direction.y),
+                    dz = simd_set1(direction.z);
+    const simd_real tmin = simd_set1(t_min);
+    const simd_real zero = simd_set1(0);
+    const simd_real inf = simd_set1(INF);
+    bool hit = false;
+    for (int i = first; i < first + n; i += width)
+    {
+        int lanes = std::min(width, first + n - i);
+        simd_mask active = static_cast<simd_mask>((1u << lanes) - 1);
+        simd_real ocx = simd_sub(ox, simd_load(&center_x[i]));
+        simd_real ocy = simd_sub(oy, simd_load(&center_y[i]));
+        simd_real ocz = simd_sub(oz, simd_load(&center_z[i]));
+        simd_real h = simd_add(simd_add(simd_mul(dx, ocx), simd_mul(dy, ocy)), simd_mul(dz, ocz));
+        simd_real lx = simd_sub(ocx, simd_mul(h, dx));
+        simd_real ly = simd_sub(ocy, simd_mul(h, dy));
+        simd_real lz = simd_sub(ocz, simd_mul(h, dz));
+        simd_real discriminant =
+            simd_sub(simd_load(&radius2[i]),
+                     simd_add(simd_add(simd_mul(lx, lx), simd_mul(ly, ly)), simd_mul(lz, lz)));
+        active &= simd_ge(discriminant, zero);
+        if (!active)
+            continue;
+        simd_real sqd = simd_sqrt(discriminant);
+        simd_real neg_h = simd_neg(h);
+        simd_real t0 = simd_sub(neg_h, sqd);
+        simd_real t1 = simd_add(neg_h, sqd);
+        simd_real t = simd_blend(simd_ge(t0, tmin), t1, t0);
+        active &= simd_ge(t, tmin);
+        active &= simd_lt(t, simd_set1(closest.t));
+        if (!active)
+            continue;
+        t = simd_blend(active, inf, t);
+        real t_best = simd_reduce_min(t);
+        simd_mask best = simd_eq(t, simd_set1(t_best)) & active;
+        closest.t = t_best;
+        closest.id = i + lowest_bit(best);
+        hit = true;
+    }
+    return hit;
+}
+
+#elif SPHERE_SIMD_WIDTH > 1
+
+// Comparisons give a mask with all the bits of a lane set where they are true
+#ifdef RAYTRACER_FLOAT
+typedef __m256 simd_real;
+static inline simd_real simd_set1(real x) { return _mm256_set1_ps(x); }
+static inline simd_real simd_load(const real *p) { return _mm256_loadu_ps(p); }
+static inline simd_real simd_add(simd_real a, simd_real b) { return _mm256_add_ps(a, b); }
+static inline simd_real simd_sub(simd_real a, simd_real b) { return _mm256_sub_ps(a, b); }
+static inline simd_real simd_mul(simd_real a, simd_real b) { return _mm256_mul_ps(a, b); }
+static inline simd_real simd_sqrt(simd_real a) { return _mm256_sqrt_ps(a); }
+static inline simd_real simd_neg(simd_real a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+static inline simd_real simd_and(simd_real a, simd_real b) { return _mm256_and_ps(a, b); }
+static inline simd_real simd_ge(simd_real a, simd_real b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline simd_real simd_lt(simd_real a, simd_real b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline simd_real simd_eq(simd_real a, simd_real b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+static inline simd_real simd_blend(simd_real m, simd_real a, simd_real b)
+{
+    return _mm256_blendv_ps(a, b, m);
+}
+static inline int simd_movemask(simd_real m) { return _mm256_movemask_ps(m); }
+static inline simd_real simd_lane_index() { return _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0); }
+// Minimum of all the lanes, in every lane
+static inline simd_real simd_min_all(simd_real t)
+{
+    simd_real m = _mm256_min_ps(t, _mm256_permute_ps(t, 0xB1));
+    m = _mm256_min_ps(m, _mm256_permute_ps(m, 0x4E));
+    return _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 0x1));
+}
+static inline real simd_first(simd_real a) { return _mm256_cvtss_f32(a); }
+#else
+typedef __m256d simd_real;
+static inline simd_real simd_set1(real x) { return _mm256_set1_pd(x); }
+static inline simd_real simd_load(const real *p) { return _mm256_loadu_pd(p); }
+static inline simd_real simd_add(simd_real a, simd_real b) { return _mm256_add_pd(a, b); }
+static inline simd_real simd_sub(simd_real a, simd_real b) { return _mm256_sub_pd(a, b); }
+static inline simd_real simd_mul(simd_real a, simd_real b) { return _mm256_mul_pd(a, b); }
+static inline simd_real simd_sqrt(simd_real a) { return _mm256_sqrt_pd(a); }
+static inline simd_real simd_neg(simd_real a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+static inline simd_real simd_and(simd_real a, simd_real b) { return _mm256_and_pd(a, b); }
+static inline simd_real simd_ge(simd_real a, simd_real b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+static inline simd_real simd_lt(simd_real a, simd_real b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+static inline simd_real simd_eq(simd_real a, simd_real b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+static inline simd_real simd_blend(simd_real m, simd_real a, simd_real b)
+{
+    return _mm256_blendv_pd(a, b, m);
+}
+static inline int simd_movemask(simd_real m) { return _mm256_movemask_pd(m); }
+static inline simd_real simd_lane_index() { return _mm256_set_pd(3, 2, 1, 0); }
+// Minimum of all the lanes, in every lane
+static inline simd_real simd_min_all(simd_real t)
+{
+    simd_real m = _mm256_min_pd(t, _mm256_permute_pd(t, 0x5));
+    return _mm256_min_pd(m, _mm256_permute2f128_pd(m, m, 0x1));
+}
+static inline real simd_first(simd_real a) { return _mm256_cvtsd_f64(a); }
+#endif
+
+bool SphereSet::closest_hit(const vec3 &origin, const vec3 &direction, real t_min, int first,
+                            int n, PrimitiveHit &closest) const
+{
+    const int width = SPHERE_SIMD_WIDTH;
+    const simd_real ox = simd_set1(origin.x), oy = simd_set1(origin.y), oz = simd_set1(origin.z);
+    const simd_real dx = simd_set1(direction.x), dy = simd_set1(direction.y),
+                    dz = simd_set1(direction.z);
+    const simd_real tmin = simd_set1(t_min);
+    const simd_real zero = simd_set1(0);
+    const simd_real inf = simd_set1(INF);
+    // Lanes past the end of the range are switched off with these masks
+    const simd_real lane_index = simd_lane_index();
+    bool hit = false;
+    for (int i = first; i < first + n; i += width)
+    {
+        simd_real active = simd_lt(lane_index, simd_set1(static_cast<real>(first + n - i)));
+        simd_real ocx = simd_sub(ox, simd_load(&center_x[i]));
+        simd_real ocy = simd_sub(oy, simd_load(&center_y[i]));
+        simd_real ocz = simd_sub(oz, simd_load(&center_z[i]));
+        simd_real h = simd_add(simd_add(simd_mul(dx, ocx), simd_mul(dy, ocy)), simd_mul(dz, ocz));
+        simd_real lx = simd_sub(ocx, simd_mul(h, dx));
+        simd_real ly = simd_sub(ocy, simd_mul(h, dy));
+        simd_real lz = simd_sub(ocz, simd_mul(h, dz));
+        simd_real discriminant =
+            simd_sub(simd_load(&radius2[i]),
+                     simd_add(simd_add(simd_mul(lx, lx), simd_mul(ly, ly)), simd_mul(lz, lz)));
+        active = simd_and(active, simd_ge(discriminant, zero));
+        if (simd_movemask(active) == 0)
+            continue;
+        simd_real sqd = simd_sqrt(discriminant);
+        simd_real neg_h = simd_neg(h);
+        simd_real t0 = simd_sub(neg_h, sqd);
+        simd_real t1 = simd_add(neg_h, sqd);
+        simd_real t = simd_blend(simd_ge(t0, tmin), t1, t0);
+        active = simd_and(active, simd_ge(t, tmin));
+        active = simd_and(active, simd_lt(t, simd_set1(closest.t)));
+        int mask = simd_movemask(active);
+        if (mask == 0)
+            continue;
+        // Horizontal minimum of the active lanes
+        t = simd_blend(active, inf, t);
+        simd_real m = simd_min_all(t);
+        int best = simd_movemask(simd_eq(t, m)) & mask;
+        closest.t = simd_first(m);
+        closest.id = i + lowest_bit(best);
+        hit = true;
+    }
+    return hit;
+}
+
+#else
+
+bool SphereSet::closest_hit(const vec3 &origin, const vec3 &direction, real t_min, int first,
+                            int n, PrimitiveHit &closest) const
+{
+    return closest_hit_scalar(origin, direction, t_min, first, n, closest);
+}
+
+#endif
@@ -0,0 +1,91 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Spheres stored as a structure of arrays, so that one ray can be tested against several spheres
+// with a single SIMD instruction
+#pragma once
+#include "commons.hpp"
+#include "packet.hpp"
+#include <vector>
+
+// Number of spheres tested at once, depends on the instruction set the code is compiled for and
+// on the scalar type (a macro since it also selects the implementation)
+#ifdef RAYTRACER_FLOAT
+#define SPHERE_REAL_SIZE 4
+#else
+#define SPHERE_REAL_SIZE 8
+#endif
+#if defined(__AVX512F__)
+#define SPHERE_SIMD_WIDTH (64 / SPHERE_REAL_SIZE)
+#elif defined(__AVX__)
+#define SPHERE_SIMD_WIDTH (32 / SPHERE_REAL_SIZE)
+#else
+#define SPHERE_SIMD_WIDTH 1
+#endif
+
+// Result of a hit-only query, the full intersection is computed later only for the closest hit
+struct PrimitiveHit
+{
+    // Distance along the ray
+    real t;
+    // Index of the primitive which was hit, -1 if nothing was hit
+    int id;
+};
+
+// A set of spheres, stored as separate arrays of the x, y and z coordinates of the centers and
+// the squares of the radii. Slots can also be left empty, they are never hit, this allows the
+// slots to line up with other arrays which also contain other objects.
+//
+// The SIMD and the scalar versions perform the same operations in the same order, so both give
+// bit identical results.
+class SphereSet
+{
+  private:
+    std::vector<real> center_x;
+    std::vector<real> center_y;
+    std::vector<real> center_z;
+    std::vector<real> radius2;
+    int count;
+
+  public:
+    SphereSet() : count(0) {}
+
+    /// @brief Removes all the spheres
+    void clear();
+
+    /// @brief Adds a sphere to the end of the set
+    void add(const vec3 &center, real radius);
+
+    /// @brief Adds a slot which is never hit by any ray
+    void add_empty();
+
+    /// @brief Must be called after all the spheres have been added, pads the arrays so that the
+    /// last group of spheres can be loaded with full width SIMD loads
+    void finish();
+
+    /// @return Number of slots in the set
+    int size() const { return count; }
+
+    /// @brief Finds the closest sphere among the slots [first, first + n) which is hit by the ray
+    /// Note: The direction of the ray must be normalized
+    /// @param origin Origin of the ray
+    /// @param direction Direction of the ray
+    /// @param t_min Minimum value of t which is valid
+    /// @param closest The closest hit found so far, its t is used as the maximum valid t. It is
+    /// updated if a closer hit is found, spheres at the same distance are resolved in favour of
+    /// the lowest index
+    /// @return true if a closer hit was found
+    bool closest_hit(const vec3 &origin, const vec3 &direction, real t_min, int first, int n,
+                     PrimitiveHit &closest) const;
+
+    /// @brief Same as closest_hit, but tests one sphere at a time
+    bool closest_hit_scalar(const vec3 &origin, const vec3 &direction, real t_min, int first,
+                            int n, PrimitiveHit &closest) const;
+
+    /// @brief Tests every ray of a packet against the slots [first, first + n), one sphere at a
+    /// time against all the rays, with the operations of closest_hit_scalar (so the hits are the
+    /// same as when the rays are tested one by one)
+    /// @param active Rays which are tested (non zero), the hits of the others are left unchanged
+    /// @param closest_t Distance of the closest hit of every ray so far, updated with closer hits
+    /// @param closest_id Slot of the closest hit of every ray, updated with closer hits
+    void closest_hits(const RayPacket &packet, const char *active, real t_min, int first, int n,
+                      real *closest_t, int *closest_id) const;
+};
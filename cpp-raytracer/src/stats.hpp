@@ -0,0 +1,82 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Counters and timers of the work done while rendering, used by the benchmarks and the profiles
+// of pixels (see profile.hpp)
+#pragma once
+#include <chrono>
+#include <stdint.h>
+
+// Work done by the threads while rendering. Every thread counts into its own RenderStats (see
+// thread_stats()), and the counts are added up when the threads finish. Nothing is counted when a
+// thread has no RenderStats, which is the default.
+struct RenderStats
+{
+    // Rays generated by the camera
+    uint64_t camera_rays = 0;
+    // Closest hit queries, one for every segment of every path
+    uint64_t rays = 0;
+    // Shadow rays cast towards the lights, which only check if anything is in the way
+    uint64_t shadow_rays = 0;
+    // Objects and primitives tested against the rays and the shadow rays (all the entries of every
+    // BVH leaf which is reached, at every level)
+    uint64_t intersection_tests = 0;
+    // Interactions of rays with materials
+    uint64_t shading_calls = 0;
+    // Seconds spent on generating camera rays, finding the closest hits and in the materials
+    double camera_seconds = 0;
+    double traversal_seconds = 0;
+    double shading_seconds = 0;
+
+    void add(const RenderStats &other)
+    {
+        camera_rays += other.camera_rays;
+        rays += other.rays;
+        shadow_rays += other.shadow_rays;
+        intersection_tests += other.intersection_tests;
+        shading_calls += other.shading_calls;
+        camera_seconds += other.camera_seconds;
+        traversal_seconds += other.traversal_seconds;
+        shading_seconds += other.shading_seconds;
+    }
+};
+
+/// @return The statistics of the calling thread, nullptr if they are not being collected
+inline RenderStats *&thread_stats()
+{
+    static thread_local RenderStats *stats = nullptr;
+    return stats;
+}
+
+// Adds the time from its creation to its destruction to a field of the thread's statistics, does
+// nothing (not even read the clock) if statistics are not being collected
+class StageTimer
+{
+  private:
+    double RenderStats::*field;
+    RenderStats *stats;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit StageTimer(double RenderStats::*field) : field(field), stats(thread_stats())
+    {
+        if (stats)
+            start = std::chrono::steady_clock::now();
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    ~StageTimer()
+    {
+        if (stats)
+            stats->*field +=
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+/// @brief Adds n to a counter of the thread's statistics, if they are being collected
+inline void count_stat(uint64_t RenderStats::*field, uint64_t n = 1)
+{
+    RenderStats *stats = thread_stats();
+    if (stats)
+        stats->*field += n;
+}
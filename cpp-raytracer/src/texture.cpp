@@ -0,0 +1,473 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "texture.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// Increase this whenever the layout of the tiled files changes
+const uint32_t TILED_TEXTURE_VERSION = 1;
+const char TILED_TEXTURE_MAGIC[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '\0'};
+
+/// @brief Gets the size and modification time of a file
+/// @return false if the file does not exist
+static bool file_info(const std::string &filename, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+/// @return The linear values of the 256 sRGB encoded values of a byte
+static const float *srgb_table()
+{
+    static const std::vector<float> table = [] {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; ++i)
+        {
+            double c = i / 255.0;
+            values[i] = static_cast<float>(c <= 0.04045 ? c / 12.92
+                                                        : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+static uint8_t linear_to_srgb(double c)
+{
+    c = std::min(std::max(c, 0.0), 1.0);
+    c = (c <= 0.0031308) ? 12.92 * c : 1.055 * std::pow(c, 1 / 2.4) - 0.055;
+    return static_cast<uint8_t>(c * 255 + 0.5);
+}
+
+static int tiles_across(int texels) { return (texels + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE; }
+
+/// @return true if every level halves the one before it down to a single texel, and its tiles
+/// are inside the file
+static bool valid_levels(const TiledTextureHeader &header, uint64_t file_size)
+{
+    for (int l = 0; l < header.levels; ++l)
+    {
+        int w = header.width[l], h = header.height[l];
+        // The position of a tile is stored in 21 bits of its key
+        if (w <= 0 || h <= 0 || w > (TEXTURE_TILE_SIZE << 20) || h > (TEXTURE_TILE_SIZE << 20))
+            return false;
+        if (l > 0 && (w != std::max(header.width[l - 1] / 2, 1) ||
+                      h != std::max(header.height[l - 1] / 2, 1)))
+            return false;
+        uint64_t bytes = static_cast<uint64_t>(tiles_across(w)) * tiles_across(h) *
+                         TEXTURE_TILE_BYTES;
+        if (header.offset[l] < sizeof(header) || header.offset[l] > file_size ||
+            bytes > file_size - header.offset[l])
+            return false;
+    }
+    int last = header.levels - 1;
+    return header.width[last] == 1 && header.height[last] == 1;
+}
+
+/// @brief Reads the header of a tiled texture file
+/// @return false if the file does not exist or is not a tiled texture of this version
+static bool read_header(FILE *file, TiledTextureHeader &header)
+{
+    struct stat st;
+    return fread(&header, sizeof(header), 1, file) == 1 &&
+           memcmp(header.magic, TILED_TEXTURE_MAGIC, sizeof(header.magic)) == 0 &&
+           header.version == TILED_TEXTURE_VERSION && header.levels > 0 &&
+           header.levels <= TEXTURE_MAX_LEVELS && fstat(fileno(file), &st) == 0 &&
+           valid_levels(header, static_cast<uint64_t>(st.st_size));
+}
+
+/// @return The image at half the width and height, every texel is the average of four texels
+static std::vector<uint8_t> downsample(const std::vector<uint8_t> &texels, int width, int height,
+                                       bool srgb)
+{
+    int half_width = std::max(width / 2, 1), half_height = std::max(height / 2, 1);
+    std::vector<uint8_t> half(static_cast<size_t>(half_width) * half_height * 4);
+    const float *table = srgb_table();
+    for (int y = 0; y < half_height; ++y)
+    {
+        int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+        for (int x = 0; x < half_width; ++x)
+        {
+            int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            const uint8_t *p[4] = {&texels[(static_cast<size_t>(y0) * width + x0) * 4],
+                                   &texels[(static_cast<size_t>(y0) * width + x1) * 4],
+                                   &texels[(static_cast<size_t>(y1) * width + x0) * 4],
+                                   &texels[(static_cast<size_t>(y1) * width + x1) * 4]};
+            uint8_t *out = &half[(static_cast<size_t>(y) * half_width + x) * 4];
+            for (int c = 0; c < 4; ++c)
+            {
+                // Colors are averaged in linear space, alpha is always linear
+                if (srgb && c < 3)
+                {
+                    double sum = table[p[0][c]] + table[p[1][c]] + table[p[2][c]] + table[p[3][c]];
+                    out[c] = linear_to_srgb(sum / 4);
+                }
+                else
+                {
+                    out[c] = static_cast<uint8_t>((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+                }
+            }
+        }
+    }
+    return half;
+}
+
+/// @brief Writes a level as tiles, row by row, the tiles on the edges are padded with the last
+/// texel
+static bool write_tiles(FILE *file, const std::vector<uint8_t> &texels, int width, int height)
+{
+    std::vector<uint8_t> tile(TEXTURE_TILE_BYTES);
+    for (int ty = 0; ty < tiles_across(height); ++ty)
+    {
+        for (int tx = 0; tx < tiles_across(width); ++tx)
+        {
+            for (int r = 0; r < TEXTURE_TILE_SIZE; ++r)
+            {
+                int y = std::min(ty * TEXTURE_TILE_SIZE + r, height - 1);
+                for (int c = 0; c < TEXTURE_TILE_SIZE; ++c)
+                {
+                    int x = std::min(tx * TEXTURE_TILE_SIZE + c, width - 1);
+                    memcpy(&tile[(r * TEXTURE_TILE_SIZE + c) * 4],
+                           &texels[(static_cast<size_t>(y) * width + x) * 4], 4);
+                }
+            }
+            if (fwrite(tile.data(), 1, tile.size(), file) != tile.size())
+                return false;
+        }
+    }
+    return true;
+}
+
+std::string make_tiled_texture(const std::string &image_filename, bool srgb)
+{
+    std::string tiled_filename = image_filename + (srgb ? ".tiles" : ".linear.tiles");
+    TiledTextureHeader header;
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (!file_info(image_filename, source_size, source_mtime))
+        throw std::runtime_error("Could not find texture " + image_filename);
+    FILE *existing = fopen(tiled_filename.c_str(), "rb");
+    if (existing)
+    {
+        bool current = read_header(existing, header) && header.source_size == source_size &&
+                       header.source_mtime == source_mtime && header.srgb == (srgb ? 1u : 0u);
+        fclose(existing);
+        if (current)
+            return tiled_filename;
+    }
+
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load(image_filename.c_str(), &width, &height, &channels, 4);
+    if (pixels == NULL)
+        throw std::runtime_error("Could not read texture " + image_filename + ": " +
+                                 stbi_failure_reason());
+    std::vector<uint8_t> level(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TILED_TEXTURE_MAGIC, sizeof(header.magic));
+    header.version = TILED_TEXTURE_VERSION;
+    header.srgb = srgb ? 1 : 0;
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    // The tiles start at a multiple of the tile size, so that every tile is read from one page
+    uint64_t offset = TEXTURE_TILE_BYTES;
+    for (int w = width, h = height;; w = std::max(w / 2, 1), h = std::max(h / 2, 1))
+    {
+        if (header.levels == TEXTURE_MAX_LEVELS)
+            throw std::runtime_error("Texture " + image_filename + " is too large");
+        header.width[header.levels] = w;
+        header.height[header.levels] = h;
+        header.offset[header.levels] = offset;
+        header.levels++;
+        offset += static_cast<uint64_t>(tiles_across(w)) * tiles_across(h) * TEXTURE_TILE_BYTES;
+        if (w == 1 && h == 1)
+            break;
+    }
+
+    // Write to a temporary file first, so that a partially written file is never read
+    std::string temp_filename = tiled_filename + ".tmp";
+    FILE *file = fopen(temp_filename.c_str(), "wb");
+    if (file == NULL)
+        throw std::runtime_error("Could not write texture " + tiled_filename);
+    std::vector<uint8_t> padding(TEXTURE_TILE_BYTES - sizeof(header), 0);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+    for (int l = 0; ok && l < header.levels; ++l)
+    {
+        if (l > 0)
+            level = downsample(level, header.width[l - 1], header.height[l - 1], srgb);
+        ok = write_tiles(file, level, header.width[l], header.height[l]);
+    }
+    ok = (fclose(file) == 0) && ok;
+    std::remove(tiled_filename.c_str());
+    if (!ok || std::rename(temp_filename.c_str(), tiled_filename.c_str()) != 0)
+    {
+        std::remove(temp_filename.c_str());
+        throw std::runtime_error("Could not write texture " + tiled_filename);
+    }
+    return tiled_filename;
+}
+
+// An open tiled texture file, tiles are read at their offset without moving a shared position
+struct TextureCache::TextureFile
+{
+    std::string filename;
+    TiledTextureHeader header;
+#ifdef _WIN32
+    FILE *file;
+    std::mutex file_lock;
+#else
+    int fd;
+#endif
+
+    bool read(void *out, size_t bytes, uint64_t offset)
+    {
+#ifdef _WIN32
+        std::lock_guard<std::mutex> guard(file_lock);
+        return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0 &&
+               fread(out, 1, bytes, file) == bytes;
+#else
+        return pread(fd, out, bytes, static_cast<off_t>(offset)) == static_cast<ssize_t>(bytes);
+#endif
+    }
+};
+
+// Tiles are identified by their texture, level and position in the level
+static uint64_t tile_key(int texture, int level, int tx, int ty)
+{
+    return (static_cast<uint64_t>(texture) << 47) | (static_cast<uint64_t>(level) << 42) |
+           (static_cast<uint64_t>(ty) << 21) | static_cast<uint64_t>(tx);
+}
+
+// Caches are told apart in the caches of the threads by an id which is never reused
+static std::atomic<uint64_t> next_cache_id(1);
+
+TextureCache::TextureCache(size_t budget) : budget(budget), id(next_cache_id++) {}
+
+TextureCache::~TextureCache()
+{
+    for (auto &file : files)
+    {
+#ifdef _WIN32
+        fclose(file->file);
+#else
+        close(file->fd);
+#endif
+    }
+}
+
+void TextureCache::set_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    budget = bytes;
+    evict();
+}
+
+int TextureCache::add_texture(const std::string &tiled_filename)
+{
+    // The texture is stored in 16 bits of the keys of the tiles
+    if (files.size() >= (1 << 16))
+        throw std::runtime_error("Too many textures");
+    std::unique_ptr<TextureFile> file(new TextureFile());
+    file->filename = tiled_filename;
+    FILE *f = fopen(tiled_filename.c_str(), "rb");
+    if (f == NULL || !read_header(f, file->header))
+    {
+        if (f)
+            fclose(f);
+        throw std::runtime_error("Could not read texture " + tiled_filename);
+    }
+#ifdef _WIN32
+    file->file = f;
+#else
+    fclose(f);
+    file->fd = open(tiled_filename.c_str(), O_RDONLY);
+    if (file->fd < 0)
+        throw std::runtime_error("Could not read texture " + tiled_filename);
+#endif
+    files.push_back(std::move(file));
+    return static_cast<int>(files.size()) - 1;
+}
+
+const TiledTextureHeader &TextureCache::header(int texture) const { return files[texture]->header; }
+
+const uint8_t *TextureCache::texel(int texture, int level, int x, int y)
+{
+    // Direct mapped, a tile can only be in the slot picked by its key
+    struct ThreadTiles
+    {
+        uint64_t owner = 0;
+        uint64_t keys[THREAD_TILE_CACHE_SIZE];
+        std::shared_ptr<const Tile> tiles[THREAD_TILE_CACHE_SIZE];
+    };
+    static thread_local ThreadTiles local;
+    if (local.owner != id)
+    {
+        // The thread used another cache before
+        local.owner = id;
+        std::fill(local.keys, local.keys + THREAD_TILE_CACHE_SIZE, ~uint64_t(0));
+        std::fill(local.tiles, local.tiles + THREAD_TILE_CACHE_SIZE, nullptr);
+    }
+    uint64_t key = tile_key(texture, level, x / TEXTURE_TILE_SIZE, y / TEXTURE_TILE_SIZE);
+    size_t slot = ((key * 0x9E3779B97F4A7C15ull) >> 32) & (THREAD_TILE_CACHE_SIZE - 1);
+    if (local.keys[slot] != key)
+    {
+        local.tiles[slot] = fetch(key);
+        local.keys[slot] = key;
+    }
+    int offset = (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE;
+    return local.tiles[slot]->texels + 4 * offset;
+}
+
+std::shared_ptr<const TextureCache::Tile> TextureCache::fetch(uint64_t key)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = resident.find(key);
+        if (it != resident.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Read without holding the lock, so that other threads can use the cache meanwhile
+    int texture = static_cast<int>(key >> 47);
+    int level = static_cast<int>((key >> 42) & 31);
+    uint64_t ty = (key >> 21) & ((1 << 21) - 1);
+    uint64_t tx = key & ((1 << 21) - 1);
+    TextureFile &file = *files[texture];
+    uint64_t offset = file.header.offset[level] +
+                      (ty * tiles_across(file.header.width[level]) + tx) * TEXTURE_TILE_BYTES;
+    std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+    if (!file.read(tile->texels, TEXTURE_TILE_BYTES, offset))
+    {
+        // Not kept in the cache, so that the tile is read again the next time
+        static const std::shared_ptr<const Tile> black = std::make_shared<Tile>();
+        std::lock_guard<std::mutex> guard(lock);
+        statistics.read_errors++;
+        read_error = "Could not read a tile of " + file.filename;
+        return black;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = resident.find(key);
+    if (it != resident.end())
+    {
+        // Another thread read the same tile at the same time
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->second;
+    }
+    lru.emplace_front(key, tile);
+    resident[key] = lru.begin();
+    statistics.tile_reads++;
+    statistics.resident_bytes += TEXTURE_TILE_BYTES;
+    statistics.peak_bytes = std::max(statistics.peak_bytes, statistics.resident_bytes);
+    evict();
+    return tile;
+}
+
+void TextureCache::evict()
+{
+    while (statistics.resident_bytes > budget && lru.size() > 1)
+    {
+        resident.erase(lru.back().first);
+        lru.pop_back();
+        statistics.resident_bytes -= TEXTURE_TILE_BYTES;
+        statistics.evictions++;
+    }
+}
+
+TextureCacheStats TextureCache::stats() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return statistics;
+}
+
+void TextureCache::check_read_errors(uint64_t since) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (statistics.read_errors > since)
+        throw std::runtime_error(read_error + " (" +
+                                 std::to_string(statistics.read_errors - since) +
+                                 " tiles could not be read)");
+}
+
+ImageTexture::ImageTexture(TextureCache *cache, int texture) : cache(cache), texture(texture)
+{
+    const TiledTextureHeader &header = cache->header(texture);
+    levels = header.levels;
+    width = header.width[0];
+    height = header.height[0];
+    srgb = header.srgb != 0;
+}
+
+color ImageTexture::texel(int level, int x, int y) const
+{
+    const TiledTextureHeader &header = cache->header(texture);
+    int w = header.width[level], h = header.height[level];
+    x %= w;
+    y %= h;
+    if (x < 0)
+        x += w;
+    if (y < 0)
+        y += h;
+    const uint8_t *t = cache->texel(texture, level, x, y);
+    if (srgb)
+    {
+        const float *table = srgb_table();
+        return color(table[t[0]], table[t[1]], table[t[2]]);
+    }
+    return color(t[0], t[1], t[2]) / real(255);
+}
+
+color ImageTexture::bilinear(int level, real s, real t) const
+{
+    const TiledTextureHeader &header = cache->header(texture);
+    // Texel centers are at half integers
+    real x = s * header.width[level] - real(0.5);
+    real y = t * header.height[level] - real(0.5);
+    real x0 = std::floor(x), y0 = std::floor(y);
+    real fx = x - x0, fy = y - y0;
+    int ix = static_cast<int>(x0), iy = static_cast<int>(y0);
+    color top = (1 - fx) * texel(level, ix, iy) + fx * texel(level, ix + 1, iy);
+    color bottom = (1 - fx) * texel(level, ix, iy + 1) + fx * texel(level, ix + 1, iy + 1);
+    return (1 - fy) * top + fy * bottom;
+}
+
+color ImageTexture::sample(const Intersection &intersect) const
+{
+    real u, v;
+    texture_coordinates(intersect, u, v);
+    // The first row of the image is at the top (v = 1)
+    real s = u - std::floor(u);
+    real t = std::ceil(v) - v;
+    // Width of the cone in texels of the full size image
+    real footprint = 0;
+    if (intersect.uv_scale > 0)
+        footprint = intersect.cone_width / intersect.uv_scale * std::max(width, height);
+    real lod = footprint > 1 ? std::log2(footprint) : 0;
+    if (lod >= levels - 1)
+        return bilinear(levels - 1, s, t);
+    int level = static_cast<int>(lod);
+    real blend = lod - level;
+    color c = bilinear(level, s, t);
+    if (blend > 0)
+        c = (1 - blend) * c + blend * bilinear(level + 1, s, t);
+    return c;
+}
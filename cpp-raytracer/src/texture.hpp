@@ -0,0 +1,179 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Image textures. Every image is converted once into a tiled, mip-mapped file next to it, and the
+// tiles are read from that file on demand into a cache with a fixed memory budget, so a scene can
+// use much more texture data than fits in memory.
+#pragma once
+#include "colors.hpp"
+#include "commons.hpp"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Width and height of a tile in texels, a tile of 8 bit RGBA texels is 4 KB
+constexpr int TEXTURE_TILE_SIZE = 32;
+constexpr size_t TEXTURE_TILE_BYTES = TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 4;
+// Enough levels for images of up to 2^23 texels on a side
+constexpr int TEXTURE_MAX_LEVELS = 24;
+// Memory used by the tiles of the texture cache unless the scene sets texture_cache_size
+constexpr size_t DEFAULT_TEXTURE_CACHE_SIZE = size_t(256) << 20;
+// Tiles remembered by every thread, so that most lookups do not take the lock of the cache. Must
+// be a power of two.
+constexpr int THREAD_TILE_CACHE_SIZE = 64;
+
+// Header of a tiled texture file. It is followed by the tiles of every level, from the full size
+// image down to a single texel, the tiles of a level are stored row by row. Tiles on the right and
+// bottom edges are padded by repeating the last texel.
+struct TiledTextureHeader
+{
+    char magic[8];
+    uint32_t version;
+    // 1 if the texels are sRGB encoded (colors), 0 if they are linear (roughness)
+    uint32_t srgb;
+    // Size and modification time of the image the file was made from, the file is made again when
+    // they change
+    uint64_t source_size;
+    int64_t source_mtime;
+    int32_t levels;
+    int32_t padding;
+    int32_t width[TEXTURE_MAX_LEVELS];
+    int32_t height[TEXTURE_MAX_LEVELS];
+    // Offset of the first tile of each level from the start of the file
+    uint64_t offset[TEXTURE_MAX_LEVELS];
+};
+
+/// @brief Converts an image (any format read by stb_image) into a tiled texture file, unless the
+/// file already exists and was made from the current version of the image. The mip maps of color
+/// textures are averaged in linear space. The whole image is in memory during the conversion,
+/// rendering only needs the tiles it reads.
+/// @param srgb true for colors, false for data such as roughness
+/// @return Name of the tiled file, the image name followed by .tiles (.linear.tiles for linear
+/// textures)
+/// @throw std::runtime_error if the image cannot be read or the file cannot be written
+std::string make_tiled_texture(const std::string &image_filename, bool srgb);
+
+struct TextureCacheStats
+{
+    // Tiles read from the files, and tiles dropped to stay within the budget
+    uint64_t tile_reads = 0;
+    uint64_t evictions = 0;
+    // Memory used by the tiles in the cache now, and the most it ever used
+    size_t resident_bytes = 0;
+    size_t peak_bytes = 0;
+    // Tiles which could not be read, their texels were black
+    uint64_t read_errors = 0;
+};
+
+// Tiles of tiled texture files, read when they are first used and dropped, least recently used
+// first, when they use more memory than the budget. Threads look tiles up in a small cache of their
+// own first, only its misses lock the shared cache, and the files are read without holding the
+// lock. Every thread keeps up to THREAD_TILE_CACHE_SIZE tiles alive besides the budget.
+class TextureCache
+{
+  private:
+    struct Tile
+    {
+        uint8_t texels[TEXTURE_TILE_BYTES];
+    };
+
+    struct TextureFile;
+
+    using TileList = std::list<std::pair<uint64_t, std::shared_ptr<const Tile>>>;
+
+    std::vector<std::unique_ptr<TextureFile>> files;
+    size_t budget;
+    // Identifies the cache in the caches of the threads
+    uint64_t id;
+
+    // Guards the members below
+    mutable std::mutex lock;
+    // Most recently used first
+    TileList lru;
+    std::unordered_map<uint64_t, TileList::iterator> resident;
+    TextureCacheStats statistics;
+    // The last tile which could not be read
+    std::string read_error;
+
+    /// @brief Finds the tile in the shared cache, or reads it from its file. Tiles are read by the
+    /// render threads, which must not throw, so a tile which cannot be read is counted in
+    /// read_errors and replaced by a black tile.
+    std::shared_ptr<const Tile> fetch(uint64_t key);
+
+    /// @brief Drops the least recently used tiles until the cache is within the budget, the most
+    /// recently used tile is always kept. The lock must be held.
+    void evict();
+
+  public:
+    /// @param budget Memory which the tiles may use, in bytes
+    explicit TextureCache(size_t budget = DEFAULT_TEXTURE_CACHE_SIZE);
+    ~TextureCache();
+
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    void set_budget(size_t bytes);
+
+    /// @brief Opens a tiled texture file made by make_tiled_texture
+    /// @return Index of the texture
+    /// @throw std::runtime_error if the file cannot be read
+    int add_texture(const std::string &tiled_filename);
+
+    const TiledTextureHeader &header(int texture) const;
+
+    /// @return The four bytes (RGBA) of a texel, valid until the next call from the same thread
+    const uint8_t *texel(int texture, int level, int x, int y);
+
+    TextureCacheStats stats() const;
+
+    /// @brief Reports the tiles which could not be read, to be called once the render threads
+    /// have finished
+    /// @param since Number of read_errors which were already reported
+    /// @throw std::runtime_error if more than since tiles could not be read
+    void check_read_errors(uint64_t since = 0) const;
+};
+
+// An image texture which reads its texels through a texture cache. Texture coordinates repeat
+// outside [0, 1].
+class ImageTexture
+{
+  private:
+    TextureCache *cache;
+    int texture;
+    int levels;
+    int width, height;
+    bool srgb;
+
+    /// @return The texel, wrapped around the edges of the level
+    color texel(int level, int x, int y) const;
+
+    /// @return The texels of a level at (s, t), interpolated bilinearly
+    color bilinear(int level, real s, real t) const;
+
+  public:
+    ImageTexture(TextureCache *cache, int texture);
+
+    /// @brief Filters the texture at the texture coordinates of the intersection. The mip map
+    /// level is chosen so that a texel is about as large as the width of the cone of rays, and
+    /// the two nearest levels are blended.
+    color sample(const Intersection &intersect) const;
+};
+
+/// @brief Gets the texture coordinates of an intersection, computing them for spheres
+inline void texture_coordinates(const Intersection &intersect, real &u, real &v)
+{
+    if (intersect.spherical_uv)
+    {
+        const vec3 &n = intersect.o_normal;
+        u = (std::atan2(-n.z, n.x) + static_cast<real>(PI)) / static_cast<real>(2 * PI);
+        v = std::acos(std::max(real(-1), std::min(-n.y, real(1)))) / static_cast<real>(PI);
+    }
+    else
+    {
+        u = intersect.u;
+        v = intersect.v;
+    }
+}
@@ -0,0 +1,70 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "thread_pool.hpp"
+#include "affinity.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int number_of_threads, bool pin)
+    : next_sequence(0), running(0), stopping(false)
+{
+    number_of_threads = std::max(number_of_threads, 1);
+    if (pin)
+        cpus = detect_topology().placement(number_of_threads);
+    for (int i = 0; i < number_of_threads; ++i)
+    {
+        int cpu = i < static_cast<int>(cpus.size()) ? cpus[i] : -1;
+        threads.emplace_back(&ThreadPool::run, this, cpu);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    available.notify_all();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+void ThreadPool::submit(int priority, std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push(Task{priority, next_sequence++, std::move(task)});
+    }
+    available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return tasks.empty() && running == 0; });
+}
+
+void ThreadPool::run(int cpu)
+{
+    if (cpu >= 0)
+        pin_current_thread(cpu);
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            available.wait(guard, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = tasks.top().run;
+            tasks.pop();
+            ++running;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--running == 0 && tasks.empty())
+                idle.notify_all();
+        }
+    }
+}
@@ -0,0 +1,76 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// A fixed set of threads shared by several jobs. Every task has a priority, the threads always run
+// the queued task with the highest priority, and tasks with the same priority in the order in
+// which they were submitted, so the tiles of an urgent job overtake the tiles of the others.
+//
+// The threads can be pinned to processors (see affinity.hpp), filling one NUMA node after the
+// other. Memory which a task allocates and touches first is then on the node of its thread.
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+  private:
+    struct Task
+    {
+        int priority;
+        uint64_t sequence;
+        std::function<void()> run;
+    };
+
+    // Orders the queue so that its top is the task with the highest priority, submitted first
+    struct LaterTask
+    {
+        bool operator()(const Task &a, const Task &b) const
+        {
+            if (a.priority != b.priority)
+                return a.priority < b.priority;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    std::mutex lock;
+    std::condition_variable available;
+    // Signalled when the queue is empty and no task is running
+    std::condition_variable idle;
+    std::priority_queue<Task, std::vector<Task>, LaterTask> tasks;
+    uint64_t next_sequence;
+    int running;
+    bool stopping;
+    std::vector<std::thread> threads;
+    // Processor of every thread, empty if the threads are not pinned
+    std::vector<int> cpus;
+
+    /// @param cpu Processor which the thread is pinned to, -1 to leave it unpinned
+    void run(int cpu);
+
+  public:
+    /// @param number_of_threads Number of threads, at least one thread is started
+    /// @param pin Pin every thread to a processor of its own, threads beyond the number of
+    /// processors are not pinned
+    explicit ThreadPool(int number_of_threads, bool pin = false);
+
+    /// @brief Runs the tasks which are still queued, and then stops the threads
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// @brief Queues a task, which must not throw
+    /// @param priority Tasks with a higher priority run first
+    void submit(int priority, std::function<void()> task);
+
+    /// @brief Waits until every task submitted so far has finished
+    void wait();
+
+    int size() const { return static_cast<int>(threads.size()); }
+
+    /// @return The processors of the threads, empty if they are not pinned
+    const std::vector<int> &processors() const { return cpus; }
+};
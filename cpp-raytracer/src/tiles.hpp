@@ -0,0 +1,89 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Splits the image into tiles which are handed out to the render threads
+#pragma once
+#include <algorithm>
+#include <atomic>
+
+// A rectangular block of pixels, from (row, col) to (row + height - 1, col + width - 1)
+struct Tile
+{
+    int row;
+    int col;
+    int height;
+    int width;
+};
+
+// Hands out the tiles of an image to the render threads. The next tile is chosen with a single
+// atomic increment, so threads never wait on a lock, and threads which finish early keep on
+// taking tiles until none are left, which balances the work between them.
+class TileScheduler
+{
+  private:
+    int image_width;
+    int image_height;
+    int tile_size;
+    int tiles_x;
+    int tiles_y;
+    std::atomic<int> next_tile;
+    std::atomic<int> finished_tiles;
+
+  public:
+    /// @param image_width Width of the image (in pixels)
+    /// @param image_height Height of the image (in pixels)
+    /// @param tile_size Width and height of a tile, tiles at the right and bottom edges may be
+    /// smaller
+    TileScheduler(int image_width, int image_height, int tile_size)
+        : image_width(image_width), image_height(image_height),
+          tile_size(tile_size > 0 ? tile_size : 1), next_tile(0), finished_tiles(0)
+    {
+        tiles_x = (image_width + this->tile_size - 1) / this->tile_size;
+        tiles_y = (image_height + this->tile_size - 1) / this->tile_size;
+    }
+
+    /// @return Total number of tiles in the image
+    int tile_count() const { return tiles_x * tiles_y; }
+
+    /// @return Number of tiles in each row of tiles
+    int tiles_per_row() const { return tiles_x; }
+
+    /// @return Height of the rows of tiles
+    int band_height() const { return tile_size; }
+
+    /// @return Index of the row of tiles (band) which the tile belongs to
+    int band(const Tile &tile) const { return tile.row / tile_size; }
+
+    /// @return Number of tiles which have been rendered
+    int finished() const { return finished_tiles.load(std::memory_order_relaxed); }
+
+    /// @brief Gets the tile at the given index, tiles are numbered row by row
+    Tile tile_at(int index) const
+    {
+        Tile tile;
+        tile.row = (index / tiles_x) * tile_size;
+        tile.col = (index % tiles_x) * tile_size;
+        tile.height = std::min(tile_size, image_height - tile.row);
+        tile.width = std::min(tile_size, image_width - tile.col);
+        return tile;
+    }
+
+    /// @return Index of the tile, the inverse of tile_at
+    int index_of(const Tile &tile) const
+    {
+        return (tile.row / tile_size) * tiles_x + tile.col / tile_size;
+    }
+
+    /// @brief Takes the next tile which has not yet been rendered
+    /// @param tile Set to the tile which has to be rendered
+    /// @return false if all the tiles have been taken
+    bool next(Tile &tile)
+    {
+        int index = next_tile.fetch_add(1, std::memory_order_relaxed);
+        if (index >= tile_count())
+            return false;
+        tile = tile_at(index);
+        return true;
+    }
+
+    /// @brief Marks a tile as finished, used to display the progress
+    void finish() { finished_tiles.fetch_add(1, std::memory_order_relaxed); }
+};
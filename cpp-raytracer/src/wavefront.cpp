@@ -0,0 +1,272 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+#include "wavefront.hpp"
+#include "stats.hpp"
+#include <algorithm>
+
+WavefrontIntegrator::WavefrontIntegrator(const Config &config, const Scene &scene)
+    : config(config), scene(scene)
+{
+}
+
+void WavefrontIntegrator::render_tile(const Camera &cam, const Tile &tile, Framebuffer &img,
+                                      AOVBuffers *aovs)
+{
+    const int samples = config.samples_per_pixel;
+    if (samples <= 0)
+        return;
+    const int pixels = tile.width * tile.height;
+    // All the samples of a pixel are in the same batch, so that they can be added up in order
+    const int pixels_per_batch = std::max(1, config.wavefront_batch / samples);
+    for (int first = 0; first < pixels; first += pixels_per_batch)
+    {
+        int last = std::min(first + pixels_per_batch, pixels);
+        generate(cam, tile, first, last);
+        features_pending.assign(samplers.size(), aovs != nullptr);
+        for (int depth = 0; depth < config.recursion_limit && paths.size() > 0; ++depth)
+        {
+            intersect(depth);
+            shade(depth);
+            trace_shadows();
+            std::swap(paths, next_paths);
+        }
+        // Paths which are still in the queue have reached the bounce limit, and gather no more
+        // light
+
+        for (int p = first; p < last; ++p)
+        {
+            int row = tile.row + p / tile.width;
+            int col = tile.col + p % tile.width;
+            color pixel_color(0, 0, 0);
+            SurfaceFeatures feature_sum;
+            int base = (p - first) * samples;
+            for (int sample = 0; sample < samples; ++sample)
+            {
+                pixel_color += radiance[base + sample];
+                feature_sum += features[base + sample];
+            }
+            img.set(row, col, pixel_color / static_cast<real>(samples));
+            if (aovs)
+                aovs->set(row, col, feature_sum / static_cast<real>(samples), samples);
+        }
+    }
+}
+
+void WavefrontIntegrator::generate(const Camera &cam, const Tile &tile, int first, int last)
+{
+    StageTimer timer(&RenderStats::camera_seconds);
+    const int samples = config.samples_per_pixel;
+    const real pixel_spread = cam.pixel_spread();
+    // Sample s of pixel p uses samplers[(p - first) * samples + s], whatever the order in which
+    // the paths are started. The rest of the path only draws plain random numbers, so every path
+    // continues with its own copy of the sampler.
+    samplers.assign((last - first) * samples, Sampler(config.sampler, samples, config.seed));
+    packets.clear();
+    paths.clear();
+    const int first_row = first / tile.width;
+    const int end_row = (last - 1) / tile.width + 1;
+    int rows[RAY_PACKET_SIZE], cols[RAY_PACKET_SIZE], indices[RAY_PACKET_SIZE];
+    Sampler *lanes[RAY_PACKET_SIZE];
+    for (int block_row = first_row; block_row < end_row; block_row += RAY_PACKET_BLOCK)
+    {
+        for (int block_col = 0; block_col < tile.width; block_col += RAY_PACKET_BLOCK)
+        {
+            for (int sample = 0; sample < samples; ++sample)
+            {
+                int count = 0;
+                for (int r = block_row; r < std::min(block_row + RAY_PACKET_BLOCK, end_row); ++r)
+                {
+                    for (int c = block_col; c < std::min(block_col + RAY_PACKET_BLOCK, tile.width);
+                         ++c)
+                    {
+                        int p = r * tile.width + c;
+                        if (p < first || p >= last)
+                            continue;
+                        indices[count] = (p - first) * samples + sample;
+                        rows[count] = tile.row + r;
+                        cols[count] = tile.col + c;
+                        lanes[count] = &samplers[indices[count]];
+                        lanes[count]->start_pixel(rows[count], cols[count]);
+                        lanes[count]->start_sample(sample);
+                        ++count;
+                    }
+                }
+                if (count == 0)
+                    continue;
+                packets.emplace_back();
+                RayPacket &packet = packets.back();
+                cam.get_rays(rows, cols, lanes, count, samples > 1, packet);
+                for (int i = 0; i < count; ++i)
+                {
+                    paths.push(packet.ray(i), color(1, 1, 1), 0, 0, pixel_spread, indices[i]);
+                }
+            }
+        }
+    }
+    radiance.assign(samplers.size(), color(0, 0, 0));
+    features.assign(samplers.size(), SurfaceFeatures());
+    count_stat(&RenderStats::camera_rays, samplers.size());
+}
+
+void WavefrontIntegrator::intersect(int depth)
+{
+    const int count = paths.size();
+    hits.resize(count);
+    hit_objects.resize(count);
+    {
+        StageTimer timer(&RenderStats::traversal_seconds);
+        if (depth == 0)
+        {
+            // The paths are in the order of the packets
+            int offset = 0;
+            for (const RayPacket &packet : packets)
+            {
+                scene.find_closest(packet, SELF_INTERSECTION_EPSILON, &hits[offset],
+                                   &hit_objects[offset]);
+                offset += packet.size;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                hits[i] = scene.find_closest(
+                    RayParams({paths.rays[i], SELF_INTERSECTION_EPSILON, INF}), hit_objects[i]);
+            }
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            if (hits[i].occured)
+                hits[i].cone_width =
+                    paths.cone_width[i] + paths.cone_spread[i] * hits[i].parametric;
+        }
+    }
+
+    // Counting sort of the paths by material, paths which missed everything go into an extra bin
+    // at the end. The sort is stable, so the paths of a material stay in the order of the pixels.
+    StageTimer timer(&RenderStats::shading_seconds);
+    const int materials = static_cast<int>(scene.material_count());
+    bin_start.assign(materials + 2, 0);
+    for (int i = 0; i < count; ++i)
+    {
+        int bin = hits[i].occured ? hits[i].material_id : materials;
+        bin_start[bin + 1]++;
+    }
+    for (int bin = 0; bin <= materials; ++bin)
+    {
+        bin_start[bin + 1] += bin_start[bin];
+    }
+    bin_next.assign(bin_start.begin(), bin_start.end() - 1);
+    order.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        int bin = hits[i].occured ? hits[i].material_id : materials;
+        order[bin_next[bin]++] = i;
+    }
+
+    // Gather the hits so that every material reads its hits from one contiguous block
+    const int hit_count = bin_start[materials];
+    sorted_hits.resize(hit_count);
+    sorted_samplers.resize(hit_count);
+    for (int j = 0; j < hit_count; ++j)
+    {
+        sorted_hits[j] = hits[order[j]];
+        sorted_samplers[j] = &samplers[paths.sample[order[j]]];
+    }
+}
+
+void WavefrontIntegrator::shade(int depth)
+{
+    StageTimer timer(&RenderStats::shading_seconds);
+    const bool sample_lights = config.light_sampling && scene.light_count() > 0;
+    const int materials = static_cast<int>(scene.material_count());
+    // Every path which hit something interacts with its material
+    count_stat(&RenderStats::shading_calls, bin_start[materials]);
+    next_paths.clear();
+    shadows.clear();
+
+    // The paths which did not hit anything see the sky
+    for (int j = bin_start[materials]; j < bin_start[materials + 1]; ++j)
+    {
+        int i = order[j];
+        int sample = paths.sample[i];
+        color sky = linalg::cmul(paths.throughput[i], Scene::sky_color(paths.rays[i].direction()));
+        if (features_pending[sample])
+        {
+            features[sample].albedo = sky;
+            features_pending[sample] = 0;
+        }
+        radiance[sample] += sky;
+    }
+
+    interactions.resize(bin_start[materials]);
+    for (int m = 0; m < materials; ++m)
+    {
+        const int begin = bin_start[m];
+        const int end = bin_start[m + 1];
+        if (begin == end)
+            continue;
+        const Material &material = scene.get_material(m);
+        material.interact(&sorted_hits[begin], &sorted_samplers[begin], &interactions[begin],
+                          end - begin);
+
+        const bool emissive = material.get_type() == Material::EMISSIVE;
+        for (int j = begin; j < end; ++j)
+        {
+            const int i = order[j];
+            const int sample = paths.sample[i];
+            const Intersection &intersect = sorted_hits[j];
+            const MaterialInteraction &interaction = interactions[j];
+            const color &throughput = paths.throughput[i];
+            if (emissive && intersect.front)
+            {
+                real weight = scene.emission_weight(hit_objects[i], paths.rays[i].origin(),
+                                                    paths.direction_pdf[i]);
+                radiance[sample] += weight * linalg::cmul(throughput, material.emission());
+            }
+            if (features_pending[sample])
+            {
+                if (depth == 0)
+                    features[sample].depth = intersect.parametric;
+                if (interaction.diffuse || !interaction.additional_rays)
+                {
+                    features[sample].albedo = linalg::cmul(throughput, material.albedo(intersect));
+                    features[sample].normal = intersect.local_normal;
+                    features_pending[sample] = 0;
+                }
+            }
+            if (!interaction.additional_rays)
+            {
+                radiance[sample] += linalg::cmul(throughput, interaction.attenuation);
+                continue;
+            }
+            Sampler &sampler = *sorted_samplers[j];
+            RayParams shadow;
+            color contribution;
+            if (sample_lights && interaction.pdf > 0 &&
+                scene.light_sample(intersect, material, sampler, shadow, contribution))
+            {
+                shadows.rays.push_back(shadow);
+                shadows.contribution.push_back(linalg::cmul(throughput, contribution));
+                shadows.sample.push_back(sample);
+            }
+            color next_throughput = linalg::cmul(throughput, interaction.attenuation);
+            if (!survives_roulette(depth, next_throughput, sampler))
+                continue;
+            real spread = paths.cone_spread[i];
+            if (interaction.diffuse)
+                spread = std::max(spread, DIFFUSE_CONE_SPREAD);
+            next_paths.push(interaction.ray, next_throughput, sample_lights ? interaction.pdf : 0,
+                            intersect.cone_width, spread, sample);
+        }
+    }
+}
+
+void WavefrontIntegrator::trace_shadows()
+{
+    StageTimer timer(&RenderStats::traversal_seconds);
+    for (int k = 0; k < shadows.size(); ++k)
+    {
+        if (!scene.occluded(shadows.rays[k]))
+            radiance[shadows.sample[k]] += shadows.contribution[k];
+    }
+}
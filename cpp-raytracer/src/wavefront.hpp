@@ -0,0 +1,138 @@
+// Homepage: https://github.com/ananthvk/cpp-raytracer
+// Wavefront path tracing: instead of following one path until it ends, a large batch of paths is
+// advanced one bounce at a time. All the rays of the batch are intersected, then the hits are
+// sorted by material and every material shades its hits together, and finally all the shadow rays
+// are traced. Each stage runs the same code over many paths, which keeps the instructions and the
+// data of the stage in the caches and makes the branches predictable.
+#pragma once
+#include "aov.hpp"
+#include "camera.hpp"
+#include "config.h"
+#include "image.hpp"
+#include "scene.hpp"
+#include "tiles.hpp"
+#include <vector>
+
+// Paths which are being traced, stored as a structure of arrays. Entry i of every array belongs to
+// the same path.
+struct PathQueue
+{
+    std::vector<Ray> rays;
+    // Fraction of the light at the end of the ray which reaches the camera
+    std::vector<color> throughput;
+    // Probability density with which the direction of the ray was picked, 0 if the lights were not
+    // sampled at its origin
+    std::vector<real> direction_pdf;
+    // Width of the cone of rays at the origin of the ray, and the angle by which it grows (see
+    // DIFFUSE_CONE_SPREAD)
+    std::vector<real> cone_width;
+    std::vector<real> cone_spread;
+    // Index of the camera sample (in the batch) which started the path
+    std::vector<int> sample;
+
+    void clear()
+    {
+        rays.clear();
+        throughput.clear();
+        direction_pdf.clear();
+        cone_width.clear();
+        cone_spread.clear();
+        sample.clear();
+    }
+
+    void push(const Ray &ray, const color &path_throughput, real pdf, real width, real spread,
+              int sample_index)
+    {
+        rays.push_back(ray);
+        throughput.push_back(path_throughput);
+        direction_pdf.push_back(pdf);
+        cone_width.push_back(width);
+        cone_spread.push_back(spread);
+        sample.push_back(sample_index);
+    }
+
+    int size() const { return static_cast<int>(rays.size()); }
+};
+
+// Shadow rays cast towards the lights during a bounce, the light is added to the sample if the
+// ray is not occluded
+struct ShadowQueue
+{
+    std::vector<RayParams> rays;
+    std::vector<color> contribution;
+    std::vector<int> sample;
+
+    void clear()
+    {
+        rays.clear();
+        contribution.clear();
+        sample.clear();
+    }
+
+    int size() const { return static_cast<int>(rays.size()); }
+};
+
+// Renders tiles with wavefront path tracing. The image is the same as the one rendered by
+// Renderer (depth first), since every path uses its own sampler in the same way. An integrator
+// keeps its buffers between tiles, so every render thread should have its own.
+class WavefrontIntegrator
+{
+  private:
+    Config config;
+    const Scene &scene;
+
+    // Per camera sample of the batch
+    std::vector<Sampler> samplers;
+    std::vector<color> radiance;
+    std::vector<SurfaceFeatures> features;
+    // true until the features of the sample have been found
+    std::vector<char> features_pending;
+
+    // Camera rays of the batch, one packet per block of pixels and sample, in the order of the
+    // paths which they start
+    std::vector<RayPacket> packets;
+    PathQueue paths;
+    PathQueue next_paths;
+    ShadowQueue shadows;
+
+    // Per path of the current bounce
+    std::vector<Intersection> hits;
+    std::vector<int> hit_objects;
+    // Path indices sorted by material, the paths of material m are from bin_start[m] to
+    // bin_start[m + 1], the paths which missed everything are at the end
+    std::vector<int> order;
+    std::vector<int> bin_start;
+    // Next free position of every bin while sorting
+    std::vector<int> bin_next;
+    // Hits, samplers and interactions of the paths in the order above
+    std::vector<Intersection> sorted_hits;
+    std::vector<Sampler *> sorted_samplers;
+    std::vector<MaterialInteraction> interactions;
+
+    /// @brief Starts the paths of all the samples of the pixels [first, last) of the tile. The
+    /// camera rays are generated in packets, for every sample of every square block of pixels.
+    void generate(const Camera &cam, const Tile &tile, int first, int last);
+
+    /// @brief Finds the closest hit of every path, and sorts the paths by material. The camera
+    /// rays (depth 0) are traced a packet at a time.
+    void intersect(int depth);
+
+    /// @brief Adds the sky to the paths which did not hit anything, and shades the hits of every
+    /// material, the paths which continue are added to next_paths
+    void shade(int depth);
+
+    /// @brief Traces the shadow rays, and adds the light of the ones which are not occluded
+    void trace_shadows();
+
+  public:
+    WavefrontIntegrator(const Config &config, const Scene &scene);
+
+    // It refers to the scene
+    WavefrontIntegrator(const WavefrontIntegrator &) = delete;
+    WavefrontIntegrator &operator=(const WavefrontIntegrator &) = delete;
+
+    /// @brief Renders the pixels of the tile into img (and aovs if it is not null), the pixels
+    /// are rendered in batches of about config.wavefront_batch paths
+    void render_tile(const Camera &cam, const Tile &tile, Framebuffer &img,
+                     AOVBuffers *aovs = nullptr);
+};